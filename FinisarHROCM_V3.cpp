@@ -1,4 +1,6 @@
 #include "StdAfx.h"
+#include <stdarg.h>
+#include <stdlib.h>
 #include <iomanip>
 #include <string>
 #include <sstream>
@@ -6,43 +8,29 @@
 #include "FinisarHROCM.h"
 #include "FinisarHROCM_V3.h"
 #include "CCRC32.h"
-
-#define OPCODE_NOP			0x01
-#define OPCODE_RES			0x02
-#define OPCODE_MID			0x03
-#define OPCODE_CLE			0x04
-#define OPCODE_TPC			0x06
-#define OPCODE_FWT			0x07
-#define OPCODE_FWS			0x08
-#define OPCODE_FWE			0x09
-#define OPCODE_GETDEV		0x0A
-#define OPCODE_SETMPPW		0x0B
-#define OPCODE_GETMPPW		0x0C
-#define OPCODE_GETMPW		0x0D
-#define OPCODE_SETMPVC		0x0E
-#define OPCODE_GETMPVC		0x0F
-#define OPCODE_GETMVC		0x10
-#define OPCODE_SETMPCS		0x11
-#define OPCODE_GETMPCS		0x12
-#define OPCODE_GETMCS		0x13
-#define OPCODE_SETMPOSNR	0x14
-#define OPCODE_GETMPOSNR	0x15
-#define OPCODE_GETMOSNR		0x16
-#define OPCODE_SETMPCP		0x17
-#define OPCODE_GETMPCP		0x18
-#define OPCODE_GETMCP		0x19
-#define OPCODE_ATG			0x1C
-#define OPCODE_ATS			0x1D
-#define OPCODE_ATC			0x1E
-
-#define OCM_SPIMAGIC_V1		0xF0E1D2C3
-#define OCM_SPIMAGIC_V3		0xF0E1C387
+#include "OCMSPIAdapter.h"
+#include "OCMTraceWriter.h"
+#include "OCMTransferTrace.h"
+#include "OCMOutputWriter.h"
+#include "OCMFlightRecorder.h"
+#include "OCMDriverStats.h"
+#include "OCMSpanTracer.h"
+#include "OCM3Opcodes.h"
 
 // Long timeout for firmware update or reset (in ms -> 3 minutes)
 #define OCM_LONGTIMEOUT 3*60*1000
 
+// The module needs a pause of at least 5 ms after each SPI transfer
+#define OCM_RECOVERMS_MIN	5
+
+// Retransmission of failed firmware transfer chunks (FWT)
+#define OCM_FWT_RETRIES		5		// Attempts after the first one
+#define OCM_FWT_BACKOFF_MS	100		// Wait after the first failure, doubled after each further one
+#define OCM_FWT_MINCHUNK	1024	// Smallest chunk in bytes
+#define OCM_FWT_GROWCHUNKS	8		// Chunks acknowledged before the chunk size is doubled again
+
 //#define LOGSTART1(s,p1) {if (_log) fprintf(_log,"%u,"##s,::GetTickCount(),p1);}
-#define LOGRESULT(Result) {if (_log) fprintf(_log,"%s\n",(Result)==0 ? "SPI=OK":"SPI=ERROR");}
+#define LOGRESULT(Result) {if (_log) logPrintf(_log,"%s\n",(Result)==0 ? "SPI=OK":"SPI=ERROR");}
 #define LOGFAILED() LOGRESULT(1)
 
 #define SLICE2FREQ(slice) ((((int)(slice) - 1)*_lastRDataDEV.SLW + _lastRDataDEV.FSF) / OCM3_FSCALE);
@@ -51,15 +39,70 @@
 #define LOGERROR(msg) {_lastError << "[ERROR] " << msg << " (" << removePath(__FILE__) << ", Line " << __LINE__ << ")" << std::endl;}
 #define LOGWARNING(msg) {_lastError << "[WARNING] " << msg << " (" << removePath(__FILE__) << ", Line " << __LINE__ << ")" << std::endl;}
 
-std::string FinisarHROCM_V3::OCM3_ParseOPCODE(int OPCODE) {
-	std::string LUT[] = { "???", "NOP", "RES", "MID", "CLE", "???", "TPC", "FWT", "FWS", "FWE", "GETDEV", "SETMPPW", "GETMPPW", "GETMPW", "SETMPVC", "GETMPVC", "GETMVC", 
-		"SETMPCS", "GETMPCS", "GETMCS", "SETMPOSNR", "GETMPOSNR", "GETMOSNR", "SETMPCP", "GETMPCP", "GETMCP" };
+// Write to a log file through its trace writer if it has one (see OCMTraceWriter.h). Transfer traces only
+// take events (see OCMTransferTrace.h).
+static void logPrintf(FILE *f, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	OCMTraceWriter *pWriter = OCMTraceWriter::find(f);
+	if (pWriter != NULL) {
+		if (pWriter->getFormat() == OCM_TRACE_RAW) {
+			pWriter->appendv(format, args);
+		}
+	}
+	else {
+		vfprintf(f, format, args);
+	}
+	va_end(args);
+}
 
-	if (OPCODE < sizeof(LUT) / sizeof(std::string)) {
-		return LUT[OPCODE];
+// Module name of the statistics: the SPI adapter ID of the configuration string ("default" if none)
+static std::string statsModuleName(const std::string &createString)
+{
+	size_t pos = createString.find("id=");
+	while (pos != std::string::npos && pos > 0 && createString[pos - 1] != ';') {
+		pos = createString.find("id=", pos + 1);
 	}
+	std::string ID = pos == std::string::npos ? "" : createString.substr(pos + 3, createString.find(';', pos) - pos - 3);
+	return ID.empty() ? "default" : ID;
+}
 
-	return std::string("???");
+// Wait after each SPI transfer: 5 ms for the module, "recoverms=0" lets benchmarks run against the emulator
+// without waiting. The module needs at least 5 ms, so on hardware recoverms can only lengthen the pause.
+static int recoverMs(const std::string &createString)
+{
+	int ms = OCM_RECOVERMS_MIN;
+	std::string Value;
+	if (getSPIConfigValue(createString.c_str(), "recoverms", Value)) {
+		ms = atoi(Value.c_str());
+		ms = ms > 0 ? ms : 0;
+		if (ms < OCM_RECOVERMS_MIN && !isOCMSimulatedAdapter(createString.c_str())) {
+			ms = OCM_RECOVERMS_MIN;
+		}
+	}
+	return ms;
+}
+
+// Record the duration and size of an SPI transfer. Polls send an all-zero command and count as opcode 0.
+static void statsTransfer(OCMDriverStats *pStats, const char *writeBuffer, size_t length, unsigned long long startUs)
+{
+	if (pStats == NULL) {
+		return;
+	}
+	unsigned int opcode = 0;
+	if (length >= sizeof(OCM3_cmd_t) && ((const OCM3_cmd_t*)writeBuffer)->SPIMAGIC != 0) {
+		opcode = ((const OCM3_cmd_t*)writeBuffer)->OPCODE;
+	}
+	else {
+		pStats->addPoll();
+	}
+	pStats->record(OCM_STATS_TRANSFER, opcode, OCMDriverStats::nowUs() - startUs);
+	pStats->record(OCM_STATS_BYTES, opcode, length);
+}
+
+std::string FinisarHROCM_V3::OCM3_ParseOPCODE(int OPCODE) {
+	return std::string(OCMTransferTrace::getOpcodeName((unsigned int)OPCODE));
 }
 
 // Constructor (does not communicate with OCM)
@@ -69,8 +112,8 @@ FinisarHROCM_V3::FinisarHROCM_V3(std::string createString,FILE *log, FILE *logbi
 	_lastTxSeqNum				= 0;				// Last transmit sequence number of regular scan
 	_lastTxSeqNumOSNR			= 0;				// Last transmit sequence number of OSNR scan
 	_lastTxSeqNumValid			= false;			// Indicates that there no start trigger is pending
-    _recover_ms					= 5;                // We have to wait at least 5ms after each SPI transfer
-    _nretry						= 2000/_recover_ms; // Approximately 2 seconds
+    _recover_ms					= recoverMs(createString); // We have to wait at least 5ms after each SPI transfer
+    _nretry						= 2000/(_recover_ms > 0 ? _recover_ms : 1); // Approximately 2 seconds
 	_log						= log;              // Handle to log file (can be NULL)
 	_logbin						= logbin;           // Handle to log file to write binary data (can be NULL)
 	_logbinFilename[0]			= 0;				// Filename of the binary log file
@@ -81,7 +124,8 @@ FinisarHROCM_V3::FinisarHROCM_V3(std::string createString,FILE *log, FILE *logbi
 	_isInit						= false;			// true : We already queried DEV? and _lastRDataDEV is valid
 	_lastTPCTask				= 0;				// Last initiated TPC tasks
 
-	_spi = createSPIAdapter(createString.c_str());
+	_spi = createOCMSPIAdapter(createString.c_str());
+	OCMDriverStats::attach(this, statsModuleName(createString));
 }
 
 // Constructor (does not communicate with OCM)
@@ -91,8 +135,8 @@ FinisarHROCM_V3::FinisarHROCM_V3(std::string createString, const char *logbinFil
 	_lastTxSeqNum				= 0;				// Last transmit sequence number of regular scan
 	_lastTxSeqNumOSNR			= 0;				// Last transmit sequence number of OSNR scan
 	_lastTxSeqNumValid			= false;			// Indicates that there no start trigger is pending
-	_recover_ms					= 5;                // We have to wait at least 5ms after each SPI transfer
-	_nretry						= 2000/_recover_ms; // Approximately 2 seconds
+	_recover_ms					= recoverMs(createString); // We have to wait at least 5ms after each SPI transfer
+	_nretry						= 2000/(_recover_ms > 0 ? _recover_ms : 1); // Approximately 2 seconds
 	_log						= NULL;             // Handle to log file (can be NULL)
 	_logbin						= NULL;				// Handle to log file to write binary data (can be NULL)
 	_nSPIMAGICErrorCount		= 0;				// Count SPIMAGIC errors
@@ -103,13 +147,15 @@ FinisarHROCM_V3::FinisarHROCM_V3(std::string createString, const char *logbinFil
 	_lastTPCTask				= 0;				// Last initiated TPC tasks
 	strcpy(_logbinFilename, logbinFilename);
 
-	_spi = createSPIAdapter(createString.c_str());
+	_spi = createOCMSPIAdapter(createString.c_str());
+	OCMDriverStats::attach(this, statsModuleName(createString));
 }
 
 // Destructor (also closes connection)
 FinisarHROCM_V3::~FinisarHROCM_V3()
 {
     close();
+	OCMDriverStats::detach(this);
 }
 
 // Open OCM
@@ -136,6 +182,13 @@ void FinisarHROCM_V3::close()
 		_spi->Close();
 	}
 
+	// Count the errors of the last response
+	std::shared_ptr<OCMFlightRecorder> pFlight = OCMFlightRecorder::find();
+	if (pFlight) {
+		OCMFlightCounters_t Counters = { _nSPIMAGICErrorCount, _nCRC1ErrorCount, _nCRC2ErrorCount, _nCmdRetransmit };
+		pFlight->updateCounters(::GetTickCount(), Counters);
+	}
+
 	logbinClose();
 }
 
@@ -150,6 +203,9 @@ OCM_Error_t FinisarHROCM_V3::logbinOpen()
 			Result = OCM_FAILED;
 			LOGERROR((std::string("Could not write file: ") + _logbinFilename).c_str());
 		}
+		else {
+			OCMTraceWriter::attach(_logbin);
+		}
 	}
 
 	return Result;
@@ -161,6 +217,7 @@ OCM_Error_t FinisarHROCM_V3::logbinClose()
 	OCM_Error_t Result = OCM_OK;
 
 	if (_logbinFilename[0] != 0 && _logbin!=NULL) {
+		OCMTraceWriter::detach(_logbin);
 		fclose(_logbin);
 		_logbin = NULL;
 	}
@@ -721,6 +778,7 @@ OCM_Error_t FinisarHROCM_V3::preset()
 
 OCM_Error_t FinisarHROCM_V3::setChannelPlan()
 {
+	OCMSpan Span("setChannelPlan");
 	OCM_Error_t Result = OCM_OK;
 	
 	if (_lastMPPWVector.size() > 0) {
@@ -751,6 +809,7 @@ OCM_Error_t FinisarHROCM_V3::queryState()
 
 OCM_Error_t FinisarHROCM_V3::startScan()
 {
+	OCMSpan Span("startScan");
 	OCM_Error_t Result = OCM_OK;
 	OCM3_Response_t Head;
 
@@ -788,6 +847,7 @@ OCM_Error_t FinisarHROCM_V3::startScan()
 
 OCM_Error_t FinisarHROCM_V3::readScan()
 {
+	OCMSpan Span("readScan");
 	// Poll and wait for the last TxSeqNum we transmitted using the startScan command
 	OCM_Error_t Result = OCM_OK;
 
@@ -848,6 +908,11 @@ bool FinisarHROCM_V3::isScanFinished()
 // Run an SPI transfer and wait afterwards to make sure OCM recovers
 OCM_Error_t FinisarHROCM_V3::spiTransfer(char *writeBuffer, char *readBuffer, size_t length)
 {
+	OCMSpan Span("spiTransfer", "spi");
+	if (length >= sizeof(OCM3_cmd_t)) {
+		Span.setArg("opcode", ((OCM3_cmd_t*)writeBuffer)->OPCODE);
+	}
+	DWORD tickCountMs = ::GetTickCount();
     logTx(writeBuffer,length);
     // Check maximum size in a single SPI transfer
     if (length>OCM3_LENMAX)
@@ -858,10 +923,20 @@ OCM_Error_t FinisarHROCM_V3::spiTransfer(char *writeBuffer, char *readBuffer, si
     }
 	SPID_Error_t spiResult = _spi != NULL ? SPID_OK : SPID_FAILED;
 
+	unsigned long long startUs = OCMDriverStats::nowUs();
     spiResult = spiResult || _spi->Transfer(writeBuffer, readBuffer, length);
+	statsTransfer(OCMDriverStats::get(this), writeBuffer, length, startUs);
     Sleep(_recover_ms); // The OCM needs 5ms to recover.
     logRx(readBuffer,length);
 	logBin(spiResult, writeBuffer, readBuffer, length);
+	if (_log) {
+		OCMTransferTrace::record(_log, tickCountMs, spiResult, writeBuffer, readBuffer, length, _nCRC1ErrorCount, _nCRC2ErrorCount, _nCmdRetransmit);
+	}
+	const std::shared_ptr<OCMFlightRecorder> &pFlight = OCMFlightRecorder::find();
+	if (pFlight) {
+		OCMFlightCounters_t Counters = { _nSPIMAGICErrorCount, _nCRC1ErrorCount, _nCRC2ErrorCount, _nCmdRetransmit };
+		pFlight->record(tickCountMs, spiResult, writeBuffer, readBuffer, length, Counters);
+	}
     
 	OCM_Error_t Result = spiResult==SPID_OK ? OCM_OK : OCM_FAILED;
 	LOGRESULT(Result);
@@ -876,6 +951,11 @@ OCM_Error_t FinisarHROCM_V3::spiTransfer(char *writeBuffer, char *readBuffer, si
 // Run an SPI transfer and wait afterwards to make sure OCM recovers
 OCM_Error_t FinisarHROCM_V3::spiTransfer(std::vector<char> &Tx,std::vector<char> &Rx)
 {
+	OCMSpan Span("spiTransfer", "spi");
+	if (Tx.size() >= sizeof(OCM3_cmd_t)) {
+		Span.setArg("opcode", ((OCM3_cmd_t*)&Tx[0])->OPCODE);
+	}
+	DWORD tickCountMs = ::GetTickCount();
     logTx(&Tx[0],Tx.size());
     // Check maximum size in a single SPI transfer
     if (Tx.size()>OCM3_LENMAX)
@@ -886,10 +966,20 @@ OCM_Error_t FinisarHROCM_V3::spiTransfer(std::vector<char> &Tx,std::vector<char>
     }
 	SPID_Error_t spiResult = _spi != NULL ? SPID_OK : SPID_FAILED;
 
+	unsigned long long startUs = OCMDriverStats::nowUs();
 	spiResult = spiResult || _spi->Transfer(Tx,Rx);
+	statsTransfer(OCMDriverStats::get(this), &Tx[0], Tx.size(), startUs);
     Sleep(_recover_ms); // The OCM needs 5ms to recover.
     logRx(&Rx[0],Rx.size());
 	logBin(spiResult, &Tx[0], &Rx[0], Tx.size());
+	if (_log) {
+		OCMTransferTrace::record(_log, tickCountMs, spiResult, &Tx[0], &Rx[0], Tx.size(), _nCRC1ErrorCount, _nCRC2ErrorCount, _nCmdRetransmit);
+	}
+	const std::shared_ptr<OCMFlightRecorder> &pFlight = OCMFlightRecorder::find();
+	if (pFlight) {
+		OCMFlightCounters_t Counters = { _nSPIMAGICErrorCount, _nCRC1ErrorCount, _nCRC2ErrorCount, _nCmdRetransmit };
+		pFlight->record(tickCountMs, spiResult, &Tx[0], &Rx[0], Tx.size(), Counters);
+	}
 
 	OCM_Error_t Result = spiResult == SPID_OK ? OCM_OK : OCM_FAILED;
 	LOGRESULT(Result);
@@ -907,12 +997,25 @@ OCM_Error_t FinisarHROCM_V3::logBin(SPID_Error_t Result, char *writeBuffer, char
 	if (_logbin != NULL) {
 		DWORD tickCountMs = ::GetTickCount();
 		unsigned int magic = 0xBEEFBEEF;
-		fwrite(&magic, sizeof(magic), 1, _logbin);				// Write magic number 0xBEEFBEEF
-		fwrite(&tickCountMs, sizeof(tickCountMs), 1, _logbin);	// Write system tick count in ms
-		fwrite(&Result, sizeof(Result), 1, _logbin);			// Write SPI transfer result
-		fwrite(&length, sizeof(length), 1, _logbin);			// Write package length
-		fwrite(writeBuffer, 1, length, _logbin);				// Write writeBuffer
-		fwrite(readBuffer, 1, length, _logbin);					// Write readBuffer
+		OCMTraceChunk_t Record[] = {
+			{ &magic, sizeof(magic) },				// Magic number 0xBEEFBEEF
+			{ &tickCountMs, sizeof(tickCountMs) },	// System tick count in ms
+			{ &Result, sizeof(Result) },			// SPI transfer result
+			{ &length, sizeof(length) },			// Package length
+			{ writeBuffer, length },				// writeBuffer
+			{ readBuffer, length }					// readBuffer
+		};
+
+		// Queue the record for the writer thread; write it directly only if the file has no trace writer
+		OCMTraceWriter *pWriter = OCMTraceWriter::find(_logbin);
+		if (pWriter != NULL) {
+			pWriter->append(Record, sizeof(Record) / sizeof(Record[0]));
+		}
+		else {
+			for (size_t i = 0; i < sizeof(Record) / sizeof(Record[0]); ++i) {
+				fwrite(Record[i].pData, 1, Record[i].Length, _logbin);
+			}
+		}
 	}
 
 	return OCM_OK;
@@ -1082,8 +1185,13 @@ void FinisarHROCM_V3::printRData(unsigned int OPCODE,char *pRData,size_t size, b
 		printf("MPSEQNO,%u\n", pHead->MPSEQNO);
 		printf("SCAN,%u\n", pHead->SCAN);
 		printf("RECORDS,%u\n", nRecords);
+		OCMOutputWriter Output(stdout);
 		for (unsigned int k = 0; k < nRecords; ++k) {
-			printf("%d,%d,%d,%d\n", pRecord[k].PORTNO, pRecord[k].SLICESTART, pRecord[k].SLICEEND, pRecord[k].POWER);
+			int Values[] = { pRecord[k].PORTNO, pRecord[k].SLICESTART, pRecord[k].SLICEEND, pRecord[k].POWER };
+			for (int i = 0; i < 4; ++i) {
+				Output.putInt(Values[i]);
+				Output.putChar(i < 3 ? ',' : '\n');
+			}
 		}
 		break;
 	}
@@ -1095,8 +1203,13 @@ void FinisarHROCM_V3::printRData(unsigned int OPCODE,char *pRData,size_t size, b
 		printf("MPSEQNO,%u\n", pHead->MPSEQNO);
 		printf("SCAN,%u\n", pHead->SCAN);
 		printf("RECORDS,%u\n", nRecords);
+		OCMOutputWriter Output(stdout);
 		for (unsigned int k = 0; k < nRecords; ++k) {
-			printf("%d,%d,%d,%d,%d,%d,%d,%d,%d,%d\n", pRecord[k].PORTNO, pRecord[k].SLICESTART, pRecord[k].SLICEEND, pRecord[k].OSNR, pRecord[k].POWER, pRecord[k].NOISETAGLOWER, pRecord[k].NOISETAGUPPER, pRecord[k].BANDWIDTHLOWER, pRecord[k].BANDWIDTHUPPER, pRecord[k].CENTERFREQUENCY);
+			int Values[] = { pRecord[k].PORTNO, pRecord[k].SLICESTART, pRecord[k].SLICEEND, pRecord[k].OSNR, pRecord[k].POWER, pRecord[k].NOISETAGLOWER, pRecord[k].NOISETAGUPPER, pRecord[k].BANDWIDTHLOWER, pRecord[k].BANDWIDTHUPPER, pRecord[k].CENTERFREQUENCY };
+			for (int i = 0; i < 10; ++i) {
+				Output.putInt(Values[i]);
+				Output.putChar(i < 9 ? ',' : '\n');
+			}
 		}
 		break;
 	}
@@ -1108,71 +1221,60 @@ void FinisarHROCM_V3::printRData(unsigned int OPCODE,char *pRData,size_t size, b
 
 void FinisarHROCM_V3::logTx(char *pData,size_t size)
 {
-    if (!_log)
+    if (!_log || OCMTransferTrace::isTrace(_log))
         return;
 
-    fprintf(_log,"%u,%d,",::GetTickCount(),(int)size);
-    fprintf(_log,"%d,%d,%d,",_nCRC1ErrorCount,_nCRC2ErrorCount,_nCmdRetransmit);
+    logPrintf(_log,"%u,%d,",::GetTickCount(),(int)size);
+    logPrintf(_log,"%d,%d,%d,",_nCRC1ErrorCount,_nCRC2ErrorCount,_nCmdRetransmit);
 
     if (size>=sizeof(OCM3_cmd_t))
     {
         OCM3_cmd_t *p = (OCM3_cmd_t*) pData;
 
-        fprintf(_log,"%s,%u,", OCM3_ParseOPCODE(p->OPCODE).c_str(),p->SEQNO);
+        logPrintf(_log,"%s,%u,", OCM3_ParseOPCODE(p->OPCODE).c_str(),p->SEQNO);
 
         CCRC32 crc;
         unsigned int CRC1 = crc.FullCRC((const unsigned char*)p, 16);
-        fprintf(_log,"CRC1=%s,",p->CRC1 == CRC1 || p->OPCODE==0 ? "OK":"FAIL");
+        logPrintf(_log,"CRC1=%s,",p->CRC1 == CRC1 || p->OPCODE==0 ? "OK":"FAIL");
     }
     else
-        fprintf(_log,"???,???,???,");
+        logPrintf(_log,"???,???,???,");
 }
 
 void FinisarHROCM_V3::logRx(char *pData,size_t size)
 {
-    if (!_log)
+    if (!_log || OCMTransferTrace::isTrace(_log))
         return;
 
     if (size>=sizeof(OCM3_Response_t))
     {
         OCM3_Response_t *p = (OCM3_Response_t*) pData;
 
-        fprintf(_log,"%u,%s,%u,%d,%u,%u,%u,%u,%u,%u,%X,%X,", p->LENGTH, OCM3_ParseOPCODE(p->OPCODE).c_str(),p->SEQNO,p->COMRES,p->PPEND, p->SEQARR[0], p->SEQARR[1], p->SEQARR[2], p->SEQARR[3], p->SEQARR[4], p->HSS,p->OSS);
+        logPrintf(_log,"%u,%s,%u,%d,%u,%u,%u,%u,%u,%u,%X,%X,", p->LENGTH, OCM3_ParseOPCODE(p->OPCODE).c_str(),p->SEQNO,p->COMRES,p->PPEND, p->SEQARR[0], p->SEQARR[1], p->SEQARR[2], p->SEQARR[3], p->SEQARR[4], p->HSS,p->OSS);
 
         CCRC32 crc;
         unsigned int CRC1 = crc.FullCRC((const unsigned char*)p, 20);
         bool CRC1OK = p->CRC1 == CRC1;
-        fprintf(_log,"CRC1=%s,",CRC1OK ? "OK":"FAIL");
+        logPrintf(_log,"CRC1=%s,",CRC1OK ? "OK":"FAIL");
 
         bool CRC2OK = true;
         if (CRC1OK && size>=p->LENGTH)
         {
             CRC2OK = checkCRC2(p,size)==OCM_OK;
             unsigned int *pCRC = (unsigned int *) (((char*)p) + p->LENGTH - 4);
-            fprintf(_log,"%08X,CRC2=%s,",*pCRC, CRC2OK ? "OK":"FAIL");
+            logPrintf(_log,"%08X,CRC2=%s,",*pCRC, CRC2OK ? "OK":"FAIL");
         }
         else
-            fprintf(_log,"???,???,");
-
-        if (!CRC1OK || !CRC2OK)
-        {
-            char Filename[32];
-            sprintf(Filename,"%u.bin",::GetTickCount());
-            FILE *f = fopen(Filename,"wb");
-            if (f)
-            {
-                fwrite(pData,1,size,f);
-                fclose(f);
-            }
-        }
+            logPrintf(_log,"???,???,");
     }
     else
-        fprintf(_log,"???,???,???,???,???,???,???,???,???,???,???,???,???,???,???,");
+        logPrintf(_log,"???,???,???,???,???,???,???,???,???,???,???,???,???,???,???,");
 }
 
 // Polls the header information (does not pick up RDATA)
 OCM_Error_t FinisarHROCM_V3::cmdPollShort(OCM3_Response_t &Head)
 {
+	OCMSpan Span("cmdPollShort");
     OCM_Error_t Result = OCM_OK;
 	int lastError = 0;
 
@@ -1213,6 +1315,7 @@ OCM_Error_t FinisarHROCM_V3::cmdPollShort(OCM3_Response_t &Head)
         if(checkCRC1(&Head,sizeof(OCM3_Response_t))!=OCM_OK) {
 			lastError = 2;
             _nCRC1ErrorCount++;
+			OCMSpanTracer::instant("CRC1 retry", "ocm", NULL, 0);
             continue;
         }
 
@@ -1249,6 +1352,7 @@ OCM_Error_t FinisarHROCM_V3::cmdPollShort(OCM3_Response_t &Head)
 // Polls the whole header including RDATA
 OCM_Error_t FinisarHROCM_V3::cmdPollLong(OCM3_Response_t &Head,std::vector<char> &RDATA,unsigned int seqnum)
 {
+	OCMSpan Span("cmdPollLong");
     OCM_Error_t Result = OCM_OK;
 
 	if (seqnum == 0) {
@@ -1283,6 +1387,7 @@ OCM_Error_t FinisarHROCM_V3::cmdPollLong(OCM3_Response_t &Head,std::vector<char>
 		// If SPIMAGIC is wrong, retry
 		if (checkSPIMAGIC(pResponse) != OCM_OK) {
 			_nSPIMAGICErrorCount++;
+			OCMSpanTracer::instant("SPIMAGIC retry", "ocm", NULL, 0);
 			LOGWARNING(std::showbase << std::hex << "SPIMAGIC mismatch - retrying (" << pResponse->SPIMAGIC << " should be " << OCM_SPIMAGIC_V3 << ")" << std::noshowbase << std::dec);
 			continue;
 		}
@@ -1290,6 +1395,7 @@ OCM_Error_t FinisarHROCM_V3::cmdPollLong(OCM3_Response_t &Head,std::vector<char>
 		// Check CRC1, if it's false, try again
         if(checkCRC1(pResponse,Head.LENGTH)!=OCM_OK) {
             _nCRC1ErrorCount++;
+			OCMSpanTracer::instant("CRC1 retry", "ocm", NULL, 0);
 			LOGWARNING(std::showbase << std::hex << "CRC1 failed - retrying (" << pResponse->CRC1 << ")" << std::noshowbase << std::dec);
 			continue;
         }
@@ -1297,6 +1403,7 @@ OCM_Error_t FinisarHROCM_V3::cmdPollLong(OCM3_Response_t &Head,std::vector<char>
         // Check CRC2, if it's false, try again
         if(checkCRC2(pResponse,Head.LENGTH)!=OCM_OK) {
             _nCRC2ErrorCount++;
+			OCMSpanTracer::instant("CRC2 retry", "ocm", NULL, 0);
 			LOGWARNING("CRC2 failed - retrying");
 			continue;
         }
@@ -1319,6 +1426,7 @@ OCM_Error_t FinisarHROCM_V3::cmdPollLong(OCM3_Response_t &Head,std::vector<char>
 // Polls the channel plan and power values.
 OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_PW(OCM3_GMPWResult_t &GMPWResult,unsigned int TxSeqNum)
 {
+	OCMSpan Span("cmdQueryTPC_PW");
     OCM_Error_t Result = OCM_OK;
 
 	// Make sure we have supporting information in _lastRDataDEV
@@ -1328,6 +1436,12 @@ OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_PW(OCM3_GMPWResult_t &GMPWResult,unsign
 	OCM3_Response_t	Head;
 	Result = Result || waitTaskComplete(Head, OCM3_PROCESS_PW, TxSeqNum);
 
+	OCMDriverStats *pStats = OCMDriverStats::get(this);
+	unsigned long long startUs = OCMDriverStats::nowUs();
+	if (pStats != NULL && Result == OCM_OK) {
+		pStats->completeTask(TxSeqNum, OPCODE_GETMPW, startUs);
+	}
+
 	// Send GMPW command
 	Result = Result || cmdSimple(OPCODE_GETMPW);
 
@@ -1338,6 +1452,12 @@ OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_PW(OCM3_GMPWResult_t &GMPWResult,unsign
 		return Result;
 	}
 
+	if (pStats != NULL) {
+		unsigned long long nowUs = OCMDriverStats::nowUs();
+		pStats->record(OCM_STATS_FETCH, OPCODE_GETMPW, nowUs - startUs);
+		pStats->endScan(TxSeqNum, OPCODE_TPC, nowUs);
+	}
+
 	// Copy header information to target object
 	memcpy(&GMPWResult.Head, &RDATA[0], sizeof(GMPWResult.Head));
 
@@ -1357,6 +1477,7 @@ OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_PW(OCM3_GMPWResult_t &GMPWResult,unsign
 // Polls the OSNR Result.
 OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_OSNR(OCM3_GMOSNRResult_t &GMOSNRResult, unsigned int TxSeqNum)
 {
+	OCMSpan Span("cmdQueryTPC_OSNR");
 	OCM_Error_t Result = OCM_OK;
 
 	// Make sure we have supporting information in _lastRDataDEV
@@ -1366,6 +1487,12 @@ OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_OSNR(OCM3_GMOSNRResult_t &GMOSNRResult,
 	OCM3_Response_t	Head;
 	Result = Result || waitTaskComplete(Head, OCM3_PROCESS_OSNR, TxSeqNum);
 
+	OCMDriverStats *pStats = OCMDriverStats::get(this);
+	unsigned long long startUs = OCMDriverStats::nowUs();
+	if (pStats != NULL && Result == OCM_OK) {
+		pStats->completeTask(TxSeqNum, OPCODE_GETMOSNR, startUs);
+	}
+
 	// Send GMOSNR command
 	Result = Result || cmdSimple(OPCODE_GETMOSNR);
 
@@ -1376,6 +1503,12 @@ OCM_Error_t FinisarHROCM_V3::cmdQueryTPC_OSNR(OCM3_GMOSNRResult_t &GMOSNRResult,
 		return Result;
 	}
 
+	if (pStats != NULL) {
+		unsigned long long nowUs = OCMDriverStats::nowUs();
+		pStats->record(OCM_STATS_FETCH, OPCODE_GETMOSNR, nowUs - startUs);
+		pStats->endScan(TxSeqNum, OPCODE_TPC, nowUs);
+	}
+
 	// Copy header information to target object
 	memcpy(&GMOSNRResult.Head, &RDATA[0], sizeof(GMOSNRResult.Head));
 
@@ -1437,11 +1570,17 @@ OCM_Error_t FinisarHROCM_V3::cmdMID(const char *MID)
 // Get Device Information (DEV?)
 OCM_Error_t FinisarHROCM_V3::cmdGETDEV(OCM3_Response_t &Head,OCM3_RDataDEV_t &RDataDev)
 {
+	unsigned long long startUs = OCMDriverStats::nowUs();
 	OCM_Error_t Result = cmdSimple(OPCODE_GETDEV);
 
 	std::vector<char> RDATA;
 	Result = Result || cmdPollLong(Head, RDATA, _seqnum - 1);
 
+	OCMDriverStats *pStats = OCMDriverStats::get(this);
+	if (pStats != NULL && Result == OCM_OK) {
+		pStats->record(OCM_STATS_FETCH, OPCODE_GETDEV, OCMDriverStats::nowUs() - startUs);
+	}
+
 	if (Result == OCM_OK && Head.OPCODE == OPCODE_GETDEV && RDATA.size()==sizeof(RDataDev)) {
 		memcpy(&RDataDev, &RDATA[0], sizeof(RDataDev));
 	}
@@ -1466,6 +1605,7 @@ OCM_Error_t FinisarHROCM_V3::cmdGETDEV(OCM3_Response_t &Head,OCM3_RDataDEV_t &RD
 // Send Trigger-And-Process command (TPC) and wait for the results
 OCM_Error_t FinisarHROCM_V3::runFullScan(OCM3_TPCProcessMask_t TaskVector)
 {
+	OCMSpan Span("runFullScan");
 	OCM3_Response_t Head;
 	unsigned int TxSeqNum = 0;
 
@@ -1488,6 +1628,7 @@ OCM_Error_t FinisarHROCM_V3::runFullScan(OCM3_TPCProcessMask_t TaskVector)
 // Send Trigger-And-Process command (TPC)
 OCM_Error_t FinisarHROCM_V3::cmdTPC(OCM3_Response_t &Head,unsigned int &TxSeqNum, OCM3_TPCProcessMask_t TaskVector)
 {
+	OCMSpan Span("cmdTPC");
     // Construct the command package
     std::vector<char> Command;
     std::vector<char> Response;
@@ -1498,6 +1639,13 @@ OCM_Error_t FinisarHROCM_V3::cmdTPC(OCM3_Response_t &Head,unsigned int &TxSeqNum
     TxSeqNum = _seqnum++;
     fillInHROCMCommand(&Command[0], 4, OPCODE_TPC , TxSeqNum);
 
+	OCMDriverStats *pStats = OCMDriverStats::get(this);
+	unsigned long long startUs = OCMDriverStats::nowUs();
+	if (pStats != NULL) {
+		unsigned int nResults = ((TaskVector & OCM3_TASK_PW_MASK) != 0 ? 1 : 0) + ((TaskVector & OCM3_TASK_OSNR_MASK) != 0 ? 1 : 0);
+		pStats->beginScan(TxSeqNum, nResults, startUs);
+	}
+
     OCM_Error_t Result = OCM_OK;
     for(int k=0;Result==OCM_OK;++k)
     {
@@ -1518,6 +1666,7 @@ OCM_Error_t FinisarHROCM_V3::cmdTPC(OCM3_Response_t &Head,unsigned int &TxSeqNum
         if (Retransmit)
         {
             ++_nCmdRetransmit;
+			OCMSpanTracer::instant("retransmit", "ocm", "attempt", k + 1);
 			LOGWARNING("Retransmitting TPC command");
             continue;
         }
@@ -1525,12 +1674,19 @@ OCM_Error_t FinisarHROCM_V3::cmdTPC(OCM3_Response_t &Head,unsigned int &TxSeqNum
         break;
     }
 
+	if (pStats != NULL && Result == OCM_OK) {
+		unsigned long long nowUs = OCMDriverStats::nowUs();
+		pStats->record(OCM_STATS_ACCEPT, OPCODE_TPC, nowUs - startUs);
+		pStats->acceptScan(TxSeqNum, nowUs);
+	}
+
     return Result;
 }
 
 // Set Measurement Plan Power (MPPW)
 OCM_Error_t FinisarHROCM_V3::cmdSETMPPW(std::vector<OCM3_MPPWRecord_t> &MPPWVector)
 {
+	OCMSpan Span("cmdSETMPPW");
 	if (MPPWVector.size() == 0) {
 		LOGERROR("MPPWVector empty");
 		return OCM_FAILED;
@@ -1581,6 +1737,7 @@ OCM_Error_t FinisarHROCM_V3::cmdSETMPPW(std::vector<OCM3_MPPWRecord_t> &MPPWVect
 // Set Measurement Plan OSNR (MPOSNR)
 OCM_Error_t FinisarHROCM_V3::cmdSETMPOSNR(std::vector<OCM3_MPOSNRRecord_t> &MPOSNRVector)
 {
+	OCMSpan Span("cmdSETMPOSNR");
 	if (MPOSNRVector.size() == 0) {
 		LOGERROR("MPOSNRVector empty");
 		return OCM_FAILED;
@@ -1631,49 +1788,94 @@ OCM_Error_t FinisarHROCM_V3::cmdSETMPOSNR(std::vector<OCM3_MPOSNRRecord_t> &MPOS
 // Firmware transfer (FWT), large files are allowed
 OCM_Error_t FinisarHROCM_V3::cmdFWT(std::vector<char> &BinaryFile)
 {
-    OCM_Error_t Result      = OCM_OK;
-    char *p                 = &BinaryFile[0];
-    size_t RemainingBytes   = BinaryFile.size();
-    unsigned int Offset     = 0;
-    size_t LengthMax        = OCM3_LENMAX - sizeof(OCM3_cmd_t) - 8;
-
-    while(RemainingBytes>0 && Result==OCM_OK)
-    {
-        size_t sizeChunk = RemainingBytes>LengthMax ? LengthMax : RemainingBytes;
-        Result = Result || cmdFWT(Offset,p,sizeChunk);
-        p += sizeChunk;
-        Offset += (unsigned int)sizeChunk;
-        RemainingBytes-=sizeChunk;
-        printf(".");
-    }
-    printf("\n");
-
-    return Result;
+    if (BinaryFile.empty())
+        return OCM_OK;
+    return cmdFWT(0,&BinaryFile[0],BinaryFile.size());
 }
 
-// Firmware transfer (FWT), transfer a chunk of maximum length of OCM3_LENMAX
+// Firmware transfer (FWT) of BufSiz bytes to Offset, split into chunks of at most OCM3_LENMAX. The next chunk
+// is copied into its command package and its CRC calculated while the module still processes the current one,
+// the two command packages are reused for all chunks. Buffer is not modified.
+// A chunk that fails is sent again from the first byte not acknowledged, up to OCM_FWT_RETRIES times, waiting
+// OCM_FWT_BACKOFF_MS longer after each failure. The chunks are halved after a failure and doubled again after
+// OCM_FWT_GROWCHUNKS chunks went through.
 OCM_Error_t FinisarHROCM_V3::cmdFWT(unsigned int Offset,char *Buffer,size_t BufSiz)
 {
-    // Construct the command package
-    std::vector<char> Command;
+    OCM_Error_t Result      = OCM_OK;
+    size_t LengthMax        = OCM3_LENMAX - sizeof(OCM3_cmd_t) - 8;
+    size_t LengthChunk      = LengthMax;
+    std::vector<char> Command[2];
     std::vector<char> Response;
-    Command.resize(sizeof(OCM3_cmd_t)+BufSiz+8);
-    Response.resize(Command.size());
-
-    unsigned int* pOffset = (unsigned int*) &Command[sizeof(OCM3_cmd_t)];
-    *pOffset = Offset;
-
-    char* pData = (char*) &Command[sizeof(OCM3_cmd_t)+4];
-    memcpy(pData,Buffer,BufSiz);
+    size_t sizeChunk[2]     = { 0, 0 };
+    unsigned int TxSeqNum[2] = { 0, 0 };
+    int iSent               = -1;       // Command waiting for its acknowledge (-1: none)
+    size_t Built            = 0;        // Bytes of Buffer packed into commands
+    size_t Acknowledged     = 0;        // Bytes accepted by the module
+    int nFailures           = 0;        // Failed attempts at the first byte not acknowledged
+    int nGood               = 0;        // Chunks acknowledged since the chunk size was changed
+
+    while(Acknowledged<BufSiz && Result==OCM_OK)
+    {
+        // Build the next command package: offset, data, CRC2
+        int iBuild = iSent==0 ? 1 : 0;
+        sizeChunk[iBuild] = 0;
+        if (Built<BufSiz)
+        {
+            size_t size = BufSiz-Built>LengthChunk ? LengthChunk : BufSiz-Built;
+            unsigned int ChunkOffset = Offset + (unsigned int)Built;
+            Command[iBuild].resize(sizeof(OCM3_cmd_t)+size+8);
+            memcpy(&Command[iBuild][sizeof(OCM3_cmd_t)],&ChunkOffset,sizeof(ChunkOffset));
+            memcpy(&Command[iBuild][sizeof(OCM3_cmd_t)+4],Buffer+Built,size);
+            TxSeqNum[iBuild] = _seqnum++;
+            fillInHROCMCommand(&Command[iBuild][0], (unsigned int)(size+4), OPCODE_FWT , TxSeqNum[iBuild]);
+            sizeChunk[iBuild] = size;
+            Built += size;
+        }
 
-	unsigned int TxSeqNum = _seqnum++;
-    fillInHROCMCommand(&Command[0], (unsigned int)(BufSiz+4), OPCODE_FWT , TxSeqNum);
+        // Check the response of the previous chunk
+        OCM_Error_t ChunkResult = OCM_OK;
+        if (iSent>=0)
+        {
+            ChunkResult = waitForSuccess(TxSeqNum[iSent]);
+            if (ChunkResult==OCM_OK)
+            {
+                Acknowledged += sizeChunk[iSent];
+                nFailures = 0;
+                if (++nGood>=OCM_FWT_GROWCHUNKS && LengthChunk<LengthMax)
+                {
+                    LengthChunk = 2*LengthChunk<LengthMax ? 2*LengthChunk : LengthMax;
+                    nGood = 0;
+                }
+            }
+        }
 
-    // Send out the command
-    OCM_Error_t Result = spiTransfer(Command,Response);
+        // Send out the next chunk
+        iSent = -1;
+        if (ChunkResult==OCM_OK && sizeChunk[iBuild]>0)
+        {
+            Response.resize(Command[iBuild].size());
+            ChunkResult = spiTransfer(Command[iBuild],Response);
+            iSent = iBuild;
+        }
 
-	// Check the response (we don't do retransmits)
-	Result = Result || waitForSuccess(TxSeqNum);
+        // Start over at the first byte not acknowledged with smaller chunks
+        if (ChunkResult!=OCM_OK)
+        {
+            if (++nFailures>OCM_FWT_RETRIES)
+            {
+                Result = Result || OCM_FAILED;
+                LOGERROR("FWT failed at offset " << Offset+Acknowledged);
+                break;
+            }
+            ++_nCmdRetransmit;
+            LOGWARNING("Retransmitting FWT at offset " << Offset+Acknowledged);
+            LengthChunk = LengthChunk/2>OCM_FWT_MINCHUNK ? LengthChunk/2 : OCM_FWT_MINCHUNK;
+            nGood = 0;
+            Built = Acknowledged;
+            iSent = -1;
+            Sleep(OCM_FWT_BACKOFF_MS << (nFailures-1));
+        }
+    }
 
     return Result;
 }
@@ -1877,17 +2079,25 @@ OCM_Error_t FinisarHROCM_V3::cmdCLRBWXB()
 // Execute simple command without payload
 OCM_Error_t FinisarHROCM_V3::cmdSimple(int OpCode)
 {
+	OCMSpan Span("cmdSimple");
+	Span.setArg("opcode", OpCode);
     OCM3_cmd_t Command;
     OCM3_cmd_t Response;
 
     fillInHROCMCommand((char*)&Command, 0, OpCode , _seqnum++);
 
     // Send out the command
+	unsigned long long startUs = OCMDriverStats::nowUs();
     OCM_Error_t Result = spiTransfer((char*)&Command,(char*)&Response,sizeof(OCM3_cmd_t));
 
     // Wait until it's accepted using SEQNUM1, retry if COMRES<0
     Result = Result || waitForSuccess(_seqnum-1);
 
+	OCMDriverStats *pStats = OCMDriverStats::get(this);
+	if (pStats != NULL && Result == OCM_OK) {
+		pStats->record(OCM_STATS_ACCEPT, (unsigned int)OpCode, OCMDriverStats::nowUs() - startUs);
+	}
+
     return Result;
 }
 
@@ -1895,6 +2105,7 @@ OCM_Error_t FinisarHROCM_V3::cmdSimple(int OpCode)
 // Polls until SEQNO are found and COMRES>=0
 OCM_Error_t FinisarHROCM_V3::waitForReply(OCM3_Response_t &Head,unsigned int seqnum)
 {
+	OCMSpan Span("waitForReply");
     OCM_Error_t Result = OCM_OK;
 
     for(int k=0;Result==OCM_OK;++k)
@@ -1934,6 +2145,7 @@ OCM_Error_t FinisarHROCM_V3::waitForSuccess(unsigned int seqnum)
 
 OCM_Error_t FinisarHROCM_V3::waitCommandAccepted(OCM3_Response_t &Head,unsigned int seqnum,bool &Retransmit)
 {
+	OCMSpan Span("waitCommandAccepted");
     OCM_Error_t Result = OCM_OK;
     Retransmit = false;
 
@@ -1981,6 +2193,7 @@ OCM_Error_t FinisarHROCM_V3::isTaskComplete(OCM3_Response_t &Head, int iSEQARR,
 
 OCM_Error_t FinisarHROCM_V3::waitTaskComplete(OCM3_Response_t &Head, int iSEQARR, unsigned int TxSeqNum)
 {
+	OCMSpan Span("waitTaskComplete");
 	OCM_Error_t Result = OCM_OK;
 	bool taskCompleted = false;
 
@@ -2006,12 +2219,13 @@ OCM_Error_t FinisarHROCM_V3::waitTaskComplete(OCM3_Response_t &Head, int iSEQARR
 int FinisarHROCM_V3::setTimeout(int ms)
 {
     int RetrySave = _nretry;
-    _nretry = ms/_recover_ms;
+    _nretry = ms/(_recover_ms > 0 ? _recover_ms : 1);
     return RetrySave;
 }
 
 OCM_Error_t FinisarHROCM_V3::runPostProcessing()
 {
+	OCMSpan Span("runPostProcessing");
 	OCM_Error_t Result = OCM_OK;
 
 	// Work out how many high-resolution channels there are. A high-resolution channel is exactly
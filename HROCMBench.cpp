@@ -0,0 +1,588 @@
+/*! \mainpage HROCMBench
+
+\section bnsec1 Overview
+Microbenchmarks of the host side of FinisarHROCM_V3 and the scan server. The driver runs against the OCM emulator
+(SPIAdapterEmulator.h) with no bus latency, no scan time and no recovery wait after a transfer, so the time measured
+is the time the host spends per operation: building and checking packages, copying records, converting values and
+formatting output. The tool does not need the module or an SPI adapter.
+
+Each benchmark is calibrated to run for about the measuring time (-time) and reports the median of 5 samples:
+- crc.*: CRC1 of a response header and CRC2 of complete GETMPW responses,
+- cmd.setmppw.*: SETMPPW with the whole measurement plan (package, CRC2, transfer, handshake),
+- rx.polllong.*: cmdPollLong of a GETMPW response (CRC1/CRC2 checks and RDATA extraction),
+- rx.querypw.*: cmdQueryTPC_PW of a completed scan (GETMPW, read and copy of the records),
+- scan.readscan.*: readScan of a completed scan (power and OSNR results, runPostProcessing),
+- get.*: get() conversions of the last scan into frequencies and powers,
+- csv.*: CSV output of a scan (scanraw) with OCMOutputWriter,
+- server.*: request handling of the scan server (OCMRequestHandler) for channel and window requests, cached
+  (repeated requests for the same scan) and uncached (every request for a new scan).
+
+The plans are 80ch (80 channels on the 50 GHz grid with OSNR) and hires8000 (8000 high-resolution slices followed by
+the 80 channels; 15440 slices do not fit into a single SPI transfer of at most 64 kB). The server serves a
+spectrum of all 15440 slices.
+
+The results are written as CSV: Benchmark,Iterations,ns/op,bytes/op,MB/s. bytes/op is the data an operation
+handles: the SPI transfers for the driver benchmarks (MOSI, counted once per transfer), the CRC input, the values
+returned by get(), the CSV text and the response of the server.
+
+\section bnsec2 Usage
+@code
+HROCMBench [-time ms] [-baseline file percent] [filter ...]
+@endcode
+
+-time sets the measuring time per benchmark (default 500 ms). Only the benchmarks containing one of the filters in
+their name are run. With -baseline the results are compared with a previous result file: every benchmark that got
+slower by more than percent is reported and the exit code is 2, so a build can be gated on it.
+
+Example:
+@code
+HROCMBench > baseline.csv
+HROCMBench -baseline baseline.csv 10 rx. scan.
+Benchmark,Iterations,ns/op,bytes/op,MB/s
+rx.polllong.80ch,127410,3891.2,3240,832.6
+...
+@endcode
+*/
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FinisarHROCM.h"
+#include "FinisarHROCM_V3.h"
+#include "CCRC32.h"
+#include "OCMDriverStats.h"
+#include "OCMOutputWriter.h"
+#include "OCMRequestHandler.h"
+#include "OCMScanServer.h"
+#include "OCMSnapshotPublisher.h"
+
+#define BENCH_DEFAULT_MS		500		// Measuring time per benchmark
+#define BENCH_SAMPLES			5		// The median of the samples is reported
+
+// Driver against the emulator: commands and scans complete at once, transfers take no time, no recovery wait
+#define BENCH_EMULATOR			"emulator=1;scanms=0;osnrms=0;commandus=0;latencyus=0;spiclk=0;recoverms=0"
+
+#define BENCH_FSF				191.3125	// First slice of the emulated module (THz)
+#define BENCH_SLW				0.0003125	// Slice width (THz)
+#define BENCH_SMAX				15440
+#define BENCH_FIRSTCHANNEL		191.35		// First channel of the plans (THz)
+#define BENCH_CHANNELS			80
+
+// Driver benchmarks
+#define BENCH_DRIVER_SETMPPW	0
+#define BENCH_DRIVER_POLLLONG	1
+#define BENCH_DRIVER_QUERYPW	2
+#define BENCH_DRIVER_READSCAN	3
+#define BENCH_DRIVER_GETPOWER	4
+#define BENCH_DRIVER_GETFCENTER	5
+
+// Server benchmarks
+#define BENCH_SERVER_CHANNELS	0
+#define BENCH_SERVER_WINDOW		1
+#define BENCH_SERVER_COMPACT	2
+
+#ifdef _WIN32
+#define BENCH_NULLDEVICE		"NUL"
+#else
+#define BENCH_NULLDEVICE		"/dev/null"
+#endif
+
+typedef struct {
+	const char		*Name;
+	unsigned int	nHiRes;			// High-resolution slices at the start of the plan
+	unsigned int	nChannels;		// 50 GHz channels with OSNR
+} BenchPlan_t;
+
+static const BenchPlan_t benchPlans[] = { { "80ch", 0, BENCH_CHANNELS }, { "hires8000", 8000, BENCH_CHANNELS } };
+
+static volatile unsigned int benchSink;		// Keeps results of the measured code alive
+
+static long long benchNowNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// A benchmark: setup() prepares everything, run(n) performs n operations
+class BenchCase
+{
+public:
+	BenchCase(const std::string &Name) : _name(Name), _bytes(0) {}
+	virtual ~BenchCase() {}
+
+	const std::string &getName() const { return _name; }
+
+	// Bytes handled per operation (valid after run)
+	double getBytes() const { return _bytes; }
+
+	virtual bool setup() { return true; }
+	virtual bool run(size_t n) = 0;
+
+protected:
+	std::string	_name;
+	double		_bytes;
+};
+
+// CRC over a buffer of the size of a response
+class BenchCrc : public BenchCase
+{
+public:
+	BenchCrc(const std::string &Name, size_t size) : BenchCase(Name), _data(size)
+	{
+		for (size_t i = 0; i < size; ++i) {
+			_data[i] = (unsigned char)(i * 131 + 7);
+		}
+		_bytes = (double)size;
+	}
+
+	virtual bool run(size_t n)
+	{
+		CCRC32 crc;
+		unsigned int sum = 0;
+		for (size_t i = 0; i < n; ++i) {
+			sum ^= crc.FullCRC(&_data[0], _data.size());
+		}
+		benchSink = sum;
+		return true;
+	}
+
+private:
+	std::vector<unsigned char>	_data;
+};
+
+// Driver against the emulator with the plan of a completed scan
+class BenchDriver : public BenchCase
+{
+public:
+	BenchDriver(const std::string &Name, const BenchPlan_t &Plan, int mode) : BenchCase(Name), _plan(Plan), _mode(mode), _txSeqNum(0) {}
+
+	virtual bool setup()
+	{
+		_ocm.reset(new FinisarHROCM_V3(std::string("id=") + _name + ";" + BENCH_EMULATOR));
+		OCM_Error_t Result = _ocm->open();
+
+		std::vector<double> fStart, fStop, fCenterStart, fCenterStop;
+		for (unsigned int i = 0; i < _plan.nHiRes; ++i) {
+			fStart.push_back(BENCH_FSF + i * BENCH_SLW);
+			fStop.push_back(BENCH_FSF + (i + 1) * BENCH_SLW);
+		}
+		for (unsigned int c = 0; c < _plan.nChannels; ++c) {
+			double fCenter = BENCH_FIRSTCHANNEL + c * 0.05;
+			fStart.push_back(fCenter - 0.025);
+			fStop.push_back(fCenter + 0.025);
+			fCenterStart.push_back(fCenter - 0.016);
+			fCenterStop.push_back(fCenter + 0.016);
+		}
+		Result = Result || _ocm->set(OCM_KEY_CHANNELPLAN_FSTART, fStart);
+		Result = Result || _ocm->set(OCM_KEY_CHANNELPLAN_FSTOP, fStop);
+		Result = Result || _ocm->set(OCM_KEY_CHANNELPLAN_OSNRCENTERSTART, fCenterStart);
+		Result = Result || _ocm->set(OCM_KEY_CHANNELPLAN_OSNRCENTERSTOP, fCenterStop);
+		Result = Result || _ocm->setChannelPlan();
+		Result = Result || _ocm->startScan();
+		Result = Result || _ocm->readScan();
+
+		// The records of the plan for SETMPPW
+		OCM3_GMPWResult_t *pGMPWResult = _ocm->getGMPWResult();
+		if (Result == OCM_OK && pGMPWResult != NULL) {
+			for (size_t k = 0; k < pGMPWResult->GMPWVector.size(); ++k) {
+				OCM3_MPPWRecord_t Record = { pGMPWResult->GMPWVector[k].PORTNO, pGMPWResult->GMPWVector[k].SLICESTART, pGMPWResult->GMPWVector[k].SLICEEND };
+				_mppw.push_back(Record);
+			}
+		}
+
+		// A power scan of its own, leaving its GETMPW response in the response register
+		if (_mode == BENCH_DRIVER_POLLLONG || _mode == BENCH_DRIVER_QUERYPW) {
+			OCM3_Response_t Head;
+			Result = Result || _ocm->cmdTPC(Head, _txSeqNum, OCM3_TASK_PW_MASK);
+			Result = Result || _ocm->cmdQueryTPC_PW(_gmpwResult, _txSeqNum);
+		}
+
+		if (Result != OCM_OK) {
+			std::string Error;
+			_ocm->get(OCM_KEY_LASTERROR, Error);
+			fprintf(stderr, "%s", Error.c_str());
+		}
+		return Result == OCM_OK && !_mppw.empty();
+	}
+
+	virtual bool run(size_t n)
+	{
+		unsigned long long bytesBefore = getTransferBytes();
+		OCM_Error_t Result = OCM_OK;
+		OCM3_Response_t Head;
+		std::vector<char> RDATA;
+		std::vector<double> Values;
+		double bytes = 0;
+		unsigned int sum = 0;
+
+		for (size_t i = 0; i < n && Result == OCM_OK; ++i) {
+			switch (_mode) {
+			case BENCH_DRIVER_SETMPPW:
+				Result = _ocm->cmdSETMPPW(_mppw);
+				break;
+			case BENCH_DRIVER_POLLLONG:
+				Result = _ocm->cmdPollLong(Head, RDATA, 0);
+				sum += (unsigned int)RDATA.size();
+				break;
+			case BENCH_DRIVER_QUERYPW:
+				Result = _ocm->cmdQueryTPC_PW(_gmpwResult, _txSeqNum);
+				sum += (unsigned int)_gmpwResult.GMPWVector.size();
+				break;
+			case BENCH_DRIVER_READSCAN:
+				Result = _ocm->readScan();
+				break;
+			case BENCH_DRIVER_GETPOWER:
+				Result = _ocm->get(OCM_KEY_SCAN_POWER, Values);
+				bytes = (double)(Values.size() * sizeof(double));
+				break;
+			case BENCH_DRIVER_GETFCENTER:
+				Result = _ocm->get(OCM_KEY_SCAN_FCENTER, Values);
+				bytes = (double)(Values.size() * sizeof(double));
+				break;
+			}
+		}
+		benchSink = sum;
+
+		if (_mode != BENCH_DRIVER_GETPOWER && _mode != BENCH_DRIVER_GETFCENTER) {
+			bytes = (double)(getTransferBytes() - bytesBefore) / n;
+		}
+		_bytes = bytes;
+		return Result == OCM_OK;
+	}
+
+private:
+	// Bytes of all SPI transfers of this driver so far
+	unsigned long long getTransferBytes() const
+	{
+		OCMDriverStats *pStats = OCMDriverStats::get(_ocm.get());
+		unsigned long long total = 0;
+		for (unsigned int opcode = 0; pStats != NULL && opcode < OCM_STATS_NOPCODES; ++opcode) {
+			const OCMLatencyHistogram *pHistogram = pStats->getHistogram(OCM_STATS_BYTES, opcode);
+			total += pHistogram != NULL ? pHistogram->getTotal() : 0;
+		}
+		return total;
+	}
+
+	BenchPlan_t							_plan;
+	int									_mode;
+	std::unique_ptr<FinisarHROCM_V3>	_ocm;
+	std::vector<OCM3_MPPWRecord_t>		_mppw;
+	OCM3_GMPWResult_t					_gmpwResult;
+	unsigned int						_txSeqNum;
+};
+
+// CSV output of a scan as written by scanraw
+class BenchCsv : public BenchCase
+{
+public:
+	BenchCsv(const std::string &Name, const BenchPlan_t &Plan) : BenchCase(Name), _file(NULL)
+	{
+		for (unsigned int i = 0; i < Plan.nHiRes; ++i) {
+			OCM3_GMPWRecord_t Record = { 1, (unsigned short)(i + 1), (unsigned short)(i + 1), (short)(-600 + (i * 37) % 500) };
+			_records.push_back(Record);
+		}
+		for (unsigned int c = 0; c < Plan.nChannels; ++c) {
+			unsigned short first = (unsigned short)(121 + c * 160 - 80);
+			OCM3_GMPWRecord_t Record = { 1, first, (unsigned short)(first + 159), (short)(-50 - (c * 7) % 30) };
+			_records.push_back(Record);
+		}
+	}
+
+	virtual ~BenchCsv()
+	{
+		if (_file != NULL) {
+			fclose(_file);
+		}
+	}
+
+	virtual bool setup()
+	{
+		FILE *f = tmpfile();
+		if (f == NULL) {
+			return false;
+		}
+		write(f);
+		_bytes = (double)ftell(f);
+		fclose(f);
+
+		_file = fopen(BENCH_NULLDEVICE, "wb");
+		return _file != NULL;
+	}
+
+	virtual bool run(size_t n)
+	{
+		for (size_t i = 0; i < n; ++i) {
+			write(_file);
+		}
+		return true;
+	}
+
+private:
+	void write(FILE *f)
+	{
+		static const OCMOutputColumn_t Columns[] = { { "Port", OCM_OUTPUT_U16, 0 }, { "SliceStart", OCM_OUTPUT_U16, 0 }, { "SliceEnd", OCM_OUTPUT_U16, 0 }, { "Power_dBm", OCM_OUTPUT_F32, 1 } };
+		OCMOutputWriter Output(f);
+		Output.beginTable(OCM_OUTPUT_CSV, Columns, 4, _records.size());
+		for (size_t k = 0; k < _records.size(); ++k) {
+			Output.putValue(_records[k].PORTNO);
+			Output.putValue(_records[k].SLICESTART);
+			Output.putValue(_records[k].SLICEEND);
+			Output.putValue(_records[k].POWER / 10.0);
+		}
+		Output.flush();
+	}
+
+	std::vector<OCM3_GMPWRecord_t>	_records;
+	FILE							*_file;
+};
+
+// Request handling of the scan server without sockets: the responses are queued and dropped
+class BenchServer : public BenchCase
+{
+public:
+	BenchServer(const std::string &Name, int mode, bool cached) : BenchCase(Name), _mode(mode), _cached(cached),
+		_handler(&_publisher), _server(&_handler, OCMScanServer::defaultSettings())
+	{
+		_conn.Id			= 1;
+		_conn.Socket		= -1;
+		_conn.Peer			= "bench";
+		_conn.State			= OCM_CONN_OPEN;
+		_conn.TxOffset		= 0;
+		_conn.TxQueued		= 0;
+		_conn.LastActiveMs	= 0;
+		_conn.WantWrite		= false;
+	}
+
+	virtual bool setup()
+	{
+		for (unsigned int s = 0; s < 2; ++s) {
+			std::shared_ptr<OCMScanSnapshot> Snapshot = std::make_shared<OCMScanSnapshot>();
+			Snapshot->Scan = s + 1;
+			Snapshot->TimestampMs = 1700000000000LL + s;
+			OCMGridResult_t Grid;
+			Grid.FirstFreq	= (unsigned int)round(BENCH_FIRSTCHANNEL * OCM3_FSCALE);
+			Grid.Step		= 500000;
+			for (unsigned int c = 0; c < BENCH_CHANNELS; ++c) {
+				OCMP_ChannelValue_t Value = { -5.0 - (c % 7) * 0.1 - s * 0.01, 35.0 + (c % 5) * 0.5 };
+				Grid.Values.push_back(Value);
+			}
+			Snapshot->Grids.push_back(Grid);
+			for (unsigned int i = 0; i < BENCH_SMAX; ++i) {
+				Snapshot->Spectrum.Freq.push_back((unsigned int)round(BENCH_FSF * OCM3_FSCALE) + i * 3125);
+				Snapshot->Spectrum.Power.push_back(-60.0 + 55.0 * exp(-pow(fmod(i * 0.3125, 50.0) - 25.0, 2) / 200.0) + s * 0.01);
+			}
+			_snapshots[s] = Snapshot;
+		}
+		_publisher.publish(_snapshots[0]);
+
+		OCMP_Header_t Head = { OCMP_MAGIC, OCMP_VERSION, OCMP_MSG_CHANNELS, 0, 1, 0 };
+		std::vector<char> Payload;
+		if (_mode == BENCH_SERVER_CHANNELS) {
+			unsigned int nEntries = 1;
+			OCMP_ChannelQuery_t Query = { (unsigned int)round(BENCH_FIRSTCHANNEL * OCM3_FSCALE), 50, BENCH_CHANNELS };
+			Payload.insert(Payload.end(), (char*)&nEntries, (char*)&nEntries + sizeof(nEntries));
+			Payload.insert(Payload.end(), (char*)&Query, (char*)&Query + sizeof(Query));
+		}
+		else {
+			unsigned int nWindows = 1;
+			OCMP_SpectrumWindow_t Window = { _snapshots[0]->Spectrum.Freq.front(), _snapshots[0]->Spectrum.Freq.back() };
+			Head.TYPE = OCMP_MSG_WINDOW;
+			Head.FLAGS = _mode == BENCH_SERVER_COMPACT ? OCMP_FLAG_COMPACT : 0;
+			Payload.insert(Payload.end(), (char*)&nWindows, (char*)&nWindows + sizeof(nWindows));
+			Payload.insert(Payload.end(), (char*)&Window, (char*)&Window + sizeof(Window));
+		}
+		Head.LENGTH = (unsigned int)Payload.size();
+		_request.assign((char*)&Head, (char*)&Head + sizeof(Head));
+		_request.insert(_request.end(), Payload.begin(), Payload.end());
+		return true;
+	}
+
+	virtual bool run(size_t n)
+	{
+		size_t bytes = 0;
+		for (size_t i = 0; i < n; ++i) {
+			if (!_cached) {
+				_publisher.publish(_snapshots[(i + 1) % 2]);
+			}
+			if (_handler.onReceive(_server, _conn, &_request[0], _request.size()) != (int)_request.size()) {
+				return false;
+			}
+			bytes += _conn.TxQueued;
+			_conn.Tx.clear();
+			_conn.TxQueued = 0;
+		}
+		_bytes = (double)bytes / n;
+		return _conn.State == OCM_CONN_OPEN;
+	}
+
+private:
+	int										_mode;
+	bool									_cached;
+	OCMSnapshotPublisher					_publisher;
+	OCMRequestHandler						_handler;
+	OCMScanServer							_server;
+	OCMConnection							_conn;
+	std::shared_ptr<const OCMScanSnapshot>	_snapshots[2];
+	std::vector<char>						_request;
+};
+
+// Time of n operations in ns, negative if an operation failed
+static double benchRun(BenchCase &Case, size_t n)
+{
+	long long startNs = benchNowNs();
+	if (!Case.run(n)) {
+		return -1;
+	}
+	return (double)(benchNowNs() - startNs);
+}
+
+// Median time per operation of BENCH_SAMPLES samples that take targetNs together
+static double benchMeasure(BenchCase &Case, double targetNs, size_t &n)
+{
+	// Grow the number of operations until a run takes a tenth of a sample
+	double sampleNs = targetNs / BENCH_SAMPLES;
+	n = 1;
+	double ns = benchRun(Case, n);
+	while (ns >= 0 && ns < sampleNs / 10) {
+		n *= ns > 0 ? std::min<size_t>(100, (size_t)(sampleNs / 10 / ns) + 2) : 100;
+		ns = benchRun(Case, n);
+	}
+	if (ns < 0) {
+		return -1;
+	}
+	n = std::max<size_t>(1, (size_t)(n * sampleNs / ns));
+
+	std::vector<double> Samples;
+	for (int k = 0; k < BENCH_SAMPLES; ++k) {
+		ns = benchRun(Case, n);
+		if (ns < 0) {
+			return -1;
+		}
+		Samples.push_back(ns / n);
+	}
+	std::sort(Samples.begin(), Samples.end());
+	return Samples[BENCH_SAMPLES / 2];
+}
+
+// ns/op by benchmark of a result file
+static bool benchReadBaseline(const char *filename, std::map<std::string, double> &Baseline)
+{
+	FILE *f = fopen(filename, "rt");
+	if (f == NULL) {
+		return false;
+	}
+	char line[512];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		char *pComma = strchr(line, ',');
+		if (pComma == NULL || strncmp(line, "Benchmark,", 10) == 0) {
+			continue;
+		}
+		*pComma = 0;
+		char *pNs = strchr(pComma + 1, ',');
+		if (pNs != NULL) {
+			Baseline[line] = atof(pNs + 1);
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+static bool benchSelected(const std::string &Name, const std::vector<std::string> &Filters)
+{
+	if (Filters.empty()) {
+		return true;
+	}
+	for (size_t i = 0; i < Filters.size(); ++i) {
+		if (Name.find(Filters[i]) != std::string::npos) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char* argv[])
+{
+	double timeMs = BENCH_DEFAULT_MS;
+	const char *BaselineFilename = NULL;
+	double tolerance = 0;
+	std::vector<std::string> Filters;
+
+	for (int iArg = 1; iArg < argc; ++iArg) {
+		if (strcmp(argv[iArg], "-time") == 0 && iArg + 1 < argc) {
+			timeMs = atof(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-baseline") == 0 && iArg + 2 < argc) {
+			BaselineFilename = argv[++iArg];
+			tolerance = atof(argv[++iArg]);
+		}
+		else if (argv[iArg][0] == '-') {
+			printf("Usage: HROCMBench [-time ms] [-baseline file percent] [filter ...]\n");
+			return 1;
+		}
+		else {
+			Filters.push_back(argv[iArg]);
+		}
+	}
+
+	std::map<std::string, double> Baseline;
+	if (BaselineFilename != NULL && !benchReadBaseline(BaselineFilename, Baseline)) {
+		fprintf(stderr, "[ERROR] Could not read file %s\n", BaselineFilename);
+		return 1;
+	}
+
+	std::vector<std::unique_ptr<BenchCase> > Cases;
+	Cases.push_back(std::unique_ptr<BenchCase>(new BenchCrc("crc.crc1", 20)));
+	for (size_t p = 0; p < sizeof(benchPlans) / sizeof(benchPlans[0]); ++p) {
+		const BenchPlan_t &Plan = benchPlans[p];
+		std::string Suffix = std::string(".") + Plan.Name;
+		size_t nRecords = Plan.nHiRes + Plan.nChannels;
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchCrc("crc.crc2" + Suffix, sizeof(OCM3_Response_t) + sizeof(OCM3_GMPWHead_t) + nRecords * sizeof(OCM3_GMPWRecord_t))));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchDriver("cmd.setmppw" + Suffix, Plan, BENCH_DRIVER_SETMPPW)));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchDriver("rx.polllong" + Suffix, Plan, BENCH_DRIVER_POLLLONG)));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchDriver("rx.querypw" + Suffix, Plan, BENCH_DRIVER_QUERYPW)));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchDriver("scan.readscan" + Suffix, Plan, BENCH_DRIVER_READSCAN)));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchDriver("get.power" + Suffix, Plan, BENCH_DRIVER_GETPOWER)));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchDriver("get.fcenter" + Suffix, Plan, BENCH_DRIVER_GETFCENTER)));
+		Cases.push_back(std::unique_ptr<BenchCase>(new BenchCsv("csv.scanraw" + Suffix, Plan)));
+	}
+	Cases.push_back(std::unique_ptr<BenchCase>(new BenchServer("server.channels.80ch", BENCH_SERVER_CHANNELS, true)));
+	Cases.push_back(std::unique_ptr<BenchCase>(new BenchServer("server.channels.80ch.uncached", BENCH_SERVER_CHANNELS, false)));
+	Cases.push_back(std::unique_ptr<BenchCase>(new BenchServer("server.window.15440", BENCH_SERVER_WINDOW, true)));
+	Cases.push_back(std::unique_ptr<BenchCase>(new BenchServer("server.window.15440.uncached", BENCH_SERVER_WINDOW, false)));
+	Cases.push_back(std::unique_ptr<BenchCase>(new BenchServer("server.window.15440.compact.uncached", BENCH_SERVER_COMPACT, false)));
+
+	int exitCode = 0;
+	printf("Benchmark,Iterations,ns/op,bytes/op,MB/s\n");
+	for (size_t i = 0; i < Cases.size(); ++i) {
+		BenchCase &Case = *Cases[i];
+		if (!benchSelected(Case.getName(), Filters)) {
+			continue;
+		}
+		size_t n = 0;
+		double ns = Case.setup() ? benchMeasure(Case, timeMs * 1e6, n) : -1;
+		if (ns < 0) {
+			fprintf(stderr, "[ERROR] %s failed\n", Case.getName().c_str());
+			exitCode = 1;
+			continue;
+		}
+		printf("%s,%zu,%.1f,%.0f,%.1f\n", Case.getName().c_str(), n, ns, Case.getBytes(), Case.getBytes() / ns * 1e3);
+		fflush(stdout);
+
+		std::map<std::string, double>::const_iterator it = Baseline.find(Case.getName());
+		if (it != Baseline.end() && it->second > 0 && ns > it->second * (1 + tolerance / 100)) {
+			fprintf(stderr, "[REGRESSION] %s: %.1f ns/op, baseline %.1f ns/op (+%.1f%%)\n", Case.getName().c_str(), ns, it->second,
+				(ns / it->second - 1) * 100);
+			if (exitCode == 0) {
+				exitCode = 2;
+			}
+		}
+	}
+
+	return exitCode;
+}
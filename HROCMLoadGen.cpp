@@ -0,0 +1,798 @@
+/*! \mainpage HROCMLoadGen
+
+\section lgsec1 Overview
+Load generator for the scan server (HROCMQueryV3 serve, protocol see OCMProtocol.h). It opens many client
+connections, sends a mix of channel and window requests at a configurable rate, keeps subscriptions open, checks
+every response and reports the latency percentiles and the throughput over time. It is used to find out how many
+collectors one host can serve.
+
+There are two kinds of connections:
+- Request connections send requests at -rate requests per second each (open loop: the send times are fixed in
+  advance, so a slow server cannot slow down the load). At most -pipeline requests are outstanding per connection;
+  the latency is measured from the planned send time to the last byte of the response, so it includes the time a
+  request had to wait for the pipeline. With -rate 0 each connection sends as fast as the pipeline allows.
+  The request is chosen at random with the weights of -mix: channels (80 channels on the 50 GHz grid and 40 on the
+  100 GHz grid from 191.4 THz, as served by serve), window (slices of the high-resolution scan in the -window range)
+  and compact (the same window with OCMP_FLAG_COMPACT).
+- Subscribers send one OCMP_MSG_SUBSCRIBE for the two channel grids and then receive the pushed scans. The age of
+  a push is the time from the scan timestamp to its arrival (meaningful if the server runs on the same host or
+  the clocks are synchronized).
+
+Every frame is checked: header, REQID in request order, message type, payload length against the entries and
+counts it announces, known status codes, finite power values, compact slices that decode to the announced count,
+and scan numbers that never go back. OCMP_MSG_ERROR responses (e.g. no scan completed yet) are counted separately.
+
+With -ramp the connections are opened step by step, so one run shows at which number of connections the
+latency starts to grow. The connections are spread over -threads threads, each serving its connections with
+non-blocking sockets.
+
+\section lgsec2 Usage
+@code
+HROCMLoadGen [-host address] [-port n] [-connections n] [-subscribers n] [-rate r] [-pipeline n]
+             [-mix channels window compact] [-window fStart fStop] [-interval ms] [-ramp n s]
+             [-threads n] [-duration s] [-report s]
+@endcode
+
+Defaults: -host 127.0.0.1 -port 8888 -connections 10 -subscribers 0 -rate 1 -pipeline 1 -mix 8 1 1
+-window 191.3 196.2 (THz) -interval 0 (subscription: every scan) -threads 4 -duration 60 -report 5.
+-connections is the number of request connections, -subscribers is added to it. -ramp n s opens n more
+connections every s seconds (subscribers are spread evenly over the ramp).
+
+Output is CSV on stdout, one line per report interval and a final line with the totals of the run:
+Time_s,Connections,Requests/s,Responses/s,MB/s,p50_ms,p90_ms,p99_ms,max_ms,Pushes/s,PushAge_p50_ms,PushAge_p99_ms,
+ScanGaps,ServerErrors,Errors. ScanGaps counts the scans a subscriber did not receive (pushes are skipped while a
+subscriber is behind). Errors are failed connections, connections closed by the server and invalid frames;
+the first ones are also printed to stderr. The exit code is 1 if there were errors.
+
+Example:
+@code
+HROCMLoadGen -connections 500 -subscribers 100 -rate 2 -ramp 50 10 -duration 120 -report 10 > load.csv
+@endcode
+*/
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "OCMProtocol.h"
+#include "OCMDriverStats.h"
+#include "OCMSpectrumCodec.h"
+
+#ifdef _WIN32
+#pragma comment(lib,"ws2_32.lib")
+typedef WSAPOLLFD LoadPollFd_t;
+#define LOAD_INVALID_SOCKET		((intptr_t)INVALID_SOCKET)
+#define LOAD_CLOSESOCKET(s)		closesocket((SOCKET)(s))
+#define LOAD_WOULDBLOCK()		(WSAGetLastError() == WSAEWOULDBLOCK)
+#define LOAD_POLL(fds, n, ms)	WSAPoll(fds, (ULONG)(n), ms)
+#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+typedef pollfd LoadPollFd_t;
+#define LOAD_INVALID_SOCKET		((intptr_t)-1)
+#define LOAD_CLOSESOCKET(s)		::close((int)(s))
+#define LOAD_WOULDBLOCK()		(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+#define LOAD_POLL(fds, n, ms)	poll(fds, (nfds_t)(n), ms)
+#endif
+
+#define LOAD_RECV_CHUNK			65536
+#define LOAD_MAXPRINTED			10			// Errors printed to stderr
+#define LOAD_FREQ_50			1914000000	// First channel of the grids of serve (191.4 THz)
+
+// Request kinds of -mix
+#define LOAD_KIND_CHANNELS		0
+#define LOAD_KIND_WINDOW		1
+#define LOAD_KIND_COMPACT		2
+#define LOAD_KIND_SUBSCRIBE		3
+#define LOAD_NKINDS				3			// Kinds of the mix
+
+typedef struct {
+	std::string		Host;
+	unsigned short	Port;
+	unsigned int	Connections;
+	unsigned int	Subscribers;
+	double			Rate;					// Requests per second and connection (0: as fast as possible)
+	unsigned int	Pipeline;
+	unsigned int	Mix[LOAD_NKINDS];
+	double			WindowStartTHz;
+	double			WindowStopTHz;
+	unsigned int	IntervalMs;				// Subscription interval
+	unsigned int	RampStep;				// Connections opened per ramp step (0: all at once)
+	double			RampSec;
+	unsigned int	Threads;
+	double			DurationSec;
+	double			ReportSec;
+} LoadSettings_t;
+
+// Measurements of one report interval (or of the whole run). Recorded from all threads.
+class LoadStats
+{
+public:
+	LoadStats() { reset(); }
+
+	void reset()
+	{
+		Latency.reset();
+		PushAge.reset();
+		Requests.store(0);
+		Responses.store(0);
+		Bytes.store(0);
+		Pushes.store(0);
+		ScanGaps.store(0);
+		ServerErrors.store(0);
+		Errors.store(0);
+	}
+
+	OCMLatencyHistogram					Latency;		// us
+	OCMLatencyHistogram					PushAge;		// us
+	std::atomic<unsigned long long>		Requests;
+	std::atomic<unsigned long long>		Responses;
+	std::atomic<unsigned long long>		Bytes;			// Received
+	std::atomic<unsigned long long>		Pushes;
+	std::atomic<unsigned long long>		ScanGaps;
+	std::atomic<unsigned long long>		ServerErrors;	// OCMP_MSG_ERROR responses
+	std::atomic<unsigned long long>		Errors;			// Connection errors and invalid frames
+
+private:
+	LoadStats(const LoadStats&);
+	LoadStats &operator=(const LoadStats&);
+};
+
+// The threads record into the interval ring slot of the current interval and into the totals. The report
+// resets the slot of the interval after next, which nobody records into.
+static LoadStats loadIntervals[3];
+static LoadStats loadTotal;
+static std::atomic<unsigned int> loadInterval(0);
+static std::atomic<unsigned int> loadConnected(0);
+static std::atomic<unsigned int> loadPrinted(0);
+static std::atomic<bool> loadStop(false);
+
+// Request payloads, built once
+static std::vector<char> loadPayloads[LOAD_NKINDS + 1];
+
+static void loadCount(std::atomic<unsigned long long> LoadStats::*pCounter, unsigned long long value)
+{
+	(loadIntervals[loadInterval.load(std::memory_order_relaxed) % 3].*pCounter).fetch_add(value, std::memory_order_relaxed);
+	(loadTotal.*pCounter).fetch_add(value, std::memory_order_relaxed);
+}
+
+static void loadRecord(OCMLatencyHistogram LoadStats::*pHistogram, unsigned long long value)
+{
+	(loadIntervals[loadInterval.load(std::memory_order_relaxed) % 3].*pHistogram).record(value);
+	(loadTotal.*pHistogram).record(value);
+}
+
+static unsigned long long loadNowUs()
+{
+	return OCMDriverStats::nowUs();
+}
+
+static long long loadUnixTimeMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Append a value to a payload
+template <typename T> static void loadPut(std::vector<char> &Out, const T &value)
+{
+	const char *p = (const char*)&value;
+	Out.insert(Out.end(), p, p + sizeof(value));
+}
+
+static void loadBuildPayloads(const LoadSettings_t &Settings)
+{
+	OCMP_ChannelQuery_t Query[2] = { { LOAD_FREQ_50, 50, 80 }, { LOAD_FREQ_50, 100, 40 } };
+	loadPut(loadPayloads[LOAD_KIND_CHANNELS], (unsigned int)2);
+	loadPut(loadPayloads[LOAD_KIND_CHANNELS], Query[0]);
+	loadPut(loadPayloads[LOAD_KIND_CHANNELS], Query[1]);
+
+	OCMP_SpectrumWindow_t Window;
+	Window.FSTART	= (unsigned int)(Settings.WindowStartTHz * 1e7 + 0.5);
+	Window.FSTOP	= (unsigned int)(Settings.WindowStopTHz * 1e7 + 0.5);
+	loadPut(loadPayloads[LOAD_KIND_WINDOW], (unsigned int)1);
+	loadPut(loadPayloads[LOAD_KIND_WINDOW], Window);
+	loadPayloads[LOAD_KIND_COMPACT] = loadPayloads[LOAD_KIND_WINDOW];
+
+	OCMP_Subscribe_t Subscribe;
+	Subscribe.INTERVAL	= Settings.IntervalMs;
+	Subscribe.NCHANNELS	= 2;
+	Subscribe.NWINDOWS	= 0;
+	loadPut(loadPayloads[LOAD_KIND_SUBSCRIBE], Subscribe);
+	loadPut(loadPayloads[LOAD_KIND_SUBSCRIBE], Query[0]);
+	loadPut(loadPayloads[LOAD_KIND_SUBSCRIBE], Query[1]);
+}
+
+// Count an error and print the first ones
+static void loadError(unsigned int iConn, const char *Message)
+{
+	loadCount(&LoadStats::Errors, 1);
+	if (loadPrinted.fetch_add(1) < LOAD_MAXPRINTED) {
+		fprintf(stderr, "[ERROR] Connection %u: %s\n", iConn, Message);
+	}
+}
+
+// Request sent and not answered yet
+typedef struct {
+	unsigned int		ReqId;
+	int					Kind;
+	unsigned long long	PlannedUs;		// Planned send time
+} LoadPending_t;
+
+// Client connection
+class LoadConnection
+{
+public:
+	LoadConnection(unsigned int Index, bool Subscriber, unsigned long long StartUs) : _index(Index), _subscriber(Subscriber),
+		_startUs(StartUs), _socket(LOAD_INVALID_SOCKET), _txOffset(0), _nextReqId(1), _nextSendUs(0), _subReqId(0), _lastScan(0),
+		_done(false)
+	{
+	}
+
+	~LoadConnection() { close(); }
+
+	bool isOpen() const { return _socket != LOAD_INVALID_SOCKET; }
+	bool isDone() const { return _done; }
+	bool isDue(unsigned long long nowUs) const { return !_done && !isOpen() && nowUs >= _startUs; }
+	intptr_t getSocket() const { return _socket; }
+	bool wantsWrite() const { return _txOffset < _tx.size(); }
+
+	bool open(const sockaddr_in &Addr, unsigned long long nowUs);
+	void close();
+
+	// Queue the requests that are due. Returns the time of the next one (~0: none planned).
+	unsigned long long send(const LoadSettings_t &Settings, std::mt19937 &Random, unsigned long long nowUs);
+	bool flush();
+	bool receive();
+
+private:
+	LoadConnection(const LoadConnection&);
+	LoadConnection &operator=(const LoadConnection&);
+
+	void queue(int Kind, unsigned long long PlannedUs);
+	void fail(const char *Message);
+	bool handleFrame(const OCMP_Header_t &Head, const char *pPayload);
+	bool checkChannels(const char *pPayload, size_t length, unsigned int nEntries);
+	bool checkWindows(const char *pPayload, size_t length, bool Compact);
+	bool checkScan(const OCMP_ScanInfo_t &Info);
+
+	unsigned int				_index;
+	bool						_subscriber;
+	unsigned long long			_startUs;
+	intptr_t					_socket;
+	std::vector<char>			_tx;			// Bytes to send
+	size_t						_txOffset;
+	std::vector<char>			_rx;			// Bytes received and not yet parsed
+	std::deque<LoadPending_t>	_pending;
+	unsigned int				_nextReqId;
+	unsigned long long			_nextSendUs;
+	unsigned int				_subReqId;		// REQID of the subscription
+	unsigned int				_lastScan;
+	bool						_done;			// Failed; not reopened
+};
+
+bool LoadConnection::open(const sockaddr_in &Addr, unsigned long long nowUs)
+{
+	_socket = (intptr_t)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (_socket != LOAD_INVALID_SOCKET) {
+		loadConnected.fetch_add(1);
+	}
+	if (_socket == LOAD_INVALID_SOCKET || connect((int)_socket, (const sockaddr*)&Addr, sizeof(Addr)) != 0) {
+		fail("Could not connect");
+		return false;
+	}
+	int noDelay = 1;
+	setsockopt((int)_socket, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+#ifdef _WIN32
+	u_long mode = 1;
+	ioctlsocket((SOCKET)_socket, FIONBIO, &mode);
+#else
+	fcntl((int)_socket, F_SETFL, fcntl((int)_socket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+	_nextSendUs = nowUs;
+	if (_subscriber) {
+		_subReqId = _nextReqId;
+		queue(LOAD_KIND_SUBSCRIBE, nowUs);
+	}
+	return true;
+}
+
+void LoadConnection::close()
+{
+	if (_socket != LOAD_INVALID_SOCKET) {
+		LOAD_CLOSESOCKET(_socket);
+		_socket = LOAD_INVALID_SOCKET;
+		loadConnected.fetch_sub(1);
+	}
+}
+
+void LoadConnection::fail(const char *Message)
+{
+	if (!loadStop.load()) {
+		loadError(_index, Message);
+	}
+	close();
+	_done = true;
+}
+
+void LoadConnection::queue(int Kind, unsigned long long PlannedUs)
+{
+	const std::vector<char> &Payload = loadPayloads[Kind];
+	OCMP_Header_t Head;
+	Head.MAGIC		= OCMP_MAGIC;
+	Head.VERSION	= OCMP_VERSION;
+	Head.TYPE		= Kind == LOAD_KIND_CHANNELS ? OCMP_MSG_CHANNELS : Kind == LOAD_KIND_SUBSCRIBE ? OCMP_MSG_SUBSCRIBE : OCMP_MSG_WINDOW;
+	Head.FLAGS		= Kind == LOAD_KIND_COMPACT ? OCMP_FLAG_COMPACT : 0;
+	Head.REQID		= _nextReqId++;
+	Head.LENGTH		= (unsigned int)Payload.size();
+
+	if (_txOffset == _tx.size()) {
+		_tx.clear();
+		_txOffset = 0;
+	}
+	loadPut(_tx, Head);
+	_tx.insert(_tx.end(), Payload.begin(), Payload.end());
+
+	LoadPending_t Pending = { Head.REQID, Kind, PlannedUs };
+	_pending.push_back(Pending);
+	loadCount(&LoadStats::Requests, 1);
+}
+
+unsigned long long LoadConnection::send(const LoadSettings_t &Settings, std::mt19937 &Random, unsigned long long nowUs)
+{
+	if (!isOpen() || _subscriber) {
+		return ~0ULL;
+	}
+	unsigned int total = Settings.Mix[0] + Settings.Mix[1] + Settings.Mix[2];
+	while (_pending.size() < Settings.Pipeline && (Settings.Rate <= 0 || _nextSendUs <= nowUs)) {
+		unsigned int pick = std::uniform_int_distribution<unsigned int>(0, total - 1)(Random);
+		int Kind = pick < Settings.Mix[0] ? LOAD_KIND_CHANNELS : pick < Settings.Mix[0] + Settings.Mix[1] ? LOAD_KIND_WINDOW : LOAD_KIND_COMPACT;
+		queue(Kind, Settings.Rate > 0 ? _nextSendUs : nowUs);
+		if (Settings.Rate > 0) {
+			_nextSendUs += (unsigned long long)(1e6 / Settings.Rate);
+		}
+	}
+	return Settings.Rate > 0 && _pending.size() < Settings.Pipeline ? _nextSendUs : ~0ULL;
+}
+
+bool LoadConnection::flush()
+{
+	while (_txOffset < _tx.size()) {
+		int n = ::send((int)_socket, &_tx[_txOffset], (int)(_tx.size() - _txOffset), 0);
+		if (n < 0 && LOAD_WOULDBLOCK()) {
+			break;
+		}
+		if (n <= 0) {
+			fail("Send failed");
+			return false;
+		}
+		_txOffset += n;
+	}
+	return true;
+}
+
+bool LoadConnection::receive()
+{
+	char buffer[LOAD_RECV_CHUNK];
+	for (;;) {
+		int n = recv((int)_socket, buffer, sizeof(buffer), 0);
+		if (n < 0 && LOAD_WOULDBLOCK()) {
+			break;
+		}
+		if (n <= 0) {
+			fail("Connection closed by the server");
+			return false;
+		}
+		loadCount(&LoadStats::Bytes, n);
+		_rx.insert(_rx.end(), buffer, buffer + n);
+	}
+
+	size_t offset = 0;
+	while (_rx.size() - offset >= sizeof(OCMP_Header_t)) {
+		OCMP_Header_t Head;
+		memcpy(&Head, &_rx[offset], sizeof(Head));
+		if (Head.MAGIC != OCMP_MAGIC || Head.LENGTH > 64 * OCMP_MAXPAYLOAD) {
+			fail("Invalid frame header");
+			return false;
+		}
+		if (_rx.size() - offset < sizeof(Head) + Head.LENGTH) {
+			break;
+		}
+		if (!handleFrame(Head, &_rx[offset + sizeof(Head)])) {
+			return false;
+		}
+		offset += sizeof(Head) + Head.LENGTH;
+	}
+	_rx.erase(_rx.begin(), _rx.begin() + offset);
+	return true;
+}
+
+bool LoadConnection::handleFrame(const OCMP_Header_t &Head, const char *pPayload)
+{
+	if (Head.VERSION != OCMP_VERSION) {
+		fail("Wrong protocol version");
+		return false;
+	}
+
+	// Pushed scan of the subscription
+	if (Head.TYPE == OCMP_MSG_SCAN) {
+		if (!_subscriber || Head.REQID != _subReqId || !checkChannels(pPayload, Head.LENGTH, 2)) {
+			fail("Invalid OCMP_MSG_SCAN");
+			return false;
+		}
+		OCMP_ScanInfo_t Info;
+		memcpy(&Info, pPayload, sizeof(Info));
+		if (_lastScan != 0 && Info.SCAN > _lastScan + 1) {
+			loadCount(&LoadStats::ScanGaps, Info.SCAN - _lastScan - 1);
+		}
+		_lastScan = Info.SCAN;
+		long long ageMs = loadUnixTimeMs() - Info.TIMESTAMP;
+		loadRecord(&LoadStats::PushAge, ageMs > 0 ? (unsigned long long)ageMs * 1000 : 0);
+		loadCount(&LoadStats::Pushes, 1);
+		return true;
+	}
+
+	// Responses come in the order of the requests
+	if (_pending.empty() || Head.REQID != _pending.front().ReqId) {
+		fail("Response with unexpected REQID");
+		return false;
+	}
+	LoadPending_t Pending = _pending.front();
+	_pending.pop_front();
+	loadCount(&LoadStats::Responses, 1);
+
+	bool valid = true;
+	if (Head.TYPE == OCMP_MSG_ERROR) {
+		valid = Head.LENGTH >= sizeof(unsigned int);
+		loadCount(&LoadStats::ServerErrors, 1);
+	}
+	else if (Pending.Kind == LOAD_KIND_CHANNELS) {
+		valid = Head.TYPE == OCMP_MSG_CHANNELS && checkChannels(pPayload, Head.LENGTH, 2);
+	}
+	else if (Pending.Kind == LOAD_KIND_SUBSCRIBE) {
+		valid = Head.TYPE == OCMP_MSG_SUBSCRIBE && Head.LENGTH == 0;
+	}
+	else {
+		bool Compact = Pending.Kind == LOAD_KIND_COMPACT;
+		valid = Head.TYPE == OCMP_MSG_WINDOW && ((Head.FLAGS & OCMP_FLAG_COMPACT) != 0) == Compact && checkWindows(pPayload, Head.LENGTH, Compact);
+	}
+	if (!valid) {
+		fail("Invalid response");
+		return false;
+	}
+
+	if (Pending.Kind != LOAD_KIND_SUBSCRIBE) {
+		unsigned long long nowUs = loadNowUs();
+		loadRecord(&LoadStats::Latency, nowUs > Pending.PlannedUs ? nowUs - Pending.PlannedUs : 0);
+	}
+	return true;
+}
+
+// Scan numbers never go back on a connection
+bool LoadConnection::checkScan(const OCMP_ScanInfo_t &Info)
+{
+	return Info.SCAN >= _lastScan;
+}
+
+// OCMP_ScanInfo_t, NENTRIES, the entries, then the values of each entry
+bool LoadConnection::checkChannels(const char *pPayload, size_t length, unsigned int nEntries)
+{
+	OCMP_ScanInfo_t Info;
+	unsigned int n = 0;
+	size_t offset = sizeof(Info) + sizeof(n);
+	if (length < offset) {
+		return false;
+	}
+	memcpy(&Info, pPayload, sizeof(Info));
+	memcpy(&n, pPayload + sizeof(Info), sizeof(n));
+	if (n != nEntries || length < offset + n * sizeof(OCMP_ChannelResult_t) || !checkScan(Info)) {
+		return false;
+	}
+
+	size_t values = offset + n * sizeof(OCMP_ChannelResult_t);
+	for (unsigned int i = 0; i < n; ++i) {
+		OCMP_ChannelResult_t Result;
+		memcpy(&Result, pPayload + offset + i * sizeof(Result), sizeof(Result));
+		if (Result.STATUS > OCMP_STATUS_RANGE || values + Result.COUNT * sizeof(OCMP_ChannelValue_t) > length) {
+			return false;
+		}
+		for (unsigned int k = 0; k < Result.COUNT; ++k, values += sizeof(OCMP_ChannelValue_t)) {
+			OCMP_ChannelValue_t Value;
+			memcpy(&Value, pPayload + values, sizeof(Value));
+			if (Value.POWER != Value.POWER || Value.OSNR != Value.OSNR) {
+				return false;
+			}
+		}
+	}
+	if (!_subscriber) {
+		_lastScan = Info.SCAN;
+	}
+	return values == length;
+}
+
+// OCMP_ScanInfo_t, NWINDOWS, the window results, then the slices of each window (plain or compact)
+bool LoadConnection::checkWindows(const char *pPayload, size_t length, bool Compact)
+{
+	OCMP_ScanInfo_t Info;
+	unsigned int n = 0;
+	size_t offset = sizeof(Info) + sizeof(n);
+	if (length < offset) {
+		return false;
+	}
+	memcpy(&Info, pPayload, sizeof(Info));
+	memcpy(&n, pPayload + sizeof(Info), sizeof(n));
+	if (n != 1 || length < offset + n * sizeof(OCMP_WindowResult_t) || !checkScan(Info)) {
+		return false;
+	}
+
+	size_t slices = offset + n * sizeof(OCMP_WindowResult_t);
+	for (unsigned int i = 0; i < n; ++i) {
+		OCMP_WindowResult_t Result;
+		memcpy(&Result, pPayload + offset + i * sizeof(Result), sizeof(Result));
+		if (Result.STATUS > OCMP_STATUS_RANGE) {
+			return false;
+		}
+		if (!Compact) {
+			if (slices + Result.COUNT * (sizeof(unsigned int) + sizeof(double)) > length) {
+				return false;
+			}
+			slices += Result.COUNT * (sizeof(unsigned int) + sizeof(double));
+			continue;
+		}
+
+		unsigned int nBytes = 0;
+		if (slices + sizeof(nBytes) > length) {
+			return false;
+		}
+		memcpy(&nBytes, pPayload + slices, sizeof(nBytes));
+		slices += sizeof(nBytes);
+		if (slices + nBytes > length) {
+			return false;
+		}
+		std::vector<unsigned int> Freq(Result.COUNT + 1);
+		std::vector<short> Power(Result.COUNT + 1);
+		if (Result.COUNT > 0 && OCMSpectrumCodec::decode((const unsigned char*)pPayload + slices, nBytes, Result.FSTART, Result.COUNT, NULL,
+			&Freq[0], &Power[0]) != nBytes) {
+			return false;
+		}
+		slices += nBytes;
+	}
+	_lastScan = Info.SCAN;
+	return slices == length;
+}
+
+// Thread serving a share of the connections
+static void loadThread(const LoadSettings_t *pSettings, std::vector<LoadConnection*> Connections, sockaddr_in Addr, unsigned int Seed)
+{
+	std::mt19937 Random(Seed);
+	std::vector<LoadPollFd_t> fds;
+	std::vector<LoadConnection*> polled;
+
+	while (!loadStop.load()) {
+		unsigned long long nowUs = loadNowUs();
+		unsigned long long nextUs = nowUs + 10000;
+		fds.clear();
+		polled.clear();
+		for (size_t i = 0; i < Connections.size(); ++i) {
+			LoadConnection &Conn = *Connections[i];
+			if (Conn.isDue(nowUs)) {
+				Conn.open(Addr, nowUs);
+			}
+			if (!Conn.isOpen()) {
+				continue;
+			}
+			unsigned long long sendUs = Conn.send(*pSettings, Random, nowUs);
+			nextUs = sendUs < nextUs ? sendUs : nextUs;
+			if (!Conn.flush()) {
+				continue;
+			}
+
+			LoadPollFd_t pfd;
+			pfd.fd = Conn.getSocket();
+			pfd.events = POLLIN | (Conn.wantsWrite() ? POLLOUT : 0);
+			pfd.revents = 0;
+			fds.push_back(pfd);
+			polled.push_back(&Conn);
+		}
+
+		int timeoutMs = nextUs > nowUs ? (int)((nextUs - nowUs + 999) / 1000) : 0;
+		if (fds.empty()) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+			continue;
+		}
+		int n = LOAD_POLL(&fds[0], fds.size(), timeoutMs);
+		for (size_t i = 0; i < fds.size() && n > 0; ++i) {
+			if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR)) != 0) {
+				polled[i]->receive();
+			}
+		}
+	}
+}
+
+// One line of the report. Rates are per second of the interval.
+static void loadReport(const char *Time, LoadStats &Stats, double seconds)
+{
+	double s = seconds > 0 ? seconds : 1;
+	printf("%s,%u,%.1f,%.1f,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f,%.1f,%llu,%llu,%llu\n", Time, loadConnected.load(),
+		Stats.Requests.load() / s, Stats.Responses.load() / s, Stats.Bytes.load() / s / 1e6,
+		Stats.Latency.getPercentile(50) / 1e3, Stats.Latency.getPercentile(90) / 1e3, Stats.Latency.getPercentile(99) / 1e3,
+		Stats.Latency.getMax() / 1e3, Stats.Pushes.load() / s, Stats.PushAge.getPercentile(50) / 1e3, Stats.PushAge.getPercentile(99) / 1e3,
+		Stats.ScanGaps.load(), Stats.ServerErrors.load(), Stats.Errors.load());
+	fflush(stdout);
+}
+
+static void loadUsage()
+{
+	printf("Usage: HROCMLoadGen [-host address] [-port n] [-connections n] [-subscribers n] [-rate r] [-pipeline n]\n");
+	printf("                    [-mix channels window compact] [-window fStart fStop] [-interval ms] [-ramp n s]\n");
+	printf("                    [-threads n] [-duration s] [-report s]\n");
+}
+
+int main(int argc, char* argv[])
+{
+	LoadSettings_t Settings;
+	Settings.Host			= "127.0.0.1";
+	Settings.Port			= 8888;
+	Settings.Connections	= 10;
+	Settings.Subscribers	= 0;
+	Settings.Rate			= 1;
+	Settings.Pipeline		= 1;
+	Settings.Mix[0]			= 8;
+	Settings.Mix[1]			= 1;
+	Settings.Mix[2]			= 1;
+	Settings.WindowStartTHz	= 191.3;
+	Settings.WindowStopTHz	= 196.2;
+	Settings.IntervalMs		= 0;
+	Settings.RampStep		= 0;
+	Settings.RampSec		= 0;
+	Settings.Threads		= 4;
+	Settings.DurationSec	= 60;
+	Settings.ReportSec		= 5;
+
+	for (int iArg = 1; iArg < argc; ++iArg) {
+		if (strcmp(argv[iArg], "-host") == 0 && iArg + 1 < argc) {
+			Settings.Host = argv[++iArg];
+		}
+		else if (strcmp(argv[iArg], "-port") == 0 && iArg + 1 < argc) {
+			Settings.Port = (unsigned short)atoi(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-connections") == 0 && iArg + 1 < argc) {
+			Settings.Connections = (unsigned int)atoi(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-subscribers") == 0 && iArg + 1 < argc) {
+			Settings.Subscribers = (unsigned int)atoi(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-rate") == 0 && iArg + 1 < argc) {
+			Settings.Rate = atof(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-pipeline") == 0 && iArg + 1 < argc) {
+			Settings.Pipeline = (unsigned int)atoi(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-mix") == 0 && iArg + 3 < argc) {
+			for (int k = 0; k < LOAD_NKINDS; ++k) {
+				Settings.Mix[k] = (unsigned int)atoi(argv[++iArg]);
+			}
+		}
+		else if (strcmp(argv[iArg], "-window") == 0 && iArg + 2 < argc) {
+			Settings.WindowStartTHz = atof(argv[++iArg]);
+			Settings.WindowStopTHz = atof(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-interval") == 0 && iArg + 1 < argc) {
+			Settings.IntervalMs = (unsigned int)atoi(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-ramp") == 0 && iArg + 2 < argc) {
+			Settings.RampStep = (unsigned int)atoi(argv[++iArg]);
+			Settings.RampSec = atof(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-threads") == 0 && iArg + 1 < argc) {
+			Settings.Threads = (unsigned int)atoi(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-duration") == 0 && iArg + 1 < argc) {
+			Settings.DurationSec = atof(argv[++iArg]);
+		}
+		else if (strcmp(argv[iArg], "-report") == 0 && iArg + 1 < argc) {
+			Settings.ReportSec = atof(argv[++iArg]);
+		}
+		else {
+			loadUsage();
+			return 1;
+		}
+	}
+
+	unsigned int nConnections = Settings.Connections + Settings.Subscribers;
+	if (nConnections == 0 || Settings.Pipeline == 0 || Settings.Threads == 0 || Settings.ReportSec <= 0 ||
+		Settings.Mix[0] + Settings.Mix[1] + Settings.Mix[2] == 0) {
+		loadUsage();
+		return 1;
+	}
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		fprintf(stderr, "[ERROR] WSAStartup failed\n");
+		return 1;
+	}
+#endif
+
+	sockaddr_in Addr;
+	memset(&Addr, 0, sizeof(Addr));
+	Addr.sin_family = AF_INET;
+	Addr.sin_port = htons(Settings.Port);
+	if (inet_pton(AF_INET, Settings.Host.c_str(), &Addr.sin_addr) != 1) {
+		fprintf(stderr, "[ERROR] Invalid address %s\n", Settings.Host.c_str());
+		return 1;
+	}
+
+	loadBuildPayloads(Settings);
+
+	// Connection i is opened in ramp step i / RampStep. The subscribers are spread evenly.
+	unsigned long long t0 = loadNowUs();
+	std::vector<std::unique_ptr<LoadConnection> > Connections;
+	for (unsigned int i = 0; i < nConnections; ++i) {
+		bool Subscriber = (unsigned long long)(i + 1) * Settings.Subscribers / nConnections > (unsigned long long)i * Settings.Subscribers / nConnections;
+		unsigned long long StartUs = t0 + (Settings.RampStep > 0 ? (unsigned long long)(i / Settings.RampStep * Settings.RampSec * 1e6) : 0);
+		Connections.push_back(std::unique_ptr<LoadConnection>(new LoadConnection(i, Subscriber, StartUs)));
+	}
+
+	std::vector<std::thread> Threads;
+	unsigned int nThreads = Settings.Threads < nConnections ? Settings.Threads : nConnections;
+	for (unsigned int t = 0; t < nThreads; ++t) {
+		std::vector<LoadConnection*> Share;
+		for (unsigned int i = t; i < nConnections; i += nThreads) {
+			Share.push_back(Connections[i].get());
+		}
+		Threads.push_back(std::thread(loadThread, &Settings, Share, Addr, t + 1));
+	}
+
+	printf("Time_s,Connections,Requests/s,Responses/s,MB/s,p50_ms,p90_ms,p99_ms,max_ms,Pushes/s,PushAge_p50_ms,PushAge_p99_ms,ScanGaps,ServerErrors,Errors\n");
+	unsigned long long reportUs = (unsigned long long)(Settings.ReportSec * 1e6);
+	unsigned long long endUs = t0 + (unsigned long long)(Settings.DurationSec * 1e6);
+	for (unsigned int k = 1; ; ++k) {
+		unsigned long long dueUs = t0 + k * reportUs;
+		unsigned long long lastUs = dueUs < endUs ? dueUs : endUs;
+		unsigned long long nowUs = loadNowUs();
+		if (lastUs > nowUs) {
+			std::this_thread::sleep_for(std::chrono::microseconds(lastUs - nowUs));
+		}
+
+		// Switch to the next interval, report the one that ended and clear the slot of the one after next
+		unsigned int interval = loadInterval.fetch_add(1);
+		char Time[32];
+		snprintf(Time, sizeof(Time), "%.1f", (lastUs - t0) / 1e6);
+		loadReport(Time, loadIntervals[interval % 3], (lastUs - (t0 + (k - 1) * reportUs)) / 1e6);
+		loadIntervals[(interval + 2) % 3].reset();
+		if (lastUs >= endUs) {
+			break;
+		}
+	}
+
+	loadStop.store(true);
+	for (size_t t = 0; t < Threads.size(); ++t) {
+		Threads[t].join();
+	}
+	loadReport("total", loadTotal, Settings.DurationSec);
+	Connections.clear();
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return loadTotal.Errors.load() > 0 ? 1 : 0;
+}
@@ -0,0 +1,78 @@
+/*! \mainpage HROCMLogAnalyzer
+
+\section lasec1 Overview
+Analyzes binary log files written by HROCMQueryV3 -logbin (HROCMQuery.bin). The file is memory mapped and decoded by several
+threads, so captures of several GB are analyzed in seconds. The tool does not need the module or an SPI adapter and builds
+on Windows and Linux.
+
+The report contains
+- the number of transfers, the logged time and the throughput (transfers, MB and TPC commands per second),
+- the transfers with errors (SPI, empty packages, wrong SPIMAGIC, CRC1, CRC2) and the longest bursts of consecutive errors,
+- per opcode the number of commands sent, retransmitted and rejected (COMRES>0) and the latency from sending a command
+  until the module accepted it,
+- per process (PW, VC, CS, OSNR, CP) the latency from the TPC command until the module reported the task complete in SEQARR.
+
+\section lasec2 Usage
+@code
+HROCMLogAnalyzer [-threads n] HROCMQuery.bin
+@endcode
+
+-threads sets the number of threads (default: number of CPU cores).
+
+Example:
+@code
+HROCMLogAnalyzer HROCMQuery.bin
+Transfers: 1523077 in 8093.5 s logged (395998020 bytes, 0 bytes skipped)
+Throughput: 188.2 transfers/s, 0.049 MB/s, 0.847 TPC/s
+Errors: 12 transfers (SPI 0, empty 0, SPIMAGIC 0, CRC1 9, CRC2 3) in 4 bursts
+  Burst of 6 transfers at tick 81230559 ms
+...
+Opcode      Sent  Retransmit  COMRES>0  Accept mean/p50/p99/max [ms]
+TPC         6861           5         0  11.2/11/16/31 (6856 accepted)
+...
+Process     Done  TPC-to-SEQARR mean/p50/p99/max [ms]
+PW          6856  1102.3/1100/1131/1212
+@endcode
+*/
+#include "stdafx.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include "OCMLogAnalyzer.h"
+#include "OCMMappedFile.h"
+
+int main(int argc, char* argv[])
+{
+	int nThreads = (int)std::thread::hardware_concurrency();
+	const char *Filename = NULL;
+
+	for (int iArg = 1; iArg < argc; ++iArg) {
+		if (strcmp(argv[iArg], "-threads") == 0 && iArg + 1 < argc) {
+			nThreads = atoi(argv[++iArg]);
+		}
+		else {
+			Filename = argv[iArg];
+		}
+	}
+
+	if (Filename == NULL) {
+		printf("Usage: HROCMLogAnalyzer [-threads n] HROCMQuery.bin\n");
+		return 1;
+	}
+
+	OCMMappedFile File;
+	if (!File.open(Filename)) {
+		fprintf(stderr, "[ERROR] %s\n", File.getLastError().c_str());
+		return 1;
+	}
+
+	OCMLogAnalyzer Analyzer;
+	if (!Analyzer.analyze(File.data(), File.size(), nThreads)) {
+		fprintf(stderr, "[ERROR] No records found in %s\n", Filename);
+		return 1;
+	}
+	printf("%s", Analyzer.getReport().c_str());
+
+	return 0;
+}
@@ -201,6 +201,48 @@ HROCMQueryV3 itu 191.4 0.05 80
 [OK] MPPW command executed (80 channels)
 @endcode
 
+\subsection hqsec4a discover
+This command detects the occupied channels without assuming a fixed grid. It programs the high-resolution channel plan, runs a scan,
+finds the channels by peak/edge detection and writes matching MPPW and MPOSNR channel plans into the module. The OSNR ranges
+(keep-out, noise search, tag range and bandwidth) are scaled to the width of each detected channel using the ratio of the -osnr settings
+to a 50GHz grid, and the noise search range is clamped so it does not reach into the neighbouring channels.
+
+Use the scanosnr command afterwards to measure the detected channels. Use the -discover flag to change the detection settings.
+
+\subsection hqsec4b discover {period}
+repeats the detection every {period} seconds until a key is pressed and measures the detected channels with an OSNR scan after each
+detection (output as for scanosnr). The detected channel set is kept between the runs: the MPOSNR plan is only uploaded again if a
+channel appeared, disappeared or one of its edges moved by more than 1.25 GHz. The MPPW plan is uploaded on every run because the
+high-resolution scan replaces it.
+
+Example:
+@code
+HROCMQueryV3 discover 60
+[INFO] Press any key to stop
+[OK] SETMPPW command executed (15599 channels)
+[INFO] Channel 1: fCenter=191.4000000THz BW=37.5GHz Peak=-10.2dBm
+[INFO] Channel 2: fCenter=191.4750000THz BW=75.0GHz Peak=-12.8dBm
+[OK] SETMPPW command executed (2 channels)
+[OK] SETMPOSNR command executed (2 channels)
+Port,fCenter_THz,Power_dBm,OSNR_dB
+1,191.4000000,-3.1,32.5
+1,191.4750000,-4.0,30.9
+[OK] SETMPPW command executed (15599 channels)
+[OK] SETMPPW command executed (2 channels)
+[INFO] Channels unchanged, MPOSNR plan kept
+...
+@endcode
+
+Example:
+@code
+HROCMQueryV3 discover
+[OK] SETMPPW command executed (15599 channels)
+[INFO] Channel 1: fCenter=191.4000000THz BW=37.5GHz Peak=-10.2dBm
+[INFO] Channel 2: fCenter=191.4750000THz BW=75.0GHz Peak=-12.8dBm
+[OK] SETMPPW command executed (2 channels)
+[OK] SETMPOSNR command executed (2 channels)
+@endcode
+
 \subsection hqsec5 mppw
 This command reads a channel plan given in CSV format from stdin and sends it to the module. You can use I/O redirection to read data from a CSV file.
 
@@ -302,31 +344,52 @@ HROCMQueryV3 cle
 [OK] CLE command executed
 @endcode
 
-\subsection hqsec10 update {filename}
+\subsection hqsec10 update {filename} {resume}
 Updates the firmware on the module using FWT and FWS commands. {filename} references a valid
 .wf file. Note that the command does not reset the module. In some cases, power cycling may be
-necessary.
+necessary. With resume, an interrupted transfer is continued (see fwt).
 
 Example:
 @code
 HROCMQueryV3 update 1247187_A00-01_03_00.wf
 [OK] File loaded (1247187_A00-01_03_00.wf, 5222300 bytes)
-........................................
-[OK] FWT executed
+[INFO] FWT 2558 of 5099 kB (50%), 1156.9 kB/s
+[INFO] FWT 5099 of 5099 kB (100%), 1154.5 kB/s
+[OK] FWT executed (5222300 bytes in 4.4 s, 1154.5 kB/s, 0 retransmits)
 [OK] FWS command executed
 [INFO] Run RES command to restart the module
 @endcode
 
-\subsection hqsec11 fwt {filename}
+\subsection hqsec11 fwt {filename} {resume}
 Transfers a firmware file using the FWT command. The firmware is not written to NV memory. {filename} references a valid
 .wf file.
 
+The file is mapped into memory and sent in chunks of the maximum SPI package size. The next chunk is prepared while the module
+still acknowledges the current one. The progress and the throughput are printed every 2 seconds.
+
+A chunk that fails is sent again up to 5 times, waiting 0.1 s after the first failure and twice as long after each further one.
+After a failure the chunks are halved (down to 1 kB) and they grow back after 8 chunks went through, so a bad link costs a few
+retransmitted chunks instead of the whole transfer.
+
+Progress is saved in the checkpoint file {filename}.fwt after each block of 4 chunks. It holds the serial number of the module,
+the size and CRC32 of each block of the image and the number of blocks the module acknowledged. If the transfer fails or the tool is
+stopped, run the command again with resume to continue after the last acknowledged block. The checkpoint is only used for the same
+image and module. Do not resume if the module was reset or power cycled in between, it has lost the blocks transferred so far.
+The checkpoint is removed when the transfer is complete.
+
 Example:
 @code
 HROCMQueryV3 fwt 1247187_A00-01_03_00.wf
 [OK] File loaded (1247187_A00-01_03_00.wf, 5222300 bytes)
-........................................
-[OK] FWT executed
+[INFO] FWT 2558 of 5099 kB (50%), 1156.9 kB/s
+[ERROR] FWT failed
+[INFO] 2558 kB acknowledged, run fwt 1247187_A00-01_03_00.wf resume to continue
+
+HROCMQueryV3 fwt 1247187_A00-01_03_00.wf resume
+[OK] File loaded (1247187_A00-01_03_00.wf, 5222300 bytes)
+[INFO] Resuming at 2558 kB
+[INFO] FWT 4861 of 5099 kB (95%), 1150.8 kB/s
+[OK] FWT executed (2601980 bytes in 2.2 s, 1149.6 kB/s, 0 retransmits)
 @endcode
 
 \subsection hqsec12 fws
@@ -391,6 +454,45 @@ HROCMQueryV3 hammer 10
 [INFO] Scan=9 t=0.00h tScan=679ms nCRC1=0 nCRC2=0 nCmdRetransmit=0
 @endcode
 
+\subsection hqsec32 bench {plan} {tasks} {seconds} {filename}
+runs scans back to back for {seconds} and writes a JSON report of the run to {filename} (stdout if omitted). Unlike
+hammer, which reports an average that includes opening the module, bench only measures the scans, needs no key
+press and gives a machine-readable result, so it can be used as acceptance test of a driver release against the
+module or the emulator (-emulator).
+- {plan} selects the channel plan: keep (the plan programmed in the module), 50 (80 channels on the 50GHz grid from
+  191.4THz), 100 (40 channels on the 100GHz grid) or hires (as the hires command)
+- {tasks} selects the tasks of the TPC command: pw, osnr, both or a task mask
+
+Each scan is a TPC command followed by the polls until the result has been read (as in the scan command). The report
+holds the scans per second, the percentiles of the scan time in ms, the SPI transfers, polls and bytes per scan (both
+directions of a transfer are counted once), the CRC errors and retransmits with their rates, and the failed scans.
+The progress is printed to stderr every 10s. The command fails if a scan failed; after 10 failed scans in a row the
+run is aborted.
+
+Example:
+@code
+HROCMQueryV3 -emulator - bench 50 pw 10
+[OK] SETMPPW command executed (80 channels)
+[OK] SETMPOSNR command executed (80 channels)
+{
+  "version": "2.3.0.7",
+  "plan": "50",
+  "tasks": 1,
+  "channels": 80,
+  "seconds": 10.165,
+  "scans": 44,
+  "failedScans": 0,
+  "aborted": false,
+  "scansPerSecond": 4.329,
+  "scanMs": { "min": 227.231, "mean": 231.019, "p50": 232.440, "p90": 232.440, "p99": 232.440, "p999": 232.440, "max": 232.440 },
+  "transfersPerScan": 43.77,
+  "pollsPerScan": 41.77,
+  "bytesPerScan": 3123,
+  "errors": { "crc1": 0, "crc2": 0, "retransmits": 0 },
+  "errorRates": { "crc1PerTransfer": 0.000e+00, "crc2PerTransfer": 0.000e+00, "retransmitsPerScan": 0.000e+00, "failedScans": 0.000e+00 }
+}
+@endcode
+
 \subsection hqsec16d avg {nAverages}
 Sets the number of averages per scan. Note that this
 command just writes the configuration into non-volatile memory. In order for the change to take effect, a RES command needs to be issued.
@@ -429,6 +531,55 @@ Example:
 HROCMQueryV3 factory
 @endcode
 
+\subsection hqsec16h serve {port} {address}
+Runs scans continuously in a background thread (see -scan50, -scan100) and serves the latest results on TCP port {port} (default 8888). If {address} is given,
+the server only binds to this IP address. This is also what the tool does when it is started without a command.
+
+The server handles any number of clients simultaneously using non-blocking sockets. Each connection has a bounded send queue. Clients
+that do not read their responses are disconnected when the queue limit is exceeded, and connections without traffic are closed after 5 minutes.
+
+Requests and responses use the binary OCMP protocol described in OCMProtocol.h. Each message is a 16-byte header (magic "OCMP",
+version, type, request id, payload length) followed by the payload. An OCMP_MSG_CHANNELS request lists ranges of channels on the
+50 GHz or 100 GHz grid. The response returns power and OSNR of these channels together with the number and time of the scan the
+values belong to. OCMP_MSG_WINDOW returns the slice powers of the high-resolution scan (see -scanhires) within one or
+more frequency windows. Clients may send several requests without waiting; the responses carry the request id and arrive in order. Requests
+are always answered from the last completed scan and never wait for a scan in progress. OCMP_MSG_TRIGGER starts the scans set to
+ondemand mode (see -scan50).
+
+With the compact flag set, OCMP_MSG_WINDOW returns the slice powers quantized to 0.01 dB and delta encoded (see OCMSpectrumCodec.h),
+which reduces a full C-band spectrum to about a tenth of its plain size. A client that keeps the previous response can also ask for the
+powers relative to that scan; the server falls back to the plain delta encoding if it no longer has it.
+
+Instead of polling, a client can send OCMP_MSG_SUBSCRIBE with a list of channel ranges and frequency windows. The server then pushes
+the requested values of every new scan as soon as it has completed. The subscription sets the minimum interval between two pushes.
+A client that reads slower than scans complete is not flooded: while a push is still queued, newer scans replace each other and only
+the latest one is sent once the client has caught up.
+
+HROCMLoadGen measures how many clients the server sustains: it opens many connections with a mix of requests and subscriptions
+and reports the latency percentiles and the throughput over time.
+
+Example:
+@code
+HROCMQueryV3 serve 8888
+[INFO] Listening on port 8888
+@endcode
+
+\subsection hqsec16i archiveread {filename} {time}
+Reads an archive written with -archive; the module is not needed. Without {time}, lists the archived scans with their time
+(ms since 1970-01-01 UTC) and scan number. With {time}, prints the first scan at or after that time in the format of scanraw,
+with an OSNR column for OSNR scans. The scan is found through the index of the archive, so this takes the same time for an
+archive of a day or of several months.
+
+Example:
+@code
+HROCMQueryV3 archiveread scans.arc 1700000000000
+[INFO] Scan=5312 Timestamp=1700000000412 SNO=ABC123456 ModuleTemp=45.2 OpticsTemp=40.1
+Port,SliceStart,SliceEnd,Power_dBm
+1,1,8,-55.3
+1,9,16,-54.9
+...
+@endcode
+
 \section hqsecb Command Line Flags
 
 \subsection hqsec16a -log
@@ -465,6 +616,10 @@ n Bytes: Tx Data (MOSI)
 n Bytes: Rx Data (MISO)
 @endcode
 
+The log files of -log and -logbin are written by a background thread. The SPI transfers only copy their records into a buffer
+in memory (see -logbuffer), so logging does not slow down the scans. If the disk cannot keep up and the buffer is full, records
+are dropped rather than delaying the transfers; the number of dropped records is reported when the tool exits.
+
 \subsection hqsec17 -2, -4, -12
 Sets the SPI clock rate. The default rate is 12 MHz. The command line switches -2 and -4 allow
 to reduce the SPI clock rate to 2 MHz and 4 MHz respectively.
@@ -509,13 +664,233 @@ HROCMQueryV3 -osnr 0.01 0.025 3 0.01 0.01 0.0125 itu 191.4 0.05 80
 [OK] SETMPOSNR command executed (80 channels)
 @endcode
 
+\subsection hqsec20 -discover {Threshold},{SplitDip},{MinWidth}
+specifies settings for the channel detection of the discover command.
+
+- {Threshold} denotes the minimum height of a channel above the noise floor in dB
+- {SplitDip} denotes how deep the power has to drop between two peaks in dB to treat them as separate channels
+- {MinWidth} denotes the minimum width of a channel in THz. Narrower features are ignored.
+
+Example:
+@code
+HROCMQueryV3 -discover 15 3 0.01 discover
+@endcode
+
+\subsection hqsec21 -scan50 {Mode} {Period} {Priority}, -scan100 {Mode} {Period} {Priority}, -scanhires {Mode} {Period} {Priority}
+specify how often the serve command scans the 50 GHz grid, the 100 GHz grid and the highest-resolution channel plan.
+
+- {Mode} is b2b to scan back-to-back (as fast as the module allows), fixed to scan every {Period} ms, ondemand to scan only when a
+  client sends OCMP_MSG_TRIGGER (see OCMProtocol.h), or off to not scan the grid at all
+- {Period} denotes the scan period in ms (fixed mode only)
+- {Priority} decides which scan runs first if both are due. Higher values win.
+
+Both grids are scanned back-to-back with equal priority by default, so they alternate. High-resolution scans are off by default. A fixed-rate grid with a higher
+priority gets its scans on time while the back-to-back grid uses the remaining time of the module.
+If a scan takes longer than the period, the missed scans are skipped and counted as overruns.
+An OCMP_MSG_TRIGGER request makes all on-demand scans due once; triggers arriving before the scans have started are merged.
+
+Example:
+@code
+HROCMQueryV3 -scan50 fixed 1000 1 -scan100 b2b 0 0 serve
+@endcode
+
+\subsection hqsec22 -schedreport {Interval}
+sets the interval in seconds at which the serve command prints the measured scan rates (default 60, 0 turns the report off).
+For each grid the report shows the measured rate, the target rate of fixed-rate scans, the number of scans, errors and
+overruns, the mean and maximum scan duration and the start jitter (mean +- standard deviation / maximum).
+
+Example:
+@code
+HROCMQueryV3 -schedreport 10 -scan50 fixed 1000 1 serve
+[INFO] Listening on port 8888
+[INFO] Scan rates
+50 GHz grid: 1.000 Hz (target 1.000 Hz), 10 runs, 0 errors, 0 overruns, duration 612/640 ms, jitter 0.3+-0.5/2 ms
+100 GHz grid: 0.658 Hz (back-to-back), 7 runs, 0 errors, duration 590/605 ms
+report: 0.100 Hz (target 0.100 Hz), 1 runs, 0 errors, 0 overruns, duration 0/0 ms, jitter 0.0+-0.0/0 ms
+@endcode
+
+\subsection hqsec23 -logbuffer {MB}
+sets the size of the memory buffer of each log file in MB (default 4). The buffer holds the records not yet written to disk.
+Increase it if records are dropped.
+
+Example:
+@code
+HROCMQueryV3 -logbin -logbuffer 64 hammer 1000
+[INFO] Press any key to stop
+[INFO] Scan=0 t=0.00h tScan=0ms nCRC1=0 nCRC2=0 nCmdRetransmit=0
+@endcode
+
+\subsection hqsec24 -replay {filename} {speed}
+runs the command against a binary log file recorded with -logbin instead of the module. No SPI adapter is needed.
+Each SPI transfer of the driver is answered with the recorded response of the same request; differences in
+sequence numbers between the recording and the replay are taken care of. {speed} sets the timing: 0
+replays as fast as possible, 1 in real time as recorded, 10 ten times faster. This allows to rerun field sessions
+deterministically, e.g. to compare the scan rate of two versions of the tool.
+
+Example:
+@code
+HROCMQueryV3 -logbin hammer 100
+HROCMQueryV3 -replay HROCMQuery.bin 0 hammer 100
+@endcode
+
+\subsection hqsec25 -logtrace
+Creates a binary transfer trace HROCMQuery.trace instead of the CSV log file (-log). The trace holds one
+fixed-size record per SPI transfer with the headers of the command and the response. Nothing is formatted or
+checked while the module is running, so logging costs far less than with -log and does not change the timing of
+long runs. HROCMTrace2Csv converts the trace into the columns of HROCMQuery.csv. CRC2 is taken from the
+check of the driver; the transfers with CRC errors are kept by the flight recorder (see -flightrec).
+The trace is overwritten by each run.
+
+Example:
+@code
+HROCMQueryV3 -logtrace hammer 1000
+HROCMTrace2Csv HROCMQuery.trace > HROCMQuery.csv
+@endcode
+
+\subsection hqsec26 -archive {filename} {compress}
+appends every scan (scan, scanraw, scanosnr, hammer and the scans of serve) to the archive {filename}. The file is created
+if it does not exist. Each scan is stored with the time, the scan number, the serial number and temperatures of the module
+and the power (and OSNR) of each channel as 16-bit values. The channel plan is stored once and referenced by the scans.
+An index written every 256 scans allows to find scans by time without reading the file (see archiveread and
+OCMScanArchive.h). With {compress} 1 the values are stored as differences between neighbouring channels, which
+typically halves the size of high-resolution scans. The file is only appended to, so a crash loses at most the scan
+being written.
+
+Example:
+@code
+HROCMQueryV3 -archive scans.arc 1 -scanhires fixed 1000 1 serve
+@endcode
+
+\subsection hqsec27 -format {format}
+selects the output of scan, scanraw and scanosnr. csv (default) writes the CSV text shown above. bin writes the same columns as
+packed little-endian binary records without header: uint16 for Port, SliceStart and SliceEnd, float64 for fCenter_THz and
+float32 for the power and OSNR values. npy writes these records as NumPy file with one named field per column. Scripts that
+run the scan commands continuously save the formatting and parsing of the text this way.
+
+Example:
+@code
+HROCMQueryV3 -format npy scanraw > scan.npy
+python -c "import numpy; a = numpy.load('scan.npy'); print(a['Power_dBm'].max())"
+@endcode
+
+\subsection hqsec28 -flightrec {MB} {errors}
+sets the size of the flight recorder and its error threshold. The flight recorder keeps the last SPI transfers (command,
+response and error counters) in {MB} MB of memory; it runs by default with 4 MB and 10 errors. Nothing is written during
+normal operation. The transfers are written to HROCMFlight_{time}_{reason}.bin (format of -logbin, readable by
+HROCMLogAnalyzer and -replay) and HROCMFlight_{time}_{reason}.csv (error counters per transfer)
+- when {errors} SPIMAGIC, CRC1 or CRC2 errors or failed transfers occur within a minute (at most once per minute;
+  0 turns this off),
+- when key d is pressed in hammer,
+- on exit, if errors occurred since the last file was written.
+
+The files are written by a background thread, so an error storm does not slow down the communication with the module.
+{MB} 0 turns the flight recorder off.
+
+Example:
+@code
+HROCMQueryV3 -flightrec 16 5 hammer 0
+[INFO] Press d to write the flight recorder, any other key to stop
+@endcode
+
+\subsection hqsec29 -stats {filename}
+writes the latency statistics of the driver to {filename} when the program ends and, with serve, at every scan rate
+report (-schedreport). The driver measures each SPI transfer and each step of a command and keeps a histogram per module
+(SPI adapter ID), step and opcode:
+- TRANSFER: SPI transfer without the 5 ms recovery time (POLL: polls),
+- ACCEPT: command sent until accepted by the module,
+- TASK: TPC accepted until the power (GETMPW) or OSNR (GETMOSNR) task is complete,
+- FETCH: result requested until read,
+- SCAN: TPC sent until the last result (power or OSNR) has been read,
+- POLLS: polls per scan,
+- BYTES: bytes per transfer.
+
+Each line holds the count, total, minimum, mean, percentiles 50, 90, 99 and 99.9 and the maximum in microseconds (polls
+and bytes for POLLS and BYTES). The percentiles are accurate to 3%. With serve the report also shows the scan latency.
+
+Example:
+@code
+HROCMQueryV3 -stats stats.csv hammer 100
+Module,Phase,Opcode,Unit,Count,Total,Min,Mean,P50,P90,P99,P999,Max
+default,TRANSFER,POLL,us,4210,1002131,180,238.0,231,263,351,607,812
+default,SCAN,TPC,us,100,91240322,880102,912403.2,909311,929791,950271,950271,951004
+@endcode
+
+\subsection hqsec30 -timeline {filename}
+records a timeline of the driver calls and writes it to {filename} in Chrome trace JSON format when the program ends.
+Open the file in the Perfetto UI (https://ui.perfetto.dev) or in chrome://tracing. It shows every phase of a scan as
+nested spans (runFullScan, readScan, setChannelPlan, cmdTPC, waitTaskComplete, cmdPollLong, spiTransfer,
+runPostProcessing, ...) per thread, and TPC retransmits and CRC retries as markers, so that the time of a slow scan can
+be attributed. Up to 1000000 events are kept; later events are dropped with a warning. Without -timeline the
+instrumentation costs practically nothing.
+
+Example:
+@code
+HROCMQueryV3 -timeline scan.json hammer 10
+@endcode
+
+\subsection hqsec31 -emulator {settings}
+runs the command against an OCM emulated in the process instead of the module. No SPI adapter is needed. The
+emulator speaks the V3 SPI protocol like the module (CRCs, sequence numbers, task slots, measurement plans, TPC
+scans) and returns a synthetic spectrum of 96 channels on the 50 GHz grid, so the tool and the driver can be
+profiled and benchmarked on any PC. {settings} is a list of key=value pairs separated by semicolons, or - for the
+defaults: scanms (duration of a scan, default 200), osnrms (additional duration of the OSNR task, 300), commandus
+(execution time of a command, 500), latencyus (bus latency per transfer, 100), ports (1), channels (96) and
+seed (1). The SPI clock of the emulated bus is set with -2, -4, ... as for the module.
+The driver also reads recoverms (pause after each SPI transfer, default 5 ms) from the settings; with
+recoverms=0 and a free bus (spiclk=0, latencyus=0) only the host side of the protocol is timed. Values below
+5 ms are only accepted for the emulator and the replay adapter; the module always gets at least 5 ms.
+
+Example:
+@code
+HROCMQueryV3 -emulator scanms=100;latencyus=50 -stats stats.csv hammer 100
+@endcode
+
+\subsection hqsec33 -faults {settings}
+injects link faults into the SPI transfers, so that the retry paths of the driver (SPIMAGIC 0xFFFFFFFF, CRC1, CRC2,
+pending COMRES, retransmits) can be exercised on purpose and the throughput under a bad link measured with bench.
+Works with the SPI adapter, -emulator and -replay. {settings} is a list of key=value pairs separated by semicolons:
+- ber: bit error rate of MOSI and MISO (long cables: about 1e-5)
+- burst: bits flipped per error (default 1)
+- periodic: 1 = an error every 1/ber bits instead of random distances
+- allones: probability per transfer that MISO reads 0xFF only
+- drop: probability per command that the module does not receive it
+- comres: probability per command that COMRES stays pending for comresms (default 100) after completion
+- seed: seed of the random faults (default 1)
+
+Dropped commands other than TPC are not retransmitted by the driver; the scan fails with a timeout.
+
+Example:
+@code
+HROCMQueryV3 -emulator scanms=20 -faults ber=1e-5;drop=0.01 bench 50 pw 60 faults.json
+@endcode
+
 */
 #include<winsock2.h>
 #include "stdafx.h"
 #include<stdio.h>
+#include <algorithm>
+#include <chrono>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 #include "FinisarHROCM_V3.h"
 #include "SPIAdapter.h"
+#include "OCMChannelDiscovery.h"
+#include "OCMRequestHandler.h"
+#include "OCMSnapshotPublisher.h"
+#include "OCMScanScheduler.h"
+#include "OCMTraceWriter.h"
+#include "OCMTransferTrace.h"
+#include "OCMScanArchive.h"
+#include "OCMOutputWriter.h"
+#include "OCMFlightRecorder.h"
+#include "OCMDriverStats.h"
+#include "OCMSpanTracer.h"
+#include "OCMMappedFile.h"
+#include "CCRC32.h"
 
 #pragma comment(lib,"ws2_32.lib")
 
@@ -523,6 +898,11 @@ HROCMQueryV3 -osnr 0.01 0.025 3 0.01 0.01 0.0125 itu 191.4 0.05 80
 
 FILE				*theLogFile = NULL;						// File handle of log file
 FILE				*theLogBinFile = NULL;					// File handle of binary log file
+size_t				theLogBufferBytes = OCM_TRACE_DEFAULT_CAPACITY;	// Memory buffer per log file
+bool				theLogTrace = false;					// theLogFile is a transfer trace (-logtrace)
+OCMScanArchiveWriter theArchive;							// Archive of all scans (-archive)
+int					theOutputFormat = OCM_OUTPUT_CSV;		// Output of scan, scanraw and scanosnr (-format)
+std::string			theStatsFilename;						// Driver statistics (-stats)
 std::string			theConfigString;						// Configuration string for class factory
 std::ostringstream	theLastError;							// Accumulated error messages
 
@@ -533,8 +913,156 @@ double				theOsnrThresTHz = 0.01;
 double				theOsnrTagRangeTHz = 0.010;
 double				theOsnrRbwTHz = 0.0125;
 
+OCMDiscoverySettings_t theDiscoverySettings = OCMChannelDiscovery::defaultSettings();
+
+// Scheduling of the scans of the serve command
+OCMSchedPlan_t		theScanPlan50 = { "50 GHz grid", OCM_SCHED_BACKTOBACK, 1000, 0 };
+OCMSchedPlan_t		theScanPlan100 = { "100 GHz grid", OCM_SCHED_BACKTOBACK, 1000, 0 };
+OCMSchedPlan_t		theScanPlanHires = { "hires", OCM_SCHED_BACKTOBACK, 1000, 0 };
+bool				theScanPlan50Enabled = true;
+bool				theScanPlan100Enabled = true;
+bool				theScanPlanHiresEnabled = false;
+int					theSchedReportSec = 60;					// Interval of the scan rate report (0: off)
+
 #define LOGERROR(OCM) {std::string tempError;OCM.get(OCM_KEY_LASTERROR, tempError);theLastError<<tempError;}
 
+// Flush and close a log file. Reports the records dropped because the disk could not keep up.
+void closeLogFile(FILE *f, const char *Name)
+{
+	OCMTraceWriter *pWriter = OCMTraceWriter::find(f);
+	if (pWriter != NULL) {
+		OCMTraceStats_t Stats = pWriter->getStats();
+		OCMTraceWriter::detach(f);
+		if (Stats.DroppedRecords > 0) {
+			fprintf(stderr, "[WARNING] %s: %llu of %llu records dropped (use -logbuffer)\n", Name,
+				Stats.DroppedRecords, Stats.DroppedRecords + Stats.Records);
+		}
+	}
+	fclose(f);
+}
+
+// Write the flight recorder if errors occurred since its last file, and stop it
+void closeFlightRecorder()
+{
+	std::shared_ptr<OCMFlightRecorder> pFlight = OCMFlightRecorder::find();
+	if (pFlight && pFlight->getStats().ErrorsSinceDump > 0) {
+		std::string Filename;
+		if (pFlight->dump("shutdown", Filename)) {
+			fprintf(stderr, "[WARNING] %llu SPI errors, last transfers written to %s\n", pFlight->getStats().Errors, Filename.c_str());
+		}
+		else {
+			fprintf(stderr, "[ERROR] Could not write the flight recorder (%s)\n", Filename.c_str());
+		}
+	}
+	pFlight.reset();
+	OCMFlightRecorder::stop();
+}
+
+// Write the driver statistics of all modules if -stats is given
+void writeStats()
+{
+	if (theStatsFilename.empty()) {
+		return;
+	}
+
+	FILE *f = fopen(theStatsFilename.c_str(), "wt");
+	if (f == NULL) {
+		theLastError << "[ERROR] Could not write file " << theStatsFilename << std::endl;
+		return;
+	}
+	OCMDriverStats::writeCsvHeader(f);
+	std::vector<OCMDriverStats*> Modules = OCMDriverStats::getModules();
+	for (size_t i = 0; i < Modules.size(); ++i) {
+		Modules[i]->writeCsv(f);
+	}
+	fclose(f);
+}
+
+// Time in ms since 1970-01-01 UTC
+long long unixTimeMs()
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// CSV text of the channel center frequencies. Kept for the last channel plan, so that repeated scans on the
+// same plan do not format the frequencies again.
+const std::vector<std::string> &frequencyText(const std::vector<double> &Freq)
+{
+	static std::vector<double> CachedFreq;
+	static std::vector<std::string> CachedText;
+	if (Freq != CachedFreq) {
+		CachedText.resize(Freq.size());
+		for (unsigned int k = 0; k < Freq.size(); ++k) {
+			CachedText[k] = OCMOutputWriter::formatFixed(Freq[k], 7);
+		}
+		CachedFreq = Freq;
+	}
+	return CachedText;
+}
+
+// Header of a scan in the archive (-archive)
+OCMArchiveScan_t archiveHead(FinisarHROCM_V3 &OCM, unsigned int SCAN, unsigned int MPSEQNO)
+{
+	OCMArchiveScan_t Head;
+	memset(&Head, 0, sizeof(Head));
+	Head.TIMESTAMPMS = unixTimeMs();
+	Head.SCAN = SCAN;
+	Head.MPSEQNO = MPSEQNO;
+
+	OCM3_RDataDEV_t	*pRDataDEV = NULL;
+	if (OCM.getRDataDEV(pRDataDEV) == OCM_OK && pRDataDEV != NULL) {
+		memcpy(Head.SNO, pRDataDEV->SNO, sizeof(Head.SNO));
+	}
+	double ModuleTemp = 0, OpticsTemp = 0;
+	OCM.get(OCM_KEY_PARAM_MODULETEMP, ModuleTemp);
+	OCM.get(OCM_KEY_PARAM_OPTICSTEMP, OpticsTemp);
+	Head.CSS = (short)floor(ModuleTemp * OCM3_PSCALE + 0.5);
+	Head.ISS = (short)floor(OpticsTemp * OCM3_PSCALE + 0.5);
+	return Head;
+}
+
+// Append a power scan to the archive if -archive is given
+void archiveScan(FinisarHROCM_V3 &OCM, const OCM3_GMPWResult_t &GMPWResult)
+{
+	const std::vector<OCM3_GMPWRecord_t> &Records = GMPWResult.GMPWVector;
+	if (!theArchive.isOpen() || Records.empty()) {
+		return;
+	}
+	std::vector<OCM3_MPPWRecord_t> Plan(Records.size());
+	std::vector<short> Power(Records.size());
+	for (unsigned int k = 0; k < Records.size(); ++k) {
+		Plan[k].PORTNO = Records[k].PORTNO;
+		Plan[k].SLICESTART = Records[k].SLICESTART;
+		Plan[k].SLICEEND = Records[k].SLICEEND;
+		Power[k] = Records[k].POWER;
+	}
+	if (!theArchive.append(archiveHead(OCM, GMPWResult.Head.SCAN, GMPWResult.Head.MPSEQNO), Plan, &Power[0], NULL)) {
+		theLastError << "[ERROR] " << theArchive.getLastError() << std::endl;
+	}
+}
+
+// Append an OSNR scan to the archive if -archive is given
+void archiveScan(FinisarHROCM_V3 &OCM, const OCM3_GMOSNRResult_t &GMOSNRResult)
+{
+	const std::vector<OCM3_GMOSNRRecord_t> &Records = GMOSNRResult.GMOSNRVector;
+	if (!theArchive.isOpen() || Records.empty()) {
+		return;
+	}
+	std::vector<OCM3_MPPWRecord_t> Plan(Records.size());
+	std::vector<short> Power(Records.size());
+	std::vector<short> OSNR(Records.size());
+	for (unsigned int k = 0; k < Records.size(); ++k) {
+		Plan[k].PORTNO = Records[k].PORTNO;
+		Plan[k].SLICESTART = Records[k].SLICESTART;
+		Plan[k].SLICEEND = Records[k].SLICEEND;
+		Power[k] = Records[k].POWER;
+		OSNR[k] = Records[k].OSNR;
+	}
+	if (!theArchive.append(archiveHead(OCM, GMOSNRResult.Head.SCAN, GMOSNRResult.Head.MPSEQNO), Plan, &Power[0], &OSNR[0])) {
+		theLastError << "[ERROR] " << theArchive.getLastError() << std::endl;
+	}
+}
+
 // Help text
 int commandHelp()
 {
@@ -551,13 +1079,17 @@ int commandHelp()
     printf("  HROCMQueryV3 itu 191.4 0.05 80      80 channels on 50GHz grid starting\n");
     printf("                                      at 191.4THz\n");
     printf("  HROCMQueryV3 mppw<plan.csv          Load channel plan from file\n");
+	printf("  HROCMQueryV3 discover               Detect channels on a hires scan and\n");
+	printf("                                      set up matching MPPW/MPOSNR plans\n");
+	printf("  HROCMQueryV3 discover 60            Repeat every 60 s with an OSNR scan,\n");
+	printf("                                      MPOSNR only sent if channels changed\n");
 	printf("  HROCMQueryV3 dev                    Query device information\n");
 	printf("  HROCMQueryV3 dump                   Poll complete SPI register file\n");
     printf("  HROCMQueryV3 dumpshort              Poll SPI register header\n");
     printf("  HROCMQueryV3 res                    Reset module\n");
     printf("  HROCMQueryV3 cle                    Clear errors\n");
     printf("  HROCMQueryV3 update HWR-01_01_00.wf Update firmware (fwt+fws)\n");
-    printf("  HROCMQueryV3 fwt HWR-01_01_00.wf    Transfer firmware\n");
+    printf("  HROCMQueryV3 fwt HWR-01_01_00.wf    Transfer firmware (add resume to continue an interrupted transfer)\n");
     printf("  HROCMQueryV3 fws                    Save firmware\n");
 	printf("  HROCMQueryV3 fwe                    Execute firmware\n");
 	printf("  HROCMQueryV3 avg 8                  Set averaging per scan (permanent)\n");
@@ -569,11 +1101,43 @@ int commandHelp()
 	printf("  HROCMQueryV3 setid dln00001234      Set SPI adapter ID to dln00001234\n");
 	printf("  HROCMQueryV3 loopback               Run SPI loopback test\n");
 	printf("  HROCMQueryV3 hammer                 Stress test - run scans until key pressed\n");
+	printf("  HROCMQueryV3 bench 50 pw 60 r.json  Benchmark - scans back to back for 60s,\n");
+	printf("                                      throughput, latency and errors as JSON\n");
+	printf("  HROCMQueryV3 archiveread scans.arc 1700000000000\n");
+	printf("                                      Print the archived scan at or after a\n");
+	printf("                                      time (ms since 1970, omit to list scans)\n");
+	printf("  HROCMQueryV3 serve 8888             Scan continuously and serve the results\n");
+	printf("                                      on TCP port 8888 (default without cmd)\n");
 	printf("  HROCMQueryV3 -id 12DE dumpshort     Talk to a specific SPI adapter\n");
 	printf("  HROCMQueryV3 -log hammer 30         Stress test - run 30 scans\n");
 	printf("                                      Logging turned on\n");
 	printf("  HROCMQueryV3 -logbin hammer 30      Stress test - run 30 scans\n");
 	printf("                                      Binary logging turned on\n");
+	printf("  HROCMQueryV3 -format npy scanraw>scan.npy\n");
+	printf("                                      Write the scan as NumPy array (csv, bin, npy)\n");
+	printf("  HROCMQueryV3 -archive scans.arc 1 hammer 0\n");
+	printf("                                      Append all scans to an archive file\n");
+	printf("                                      Compression (0 = off, 1 = on)\n");
+	printf("  HROCMQueryV3 -logtrace hammer 30    Stress test - run 30 scans\n");
+	printf("                                      Binary transfer trace instead of -log\n");
+	printf("  HROCMQueryV3 -flightrec 16 5 hammer 0\n");
+	printf("                                      Keep 16 MB of transfers, write them after\n");
+	printf("                                      5 errors per minute (0 MB = off)\n");
+	printf("  HROCMQueryV3 -stats stats.csv hammer 30\n");
+	printf("                                      Write latency percentiles per opcode\n");
+	printf("  HROCMQueryV3 -timeline scan.json hammer 10\n");
+	printf("                                      Timeline of the driver calls for Perfetto\n");
+	printf("  HROCMQueryV3 -emulator scanms=100 hammer 30\n");
+	printf("                                      Run against an emulated module\n");
+	printf("                                      (- = default settings)\n");
+	printf("  HROCMQueryV3 -faults ber=1e-5;drop=0.01 bench 50 pw 60\n");
+	printf("                                      Inject SPI link faults (bit errors, all\n");
+	printf("                                      ones, dropped commands, delayed COMRES)\n");
+	printf("  HROCMQueryV3 -replay HROCMQuery.bin 1 hammer 30\n");
+	printf("                                      Replay a -logbin session without\n");
+	printf("                                      hardware: Speed (0 = fast, 1 = real time)\n");
+	printf("  HROCMQueryV3 -logbin -logbuffer 64 hammer 30\n");
+	printf("                                      Buffer up to 64 MB of log records\n");
 	printf("  HROCMQueryV3 -log -2 hammer 30      Stress test - run 30 scans,SPICLK = 2MHz\n");
 	printf("                                      -2 -4 -20 -25 -12 are allowed clock rates\n");
 	printf("  HROCMQueryV3 -osnr 0.01 0.025 3 0.01 0.01 0.0125 itu 191.4 0.05 80\n");
@@ -582,6 +1146,16 @@ int commandHelp()
 	printf("                                      Threshold [dB], (ignored if BWXB is 'S')\n");
 	printf("                                      Threshold [THz], (ignored if BWXB is 'T')\n");
 	printf("                                      TagRange [THz], RBW [THz]\n");
+	printf("  HROCMQueryV3 -discover 10 3 0.005 discover\n");
+	printf("                                      Use non-default discovery settings:\n");
+	printf("                                      Threshold above noise floor [dB],\n");
+	printf("                                      Split dip [dB], MinWidth [THz]\n");
+	printf("  HROCMQueryV3 -scan50 fixed 1000 1 -scan100 b2b 0 0 serve\n");
+	printf("                                      Scan the 50 GHz grid at 1 Hz and the\n");
+	printf("                                      100 GHz grid as fast as possible:\n");
+	printf("                                      Mode (b2b, fixed, ondemand, off),\n");
+	printf("                                      Period [ms],\n");
+	printf("                                      Priority. -scanhires adds hires scans\n");
 
     return 0;
 }
@@ -664,12 +1238,23 @@ int commandSingleScan()
 	if (Result == OCM_OK && pRDataDEV!=NULL)
 	{
 		OCM3_GMPWResult_t *pGMPWResult = OCM.getGMPWResult();
+		archiveScan(OCM, *pGMPWResult);
 	
-		printf("Port,fCenter_THz,Power_dBm\n");
+		std::vector<double> Freq(pGMPWResult->GMPWVector.size());
 		for (unsigned int k = 0; k<pGMPWResult->GMPWVector.size(); ++k) {
 			double fSliceLeft = ((pGMPWResult->GMPWVector[k].SLICESTART-1)*pRDataDEV->SLW+ pRDataDEV->FSF)/OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
 			double fSliceRight= ((pGMPWResult->GMPWVector[k].SLICEEND-1+1)*pRDataDEV->SLW+ pRDataDEV->FSF)/OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-			printf("%d,%.7f,%.1f\n", pGMPWResult->GMPWVector[k].PORTNO, (fSliceLeft + fSliceRight) / 2, pGMPWResult->GMPWVector[k].POWER / 10.0);
+			Freq[k] = (fSliceLeft + fSliceRight) / 2;
+		}
+		const std::vector<std::string> &FreqText = frequencyText(Freq);
+
+		static const OCMOutputColumn_t Columns[] = { { "Port", OCM_OUTPUT_U16, 0 }, { "fCenter_THz", OCM_OUTPUT_F64, 7 }, { "Power_dBm", OCM_OUTPUT_F32, 1 } };
+		OCMOutputWriter Output(stdout);
+		Output.beginTable(theOutputFormat, Columns, 3, Freq.size());
+		for (unsigned int k = 0; k<pGMPWResult->GMPWVector.size(); ++k) {
+			Output.putValue(pGMPWResult->GMPWVector[k].PORTNO);
+			Output.putValue(Freq[k], FreqText[k]);
+			Output.putValue(pGMPWResult->GMPWVector[k].POWER / 10.0);
 		}
 	}
 
@@ -692,10 +1277,16 @@ int commandSingleScanRaw()
     if (Result==OCM_OK)
     {
 		OCM3_GMPWResult_t *pGMPWResult = OCM.getGMPWResult();
+		archiveScan(OCM, *pGMPWResult);
 	    
-		printf("Port,SliceStart,SliceEnd,Power_dBm\n");
+		static const OCMOutputColumn_t Columns[] = { { "Port", OCM_OUTPUT_U16, 0 }, { "SliceStart", OCM_OUTPUT_U16, 0 }, { "SliceEnd", OCM_OUTPUT_U16, 0 }, { "Power_dBm", OCM_OUTPUT_F32, 1 } };
+		OCMOutputWriter Output(stdout);
+		Output.beginTable(theOutputFormat, Columns, 4, pGMPWResult->GMPWVector.size());
         for(unsigned int k=0;k<pGMPWResult->GMPWVector.size();++k) {
-            printf("%d,%d,%d,%.1f\n", pGMPWResult->GMPWVector[k].PORTNO, pGMPWResult->GMPWVector[k].SLICESTART, pGMPWResult->GMPWVector[k].SLICEEND, pGMPWResult->GMPWVector[k].POWER/10.0);
+			Output.putValue(pGMPWResult->GMPWVector[k].PORTNO);
+			Output.putValue(pGMPWResult->GMPWVector[k].SLICESTART);
+			Output.putValue(pGMPWResult->GMPWVector[k].SLICEEND);
+			Output.putValue(pGMPWResult->GMPWVector[k].POWER/10.0);
 		}
     }
 
@@ -704,6 +1295,28 @@ int commandSingleScanRaw()
 }
 
 // Run single scan OSNR measurement
+// Output an OSNR scan result in the format selected with -format (scanosnr, discover {period})
+void writeOSNRTable(const OCM3_RDataDEV_t &RDataDEV, const OCM3_GMOSNRResult_t &GMOSNRResult)
+{
+	std::vector<double> Freq(GMOSNRResult.GMOSNRVector.size());
+	for (unsigned int k = 0; k<GMOSNRResult.GMOSNRVector.size(); ++k) {
+		//double fSliceLeft = ((GMOSNRResult.GMOSNRVector[k].SLICESTART - 1)*RDataDEV.SLW + RDataDEV.FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
+		//double fSliceRight = ((GMOSNRResult.GMOSNRVector[k].SLICEEND - 1 + 1)*RDataDEV.SLW + RDataDEV.FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
+		Freq[k] = ((GMOSNRResult.GMOSNRVector[k].CENTERFREQUENCY - 1)*RDataDEV.SLW + RDataDEV.FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
+	}
+	const std::vector<std::string> &FreqText = frequencyText(Freq);
+
+	static const OCMOutputColumn_t Columns[] = { { "Port", OCM_OUTPUT_U16, 0 }, { "fCenter_THz", OCM_OUTPUT_F64, 7 }, { "Power_dBm", OCM_OUTPUT_F32, 1 }, { "OSNR_dB", OCM_OUTPUT_F32, 1 } };
+	OCMOutputWriter Output(stdout);
+	Output.beginTable(theOutputFormat, Columns, 4, Freq.size());
+	for (unsigned int k = 0; k<GMOSNRResult.GMOSNRVector.size(); ++k) {
+		Output.putValue(GMOSNRResult.GMOSNRVector[k].PORTNO);
+		Output.putValue(Freq[k], FreqText[k]);
+		Output.putValue(GMOSNRResult.GMOSNRVector[k].POWER / OCM3_PSCALE);
+		Output.putValue(GMOSNRResult.GMOSNRVector[k].OSNR / OCM3_PSCALE);
+	}
+}
+
 int commandSingleScanOSNR()
 {
 	FinisarHROCM_V3 OCM(theConfigString,theLogFile,theLogBinFile);
@@ -722,16 +1335,8 @@ int commandSingleScanOSNR()
 	if (Result == OCM_OK && pRDataDEV!=NULL)
 	{
 		OCM3_GMOSNRResult_t *pGMPWResult = OCM.getGMOSNRResult();
-
-		printf("Port,fCenter_THz,Power_dBm,OSNR_dB\n");
-		for (unsigned int k = 0; k<pGMPWResult->GMOSNRVector.size(); ++k) {
-			//double fSliceLeft = ((pGMPWResult->GMOSNRVector[k].SLICESTART - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-			//double fSliceRight = ((pGMPWResult->GMOSNRVector[k].SLICEEND - 1 + 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-			double fCenter = ((pGMPWResult->GMOSNRVector[k].CENTERFREQUENCY - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-			double Power = pGMPWResult->GMOSNRVector[k].POWER / OCM3_PSCALE;
-			double OSNR = pGMPWResult->GMOSNRVector[k].OSNR / OCM3_PSCALE;
-			printf("%d,%.7f,%.1f,%.1f\n", pGMPWResult->GMOSNRVector[k].PORTNO, fCenter, Power, OSNR);
-		}
+		archiveScan(OCM, *pGMPWResult);
+		writeOSNRTable(*pRDataDEV, *pGMPWResult);
 	}
 
 	LOGERROR(OCM);
@@ -746,7 +1351,7 @@ int commandHammer(int nRuns)
     // Open OCM
     OCM_Error_t Result = OCM.open();
 
-    printf("[INFO] Press any key to stop\n");
+    printf("[INFO] Press d to write the flight recorder, any other key to stop\n");
 
 	// Remember last TxSeqNum
 	unsigned int lastTxSeqNum0 = 0;
@@ -778,17 +1383,23 @@ int commandHammer(int nRuns)
 			// Pick up result
 			OCM3_GMPWResult_t GMPWResult;
 			Result = Result || OCM.cmdQueryTPC_PW(GMPWResult, lastTxSeqNum0);
+			if (Result == OCM_OK) {
+				archiveScan(OCM, GMPWResult);
+			}
 
             printf("[INFO] Scan=%d t=%.2fh tScan=%.0fms nCRC1=%d nCRC2=%d nCmdRetransmit=%d\n",iRun,(double)(::GetTickCount()-t0)/1000.0/3600.0,(double)(::GetTickCount()-t0)/(iRun+1),OCM.getNCRC1ErrorCount(),OCM.getNCRC2ErrorCount(),OCM.getNCmdRetransmit());
         }
 
 		LOGERROR(OCM);
 
-        // Check keyboard to interrupt loop
+        // Check keyboard to interrupt loop or to write the flight recorder
         if (_kbhit())
         {
-            getch();
-            break;
+            std::shared_ptr<OCMFlightRecorder> pFlight = OCMFlightRecorder::find();
+            if (getch() != 'd' || !pFlight)
+                break;
+            pFlight->requestDump("demand");
+            printf("[INFO] Writing flight recorder\n");
         }
     }
 
@@ -796,6 +1407,170 @@ int commandHammer(int nRuns)
 	return Result;
 }
 
+// Counters of the driver statistics that the bench command reports per scan
+typedef struct {
+	unsigned long long	Transfers;
+	unsigned long long	Polls;
+	unsigned long long	Bytes;
+} BenchCounters_t;
+
+BenchCounters_t benchCounters(FinisarHROCM_V3 &OCM)
+{
+	BenchCounters_t Counters = { 0, 0, 0 };
+	OCMDriverStats *pStats = OCMDriverStats::get(&OCM);
+	for (unsigned int opcode = 0; pStats != NULL && opcode < OCM_STATS_NOPCODES; ++opcode) {
+		const OCMLatencyHistogram *pTransfer = pStats->getHistogram(OCM_STATS_TRANSFER, opcode);
+		const OCMLatencyHistogram *pBytes = pStats->getHistogram(OCM_STATS_BYTES, opcode);
+		Counters.Transfers += pTransfer != NULL ? pTransfer->getCount() : 0;
+		Counters.Polls += pTransfer != NULL && opcode == 0 ? pTransfer->getCount() : 0;
+		Counters.Bytes += pBytes != NULL ? pBytes->getTotal() : 0;
+	}
+	return Counters;
+}
+
+// Run scans back to back for a given time and report throughput, scan latency, SPI traffic and errors as JSON
+// Plan    : keep (channel plan of the module), 50, 100 (ITU grids of the serve command) or hires
+// Tasks   : pw, osnr, both or the task mask of the TPC command
+// Filename: JSON file, NULL for stdout
+int commandBench(const char *Plan, const char *Tasks, int nSeconds, const char *Filename)
+{
+	OCM3_TPCProcessMask_t TaskVector = 0;
+	if (strcmp(Tasks, "pw") == 0) {
+		TaskVector = OCM3_TASK_PW_MASK;
+	}
+	else if (strcmp(Tasks, "osnr") == 0) {
+		TaskVector = OCM3_TASK_OSNR_MASK;
+	}
+	else if (strcmp(Tasks, "both") == 0) {
+		TaskVector = OCM3_TASK_PW_MASK | OCM3_TASK_OSNR_MASK;
+	}
+	else {
+		TaskVector = (OCM3_TPCProcessMask_t)strtoul(Tasks, NULL, 0);
+	}
+	if (TaskVector == 0 || nSeconds <= 0) {
+		theLastError << "[ERROR] Invalid bench workload (tasks " << Tasks << ", " << nSeconds << "s)" << std::endl;
+		return OCM_FAILED;
+	}
+
+	// Program the channel plan
+	OCM_Error_t Result = OCM_OK;
+	if (strcmp(Plan, "50") == 0) {
+		Result = Result || commandITU((int)(191.4 * OCM3_FSCALE + 0.5), (int)(0.05 * OCM3_FSCALE + 0.5), 80);
+	}
+	else if (strcmp(Plan, "100") == 0) {
+		Result = Result || commandITU((int)(191.4 * OCM3_FSCALE + 0.5), (int)(0.1 * OCM3_FSCALE + 0.5), 40);
+	}
+	else if (strcmp(Plan, "hires") == 0) {
+		Result = Result || commandHIRES();
+	}
+	else if (strcmp(Plan, "keep") != 0) {
+		theLastError << "[ERROR] Unknown bench plan " << Plan << std::endl;
+		return OCM_FAILED;
+	}
+
+	FinisarHROCM_V3 OCM(theConfigString, theLogFile, theLogBinFile);
+
+	// Open OCM. Opening and GETDEV are not part of the measurement.
+	Result = Result || OCM.open();
+	OCM3_RDataDEV_t	*pRDataDEV = NULL;
+	Result = Result || OCM.getRDataDEV(pRDataDEV);
+	if (Result != OCM_OK) {
+		LOGERROR(OCM);
+		return Result;
+	}
+
+	FILE *f = Filename != NULL ? fopen(Filename, "wt") : stdout;
+	if (f == NULL) {
+		theLastError << "[ERROR] Could not write file " << Filename << std::endl;
+		return OCM_FAILED;
+	}
+
+	// Run scans until the time is up. Failed scans are counted; the run is aborted after 10 failures in a row
+	// (e.g. the module is not connected).
+	OCMLatencyHistogram ScanUs;
+	BenchCounters_t Start = benchCounters(OCM);
+	int nCRC1 = OCM.getNCRC1ErrorCount();
+	int nCRC2 = OCM.getNCRC2ErrorCount();
+	int nCmdRetransmit = OCM.getNCmdRetransmit();
+	unsigned long long nFailed = 0;
+	int nFailedInRow = 0;
+	size_t nChannels = 0;
+	unsigned long long t0 = OCMDriverStats::nowUs();
+	unsigned long long tEnd = t0 + (unsigned long long)nSeconds * 1000000;
+	unsigned long long tReport = t0 + 10000000;
+	unsigned long long t = t0;
+	while (t < tEnd && nFailedInRow < 10) {
+		OCM_Error_t ScanResult = OCM.runFullScan(TaskVector);
+		unsigned long long t1 = OCMDriverStats::nowUs();
+		if (ScanResult == OCM_OK) {
+			ScanUs.record(t1 - t);
+			nChannels = (TaskVector & OCM3_TASK_PW_MASK) != 0 ? OCM.getGMPWResult()->GMPWVector.size() : OCM.getGMOSNRResult()->GMOSNRVector.size();
+			nFailedInRow = 0;
+		}
+		else {
+			++nFailed;
+			++nFailedInRow;
+		}
+		LOGERROR(OCM);
+		t = t1;
+
+		// Progress goes to stderr, so that stdout only holds the JSON
+		if (t >= tReport) {
+			fprintf(stderr, "[INFO] t=%.0fs scans=%llu failed=%llu\n", (t - t0) / 1e6, ScanUs.getCount(), nFailed);
+			tReport += 10000000;
+		}
+	}
+	BenchCounters_t End = benchCounters(OCM);
+	nCRC1 = OCM.getNCRC1ErrorCount() - nCRC1;
+	nCRC2 = OCM.getNCRC2ErrorCount() - nCRC2;
+	nCmdRetransmit = OCM.getNCmdRetransmit() - nCmdRetransmit;
+
+	double ElapsedS = (t - t0) / 1e6;
+	unsigned long long nScans = ScanUs.getCount();
+	unsigned long long nAttempts = nScans + nFailed;
+	unsigned long long nTransfers = End.Transfers - Start.Transfers;
+	double PerScan = nAttempts > 0 ? 1.0 / nAttempts : 0;
+	double PerTransfer = nTransfers > 0 ? 1.0 / nTransfers : 0;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"version\": \"%s\",\n", THEVERSION);
+	fprintf(f, "  \"plan\": \"%s\",\n", Plan);
+	fprintf(f, "  \"tasks\": %u,\n", (unsigned int)TaskVector);
+	fprintf(f, "  \"channels\": %u,\n", (unsigned int)nChannels);
+	fprintf(f, "  \"seconds\": %.3f,\n", ElapsedS);
+	fprintf(f, "  \"scans\": %llu,\n", nScans);
+	fprintf(f, "  \"failedScans\": %llu,\n", nFailed);
+	fprintf(f, "  \"aborted\": %s,\n", nFailedInRow >= 10 ? "true" : "false");
+	fprintf(f, "  \"scansPerSecond\": %.3f,\n", ElapsedS > 0 ? nScans / ElapsedS : 0);
+	fprintf(f, "  \"scanMs\": { \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"p999\": %.3f, \"max\": %.3f },\n",
+		ScanUs.getMin() / 1e3, ScanUs.getMean() / 1e3, ScanUs.getPercentile(50) / 1e3, ScanUs.getPercentile(90) / 1e3,
+		ScanUs.getPercentile(99) / 1e3, ScanUs.getPercentile(99.9) / 1e3, ScanUs.getMax() / 1e3);
+	fprintf(f, "  \"transfersPerScan\": %.2f,\n", nTransfers * PerScan);
+	fprintf(f, "  \"pollsPerScan\": %.2f,\n", (End.Polls - Start.Polls) * PerScan);
+	fprintf(f, "  \"bytesPerScan\": %.0f,\n", (End.Bytes - Start.Bytes) * PerScan);
+	fprintf(f, "  \"errors\": { \"crc1\": %d, \"crc2\": %d, \"retransmits\": %d },\n", nCRC1, nCRC2, nCmdRetransmit);
+	fprintf(f, "  \"errorRates\": { \"crc1PerTransfer\": %.3e, \"crc2PerTransfer\": %.3e, \"retransmitsPerScan\": %.3e, \"failedScans\": %.3e }\n",
+		nCRC1 * PerTransfer, nCRC2 * PerTransfer, nCmdRetransmit * PerScan, nFailed * PerScan);
+	fprintf(f, "}\n");
+
+	if (ferror(f) != 0) {
+		Result = Result || OCM_FAILED;
+		theLastError << "[ERROR] Could not write file " << (Filename != NULL ? Filename : "stdout") << std::endl;
+	}
+	if (f != stdout) {
+		fclose(f);
+	}
+
+	// The run fails if a scan failed, so that bench can be used as acceptance test
+	if (nFailed > 0 || nScans == 0) {
+		Result = Result || OCM_FAILED;
+		theLastError << "[ERROR] " << nFailed << " of " << nAttempts << " scans failed" << std::endl;
+	}
+
+	LOGERROR(OCM);
+	return Result;
+}
+
 // Clear errors
 int commandCLE()
 {
@@ -1036,6 +1811,133 @@ int commandHIRES()
 	return Result;
 }
 
+// Detect the occupied channels on a high-resolution scan and set up matching channel plans. With PeriodSec > 0 the
+// detection is repeated every PeriodSec seconds until a key is pressed, each time followed by an OSNR scan of the
+// detected channels. The MPOSNR plan is only uploaded again when the detected channels have changed.
+int commandDiscover(int PeriodSec)
+{
+	// The OSNR ranges are scaled to the channel width using the ratios of the -osnr settings to a 50GHz grid
+	OCMDiscoverySettings_t Settings = theDiscoverySettings;
+	Settings.KeepoutScale	= theOsnrSearchMinTHz / 0.05;
+	Settings.NoiseScale		= theOsnrSearchMaxTHz / 0.05;
+	Settings.TagRangeScale	= theOsnrTagRangeTHz / 0.05;
+	Settings.BwScale		= theOsnrThresTHz / 0.05;
+	Settings.ThresDb		= theOsnrThresDb;
+	Settings.RbwTHz			= theOsnrRbwTHz;
+
+	// Kept over the runs, so that unchanged channels are recognized
+	OCMChannelDiscovery Discovery;
+	Discovery.setSettings(Settings);
+
+	if (PeriodSec > 0) {
+		printf("[INFO] Press any key to stop\n");
+	}
+
+	OCM_Error_t Result = OCM_OK;
+	for (;;) {
+		DWORD tStart = ::GetTickCount();
+
+		// Program the highest-resolution channel plan
+		Result = Result || commandHIRES();
+
+		FinisarHROCM_V3 OCM(theConfigString, theLogFile, theLogBinFile);
+
+		// Open OCM
+		Result = Result || OCM.open();
+
+		// Get RDataDEV
+		OCM3_RDataDEV_t	*pRDataDEV = NULL;
+		Result = Result || OCM.getRDataDEV(pRDataDEV);
+		if (Result != OCM_OK || pRDataDEV == NULL) {
+			LOGERROR(OCM);
+			return Result; // pRDataDEV could be NULL. So better return here in case of failure.
+		}
+
+		// Run the high-resolution scan
+		Result = Result || OCM.runFullScan(OCM3_TASK_PW_MASK);
+
+		// Detect the channels
+		bool planChanged = false;
+		if (Result == OCM_OK && Discovery.update(*pRDataDEV, OCM.getGMPWResult()->GMPWVector, planChanged) != OCM_OK) {
+			Result = Result || OCM_FAILED;
+			theLastError << "[ERROR] " << Discovery.getLastError() << std::endl;
+		}
+		if (Result == OCM_OK && Discovery.getChannels().size() == 0) {
+			Result = Result || OCM_FAILED;
+			theLastError << "[ERROR] No channels found" << std::endl;
+		}
+		if (Result == OCM_OK && (int)Discovery.getChannels().size() > pRDataDEV->Nmax) {
+			Result = Result || OCM_FAILED;
+			theLastError << "[ERROR] Too many channels found: " << Discovery.getChannels().size() << " (Max=" << pRDataDEV->Nmax << ")" << std::endl;
+		}
+
+		if (Result == OCM_OK && planChanged) {
+			const std::vector<OCMDiscoveredChannel_t> &Channels = Discovery.getChannels();
+			for (unsigned int k = 0; k < Channels.size(); ++k) {
+				double fStart = ((Channels[k].SliceStart - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
+				double fStop = ((Channels[k].SliceEnd - 1 + 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE;
+				printf("[INFO] Channel %d: fCenter=%.7fTHz BW=%.1fGHz Peak=%.1fdBm\n", k + 1, (fStart + fStop) / 2, (fStop - fStart)*1000.0, Channels[k].PeakPowerDbm);
+			}
+		}
+
+		// Call MPPW command. Always needed, the high-resolution channel plan has replaced it.
+		std::vector<OCM3_MPPWRecord_t> MPPWVector;
+		Discovery.getMPPWVector(MPPWVector);
+		Result = Result || OCM.cmdSETMPPW(MPPWVector);
+		if (Result == OCM_OK) {
+			printf("[OK] SETMPPW command executed (%d channels)\n", (int)MPPWVector.size());
+		}
+
+		// Call MPOSNR command. The module keeps the MPOSNR plan over the high-resolution scan, so it only has
+		// to be uploaded if the channels have changed.
+		if (Result == OCM_OK && planChanged) {
+			std::vector<OCM3_MPOSNRRecord_t> MPOSNRVector;
+			Discovery.getMPOSNRVector(MPOSNRVector);
+			Result = Result || OCM.cmdSETMPOSNR(MPOSNRVector);
+			if (Result == OCM_OK) {
+				printf("[OK] SETMPOSNR command executed (%d channels)\n", (int)MPOSNRVector.size());
+			}
+		}
+		else if (Result == OCM_OK) {
+			printf("[INFO] Channels unchanged, MPOSNR plan kept\n");
+		}
+
+		if (PeriodSec <= 0 || Result != OCM_OK) {
+			LOGERROR(OCM);
+			break;
+		}
+
+		// Measure the detected channels
+		Result = Result || OCM.runFullScan(OCM3_TASK_OSNR_MASK);
+		if (Result == OCM_OK) {
+			OCM3_GMOSNRResult_t *pGMOSNRResult = OCM.getGMOSNRResult();
+			archiveScan(OCM, *pGMOSNRResult);
+			writeOSNRTable(*pRDataDEV, *pGMOSNRResult);
+		}
+		LOGERROR(OCM);
+
+		// Wait for the next run, any key stops
+		bool stop = false;
+		while (Result == OCM_OK && !stop) {
+			if (_kbhit()) {
+				getch();
+				stop = true;
+			}
+			else if (::GetTickCount() - tStart >= (DWORD)PeriodSec * 1000) {
+				break;
+			}
+			else {
+				Sleep(10);
+			}
+		}
+		if (stop || Result != OCM_OK) {
+			break;
+		}
+	}
+
+	return Result;
+}
+
 // read channel plan from stdin
 int commandMPPW()
 {
@@ -1084,40 +1986,176 @@ int commandMPPW()
 	return Result;
 }
 
+#define FWT_BLOCKCHUNKS 4 // Chunks of the maximum size (see cmdFWT) per checkpoint
+
+// Checkpoint of a firmware transfer ({filename}.fwt): the module, a manifest of the image (size and CRC32 of each
+// block) and the number of blocks the module acknowledged
+typedef struct {
+	std::string					Module;		// Serial number
+	size_t						Size;
+	size_t						BlockSize;
+	std::vector<unsigned int>	CRC;		// Per block
+	size_t						Blocks;		// Blocks acknowledged
+} FWTCheckpoint_t;
+
+static bool readFWTCheckpoint(const std::string &Filename, FWTCheckpoint_t &Checkpoint)
+{
+	FILE *f = fopen(Filename.c_str(), "r");
+	if (f == NULL) {
+		return false;
+	}
+	char line[256];
+	bool valid = true;
+	Checkpoint.Size = 0;
+	Checkpoint.BlockSize = 0;
+	Checkpoint.Blocks = 0;
+	Checkpoint.CRC.clear();
+	while (valid && fgets(line, sizeof(line), f) != NULL) {
+		line[strcspn(line, "\r\n")] = 0;
+		std::string Line = line;
+		size_t pos = Line.find('=');
+		std::string Key = Line.substr(0, pos);
+		std::string Value = pos == std::string::npos ? "" : Line.substr(pos + 1);
+		if (Key == "module") {
+			Checkpoint.Module = Value;
+		}
+		else if (Key == "size") {
+			Checkpoint.Size = (size_t)strtoull(Value.c_str(), NULL, 10);
+		}
+		else if (Key == "blocksize") {
+			Checkpoint.BlockSize = (size_t)strtoull(Value.c_str(), NULL, 10);
+		}
+		else if (Key == "acknowledged") {
+			Checkpoint.Blocks = (size_t)strtoull(Value.c_str(), NULL, 10);
+		}
+		else if (Key == "crc") {
+			Checkpoint.CRC.push_back((unsigned int)strtoul(Value.c_str(), NULL, 16));
+		}
+		else if (!Line.empty() && Line[0] != '#') {
+			valid = false;
+		}
+	}
+	fclose(f);
+	return valid && Checkpoint.Blocks <= Checkpoint.CRC.size();
+}
+
+// Written and synced to a temporary file first, which then atomically replaces the checkpoint: a crash
+// leaves either the previous or the new checkpoint
+static bool writeFWTCheckpoint(const std::string &Filename, const FWTCheckpoint_t &Checkpoint)
+{
+	std::string Temporary = Filename + ".tmp";
+	FILE *f = fopen(Temporary.c_str(), "w");
+	if (f == NULL) {
+		return false;
+	}
+	fprintf(f, "# Firmware transfer checkpoint (HROCMQueryV3 fwt)\n");
+	fprintf(f, "module=%s\n", Checkpoint.Module.c_str());
+	fprintf(f, "size=%zu\n", Checkpoint.Size);
+	fprintf(f, "blocksize=%zu\n", Checkpoint.BlockSize);
+	fprintf(f, "acknowledged=%zu\n", Checkpoint.Blocks);
+	for (size_t i = 0; i < Checkpoint.CRC.size(); ++i) {
+		fprintf(f, "crc=%08X\n", Checkpoint.CRC[i]);
+	}
+	bool ok = fflush(f) == 0;
+#ifdef _WIN32
+	ok = ok && _commit(_fileno(f)) == 0;
+#else
+	ok = ok && fsync(fileno(f)) == 0;
+#endif
+	ok = (fclose(f) == 0) && ok;
+	if (!ok) {
+		return false;
+	}
+#ifdef _WIN32
+	return MoveFileExA(Temporary.c_str(), Filename.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename(Temporary.c_str(), Filename.c_str()) == 0;
+#endif
+}
+
 // Firmware transfer (FWT)
-int commandFWT(const char *Filename)
+int commandFWT(const char *Filename, bool Resume)
 {
     FinisarHROCM_V3 OCM(theConfigString,theLogFile,theLogBinFile);
 
     // Open OCM
     OCM_Error_t Result = OCM.open();
 
-    // Load binary file (old style...)
-    std::vector<char> BinaryFile;
-    FILE *f = fopen(Filename,"rb");
-    if (f) {
-        int c=fgetc(f);
-        while(!feof(f)) {
-            BinaryFile.push_back((char)c);
-            c=fgetc(f);
-        }
-        fclose(f);
-    }
-    else {
+    // Map the binary file, the chunks are sent straight from the mapping
+    OCMMappedFile BinaryFile;
+    if (!BinaryFile.open(Filename)) {
         Result = Result || OCM_FAILED;
-		theLastError << "[ERROR] File not found (" << Filename << ")" << std::endl;
+		theLastError << "[ERROR] " << BinaryFile.getLastError() << std::endl;
     }
 	if (Result == OCM_OK) {
 		printf("[OK] File loaded (%s, %d bytes)\n", Filename, (int)BinaryFile.size());
 	}
 
-    // Call FWT command
-    Result = Result || OCM.cmdFWT(BinaryFile);
+	// Manifest of the image and the module it goes to
+	size_t BlockSize = FWT_BLOCKCHUNKS * (OCM3_LENMAX - sizeof(OCM3_cmd_t) - 8);
+	FWTCheckpoint_t Checkpoint;
+	Checkpoint.Size			= BinaryFile.size();
+	Checkpoint.BlockSize	= BlockSize;
+	Checkpoint.Blocks		= 0;
+	Result = Result || OCM.get(OCM_KEY_PARAM_SERIALNO, Checkpoint.Module);
+	for (size_t Offset = 0; Offset < BinaryFile.size(); Offset += BlockSize) {
+		size_t size = BinaryFile.size() - Offset > BlockSize ? BlockSize : BinaryFile.size() - Offset;
+		CCRC32 crc;
+		Checkpoint.CRC.push_back(crc.FullCRC((const unsigned char *)BinaryFile.data() + Offset, (unsigned int)size));
+	}
+
+	// Continue after the blocks acknowledged by a previous transfer of the same image to the same module
+	std::string CheckpointFile = std::string(Filename) + ".fwt";
+	FWTCheckpoint_t Previous;
+	if (Result == OCM_OK && readFWTCheckpoint(CheckpointFile, Previous)) {
+		if (Previous.Module != Checkpoint.Module || Previous.Size != Checkpoint.Size || Previous.BlockSize != Checkpoint.BlockSize ||
+			Previous.CRC != Checkpoint.CRC) {
+			printf("[INFO] Checkpoint %s belongs to another image or module, starting at 0\n", CheckpointFile.c_str());
+		}
+		else if (Resume) {
+			Checkpoint.Blocks = Previous.Blocks;
+			printf("[INFO] Resuming at %u kB\n", (unsigned int)(Checkpoint.Blocks * BlockSize / 1024));
+		}
+		else if (Previous.Blocks > 0) {
+			printf("[INFO] Checkpoint at %u kB found, add \"resume\" to continue there\n", (unsigned int)(Previous.Blocks * BlockSize / 1024));
+		}
+	}
+
+    // Call FWT command (does not modify the buffer) block by block, saving the checkpoint after each block
+	unsigned long long startUs = OCMDriverStats::nowUs();
+	unsigned long long printUs = startUs;
+	size_t startOffset = Checkpoint.Blocks * BlockSize;
+	bool checkpointFailed = false;
+	for (size_t Offset = startOffset; Offset < BinaryFile.size() && Result == OCM_OK; Offset += BlockSize) {
+		size_t size = BinaryFile.size() - Offset > BlockSize ? BlockSize : BinaryFile.size() - Offset;
+		Result = Result || OCM.cmdFWT((unsigned int)Offset, const_cast<char*>(BinaryFile.data()) + Offset, size);
+		if (Result != OCM_OK) {
+			break;
+		}
+		++Checkpoint.Blocks;
+		if (!checkpointFailed && !writeFWTCheckpoint(CheckpointFile, Checkpoint)) {
+			printf("[WARNING] Could not write checkpoint %s\n", CheckpointFile.c_str());
+			checkpointFailed = true;
+		}
+
+		unsigned long long nowUs = OCMDriverStats::nowUs();
+		if (nowUs - printUs >= 2000000) {
+			printf("[INFO] FWT %u of %u kB (%d%%), %.1f kB/s\n", (unsigned int)((Offset + size) / 1024), (unsigned int)(BinaryFile.size() / 1024),
+				(int)((Offset + size) * 100.0 / BinaryFile.size()), (Offset + size - startOffset) / 1024.0 * 1e6 / (nowUs - startUs));
+			printUs = nowUs;
+		}
+	}
+	double seconds = (OCMDriverStats::nowUs() - startUs) / 1e6;
 	if (Result == OCM_OK) {
-		printf("[OK] FWT executed\n");
+		remove(CheckpointFile.c_str());
+		printf("[OK] FWT executed (%d bytes in %.1f s, %.1f kB/s, %d retransmits)\n", (int)(BinaryFile.size() - startOffset), seconds,
+			seconds > 0 ? (BinaryFile.size() - startOffset) / 1024.0 / seconds : 0.0, OCM.getNCmdRetransmit());
 	}
 	else {
 		printf("[ERROR] FWT failed\n");
+		if (Checkpoint.Blocks > 0 && !checkpointFailed) {
+			printf("[INFO] %u kB acknowledged, run fwt %s resume to continue\n", (unsigned int)(Checkpoint.Blocks * BlockSize / 1024), Filename);
+		}
 	}
 
 	LOGERROR(OCM);
@@ -1167,12 +2205,12 @@ int commandFWS()
 }
 
 // Update module firmware
-int commandUpdate(const char *Filename)
+int commandUpdate(const char *Filename, bool Resume)
 {
     OCM_Error_t Result = OCM_OK;
 
     // Transfer firmware
-    Result = Result || commandFWT(Filename);
+    Result = Result || commandFWT(Filename, Resume);
     // Save firmware
     Result = Result || commandFWS();
     // Reset module
@@ -1260,6 +2298,44 @@ int commandFactory()
 	return Result;
 }
 
+// List the scans of an archive, or print the scan at or after a time (ms since 1970) in CSV format
+int commandArchiveRead(const char *Filename, const char *Time)
+{
+	OCMScanArchiveReader Archive;
+	if (!Archive.open(Filename)) {
+		theLastError << "[ERROR] " << Archive.getLastError() << std::endl;
+		return OCM_FAILED;
+	}
+
+	if (Time == NULL) {
+		printf("Index,Timestamp_ms,Scan\n");
+		for (size_t i = 0; i < Archive.size(); ++i) {
+			printf("%u,%lld,%u\n", (unsigned int)i, Archive.getEntry(i).TIMESTAMPMS, Archive.getEntry(i).SCAN);
+		}
+		return OCM_OK;
+	}
+
+	OCMArchiveScan_t Head;
+	std::vector<OCM3_MPPWRecord_t> Plan;
+	std::vector<short> Power, OSNR;
+	size_t i = Archive.findTime(strtoll(Time, NULL, 10));
+	if (i >= Archive.size() || !Archive.readScan(i, Head, Plan, Power, OSNR)) {
+		theLastError << "[ERROR] No scan at or after " << Time << " in " << Filename << std::endl;
+		return OCM_FAILED;
+	}
+
+	fprintf(stderr, "[INFO] Scan=%u Timestamp=%lld SNO=%.16s ModuleTemp=%.1f OpticsTemp=%.1f\n", Head.SCAN, Head.TIMESTAMPMS, Head.SNO, Head.CSS / OCM3_PSCALE, Head.ISS / OCM3_PSCALE);
+	printf("Port,SliceStart,SliceEnd,Power_dBm%s\n", OSNR.empty() ? "" : ",OSNR_dB");
+	for (unsigned int k = 0; k < Plan.size(); ++k) {
+		printf("%d,%d,%d,%.1f", Plan[k].PORTNO, Plan[k].SLICESTART, Plan[k].SLICEEND, Power[k] / OCM3_PSCALE);
+		if (!OSNR.empty()) {
+			printf(",%.1f", OSNR[k] / OCM3_PSCALE);
+		}
+		printf("\n");
+	}
+	return OCM_OK;
+}
+
 // Parse hex number
 unsigned int htou(const char *s) {
 	unsigned int result;
@@ -1270,369 +2346,285 @@ unsigned int htou(const char *s) {
 
 	return result;
 }
-//创建一个互斥量
-HANDLE g_hMutex = NULL;
-//定义接受数组
-typedef struct {
-	int type;
-	int number;
-}TLV1;
+// Scan results served by the request handlers
+OCMSnapshotPublisher g_ScanPublisher;
 
-std::vector<int>TLV2(30);
-std::vector<int>TLV2_centerfre(10);
-std::vector<int>TLV2_channel(10);
-std::vector<int>TLV2_nchannel(10);
+// Empty snapshot on the 50 GHz and 100 GHz grid starting at 191.4 THz
+std::shared_ptr<OCMScanSnapshot> newScanSnapshot()
+{
+	std::shared_ptr<OCMScanSnapshot> pSnapshot = std::make_shared<OCMScanSnapshot>();
+	pSnapshot->Grids.resize(2);
+	pSnapshot->Grids[0].FirstFreq = (unsigned int)(191.4 * OCM3_FSCALE + 0.5);
+	pSnapshot->Grids[0].Step = (unsigned int)(0.05 * OCM3_FSCALE + 0.5);
+	pSnapshot->Grids[0].Values.resize(80);
+	pSnapshot->Grids[1].FirstFreq = (unsigned int)(191.4 * OCM3_FSCALE + 0.5);
+	pSnapshot->Grids[1].Step = (unsigned int)(0.1 * OCM3_FSCALE + 0.5);
+	pSnapshot->Grids[1].Values.resize(40);
+	return pSnapshot;
+}
 
+// Scans one channel grid of the snapshot: uploads the ITU channel plan, runs an OSNR scan and publishes
+// a new snapshot with the results. The other grids keep the values of the previous snapshot.
+class GridScanJob : public OCMScanJob
+{
+public:
+	GridScanJob(OCMSnapshotPublisher *pPublisher, unsigned int iGrid) : _pPublisher(pPublisher), _iGrid(iGrid) {}
 
+	virtual OCM_Error_t run()
+	{
+		// Build the results in a private copy
+		std::shared_ptr<const OCMScanSnapshot> pPrevious = _pPublisher->getSnapshot();
+		std::shared_ptr<OCMScanSnapshot> pThreadData = pPrevious ? std::make_shared<OCMScanSnapshot>(*pPrevious) : newScanSnapshot();
+		OCMGridResult_t &Grid = pThreadData->Grids[_iGrid];
 
-typedef struct {
-	int frestep_50;
-	int frestep_100;
-	float frecenter[4];
-}RecvData;
+		OCM_Error_t Result = commandITU((int)Grid.FirstFreq, (int)Grid.Step, (int)Grid.Values.size());
 
-typedef struct {
-	/*float frecenter;
-	int frestep_50;
-	int frestep_100;*/
-	//double centerfre[80];
-	double power_dbm[80];
-	double osnr_db[80];
-	double power_dbm_100[40];
-	double osnr_db_100[40];
-}Node;
+		FinisarHROCM_V3 OCM(theConfigString, theLogFile, theLogBinFile);
 
-typedef struct {
-	int power_dbm[4];
-	int osnr_db[4];
-	//double power_dbm_100[4];
-	//double osnr_db_100[4];
-}Data;
-//线程函数
-DWORD WINAPI ThreadProcScan(LPVOID lpParameter)
-{
-	Node*  pThreadData = (Node*)lpParameter;
-	while (1)
-	{
-		int i;
-		WaitForSingleObject(g_hMutex, INFINITE);
-		//printf("Thread1周期采集光谱信息\n");
-		/*for (i = 0; i <80; i++)
+		// Open OCM
+		Result = Result || OCM.open();
+
+		// Get RDataDEV
+		OCM3_RDataDEV_t	*pRDataDEV = NULL;
+		Result = Result || OCM.getRDataDEV(pRDataDEV);
+
+		// Call TPC command
+		Result = Result || OCM.runFullScan(OCM3_TASK_OSNR_MASK);
+
+		if (Result == OCM_OK && pRDataDEV != NULL)
 		{
-			pThreadData->osnr_db[i] = i;
-			pThreadData->power_dbm[i] = i;
+			OCM3_GMOSNRResult_t *pGMPWResult = OCM.getGMOSNRResult();
+			archiveScan(OCM, *pGMPWResult);
+			for (unsigned int k = 0; k < pGMPWResult->GMOSNRVector.size() && k < Grid.Values.size(); ++k)
+			{
+				Grid.Values[k].POWER = pGMPWResult->GMOSNRVector[k].POWER / OCM3_PSCALE;
+				Grid.Values[k].OSNR = pGMPWResult->GMOSNRVector[k].OSNR / OCM3_PSCALE;
+			}
+
+			pThreadData->Scan = (pPrevious ? pPrevious->Scan : 0) + 1;
+			pThreadData->TimestampMs = unixTimeMs();
+			_pPublisher->publish(pThreadData);
 		}
-		printf("threadpower:%.1f,%.1f\n", pThreadData->power_dbm[0], pThreadData->power_dbm[1]*/
-		commandITU((int)(191.4 * OCM3_FSCALE + 0.5), (int)( 0.05* OCM3_FSCALE + 0.5), 80);
+		else
 		{
-			FinisarHROCM_V3 OCM(theConfigString, theLogFile, theLogBinFile);
+			LOGERROR(OCM);
+		}
 
-			// Open OCM
-			OCM_Error_t Result = OCM.open();
+		return Result;
+	}
 
-			// Get RDataDEV
-			OCM3_RDataDEV_t	*pRDataDEV = NULL;
-			Result = Result || OCM.getRDataDEV(pRDataDEV);
+private:
+	OCMSnapshotPublisher	*_pPublisher;
+	unsigned int			_iGrid;		// Index into OCMScanSnapshot::Grids
+};
 
-			// Call TPC command
-			Result = Result || OCM.runFullScan(OCM3_TASK_OSNR_MASK);
+// Runs a scan on the highest-resolution channel plan and publishes a new snapshot with the slice powers
+class HiResScanJob : public OCMScanJob
+{
+public:
+	HiResScanJob(OCMSnapshotPublisher *pPublisher) : _pPublisher(pPublisher) {}
 
-			// Output result in CSV format
-			if (Result == OCM_OK && pRDataDEV != NULL)
-			{
-				OCM3_GMOSNRResult_t *pGMPWResult = OCM.getGMOSNRResult();
-				//printf("Port,fCenter_THz,Power_dBm,OSNR_dB\n");
-				for (unsigned int k = 0; k < pGMPWResult->GMOSNRVector.size(); ++k)
-				{
-					//double fSliceLeft = ((pGMPWResult->GMOSNRVector[k].SLICESTART - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-					//double fSliceRight = ((pGMPWResult->GMOSNRVector[k].SLICEEND - 1 + 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-					//pThreadData->centerfre[k] = ((pGMPWResult->GMOSNRVector[k].CENTERFREQUENCY - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-					pThreadData->power_dbm[k] = pGMPWResult->GMOSNRVector[k].POWER / OCM3_PSCALE;
-					pThreadData->osnr_db[k] = pGMPWResult->GMOSNRVector[k].OSNR / OCM3_PSCALE;
-					//printf("%.7f,%.1f,%.1f\n", pThreadData->power_dbm[k], pThreadData->osnr_db[k]);
-				}
+	virtual OCM_Error_t run()
+	{
+		OCM_Error_t Result = commandHIRES();
+
+		FinisarHROCM_V3 OCM(theConfigString, theLogFile, theLogBinFile);
+
+		// Open OCM
+		Result = Result || OCM.open();
+
+		// Get RDataDEV
+		OCM3_RDataDEV_t	*pRDataDEV = NULL;
+		Result = Result || OCM.getRDataDEV(pRDataDEV);
+
+		// Call TPC command
+		Result = Result || OCM.runFullScan(OCM3_TASK_PW_MASK);
+
+		if (Result == OCM_OK && pRDataDEV != NULL)
+		{
+			std::shared_ptr<const OCMScanSnapshot> pPrevious = _pPublisher->getSnapshot();
+			std::shared_ptr<OCMScanSnapshot> pThreadData = pPrevious ? std::make_shared<OCMScanSnapshot>(*pPrevious) : newScanSnapshot();
+
+			// Center frequency of each record. Slice numbers are 1-based, not 0-based.
+			archiveScan(OCM, *OCM.getGMPWResult());
+			const std::vector<OCM3_GMPWRecord_t> &Records = OCM.getGMPWResult()->GMPWVector;
+			std::vector<std::pair<unsigned int, double> > Slices(Records.size());
+			for (unsigned int k = 0; k < Records.size(); ++k) {
+				Slices[k].first = (unsigned int)(pRDataDEV->FSF + ((Records[k].SLICESTART - 1) + Records[k].SLICEEND) * (double)pRDataDEV->SLW / 2 + 0.5);
+				Slices[k].second = Records[k].POWER / OCM3_PSCALE;
+			}
+			if (!std::is_sorted(Slices.begin(), Slices.end())) {
+				std::sort(Slices.begin(), Slices.end());
+			}
+
+			OCMSpectrum_t &Spectrum = pThreadData->Spectrum;
+			Spectrum.Freq.resize(Slices.size());
+			Spectrum.Power.resize(Slices.size());
+			for (unsigned int k = 0; k < Slices.size(); ++k) {
+				Spectrum.Freq[k] = Slices[k].first;
+				Spectrum.Power[k] = Slices[k].second;
 			}
+
+			pThreadData->Scan = (pPrevious ? pPrevious->Scan : 0) + 1;
+			pThreadData->TimestampMs = unixTimeMs();
+			_pPublisher->publish(pThreadData);
 		}
-		commandITU((int)(191.4 * OCM3_FSCALE + 0.5), (int)(0.1 * OCM3_FSCALE + 0.5), 40); //0.5应该没有意义，前面有int，真蠢
+		else
 		{
-			
-			FinisarHROCM_V3 OCM(theConfigString, theLogFile, theLogBinFile);
+			LOGERROR(OCM);
+		}
 
-			// Open OCM
-			OCM_Error_t Result = OCM.open();
+		return Result;
+	}
 
-			// Get RDataDEV
-			OCM3_RDataDEV_t	*pRDataDEV = NULL;
-			Result = Result || OCM.getRDataDEV(pRDataDEV);
+private:
+	OCMSnapshotPublisher	*_pPublisher;
+};
 
-			// Call TPC command
-			Result = Result || OCM.runFullScan(OCM3_TASK_OSNR_MASK);
+// Prints the measured scan rates
+class SchedReportJob : public OCMScanJob
+{
+public:
+	SchedReportJob(OCMScanScheduler *pScheduler) : _pScheduler(pScheduler) {}
 
-			// Output result in CSV format
-			if (Result == OCM_OK && pRDataDEV != NULL)
-			{
-				OCM3_GMOSNRResult_t *pGMPWResult = OCM.getGMOSNRResult();
-				//printf("Port,fCenter_THz,Power_dBm,OSNR_dB\n");
-				for (unsigned int k = 0; k < pGMPWResult->GMOSNRVector.size(); ++k)
-				{
-					//double fSliceLeft = ((pGMPWResult->GMOSNRVector[k].SLICESTART - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-					//double fSliceRight = ((pGMPWResult->GMOSNRVector[k].SLICEEND - 1 + 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-					//pThreadData->centerfre[k] =' ((pGMPWResult->GMOSNRVector[k].CENTERFREQUENCY - 1)*pRDataDEV->SLW + pRDataDEV->FSF) / OCM3_FSCALE; // Slice numbers are 1-based, not 0-based
-					pThreadData->power_dbm_100[k] = pGMPWResult->GMOSNRVector[k].POWER / OCM3_PSCALE;
-					pThreadData->osnr_db_100[k] = pGMPWResult->GMOSNRVector[k].OSNR / OCM3_PSCALE;
-					//printf("%.1f,%.1f\n", pThreadData->power_dbm_100[k], pThreadData->osnr_db_100[k]);
+	virtual OCM_Error_t run()
+	{
+		printf("[INFO] Scan rates\n%s", _pScheduler->getReport().c_str());
+		if (!theStatsFilename.empty()) {
+			std::vector<OCMDriverStats*> Modules = OCMDriverStats::getModules();
+			for (size_t i = 0; i < Modules.size(); ++i) {
+				const OCMLatencyHistogram *pScan = Modules[i]->getHistogram(OCM_STATS_SCAN);
+				if (pScan != NULL) {
+					printf("Scan latency %s: %llu scans, p50 %.0f ms, p99 %.0f ms, max %.0f ms\n", Modules[i]->getName().c_str(), pScan->getCount(),
+						pScan->getPercentile(50.0) / 1000.0, pScan->getPercentile(99.0) / 1000.0, pScan->getMax() / 1000.0);
 				}
 			}
+			writeStats();
+		}
+		std::string Error = theLastError.str();
+		if (Error != "") {
+			fprintf(stderr, "%s", Error.c_str());
+			theLastError.str("");
 		}
-		ReleaseMutex(g_hMutex);
-		Sleep(2000);
+		return OCM_OK;
 	}
+
+private:
+	OCMScanScheduler	*_pScheduler;
+};
+
+// Runs the scan plans
+DWORD WINAPI ThreadProcScan(LPVOID lpParameter)
+{
+	OCMScanScheduler *pScheduler = (OCMScanScheduler*)lpParameter;
+	OCMSpanTracer::setThreadName("scan");
+	if (pScheduler->run() != OCM_OK) {
+		fprintf(stderr, "%s", pScheduler->getLastError().c_str());
+	}
+	return 0;
 }
 
+// Pushes new scans to the subscribers as soon as they are published
+class ServerWakeup : public OCMPublishListener
+{
+public:
+	ServerWakeup(OCMScanServer *pServer) : _pServer(pServer) {}
+
+	virtual void onPublish(unsigned int Generation)
+	{
+		_pServer->wakeup();
+	}
+
+private:
+	OCMScanServer	*_pServer;
+};
+
+// Triggers the on-demand scan plans on request of a client (OCMP_MSG_TRIGGER)
+class ServerTrigger : public OCMScanTrigger
+{
+public:
+	ServerTrigger(OCMScanScheduler *pScheduler) : _pScheduler(pScheduler) {}
+
+	// Call before the scan thread is started
+	void addPlan(int Id) { _plans.push_back(Id); }
+
+	virtual bool triggerScans()
+	{
+		for (size_t i = 0; i < _plans.size(); ++i) {
+			_pScheduler->trigger(_plans[i]);
+		}
+		return !_plans.empty();
+	}
+
+private:
+	OCMScanScheduler	*_pScheduler;
+	std::vector<int>	_plans;		// Ids of the on-demand plans
+};
+
+// Run the scan thread and serve the results to any number of clients
+int commandServe(unsigned short Port, const char *BindAddress)
+{
+	OCMScanScheduler Scheduler;
+	ServerTrigger Trigger(&Scheduler);
+	OCMRequestHandler Handler(&g_ScanPublisher, &Trigger);
+	OCMServerSettings_t Settings = OCMScanServer::defaultSettings();
+	Settings.Port = Port;
+	if (BindAddress != NULL) {
+		Settings.BindAddress = BindAddress;
+	}
+
+	OCMScanServer Server(&Handler, Settings);
+	OCM_Error_t Result = Server.open();
+	ServerWakeup Wakeup(&Server);
+
+	// Scan plans. The report runs with the highest priority so that it is printed on time.
+	GridScanJob Scan50(&g_ScanPublisher, 0);
+	GridScanJob Scan100(&g_ScanPublisher, 1);
+	HiResScanJob ScanHires(&g_ScanPublisher);
+	SchedReportJob Report(&Scheduler);
+	OCMSchedPlan_t *pPlans[3] = { &theScanPlan50, &theScanPlan100, &theScanPlanHires };
+	bool Enabled[3] = { theScanPlan50Enabled, theScanPlan100Enabled, theScanPlanHiresEnabled };
+	OCMScanJob *pJobs[3] = { &Scan50, &Scan100, &ScanHires };
+	for (int i = 0; i < 3; ++i) {
+		if (Enabled[i]) {
+			int Id = Scheduler.addPlan(*pPlans[i], pJobs[i]);
+			if (pPlans[i]->Mode == OCM_SCHED_ONDEMAND) {
+				Trigger.addPlan(Id);
+			}
+		}
+	}
+	if (theSchedReportSec > 0) {
+		OCMSchedPlan_t ReportPlan = { "report", OCM_SCHED_FIXEDRATE, theSchedReportSec * 1000, 1000000 };
+		Scheduler.addPlan(ReportPlan, &Report);
+	}
+
+	HANDLE hThread = NULL;
+	if (Result == OCM_OK) {
+		printf("[INFO] Listening on port %d\n", (int)Port);
+
+		// Start the scan thread
+		g_ScanPublisher.setListener(&Wakeup);
+		hThread = CreateThread(NULL, 0, ThreadProcScan, &Scheduler, 0, NULL);
+	}
+	Result = Result || Server.run();
+
+	// The scan thread uses the scheduler, the jobs and the server: wait until it has finished its job
+	Scheduler.stop();
+	if (hThread != NULL) {
+		WaitForSingleObject(hThread, INFINITE);
+		CloseHandle(hThread);
+	}
+	g_ScanPublisher.setListener(NULL);
+
+	theLastError << Server.getLastError();
+	return Result;
+}
 
 // Main command line interface
 int _tmain(int argc, _TCHAR* argv[])
 {
-	
 	int Result = 0;
-	 {
-	   TLV1 *myRecvData = (TLV1*)malloc(sizeof(TLV1));
-	   //Data *myData = (Data*)malloc(sizeof(Data));
-	   Node *myNode = (Node*)malloc(sizeof(Node));
-	  //创建一个互斥量
-	   g_hMutex = CreateMutex(NULL, FALSE, NULL);
-
-	   //创建一个子线程
-	   HANDLE hThread = CreateThread(NULL, 0, ThreadProcScan, myNode, 0, NULL);
-
-	   //关闭线程句柄
-	   CloseHandle(hThread);
-	   Sleep(100);
- 
-	 //初始化WSA
-	   WORD sockVersion = MAKEWORD(2, 2);
-	   WSADATA wsaData;
-	   if (WSAStartup(sockVersion, &wsaData) != 0)
-	   {
-		   return 0;
-	   }
-
-	   //创建套接字
-	   SOCKET slisten = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-	   if (slisten == INVALID_SOCKET) 
-	   {
-		   printf("socket error");
-		   return 0;
-	   }
-
-
-	   //绑定IP和端口
-	   sockaddr_in sin;
-	   sin.sin_family = AF_INET;
-
-
-	   sin.sin_port = htons(8888);
-	   sin.sin_addr.S_un.S_addr = inet_addr("192.168.108.239");
-	   if (bind(slisten, (LPSOCKADDR)&sin, sizeof(sin)) == SOCKET_ERROR) 
-	   {
-		   printf("bind error !");
-	   }
-
-	   //开始监听
-	   if (listen(slisten, 5) == SOCKET_ERROR)
-	   {
-		   printf("listen error !");
-		   return 0;
-	   }
-
-	   //确认连接
-	   SOCKET sClient;
-	   sockaddr_in remoteAddr;
-	   int nAddrlen = sizeof(remoteAddr);
-	   printf("等待连接...\n");
-	   sClient = accept(slisten, (SOCKADDR *)&remoteAddr, &nAddrlen);
-	   if (sClient == INVALID_SOCKET)
-	   {
-		   printf("accept error !");
-		   return 0;
-	   }
-	   printf("接受到一个连接：%s \r\n", inet_ntoa(remoteAddr.sin_addr));
-	   while (true)
-	   {
-		   //接受数据
-		   int needrecv;
-		   needrecv= sizeof(TLV1);
-		   char *buffer = (char*)malloc(needrecv);
-		   int pos = 0;
-		   while (pos < needrecv)
-		   {
-			   int ret = recv(sClient, buffer + pos, 1024, 0);
-			   if (ret < 0)
-			   {
-				   printf("Server Recieve Data Failed!\n");
-				   return 0;
-			   }
-			   pos += ret;
-		   }
-		   memcpy(myRecvData, buffer, needrecv);
-		   free(buffer);
-		  // *(buffer + needrecv) = '\0';
-
-		   //读入TLV2
-		   int type = myRecvData->type;
-		   int number = myRecvData->number;
-		 
-		   needrecv = type * number * sizeof(int);
-		   char *buffer1 = (char*)malloc(needrecv);
-		   printf("type:%d,number:%d\n", myRecvData->type, myRecvData->number);
-		   pos = 0;
-		   while (pos < needrecv)
-		   {
-			   int ret = recv(sClient, buffer1+ pos, 1024, 0);
-			   if (ret < 0)
-			   {
-				   printf("Server Recieve Data Failed!\n");
-				   return 0;
-			   }
-			   pos += ret;
-		   }
-		   memcpy(&TLV2[0], buffer1, needrecv);
-		   free(buffer1);
-		   int i;
-		   int j = 0;
-		   int k = 0;
-		   int l = 0;
-
-		   for (i = 0; i <type * number; i++){
-			   if (i % 3 == 0) {
-				   TLV2_centerfre[j] = TLV2[i];
-				   j++;
-			   }
-			   if (i % 3 == 1) {
-				   TLV2_channel[k] = TLV2[i];
-				   k++;
-			   }
-			   if (i % 3 == 2) {
-				   TLV2_nchannel[l] = TLV2[i];
-				   l++;
-			   }
-			}
-		   printf("centerfre:");
-		   for (i = 0; i < number; i++) {
-			   printf("%f\t", TLV2_centerfre[i]/100.0);
-		   }
-		   printf("\n");
-
-		   printf("channel:");
-		   for (i = 0; i < number; i++) {
-			   printf("%d\t", TLV2_channel[i]);
-		   }
-		   printf("\n");
-
-		   printf("nchannel:");
-		   for (i = 0; i < number; i++) {
-			   printf("%d\t", TLV2_nchannel[i]);
-		   }
-		   printf("\n");
-
-		   int channelsum = 0;
-		   int needSend;
-		   for (i = 0; i < number; i++)
-		   {
-			   channelsum = channelsum + TLV2_nchannel[i];
-		   }
-		   needSend = channelsum * 2 * sizeof(double);
-		   char *sendbuffer = (char*)malloc(needSend);
-		  
-		   
-		   //读入数据
-		   std::vector<double>send2Client(channelsum * 2);
-		   int index;
-		
-		   WaitForSingleObject(g_hMutex, INFINITE);
-
-		   for (i = 0; i < number; i++)
-		   {
-			   if (TLV2_channel[i] == 50)
-			   {
-				   index = round((TLV2_centerfre[i] - 19140) / 5);
-				   send2Client[2 * i] = myNode->power_dbm[index];
-				   send2Client[2 * i + 1] = myNode->osnr_db[index];
-			   }
-			   if (TLV2_channel[i] == 100)
-			   {
-				   index = round((TLV2_centerfre[i] - 19140) / 10);
-				   send2Client[2 * i] = myNode->power_dbm_100[index];
-				   send2Client[2 * i + 1] = myNode->osnr_db_100[index];
-				   printf("Send:%.1f,%.1f\n", myNode->power_dbm_100[index], myNode->osnr_db_100[index]);
-			   }
-		   }
-		   //if (TLV2_channel[0] == 50)
-		   //{
-			  // for (i = 0; i < sizeof(myRecvData->frecenter)/4; i++)
-			  // {
-				 //  index = round(((myRecvData->frecenter[i]) * 100 - 19140) / 5);
-				 //  myData->osnr_db[i] = myNode->osnr_db[index];
-				 //  myData->power_dbm[i] = myNode->power_dbm[index];
-				 // // printf("Send:%.1f,%.1f\n", myData->osnr_db[i], myData->power_dbm[i]);
-			  // }
-			  //
-		   //}
-		   //else
-		   //{
-			  // for (i = 0; i < sizeof(myRecvData->frecenter) / 4; i++)
-			  // {
-				 //  //index = round(((myRecvData->frecenter[i]) * 100 - 19140) / 5);
-				 //  myData->osnr_db[i] = 0;
-				 //  myData->power_dbm[i] = 0;
-				 // 
-			  // }
-		   //}
-		   //if (cfrestep_100)
-		   //{
-			  // for (i = 0; i < sizeof(myRecvData->frecenter) / 4; i++)
-			  // {
-				 //  index = round(((myRecvData->frecenter[i]) * 100 - 19140) / 10);
-				 //  myData->osnr_db_100[i] = myNode->osnr_db_100[index];
-				 //  myData->power_dbm_100[i] = myNode->power_dbm_100[index];
-				 ////  printf("50GHz channel Send:%.1f,%.1f\n", myData->osnr_db_100[i], myData->power_dbm_100[i]);
-			  // }
-
-		   //}
-		   //else
-		   //{
-
-			  // for (i = 0; i < sizeof(myRecvData->frecenter) / 4; i++)
-			  // {
-				 //  //index = round(((myRecvData->frecenter[i]) * 100 - 19140) / 10);
-				 //  myData->osnr_db_100[i] = 0;
-				 //  myData->power_dbm_100[i] = 0;
-				 // // printf("Send:%.1f,%.1f\n", myData->osnr_db_100[i], myData->power_dbm_100[i]);
-			  // }
-		   //}
-		   ReleaseMutex(g_hMutex);
-		  
-		   memcpy(sendbuffer, &send2Client[0], needSend);
-		   int position = 0;
-		   while (position < needSend)
-		   {
-			   int length = send(sClient, sendbuffer + position, sizeof(Data), 0);
-			   if (length < 0)
-			   {
-				   printf("Server Transmit Data Failed!\n");
-				   return 0;
-			   }
-			   position += length;
-		   }
-		  // free(sendbuffer);
-		   send(sClient, "end", 3, 0);
-		  // free(myData);
-	   }
-       closesocket(sClient);
-	   closesocket(slisten);
-	   WSACleanup();
-       return 0;
-     }
+
     // Seed the random number generator so that the Tx sequence number
     // always starts with a different number.
     // This is important because this tool terminates after issuing a command.
@@ -1643,11 +2635,36 @@ int _tmain(int argc, _TCHAR* argv[])
     int iArg=1;
 	unsigned int    SPIClock = SPID_DEFAULT_CLOCKRATE;	// Default = 12 MHz
 	std::string		SPIAdapterID = "";					// SPI adapter ID
+	std::string		ReplayFilename = "";				// Binary log file to replay instead of using the SPI adapter
+	std::string		ReplaySpeed = "0";
+	std::string		EmulatorSettings = "";				// Settings of the emulated module, empty: no emulator
+	std::string		FaultSettings = "";					// Faults injected into the SPI transfers, empty: none
+	std::string		ArchiveFilename = "";				// Archive of all scans
+	bool			ArchiveCompress = false;
+	size_t			FlightBytes = OCM_FLIGHT_DEFAULT_CAPACITY;	// Memory of the flight recorder
+	unsigned int	FlightThreshold = OCM_FLIGHT_DEFAULT_THRESHOLD;
+	std::string		TimelineFilename = "";				// Timeline of the driver calls
 
     // See if there are options
     for(;iArg<argc;++iArg)
     {
-		if (strcmp(argv[iArg], "-log") == 0)       // Option -log creates a log file
+		if ((strcmp(argv[iArg], "-log") == 0 || strcmp(argv[iArg], "-logtrace") == 0) && theLogFile)
+		{
+			Result = Result || OCM_FAILED;
+			theLastError << "[ERROR] -log and -logtrace cannot be combined" << std::endl;
+		}
+		else if (strcmp(argv[iArg], "-logtrace") == 0)       // Option -logtrace creates a binary transfer trace
+		{
+			char Filename[] = "HROCMQuery.trace";
+			theLogFile = fopen(Filename, "wb");
+			theLogTrace = true;
+			if (!theLogFile)
+			{
+				Result = Result || OCM_FAILED;
+				theLastError << "[ERROR] Log file open failed (" << Filename << ")" << std::endl;
+			}
+		}
+		else if (strcmp(argv[iArg], "-log") == 0)       // Option -log creates a log file
 		{
 			bool fileExists = false;
 			char Filename[] = "HROCMQuery.csv";
@@ -1680,6 +2697,86 @@ int _tmain(int argc, _TCHAR* argv[])
 				theLastError << "[ERROR] Log file open failed (" << Filename << ")" << std::endl;
 			}
 		}
+		else if (strcmp(argv[iArg], "-logbuffer") == 0)       // Option -logbuffer sets the memory buffer of the log files
+		{
+			if (++iArg < argc && Result == OCM_OK) {
+				int MB = atoi(argv[iArg]);
+				if (MB <= 0) {
+					Result = Result || OCM_FAILED;
+					theLastError << "[ERROR] Invalid log buffer size " << argv[iArg] << std::endl;
+				}
+				theLogBufferBytes = (size_t)MB * 1024 * 1024;
+			}
+		}
+		else if (strcmp(argv[iArg], "-format") == 0)    // Option -format selects the output format of the scan commands
+		{
+			if (++iArg < argc) {
+				if (strcmp(argv[iArg], "csv") == 0) {
+					theOutputFormat = OCM_OUTPUT_CSV;
+				}
+				else if (strcmp(argv[iArg], "bin") == 0) {
+					theOutputFormat = OCM_OUTPUT_BIN;
+				}
+				else if (strcmp(argv[iArg], "npy") == 0) {
+					theOutputFormat = OCM_OUTPUT_NPY;
+				}
+				else {
+					Result = Result || OCM_FAILED;
+					theLastError << "[ERROR] Unknown output format " << argv[iArg] << std::endl;
+				}
+			}
+		}
+		else if (strcmp(argv[iArg], "-archive") == 0)    // Option -archive appends all scans to an archive file
+		{
+			if (++iArg < argc) {
+				ArchiveFilename = argv[iArg];
+			}
+			if (++iArg < argc) {
+				ArchiveCompress = atoi(argv[iArg]) != 0;
+			}
+		}
+		else if (strcmp(argv[iArg], "-timeline") == 0)    // Option -timeline records a timeline of the driver calls
+		{
+			if (++iArg < argc) {
+				TimelineFilename = argv[iArg];
+			}
+		}
+		else if (strcmp(argv[iArg], "-stats") == 0)    // Option -stats writes the driver statistics to a file
+		{
+			if (++iArg < argc) {
+				theStatsFilename = argv[iArg];
+			}
+		}
+		else if (strcmp(argv[iArg], "-flightrec") == 0)    // Option -flightrec sets the size and threshold of the flight recorder
+		{
+			if (++iArg < argc) {
+				FlightBytes = (size_t)atoi(argv[iArg]) * 1024 * 1024;
+			}
+			if (++iArg < argc) {
+				FlightThreshold = (unsigned int)atoi(argv[iArg]);
+			}
+		}
+		else if (strcmp(argv[iArg], "-emulator") == 0)    // Option -emulator runs against an emulated module instead of the SPI adapter
+		{
+			if (++iArg < argc) {
+				EmulatorSettings = argv[iArg];
+			}
+		}
+		else if (strcmp(argv[iArg], "-faults") == 0)    // Option -faults injects link faults into the SPI transfers
+		{
+			if (++iArg < argc) {
+				FaultSettings = argv[iArg];
+			}
+		}
+		else if (strcmp(argv[iArg], "-replay") == 0)    // Option -replay replays a binary log file instead of using the SPI adapter
+		{
+			if (++iArg < argc) {
+				ReplayFilename = argv[iArg];
+			}
+			if (++iArg < argc) {
+				ReplaySpeed = argv[iArg];
+			}
+		}
 		else if (strcmp(argv[iArg], "-id") == 0)    // Option -id sets the SPI adapter ID
 		{
 			if (++iArg < argc) {
@@ -1727,20 +2824,123 @@ int _tmain(int argc, _TCHAR* argv[])
 				theOsnrRbwTHz = atof(argv[iArg]);
 			}
 		}
+		else if (strcmp(argv[iArg], "-discover") == 0)    // Option -discover sets the channel discovery parameters
+		{
+			if (++iArg < argc && Result == OCM_OK) {
+				theDiscoverySettings.ThresholdDb = atof(argv[iArg]);
+			}
+			if (++iArg < argc && Result == OCM_OK) {
+				theDiscoverySettings.SplitDipDb = atof(argv[iArg]);
+			}
+			if (++iArg < argc && Result == OCM_OK) {
+				theDiscoverySettings.MinWidthTHz = atof(argv[iArg]);
+			}
+		}
+		else if (strcmp(argv[iArg], "-scan50") == 0 || strcmp(argv[iArg], "-scan100") == 0 || strcmp(argv[iArg], "-scanhires") == 0)    // Options -scan50, -scan100 and -scanhires set the scheduling of the serve command
+		{
+			bool is50 = strcmp(argv[iArg], "-scan50") == 0;
+			bool is100 = strcmp(argv[iArg], "-scan100") == 0;
+			OCMSchedPlan_t &Plan = is50 ? theScanPlan50 : is100 ? theScanPlan100 : theScanPlanHires;
+			bool &Enabled = is50 ? theScanPlan50Enabled : is100 ? theScanPlan100Enabled : theScanPlanHiresEnabled;
+			if (++iArg < argc && Result == OCM_OK) {
+				Enabled = true;
+				if (strcmp(argv[iArg], "b2b") == 0) {
+					Plan.Mode = OCM_SCHED_BACKTOBACK;
+				}
+				else if (strcmp(argv[iArg], "fixed") == 0) {
+					Plan.Mode = OCM_SCHED_FIXEDRATE;
+				}
+				else if (strcmp(argv[iArg], "ondemand") == 0) {
+					Plan.Mode = OCM_SCHED_ONDEMAND;
+				}
+				else if (strcmp(argv[iArg], "off") == 0) {
+					Enabled = false;
+				}
+				else {
+					Result = Result || OCM_FAILED;
+					theLastError << "[ERROR] Invalid scan mode " << argv[iArg] << " (b2b, fixed, ondemand or off)" << std::endl;
+				}
+			}
+			if (Enabled && ++iArg < argc && Result == OCM_OK) {
+				Plan.PeriodMs = atoi(argv[iArg]);
+				if (Plan.Mode == OCM_SCHED_FIXEDRATE && Plan.PeriodMs <= 0) {
+					Result = Result || OCM_FAILED;
+					theLastError << "[ERROR] Invalid scan period " << argv[iArg] << std::endl;
+				}
+			}
+			if (Enabled && ++iArg < argc && Result == OCM_OK) {
+				Plan.Priority = atoi(argv[iArg]);
+			}
+		}
+		else if (strcmp(argv[iArg], "-schedreport") == 0)    // Option -schedreport sets the interval of the scan rate report
+		{
+			if (++iArg < argc && Result == OCM_OK) {
+				theSchedReportSec = atoi(argv[iArg]);
+			}
+		}
 		else {
 			break;
 		}
     }
 
+	// Write the log files from a background thread
+	if (theLogFile && theLogTrace) {
+		OCMTransferTrace::open(theLogFile, theLogBufferBytes);
+	}
+	else if (theLogFile) {
+		OCMTraceWriter::attach(theLogFile, theLogBufferBytes);
+	}
+	if (theLogBinFile) {
+		OCMTraceWriter::attach(theLogBinFile, theLogBufferBytes);
+	}
+
+	if (FlightBytes > 0) {
+		OCMFlightRecorder::start(FlightBytes, FlightThreshold);
+	}
+
+	if (!TimelineFilename.empty()) {
+		OCMSpanTracer::setThreadName("main");
+		OCMSpanTracer::start(OCM_SPAN_DEFAULT_MAXEVENTS);
+	}
+
+	if (!ArchiveFilename.empty() && !theArchive.open(ArchiveFilename.c_str(), ArchiveCompress)) {
+		Result = Result || OCM_FAILED;
+		theLastError << "[ERROR] " << theArchive.getLastError() << std::endl;
+	}
+
 	std::ostringstream configString;
 	configString << "id=" << SPIAdapterID << ";spiclk=" << SPIClock;
+	if (!ReplayFilename.empty()) {
+		configString << ";replay=" << ReplayFilename << ";speed=" << ReplaySpeed;
+	}
+	if (!EmulatorSettings.empty()) {
+		configString << ";emulator=1";
+		if (EmulatorSettings != "-") {
+			configString << ";" << EmulatorSettings;
+		}
+	}
+	// The keys of the fault injector are prefixed with "fault" in the configuration string
+	for (size_t start = 0; start < FaultSettings.size();) {
+		size_t end = FaultSettings.find(';', start);
+		if (end == std::string::npos) {
+			end = FaultSettings.size();
+		}
+		if (end > start) {
+			configString << ";fault" << FaultSettings.substr(start, end - start);
+		}
+		start = end + 1;
+	}
 	theConfigString = configString.str();
 
     // Print selected SPI clock rate
     // printf("[INFO] SPICLK = %.1f MHz\n",theSPIClock/1000000.0);
 
     if (argc<iArg+1)
-        Result = Result || commandHelp();
+        Result = Result || commandServe(8888, NULL);
+	else if (strcmp(argv[iArg], "help") == 0)
+		Result = Result || commandHelp();
+	else if (strcmp(argv[iArg], "serve") == 0)
+		Result = Result || commandServe(argc>(iArg + 1) ? (unsigned short)atoi(argv[iArg + 1]) : 8888, argc>(iArg + 2) ? argv[iArg + 2] : NULL);
 	else if (strcmp(argv[iArg], "list") == 0)
 		Result = Result || commandListAdapters();
 	else if (strcmp(argv[iArg], "setid") == 0 && argc>(iArg + 1))
@@ -1761,6 +2961,8 @@ int _tmain(int argc, _TCHAR* argv[])
 		Result = Result || commandSingleScanOSNR();
 	else if (strcmp(argv[iArg],"hammer")==0)
         Result = Result || commandHammer(argc>(iArg+1) ? atoi(argv[iArg+1]) : 0);
+	else if (strcmp(argv[iArg], "bench") == 0 && argc>(iArg+3))
+		Result = Result || commandBench(argv[iArg+1], argv[iArg+2], atoi(argv[iArg+3]), argc>(iArg+4) ? argv[iArg+4] : NULL);
     else if (strcmp(argv[iArg],"dump")==0)
         Result = Result || commandDump();
     else if (strcmp(argv[iArg],"dumpshort")==0)
@@ -1771,16 +2973,18 @@ int _tmain(int argc, _TCHAR* argv[])
         Result = Result || commandITU((int)(atof(argv[iArg+1])*OCM3_FSCALE+0.5),(int)(atof(argv[iArg+2])*OCM3_FSCALE+0.5),atoi(argv[iArg+3]));
     else if (strcmp(argv[iArg],"hires")==0)
         Result = Result || commandHIRES();
+	else if (strcmp(argv[iArg], "discover") == 0)
+		Result = Result || commandDiscover(argc>(iArg+1) ? atoi(argv[iArg+1]) : 0);
     else if (strcmp(argv[iArg],"psa")==0)
         Result = Result || commandMPPW();
     else if (strcmp(argv[iArg],"fwt")==0 && argc>(iArg+1))
-        Result = Result || commandFWT(argv[iArg+1]);
+        Result = Result || commandFWT(argv[iArg+1], argc>(iArg+2) && strcmp(argv[iArg+2],"resume")==0);
     else if (strcmp(argv[iArg],"fws")==0)
         Result = Result || commandFWS();
     else if (strcmp(argv[iArg],"fwe")==0)
         Result = Result || commandFWE();
     else if (strcmp(argv[iArg],"update")==0 && argc>(iArg+1))
-        Result = Result || commandUpdate(argv[iArg+1]);
+        Result = Result || commandUpdate(argv[iArg+1], argc>(iArg+2) && strcmp(argv[iArg+2],"resume")==0);
 	else if (strcmp(argv[iArg], "avg") == 0 && argc>(iArg + 1))
 		Result = Result || commandAVG(atoi(argv[iArg + 1]));
 	else if (strcmp(argv[iArg], "bws") == 0)
@@ -1789,6 +2993,8 @@ int _tmain(int argc, _TCHAR* argv[])
 		Result = Result || commandBWT();
 	else if (strcmp(argv[iArg], "factory") == 0)
 		Result = Result || commandFactory();
+	else if (strcmp(argv[iArg], "archiveread") == 0 && argc>(iArg + 1))
+		Result = Result || commandArchiveRead(argv[iArg + 1], argc>(iArg + 2) ? argv[iArg + 2] : NULL);
 	else
         Result = Result || commandHelp();
 
@@ -1802,11 +3008,26 @@ int _tmain(int argc, _TCHAR* argv[])
 	}
 
 	if (theLogFile) {
-		fclose(theLogFile);
+		closeLogFile(theLogFile, theLogTrace ? "HROCMQuery.trace" : "HROCMQuery.csv");
 	}
 
 	if (theLogBinFile) {
-		fclose(theLogBinFile);
+		closeLogFile(theLogBinFile, "HROCMQuery.bin");
+	}
+
+	theArchive.close();
+	closeFlightRecorder();
+	writeStats();
+
+	if (!TimelineFilename.empty()) {
+		std::string Error;
+		OCMSpanTracer::stop();
+		if (!OCMSpanTracer::writeChromeJson(TimelineFilename.c_str(), Error)) {
+			fprintf(stderr, "[ERROR] %s\n", Error.c_str());
+		}
+		else if (OCMSpanTracer::getDropped() > 0) {
+			fprintf(stderr, "[WARNING] %s: %llu events dropped\n", TimelineFilename.c_str(), OCMSpanTracer::getDropped());
+		}
 	}
 
 	return Result;
@@ -0,0 +1,72 @@
+/*! \mainpage HROCMTrace2Csv
+
+\section tcsec1 Overview
+Converts a transfer trace written by HROCMQueryV3 -logtrace (HROCMQuery.trace) into the CSV format of HROCMQueryV3 -log
+(HROCMQuery.csv), so that the existing spreadsheets and scripts can be used. The trace is memory mapped; the tool does
+not need the module or an SPI adapter and builds on Windows and Linux.
+
+The CRC columns are checked while converting. CRC2 is taken from the check of the driver during the run (see
+OCMTransferTrace.h); it is "???" for the last transfer of the trace.
+
+\section tcsec2 Usage
+@code
+HROCMTrace2Csv HROCMQuery.trace > HROCMQuery.csv
+@endcode
+*/
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include "OCMMappedFile.h"
+#include "OCMTransferTrace.h"
+
+int main(int argc, char* argv[])
+{
+	if (argc != 2) {
+		printf("Usage: HROCMTrace2Csv HROCMQuery.trace > HROCMQuery.csv\n");
+		return 1;
+	}
+
+	OCMMappedFile File;
+	if (!File.open(argv[1])) {
+		fprintf(stderr, "[ERROR] %s\n", File.getLastError().c_str());
+		return 1;
+	}
+
+	OCMTransferTraceHeader_t Header;
+	if (File.size() < sizeof(Header)) {
+		fprintf(stderr, "[ERROR] %s is not a transfer trace\n", argv[1]);
+		return 1;
+	}
+	memcpy(&Header, File.data(), sizeof(Header));
+	if (Header.MAGIC != OCM_TRANSFERTRACE_MAGIC || Header.VERSION != OCM_TRANSFERTRACE_VERSION || Header.EVENTSIZE != sizeof(OCMTransferEvent_t)) {
+		fprintf(stderr, "[ERROR] %s is not a transfer trace of this version\n", argv[1]);
+		return 1;
+	}
+
+	static char OutputBuffer[1 << 20];
+	setvbuf(stdout, OutputBuffer, _IOFBF, sizeof(OutputBuffer));
+	printf("%s\n", OCMTransferTrace::getCsvHeader());
+
+	const char *pEvents = File.data() + sizeof(Header);
+	size_t nEvents = (File.size() - sizeof(Header)) / sizeof(OCMTransferEvent_t);
+	OCMTransferEvent_t Event, Next;
+	if (nEvents > 0) {
+		memcpy(&Next, pEvents, sizeof(Next));
+	}
+	for (size_t i = 0; i < nEvents; ++i) {
+		Event = Next;
+		if (i + 1 < nEvents) {
+			memcpy(&Next, pEvents + (i + 1) * sizeof(Next), sizeof(Next));
+		}
+		char line[OCM_TRANSFERTRACE_MAXLINE];
+		OCMTransferTrace::formatCsv(Event, i + 1 < nEvents ? &Next : NULL, line, sizeof(line));
+		fputs(line, stdout);
+	}
+	fflush(stdout);
+
+	if ((File.size() - sizeof(Header)) % sizeof(OCMTransferEvent_t) != 0) {
+		fprintf(stderr, "[WARNING] Last event truncated\n");
+	}
+
+	return 0;
+}
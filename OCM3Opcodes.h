@@ -0,0 +1,35 @@
+//
+// Opcodes and constants of the V3 SPI protocol (used by FinisarHROCM_V3 and SPIAdapterEmulator)
+//
+#pragma once
+
+#define OPCODE_NOP			0x01
+#define OPCODE_RES			0x02
+#define OPCODE_MID			0x03
+#define OPCODE_CLE			0x04
+#define OPCODE_TPC			0x06
+#define OPCODE_FWT			0x07
+#define OPCODE_FWS			0x08
+#define OPCODE_FWE			0x09
+#define OPCODE_GETDEV		0x0A
+#define OPCODE_SETMPPW		0x0B
+#define OPCODE_GETMPPW		0x0C
+#define OPCODE_GETMPW		0x0D
+#define OPCODE_SETMPVC		0x0E
+#define OPCODE_GETMPVC		0x0F
+#define OPCODE_GETMVC		0x10
+#define OPCODE_SETMPCS		0x11
+#define OPCODE_GETMPCS		0x12
+#define OPCODE_GETMCS		0x13
+#define OPCODE_SETMPOSNR	0x14
+#define OPCODE_GETMPOSNR	0x15
+#define OPCODE_GETMOSNR		0x16
+#define OPCODE_SETMPCP		0x17
+#define OPCODE_GETMPCP		0x18
+#define OPCODE_GETMCP		0x19
+#define OPCODE_ATG			0x1C
+#define OPCODE_ATS			0x1D
+#define OPCODE_ATC			0x1E
+
+#define OCM_SPIMAGIC_V1		0xF0E1D2C3
+#define OCM_SPIMAGIC_V3		0xF0E1C387
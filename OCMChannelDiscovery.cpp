@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "OCMChannelDiscovery.h"
+
+OCMChannelDiscovery::OCMChannelDiscovery() : _lastRDataDEV()
+{
+	_settings	= defaultSettings();
+	_isValid	= false;
+}
+
+OCMDiscoverySettings_t OCMChannelDiscovery::defaultSettings()
+{
+	OCMDiscoverySettings_t Settings;
+
+	Settings.ThresholdDb	= 10.0;
+	Settings.SplitDipDb		= 3.0;
+	Settings.MinWidthTHz	= 0.005;
+	Settings.ChangeTolTHz	= 0.00125;
+	Settings.KeepoutScale	= 0.010 / 0.05;		// Same ratios as the itu command defaults on a 50GHz grid
+	Settings.NoiseScale		= 0.025 / 0.05;
+	Settings.TagRangeScale	= 0.010 / 0.05;
+	Settings.BwScale		= 0.010 / 0.05;
+	Settings.ThresDb		= 3.0;
+	Settings.RbwTHz			= 0.0125;
+
+	return Settings;
+}
+
+void OCMChannelDiscovery::reset()
+{
+	_channels.clear();
+	_isValid = false;
+}
+
+OCM_Error_t OCMChannelDiscovery::update(const OCM3_RDataDEV_t &RDataDEV, const std::vector<OCM3_GMPWRecord_t> &HiRes, bool &planChanged)
+{
+	planChanged = false;
+	_lastError.clear();
+
+	if (RDataDEV.SLW == 0 || RDataDEV.Smax == 0) {
+		_lastError = "Could not determine module scan range";
+		return OCM_FAILED;
+	}
+
+	// Collect the high-resolution section. It ends with the first channel that is wider than one slice.
+	_slice.clear();
+	_power.clear();
+	for (unsigned int i = 0; i < HiRes.size(); ++i) {
+		if (HiRes[i].SLICESTART != HiRes[i].SLICEEND) {
+			break;
+		}
+		if (!_slice.empty() && HiRes[i].SLICESTART <= _slice.back()) {
+			_lastError = "High-resolution section is not in ascending slice order";
+			return OCM_FAILED;
+		}
+		_slice.push_back(HiRes[i].SLICESTART);
+		_power.push_back(HiRes[i].POWER / OCM3_PSCALE);
+	}
+
+	const int n = (int)_slice.size();
+	if (n < 3) {
+		_lastError = "No high-resolution scan available. Use the hires command to set up the channel plan.";
+		return OCM_FAILED;
+	}
+
+	// Smooth with a 3-slice moving average to suppress single-slice spikes
+	_smooth.resize(n);
+	_smooth[0] = _power[0];
+	_smooth[n - 1] = _power[n - 1];
+	for (int i = 1; i < n - 1; ++i) {
+		_smooth[i] = (_power[i - 1] + _power[i] + _power[i + 1]) / 3;
+	}
+
+	// Noise floor estimate: 10th percentile of the smoothed spectrum
+	_sorted = _smooth;
+	std::nth_element(_sorted.begin(), _sorted.begin() + n / 10, _sorted.end());
+	const double floorDb = _sorted[n / 10];
+	const double levelDb = floorDb + _settings.ThresholdDb;
+	const double shoulderDb = floorDb + _settings.ThresholdDb / 2;
+
+	const int minWidthSlices = std::max(1, (int)round(_settings.MinWidthTHz * OCM3_FSCALE / RDataDEV.SLW));
+
+	// Find the occupied regions and split them at deep dips between neighbouring peaks
+	std::vector<OCMDiscoveredChannel_t> Channels;
+	int lastEnd = -1; // Index of the last slice assigned to a channel
+	for (int i = 0; i < n; ) {
+		if (_smooth[i] <= levelDb) {
+			++i;
+			continue;
+		}
+
+		int a = i;
+		while (i < n && _smooth[i] > levelDb) {
+			++i;
+		}
+		int b = i - 1;
+
+		// Walk through the region. Whenever the signal rises by SplitDipDb after having dropped by
+		// SplitDipDb from the previous peak, the region is split at the dip.
+		std::vector<std::pair<int, int> > Segments;
+		int segStart = a;
+		double peakVal = _smooth[a];
+		int dipIdx = -1;
+		double dipVal = 0;
+		for (int k = a + 1; k <= b; ++k) {
+			double v = _smooth[k];
+			if (dipIdx < 0) {
+				if (v >= peakVal) {
+					peakVal = v;
+				}
+				else {
+					dipVal = v;
+					dipIdx = k;
+				}
+			}
+			else if (v < dipVal) {
+				dipVal = v;
+				dipIdx = k;
+			}
+			else if (v - dipVal >= _settings.SplitDipDb && peakVal - dipVal >= _settings.SplitDipDb) {
+				Segments.push_back(std::make_pair(segStart, dipIdx - 1));
+				segStart = dipIdx + 1;
+				peakVal = v;
+				dipIdx = -1;
+			}
+			else if (v >= peakVal) {
+				peakVal = v;
+				dipIdx = -1;
+			}
+		}
+		Segments.push_back(std::make_pair(segStart, b));
+
+		for (unsigned int s = 0; s < Segments.size(); ++s) {
+			int first = Segments[s].first;
+			int last = Segments[s].second;
+
+			// Extend the outer edges down the roll-off of the channel
+			if (s == 0) {
+				while (first - 1 > lastEnd && _smooth[first - 1] < _smooth[first] && _smooth[first - 1] > shoulderDb) {
+					--first;
+				}
+			}
+			if (s == Segments.size() - 1) {
+				while (last + 1 < n && _smooth[last + 1] < _smooth[last] && _smooth[last + 1] > shoulderDb) {
+					++last;
+				}
+			}
+
+			if (_slice[last] - _slice[first] + 1 < minWidthSlices) {
+				continue;
+			}
+
+			OCMDiscoveredChannel_t Channel;
+			int peak = first;
+			for (int k = first + 1; k <= last; ++k) {
+				if (_power[k] > _power[peak]) {
+					peak = k;
+				}
+			}
+			Channel.SliceStart		= _slice[first];
+			Channel.SliceEnd		= _slice[last];
+			Channel.SlicePeak		= _slice[peak];
+			Channel.PeakPowerDbm	= _power[peak];
+			Channels.push_back(Channel);
+			lastEnd = last;
+		}
+
+		i = std::max(i, lastEnd + 1);
+	}
+
+	if (_isValid && isSamePlan(Channels) && RDataDEV.SLW == _lastRDataDEV.SLW && RDataDEV.FSF == _lastRDataDEV.FSF) {
+		// Keep the current edges so that the plan stays stable, only refresh the peak values
+		for (unsigned int k = 0; k < _channels.size(); ++k) {
+			_channels[k].SlicePeak = Channels[k].SlicePeak;
+			_channels[k].PeakPowerDbm = Channels[k].PeakPowerDbm;
+		}
+	}
+	else {
+		_channels.swap(Channels);
+		_lastRDataDEV = RDataDEV;
+		_isValid = true;
+		planChanged = true;
+	}
+
+	return OCM_OK;
+}
+
+bool OCMChannelDiscovery::isSamePlan(const std::vector<OCMDiscoveredChannel_t> &Channels) const
+{
+	if (Channels.size() != _channels.size()) {
+		return false;
+	}
+
+	const int tolSlices = (int)round(_settings.ChangeTolTHz * OCM3_FSCALE / _lastRDataDEV.SLW);
+	for (unsigned int k = 0; k < Channels.size(); ++k) {
+		if (abs(Channels[k].SliceStart - _channels[k].SliceStart) > tolSlices || abs(Channels[k].SliceEnd - _channels[k].SliceEnd) > tolSlices) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void OCMChannelDiscovery::getMPPWVector(std::vector<OCM3_MPPWRecord_t> &MPPWVector) const
+{
+	MPPWVector.resize(_channels.size());
+	for (unsigned int k = 0; k < _channels.size(); ++k) {
+		MPPWVector[k].PORTNO		= 1;
+		MPPWVector[k].SLICESTART	= _channels[k].SliceStart;
+		MPPWVector[k].SLICEEND		= _channels[k].SliceEnd;
+	}
+}
+
+void OCMChannelDiscovery::getMPOSNRVector(std::vector<OCM3_MPOSNRRecord_t> &MPOSNRVector) const
+{
+	MPOSNRVector.resize(_channels.size());
+	for (unsigned int k = 0; k < _channels.size(); ++k) {
+		const OCMDiscoveredChannel_t &Channel = _channels[k];
+		int width = Channel.SliceEnd - Channel.SliceStart + 1;
+		int center = (Channel.SliceStart + Channel.SliceEnd) / 2;
+
+		// Ranges are measured from the channel center (like the itu command does). The noise search must
+		// not reach into the neighbouring channels.
+		int maxLower = k > 0 ? center - _channels[k - 1].SliceEnd : center - 1;
+		int maxUpper = k + 1 < _channels.size() ? _channels[k + 1].SliceStart - center : _lastRDataDEV.Smax - center;
+		int noiseLower = std::min((int)round(_settings.NoiseScale * width), std::max(maxLower, 1));
+		int noiseUpper = std::min((int)round(_settings.NoiseScale * width), std::max(maxUpper, 1));
+		int keepout = (int)round(_settings.KeepoutScale * width);
+
+		OCM3_MPOSNRRecord_t &Record = MPOSNRVector[k];
+		Record.PORTNO		= 1;
+		Record.CENTERSTART	= Channel.SliceStart;
+		Record.CENTERSTOP	= Channel.SliceEnd;
+		Record.KEEPOUTLOWER	= std::max(0, std::min(keepout, noiseLower - 1));
+		Record.KEEPOUTUPPER	= std::max(0, std::min(keepout, noiseUpper - 1));
+		Record.NOISELOWER	= noiseLower;
+		Record.NOISEUPPER	= noiseUpper;
+		if (_lastRDataDEV.BWXB == 'T') {
+			Record.CENTERBWTHRES = (unsigned short)round(_settings.ThresDb * OCM3_PSCALE);
+		}
+		else {
+			Record.CENTERBWTHRES = (unsigned short)std::max(0.0, round((_settings.BwScale * width - 1) / 2));
+		}
+		Record.TAGRANGE		= (unsigned short)std::max(0.0, round((_settings.TagRangeScale * width - 1) / 2));
+		Record.RBW			= (unsigned short)round(_settings.RbwTHz * OCM3_RBWSCALE);
+	}
+}
@@ -0,0 +1,84 @@
+//
+// Channel discovery on high-resolution scans
+//
+// Runs a peak/edge detection on the result of a high-resolution scan (see commandHIRES), infers
+// the occupied channels (center and width, no fixed grid assumed) and derives matching MPPW and
+// MPOSNR channel plans. The OSNR keep-out, noise and tag ranges are scaled to the width of each
+// channel and clamped to the gap to the neighbouring channels.
+//
+// The engine keeps the last detected channel set. update() only reports a changed plan if a
+// channel appeared, disappeared or one of its edges moved by more than the configured tolerance,
+// so the MPOSNR plan only has to be uploaded again when the spectrum actually changed (the MPPW
+// plan is replaced by every high-resolution scan, see discover {period} in HROCMQueryV3.cpp).
+//
+#pragma once
+
+#include <vector>
+#include "FinisarHROCM_V3.h"
+
+// Settings for the channel discovery
+typedef struct {
+	double ThresholdDb;		// Minimum height of a channel above the noise floor in dB
+	double SplitDipDb;		// Adjacent channels are split at a dip at least this deep below both peaks in dB
+	double MinWidthTHz;		// Occupied regions narrower than this are ignored (spurs, noise spikes)
+	double ChangeTolTHz;	// An edge has to move by more than this before the plan is considered changed
+	double KeepoutScale;	// Keep-out range as a fraction of the channel width
+	double NoiseScale;		// Noise tag search range as a fraction of the channel width
+	double TagRangeScale;	// Width of each noise tag as a fraction of the channel width
+	double BwScale;			// Signal bandwidth as a fraction of the channel width (BWXB = 'S')
+	double ThresDb;			// Threshold for the signal power calculation in dB (BWXB = 'T')
+	double RbwTHz;			// Resolution bandwidth for the OSNR calculation in THz
+} OCMDiscoverySettings_t;
+
+// A channel found by the discovery (slice numbers are 1-based)
+typedef struct {
+	int SliceStart;			// First occupied slice
+	int SliceEnd;			// Last occupied slice
+	int SlicePeak;			// Slice with the highest power
+	double PeakPowerDbm;	// Power of the peak slice in dBm
+} OCMDiscoveredChannel_t;
+
+class OCMChannelDiscovery
+{
+public:
+	OCMChannelDiscovery();
+
+	// Default settings. The scale factors correspond to the defaults of the itu command on a 50GHz grid.
+	static OCMDiscoverySettings_t defaultSettings();
+
+	void setSettings(const OCMDiscoverySettings_t &Settings) { _settings = Settings; }
+	const OCMDiscoverySettings_t &getSettings() const { return _settings; }
+
+	// Forget the previous result. The next update() always reports a changed plan.
+	void reset();
+
+	// Run the detection on a high-resolution scan. HiRes has to contain the one-slice-wide channels of
+	// the scan in ascending order (the hires channel plan). planChanged is set if the channel set differs
+	// from the one of the previous call.
+	OCM_Error_t update(const OCM3_RDataDEV_t &RDataDEV, const std::vector<OCM3_GMPWRecord_t> &HiRes, bool &planChanged);
+
+	// Channels found by the last update()
+	const std::vector<OCMDiscoveredChannel_t> &getChannels() const { return _channels; }
+
+	// Channel plans for the channels found by the last update()
+	void getMPPWVector(std::vector<OCM3_MPPWRecord_t> &MPPWVector) const;
+	void getMPOSNRVector(std::vector<OCM3_MPOSNRRecord_t> &MPOSNRVector) const;
+
+	// Error message of the last failed update()
+	const std::string &getLastError() const { return _lastError; }
+
+private:
+	bool isSamePlan(const std::vector<OCMDiscoveredChannel_t> &Channels) const;
+
+	OCMDiscoverySettings_t				_settings;
+	OCM3_RDataDEV_t						_lastRDataDEV;	// Slice geometry of the last update()
+	std::vector<OCMDiscoveredChannel_t>	_channels;		// Result of the last update()
+	bool								_isValid;		// true : _channels holds a result
+	std::string							_lastError;
+
+	// Work buffers, reused by the runs of a repeated discovery (discover {period})
+	std::vector<int>					_slice;
+	std::vector<double>					_power;
+	std::vector<double>					_smooth;
+	std::vector<double>					_sorted;
+};
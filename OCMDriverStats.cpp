@@ -0,0 +1,326 @@
+#include "stdafx.h"
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "OCMDriverStats.h"
+#include "OCMTransferTrace.h"
+
+static const char *const driverStatsPhases[OCM_STATS_NPHASES] = { "TRANSFER", "ACCEPT", "TASK", "FETCH", "SCAN", "POLLS", "BYTES" };
+static const char *const driverStatsUnits[OCM_STATS_NPHASES] = { "us", "us", "us", "us", "us", "polls", "bytes" };
+
+// Modules and the driver instances attached to them
+typedef struct {
+	std::atomic<const void*>		pOwner;
+	std::atomic<OCMDriverStats*>	pStats;
+} DriverStatsOwner_t;
+
+static std::mutex &driverStatsMutex()
+{
+	static std::mutex Mutex;
+	return Mutex;
+}
+
+static std::map<std::string, std::unique_ptr<OCMDriverStats> > &driverStatsModules()
+{
+	static std::map<std::string, std::unique_ptr<OCMDriverStats> > Modules;
+	return Modules;
+}
+
+static DriverStatsOwner_t *driverStatsOwners()
+{
+	static DriverStatsOwner_t Owners[OCM_STATS_MAXOWNERS];
+	return Owners;
+}
+
+OCMLatencyHistogram::OCMLatencyHistogram()
+{
+	reset();
+}
+
+void OCMLatencyHistogram::reset()
+{
+	for (size_t i = 0; i < OCM_STATS_NBUCKETS; ++i) {
+		_buckets[i].store(0, std::memory_order_relaxed);
+	}
+	_count.store(0, std::memory_order_relaxed);
+	_total.store(0, std::memory_order_relaxed);
+	_min.store(~0ULL, std::memory_order_relaxed);
+	_max.store(0, std::memory_order_relaxed);
+}
+
+void OCMLatencyHistogram::record(unsigned long long value)
+{
+	_buckets[getBucket(value)].fetch_add(1, std::memory_order_relaxed);
+	_count.fetch_add(1, std::memory_order_relaxed);
+	_total.fetch_add(value, std::memory_order_relaxed);
+
+	unsigned long long current = _min.load(std::memory_order_relaxed);
+	while (value < current && !_min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+	}
+	current = _max.load(std::memory_order_relaxed);
+	while (value > current && !_max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+	}
+}
+
+unsigned long long OCMLatencyHistogram::getMin() const
+{
+	return getCount() > 0 ? _min.load(std::memory_order_relaxed) : 0;
+}
+
+double OCMLatencyHistogram::getMean() const
+{
+	unsigned long long count = getCount();
+	return count > 0 ? (double)getTotal() / count : 0.0;
+}
+
+unsigned long long OCMLatencyHistogram::getPercentile(double percent) const
+{
+	unsigned long long count = getCount();
+	if (count == 0) {
+		return 0;
+	}
+
+	// Rank of the value, rounded up
+	unsigned long long rank = (unsigned long long)(percent / 100.0 * count + 0.999999);
+	rank = rank < 1 ? 1 : rank > count ? count : rank;
+
+	unsigned long long seen = 0;
+	for (size_t i = 0; i < OCM_STATS_NBUCKETS; ++i) {
+		seen += _buckets[i].load(std::memory_order_relaxed);
+		if (seen >= rank) {
+			unsigned long long value = getBucketMax(i);
+			return value < getMax() ? value : getMax();
+		}
+	}
+	return getMax();
+}
+
+// Values below 2*OCM_STATS_SUBBUCKETS map to themselves. Above, the bucket is given by the position of the
+// highest bit and the OCM_STATS_SUBBUCKETS values below it.
+size_t OCMLatencyHistogram::getBucket(unsigned long long value)
+{
+	if (value < 2 * OCM_STATS_SUBBUCKETS) {
+		return (size_t)value;
+	}
+	if (value >> 32 != 0) {
+		return OCM_STATS_NBUCKETS - 1;
+	}
+
+	int msb = 0;
+	while ((value >> (msb + 1)) != 0) {
+		++msb;
+	}
+	unsigned long long mantissa = value >> (msb - 5);		// OCM_STATS_SUBBUCKETS .. 2*OCM_STATS_SUBBUCKETS-1
+	return (size_t)(msb - 4) * OCM_STATS_SUBBUCKETS + (size_t)(mantissa - OCM_STATS_SUBBUCKETS);
+}
+
+unsigned long long OCMLatencyHistogram::getBucketMax(size_t bucket)
+{
+	if (bucket < 2 * OCM_STATS_SUBBUCKETS) {
+		return bucket;
+	}
+	int msb = (int)(bucket / OCM_STATS_SUBBUCKETS) + 4;
+	unsigned long long mantissa = bucket % OCM_STATS_SUBBUCKETS + OCM_STATS_SUBBUCKETS;
+	return ((mantissa + 1) << (msb - 5)) - 1;
+}
+
+OCMDriverStats::OCMDriverStats(const std::string &Name)
+{
+	_name = Name;
+	for (int phase = 0; phase < OCM_STATS_NPHASES; ++phase) {
+		for (int opcode = 0; opcode < OCM_STATS_NOPCODES; ++opcode) {
+			_histograms[phase][opcode].store(NULL, std::memory_order_relaxed);
+		}
+	}
+	_polls.store(0, std::memory_order_relaxed);
+	_scanSeqNum.store(0, std::memory_order_relaxed);
+	_scanResults.store(0, std::memory_order_relaxed);
+	_scanStartUs.store(0, std::memory_order_relaxed);
+	_scanAcceptUs.store(0, std::memory_order_relaxed);
+	_scanPolls.store(0, std::memory_order_relaxed);
+}
+
+OCMDriverStats::~OCMDriverStats()
+{
+	for (int phase = 0; phase < OCM_STATS_NPHASES; ++phase) {
+		for (int opcode = 0; opcode < OCM_STATS_NOPCODES; ++opcode) {
+			delete _histograms[phase][opcode].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+void OCMDriverStats::record(int phase, unsigned int opcode, unsigned long long value)
+{
+	if (phase < 0 || phase >= OCM_STATS_NPHASES || opcode >= OCM_STATS_NOPCODES) {
+		return;
+	}
+
+	// The first thread to record allocates the histogram
+	std::atomic<OCMLatencyHistogram*> &Slot = _histograms[phase][opcode];
+	OCMLatencyHistogram *pHistogram = Slot.load(std::memory_order_acquire);
+	if (pHistogram == NULL) {
+		OCMLatencyHistogram *pNew = new OCMLatencyHistogram();
+		if (Slot.compare_exchange_strong(pHistogram, pNew, std::memory_order_acq_rel)) {
+			pHistogram = pNew;
+		}
+		else {
+			delete pNew;
+		}
+	}
+	pHistogram->record(value);
+}
+
+const OCMLatencyHistogram *OCMDriverStats::getHistogram(int phase, unsigned int opcode) const
+{
+	if (phase < 0 || phase >= OCM_STATS_NPHASES || opcode >= OCM_STATS_NOPCODES) {
+		return NULL;
+	}
+	return _histograms[phase][opcode].load(std::memory_order_acquire);
+}
+
+const OCMLatencyHistogram *OCMDriverStats::getHistogram(int phase) const
+{
+	for (unsigned int opcode = 0; opcode < OCM_STATS_NOPCODES; ++opcode) {
+		const OCMLatencyHistogram *pHistogram = getHistogram(phase, opcode);
+		if (pHistogram != NULL) {
+			return pHistogram;
+		}
+	}
+	return NULL;
+}
+
+void OCMDriverStats::beginScan(unsigned int TxSeqNum, unsigned int nResults, unsigned long long startUs)
+{
+	_scanSeqNum.store(TxSeqNum, std::memory_order_relaxed);
+	_scanResults.store(nResults, std::memory_order_relaxed);
+	_scanStartUs.store(startUs, std::memory_order_relaxed);
+	_scanAcceptUs.store(0, std::memory_order_relaxed);
+	_scanPolls.store(_polls.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void OCMDriverStats::acceptScan(unsigned int TxSeqNum, unsigned long long nowUs)
+{
+	if (_scanSeqNum.load(std::memory_order_relaxed) == TxSeqNum) {
+		_scanAcceptUs.store(nowUs, std::memory_order_relaxed);
+	}
+}
+
+void OCMDriverStats::completeTask(unsigned int TxSeqNum, unsigned int opcode, unsigned long long nowUs)
+{
+	unsigned long long acceptUs = _scanAcceptUs.load(std::memory_order_relaxed);
+	if (_scanSeqNum.load(std::memory_order_relaxed) == TxSeqNum && acceptUs != 0) {
+		record(OCM_STATS_TASK, opcode, nowUs - acceptUs);
+	}
+}
+
+void OCMDriverStats::endScan(unsigned int TxSeqNum, unsigned int opcode, unsigned long long nowUs)
+{
+	unsigned int nResults = _scanResults.load(std::memory_order_relaxed);
+	if (_scanSeqNum.load(std::memory_order_relaxed) != TxSeqNum || nResults == 0) {
+		return;
+	}
+	_scanResults.store(nResults - 1, std::memory_order_relaxed);
+	if (nResults > 1) {
+		return;
+	}
+	unsigned long long startUs = _scanStartUs.exchange(0, std::memory_order_relaxed);
+	if (startUs != 0) {
+		record(OCM_STATS_SCAN, opcode, nowUs - startUs);
+		record(OCM_STATS_POLLS, opcode, _polls.load(std::memory_order_relaxed) - _scanPolls.load(std::memory_order_relaxed));
+	}
+}
+
+void OCMDriverStats::writeCsvHeader(FILE *f)
+{
+	fprintf(f, "Module,Phase,Opcode,Unit,Count,Total,Min,Mean,P50,P90,P99,P999,Max\n");
+}
+
+void OCMDriverStats::writeCsv(FILE *f) const
+{
+	for (int phase = 0; phase < OCM_STATS_NPHASES; ++phase) {
+		for (unsigned int opcode = 0; opcode < OCM_STATS_NOPCODES; ++opcode) {
+			const OCMLatencyHistogram *pHistogram = getHistogram(phase, opcode);
+			if (pHistogram == NULL) {
+				continue;
+			}
+			fprintf(f, "%s,%s,%s,%s,%llu,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu\n", _name.c_str(), getPhaseName(phase),
+				getOpcodeName(opcode), driverStatsUnits[phase], pHistogram->getCount(), pHistogram->getTotal(),
+				pHistogram->getMin(), pHistogram->getMean(), pHistogram->getPercentile(50.0), pHistogram->getPercentile(90.0),
+				pHistogram->getPercentile(99.0), pHistogram->getPercentile(99.9), pHistogram->getMax());
+		}
+	}
+}
+
+const char *OCMDriverStats::getPhaseName(int phase)
+{
+	return phase >= 0 && phase < OCM_STATS_NPHASES ? driverStatsPhases[phase] : "???";
+}
+
+const char *OCMDriverStats::getOpcodeName(unsigned int opcode)
+{
+	return opcode == 0 ? "POLL" : OCMTransferTrace::getOpcodeName(opcode);
+}
+
+unsigned long long OCMDriverStats::nowUs()
+{
+	return (unsigned long long)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+OCMDriverStats *OCMDriverStats::findModule(const std::string &Name)
+{
+	std::lock_guard<std::mutex> Lock(driverStatsMutex());
+	std::unique_ptr<OCMDriverStats> &pStats = driverStatsModules()[Name];
+	if (!pStats) {
+		pStats.reset(new OCMDriverStats(Name));
+	}
+	return pStats.get();
+}
+
+std::vector<OCMDriverStats*> OCMDriverStats::getModules()
+{
+	std::lock_guard<std::mutex> Lock(driverStatsMutex());
+	std::vector<OCMDriverStats*> Modules;
+	for (std::map<std::string, std::unique_ptr<OCMDriverStats> >::iterator it = driverStatsModules().begin(); it != driverStatsModules().end(); ++it) {
+		Modules.push_back(it->second.get());
+	}
+	return Modules;
+}
+
+// Instances beyond OCM_STATS_MAXOWNERS are not measured
+void OCMDriverStats::attach(const void *pOwner, const std::string &Name)
+{
+	OCMDriverStats *pStats = findModule(Name);
+
+	std::lock_guard<std::mutex> Lock(driverStatsMutex());
+	DriverStatsOwner_t *pOwners = driverStatsOwners();
+	for (size_t i = 0; i < OCM_STATS_MAXOWNERS; ++i) {
+		if (pOwners[i].pOwner.load(std::memory_order_relaxed) == NULL) {
+			pOwners[i].pStats.store(pStats, std::memory_order_relaxed);
+			pOwners[i].pOwner.store(pOwner, std::memory_order_release);
+			return;
+		}
+	}
+}
+
+void OCMDriverStats::detach(const void *pOwner)
+{
+	std::lock_guard<std::mutex> Lock(driverStatsMutex());
+	DriverStatsOwner_t *pOwners = driverStatsOwners();
+	for (size_t i = 0; i < OCM_STATS_MAXOWNERS; ++i) {
+		if (pOwners[i].pOwner.load(std::memory_order_relaxed) == pOwner) {
+			pOwners[i].pOwner.store(NULL, std::memory_order_release);
+		}
+	}
+}
+
+OCMDriverStats *OCMDriverStats::get(const void *pOwner)
+{
+	DriverStatsOwner_t *pOwners = driverStatsOwners();
+	for (size_t i = 0; i < OCM_STATS_MAXOWNERS; ++i) {
+		if (pOwners[i].pOwner.load(std::memory_order_acquire) == pOwner) {
+			return pOwners[i].pStats.load(std::memory_order_relaxed);
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,135 @@
+//
+// Latency histograms and counters of FinisarHROCM_V3 (-stats, see HROCMQueryV3.cpp)
+//
+// The driver measures every SPI transfer and every phase of a command and records the result per opcode
+// (names of OCM3_ParseOPCODE; polls are transfers of an all-zero command and are recorded as POLL):
+// - OCM_STATS_TRANSFER: duration of the SPI transfer, without the recovery time of the module,
+// - OCM_STATS_ACCEPT: command sent until the module accepted it (TPC, simple commands),
+// - OCM_STATS_TASK: TPC accepted until the task is seen complete (GETMPW: power, GETMOSNR: OSNR),
+// - OCM_STATS_FETCH: result requested until its RDATA has been read (GETMPW, GETMOSNR, GETDEV),
+// - OCM_STATS_SCAN: TPC sent until the last result of its tasks (power, OSNR) has been read (TPC),
+// - OCM_STATS_POLLS: polls from TPC sent until the last result has been read (TPC),
+// - OCM_STATS_BYTES: bytes per transfer in each direction.
+// Times are in microseconds.
+//
+// The histograms are log-linear (HDR style): values below 2*OCM_STATS_SUBBUCKETS have their own bucket,
+// above that each power of two is split into OCM_STATS_SUBBUCKETS buckets, so percentiles are accurate to
+// 1/OCM_STATS_SUBBUCKETS (3%) up to 2^32. Recording is lock-free (relaxed atomic increments) and safe from
+// any thread; reading while recording gives a consistent enough snapshot for reporting.
+//
+// The statistics are kept per module (SPI adapter ID) for the lifetime of the process; a driver instance
+// attaches to the statistics of its module when it is created.
+//
+#pragma once
+
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Phases
+#define OCM_STATS_TRANSFER		0
+#define OCM_STATS_ACCEPT		1
+#define OCM_STATS_TASK			2
+#define OCM_STATS_FETCH			3
+#define OCM_STATS_SCAN			4
+#define OCM_STATS_POLLS			5
+#define OCM_STATS_BYTES			6
+#define OCM_STATS_NPHASES		7
+
+#define OCM_STATS_NOPCODES		32				// Opcode slots; 0 holds the polls
+#define OCM_STATS_SUBBUCKETS	32
+#define OCM_STATS_NBUCKETS		(OCM_STATS_SUBBUCKETS * 28)	// Up to 2^32
+#define OCM_STATS_MAXOWNERS		64				// Driver instances attached at the same time
+
+class OCMLatencyHistogram
+{
+public:
+	OCMLatencyHistogram();
+
+	void record(unsigned long long value);
+
+	// Remove all values. Not atomic as a whole: values recorded at the same time may be lost.
+	void reset();
+
+	unsigned long long getCount() const { return _count.load(std::memory_order_relaxed); }
+	unsigned long long getTotal() const { return _total.load(std::memory_order_relaxed); }
+	unsigned long long getMin() const;
+	unsigned long long getMax() const { return _max.load(std::memory_order_relaxed); }
+	double getMean() const;
+
+	// Smallest value v such that at least percent % of the values are <= v (upper edge of its bucket)
+	unsigned long long getPercentile(double percent) const;
+
+private:
+	OCMLatencyHistogram(const OCMLatencyHistogram&);
+	OCMLatencyHistogram &operator=(const OCMLatencyHistogram&);
+
+	static size_t getBucket(unsigned long long value);
+	static unsigned long long getBucketMax(size_t bucket);
+
+	std::atomic<unsigned long long>	_buckets[OCM_STATS_NBUCKETS];
+	std::atomic<unsigned long long>	_count;
+	std::atomic<unsigned long long>	_total;
+	std::atomic<unsigned long long>	_min;
+	std::atomic<unsigned long long>	_max;
+};
+
+class OCMDriverStats
+{
+public:
+	OCMDriverStats(const std::string &Name);
+	~OCMDriverStats();
+
+	const std::string &getName() const { return _name; }
+
+	void record(int phase, unsigned int opcode, unsigned long long value);
+
+	// Histogram of a phase and opcode, NULL if nothing has been recorded
+	const OCMLatencyHistogram *getHistogram(int phase, unsigned int opcode) const;
+
+	// First histogram of a phase (SCAN and POLLS are only recorded for TPC)
+	const OCMLatencyHistogram *getHistogram(int phase) const;
+
+	// Steps of a scan: TPC sent (nResults: results its tasks produce), TPC accepted, task complete (opcode of
+	// the result), result read (opcode of the TPC; the scan ends with the last one). Only the last TPC is
+	// followed; calls for other sequence numbers are ignored.
+	void beginScan(unsigned int TxSeqNum, unsigned int nResults, unsigned long long startUs);
+	void acceptScan(unsigned int TxSeqNum, unsigned long long nowUs);
+	void completeTask(unsigned int TxSeqNum, unsigned int opcode, unsigned long long nowUs);
+	void endScan(unsigned int TxSeqNum, unsigned int opcode, unsigned long long nowUs);
+
+	void addPoll() { _polls.fetch_add(1, std::memory_order_relaxed); }
+
+	// One line per histogram: Module,Phase,Opcode,Unit,Count,Total,Min,Mean,P50,P90,P99,P999,Max
+	static void writeCsvHeader(FILE *f);
+	void writeCsv(FILE *f) const;
+
+	static const char *getPhaseName(int phase);
+	static const char *getOpcodeName(unsigned int opcode);
+
+	// Monotonic time in microseconds
+	static unsigned long long nowUs();
+
+	// Statistics of module Name, created on first use. The objects live until the process exits.
+	static OCMDriverStats *findModule(const std::string &Name);
+	static std::vector<OCMDriverStats*> getModules();
+
+	// Statistics used by a driver instance. get() does not lock.
+	static void attach(const void *pOwner, const std::string &Name);
+	static void detach(const void *pOwner);
+	static OCMDriverStats *get(const void *pOwner);
+
+private:
+	OCMDriverStats(const OCMDriverStats&);
+	OCMDriverStats &operator=(const OCMDriverStats&);
+
+	std::string								_name;
+	std::atomic<OCMLatencyHistogram*>		_histograms[OCM_STATS_NPHASES][OCM_STATS_NOPCODES];	// Allocated on first use
+	std::atomic<unsigned long long>			_polls;
+	std::atomic<unsigned int>				_scanSeqNum;		// TxSeqNum of the last TPC
+	std::atomic<unsigned int>				_scanResults;		// Results of the scan not read yet
+	std::atomic<unsigned long long>			_scanStartUs;		// 0 after the scan has been recorded
+	std::atomic<unsigned long long>			_scanAcceptUs;		// 0 until the TPC has been accepted
+	std::atomic<unsigned long long>			_scanPolls;			// _polls when the TPC was sent
+};
@@ -0,0 +1,296 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include "OCMFlightRecorder.h"
+
+#define OCM_FLIGHT_MAGIC	0xBEEFBEEF		// Start of a record in -logbin files
+
+// Process-wide recorder
+static std::mutex &flightRegistryMutex()
+{
+	static std::mutex Mutex;
+	return Mutex;
+}
+
+static std::shared_ptr<OCMFlightRecorder> &flightRegistry()
+{
+	static std::shared_ptr<OCMFlightRecorder> Recorder;
+	return Recorder;
+}
+
+// Incremented by start() and stop(), tells find() when its per-thread copy is out of date
+static std::atomic<unsigned int> &flightRegistryGeneration()
+{
+	static std::atomic<unsigned int> Generation(1);
+	return Generation;
+}
+
+static int flightErrorSum(const OCMFlightCounters_t &Counters)
+{
+	return Counters.nSPIMAGICError + Counters.nCRC1Error + Counters.nCRC2Error;
+}
+
+OCMFlightRecorder::OCMFlightRecorder(size_t capacity, unsigned int errorsPerMinute, const std::string &Prefix)
+{
+	_ring.resize(capacity);
+	_head = 0;
+	_used = 0;
+	_frames = 0;
+	_prefix = Prefix;
+	_threshold = errorsPerMinute;
+	memset(&_lastCounters, 0, sizeof(_lastCounters));
+	_windowStartMs = 0;
+	_windowErrors = 0;
+	_dumped = false;
+	_lastDumpMs = 0;
+	memset(&_stats, 0, sizeof(_stats));
+	_stop = false;
+	_thread = std::thread(&OCMFlightRecorder::threadProc, this);
+}
+
+OCMFlightRecorder::~OCMFlightRecorder()
+{
+	{
+		std::lock_guard<std::mutex> Lock(_mutex);
+		_stop = true;
+		_wake.notify_all();
+	}
+	_thread.join();
+}
+
+void OCMFlightRecorder::record(unsigned int tickMs, int spiResult, const char *pTx, const char *pRx, size_t length, const OCMFlightCounters_t &Counters)
+{
+	Frame_t Frame;
+	Frame.TickMs	= tickMs;
+	Frame.SpiResult	= spiResult;
+	Frame.Length	= (unsigned int)length;
+	Frame.Counters	= Counters;
+	size_t size = sizeof(Frame) + 2 * length;
+
+	std::lock_guard<std::mutex> Lock(_mutex);
+	_stats.Transfers++;
+	countErrors(tickMs, spiResult, Counters);
+	if (size > _ring.size()) {
+		_stats.Skipped++;
+		return;
+	}
+
+	// Overwrite the oldest frames
+	while (_ring.size() - _used < size) {
+		Frame_t Oldest;
+		copyOut(_head, &Oldest, sizeof(Oldest));
+		size_t oldest = sizeof(Oldest) + 2 * (size_t)Oldest.Length;
+		_head = (_head + oldest) % _ring.size();
+		_used -= oldest;
+		_frames--;
+	}
+
+	size_t pos = (_head + _used) % _ring.size();
+	copyIn(pos, &Frame, sizeof(Frame));
+	copyIn((pos + sizeof(Frame)) % _ring.size(), pTx, length);
+	copyIn((pos + sizeof(Frame) + length) % _ring.size(), pRx, length);
+	_used += size;
+	_frames++;
+}
+
+void OCMFlightRecorder::updateCounters(unsigned int tickMs, const OCMFlightCounters_t &Counters)
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	countErrors(tickMs, 0, Counters);
+}
+
+// Count the errors since the previous transfer and request a dump if there are too many. Called with the lock held.
+void OCMFlightRecorder::countErrors(unsigned int tickMs, int spiResult, const OCMFlightCounters_t &Counters)
+{
+	// The counters start at 0 again with each instance of the driver
+	int sum = flightErrorSum(Counters);
+	int previous = flightErrorSum(_lastCounters);
+	unsigned int errors = (unsigned int)(sum >= previous ? sum - previous : sum) + (spiResult != 0 ? 1 : 0);
+	_lastCounters = Counters;
+	if (errors == 0) {
+		return;
+	}
+
+	_stats.Errors += errors;
+	_stats.ErrorsSinceDump += errors;
+	if (_windowErrors == 0 || tickMs - _windowStartMs >= 60000) {
+		_windowStartMs = tickMs;
+		_windowErrors = 0;
+	}
+	_windowErrors += errors;
+
+	if (_threshold > 0 && _windowErrors >= _threshold && (!_dumped || tickMs - _lastDumpMs >= OCM_FLIGHT_MININTERVAL_MS) && _dumpReason.empty()) {
+		_dumped = true;
+		_lastDumpMs = tickMs;
+		_dumpReason = "errorrate";
+		_wake.notify_one();
+	}
+}
+
+void OCMFlightRecorder::requestDump(const char *Reason)
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	_dumpReason = Reason;
+	_wake.notify_one();
+}
+
+bool OCMFlightRecorder::dump(const char *Reason, std::string &Filename)
+{
+	std::vector<char> Frames;
+	snapshot(Frames);
+	return write(Frames, Reason, Filename);
+}
+
+OCMFlightStats_t OCMFlightRecorder::getStats()
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	OCMFlightStats_t Stats = _stats;
+	Stats.Frames = _frames;
+	return Stats;
+}
+
+std::string OCMFlightRecorder::getLastDump()
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	return _lastDump;
+}
+
+void OCMFlightRecorder::copyIn(size_t pos, const void *pData, size_t length)
+{
+	size_t first = _ring.size() - pos < length ? _ring.size() - pos : length;
+	memcpy(&_ring[pos], pData, first);
+	memcpy(&_ring[0], (const char*)pData + first, length - first);
+}
+
+void OCMFlightRecorder::copyOut(size_t pos, void *pData, size_t length) const
+{
+	size_t first = _ring.size() - pos < length ? _ring.size() - pos : length;
+	memcpy(pData, &_ring[pos], first);
+	memcpy((char*)pData + first, &_ring[0], length - first);
+}
+
+// Copy the frames in the ring, oldest first, and reset the error count of the next shutdown dump
+void OCMFlightRecorder::snapshot(std::vector<char> &Frames)
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	Frames.resize(_used);
+	if (_used > 0) {
+		copyOut(_head, &Frames[0], _used);
+	}
+	_stats.ErrorsSinceDump = 0;
+}
+
+bool OCMFlightRecorder::write(const std::vector<char> &Frames, const char *Reason, std::string &Filename)
+{
+	long long nowMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	char name[256];
+	snprintf(name, sizeof(name), "%s_%lld_%s", _prefix.c_str(), nowMs, Reason);
+	Filename = std::string(name) + ".bin";
+
+	FILE *fBin = fopen(Filename.c_str(), "wb");
+	FILE *fCsv = fopen((std::string(name) + ".csv").c_str(), "wt");
+	bool Result = fBin != NULL && fCsv != NULL;
+	if (fCsv != NULL) {
+		fprintf(fCsv, "TickCount,Length,SpiResult,nSPIMAGICError,nCRC1Error,nCRC2Error,nRetransmit\n");
+	}
+
+	for (size_t pos = 0; Result && pos + sizeof(Frame_t) <= Frames.size(); ) {
+		Frame_t Frame;
+		memcpy(&Frame, &Frames[pos], sizeof(Frame));
+		pos += sizeof(Frame);
+
+		unsigned int magic = OCM_FLIGHT_MAGIC;
+		size_t length = Frame.Length;
+		fwrite(&magic, sizeof(magic), 1, fBin);
+		fwrite(&Frame.TickMs, sizeof(Frame.TickMs), 1, fBin);
+		fwrite(&Frame.SpiResult, sizeof(Frame.SpiResult), 1, fBin);
+		fwrite(&length, sizeof(length), 1, fBin);
+		fwrite(&Frames[pos], 1, 2 * length, fBin);
+		pos += 2 * length;
+
+		fprintf(fCsv, "%u,%u,%d,%d,%d,%d,%d\n", Frame.TickMs, Frame.Length, Frame.SpiResult, Frame.Counters.nSPIMAGICError,
+			Frame.Counters.nCRC1Error, Frame.Counters.nCRC2Error, Frame.Counters.nRetransmit);
+	}
+
+	Result = Result && ferror(fBin) == 0 && ferror(fCsv) == 0;
+	if (fBin != NULL) {
+		fclose(fBin);
+	}
+	if (fCsv != NULL) {
+		fclose(fCsv);
+	}
+
+	std::lock_guard<std::mutex> Lock(_mutex);
+	if (Result) {
+		_stats.Dumps++;
+	}
+	return Result;
+}
+
+void OCMFlightRecorder::threadProc()
+{
+	std::unique_lock<std::mutex> Lock(_mutex);
+	for (;;) {
+		while (!_stop && _dumpReason.empty()) {
+			_wake.wait(Lock);
+		}
+		if (_stop) {
+			break;
+		}
+		std::string Reason = _dumpReason;
+		Lock.unlock();
+
+		std::vector<char> Frames;
+		std::string Filename;
+		snapshot(Frames);
+		bool Result = write(Frames, Reason.c_str(), Filename);
+
+		Lock.lock();
+		_dumpReason.clear();
+		if (Result) {
+			_lastDump = Filename;
+		}
+	}
+}
+
+std::shared_ptr<OCMFlightRecorder> OCMFlightRecorder::start(size_t capacity, unsigned int errorsPerMinute)
+{
+	std::lock_guard<std::mutex> Lock(flightRegistryMutex());
+	if (!flightRegistry()) {
+		flightRegistry() = std::make_shared<OCMFlightRecorder>(capacity, errorsPerMinute, OCM_FLIGHT_PREFIX);
+		flightRegistryGeneration().fetch_add(1, std::memory_order_release);
+	}
+	return flightRegistry();
+}
+
+void OCMFlightRecorder::stop()
+{
+	std::shared_ptr<OCMFlightRecorder> pRecorder;
+	{
+		std::lock_guard<std::mutex> Lock(flightRegistryMutex());
+		pRecorder.swap(flightRegistry());
+		flightRegistryGeneration().fetch_add(1, std::memory_order_release);
+	}
+
+	// Drop the copy of the calling thread, so that the recorder is destroyed here unless another thread still uses it
+	find();
+}
+
+const std::shared_ptr<OCMFlightRecorder> &OCMFlightRecorder::find()
+{
+	// Every transfer looks up the recorder: the registry lock is only taken after start() or stop()
+	static thread_local std::shared_ptr<OCMFlightRecorder> Cache;
+	static thread_local unsigned int cacheGeneration = 0;
+	if (flightRegistryGeneration().load(std::memory_order_acquire) != cacheGeneration) {
+		std::shared_ptr<OCMFlightRecorder> Previous;
+		{
+			std::lock_guard<std::mutex> Lock(flightRegistryMutex());
+			Previous.swap(Cache);
+			Cache = flightRegistry();
+			cacheGeneration = flightRegistryGeneration().load(std::memory_order_relaxed);
+		}
+	}
+	return Cache;
+}
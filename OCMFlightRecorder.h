@@ -0,0 +1,122 @@
+//
+// In-memory flight recorder of the last SPI transfers (-flightrec, see HROCMQueryV3.cpp)
+//
+// FinisarHROCM_V3 records every transfer (MOSI and MISO data) together with its error counters in a
+// bounded ring buffer; the oldest transfers are overwritten. Nothing is written to disk in the transfer
+// path. The ring is written to a file
+// - on demand (requestDump(), e.g. key 'd' in hammer),
+// - when the errors within a minute reach a threshold, at most once per OCM_FLIGHT_MININTERVAL_MS,
+// - on shutdown if errors occurred since the last dump (dump() called by the application).
+//
+// Errors are transfers that failed, and increments of the SPIMAGIC, CRC1 and CRC2 error counters of the
+// driver. The driver checks a response after the transfer, so an error shows up in the counters of the
+// following transfer (or in updateCounters() when the driver is closed).
+//
+// A dump consists of <prefix>_<time>_<reason>.bin with the transfers in the format of -logbin (so
+// HROCMLogAnalyzer and -replay can read it) and <prefix>_<time>_<reason>.csv with the counters of each
+// transfer. <time> is the host time in ms since 1970-01-01 UTC. Dumps requested
+// by the driver are written by a background thread; copying the ring is the only work done under the
+// lock of the recorder.
+//
+// The driver uses the process-wide recorder created with start().
+//
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define OCM_FLIGHT_DEFAULT_CAPACITY		(4*1024*1024)	// Bytes of transfer data kept
+#define OCM_FLIGHT_DEFAULT_THRESHOLD	10				// Errors per minute that trigger a dump
+#define OCM_FLIGHT_MININTERVAL_MS		60000			// Minimum time between two threshold dumps
+#define OCM_FLIGHT_PREFIX				"HROCMFlight"
+
+// Error counters of the driver at the time of a transfer
+typedef struct {
+	int		nSPIMAGICError;
+	int		nCRC1Error;
+	int		nCRC2Error;
+	int		nRetransmit;
+} OCMFlightCounters_t;
+
+typedef struct {
+	unsigned long long	Transfers;			// Transfers recorded
+	unsigned long long	Errors;				// Errors seen
+	unsigned long long	ErrorsSinceDump;
+	unsigned long long	Dumps;
+	unsigned long long	Skipped;			// Transfers larger than the ring
+	size_t				Frames;				// Transfers currently in the ring
+} OCMFlightStats_t;
+
+class OCMFlightRecorder
+{
+public:
+	// errorsPerMinute 0 disables the threshold dumps
+	OCMFlightRecorder(size_t capacity, unsigned int errorsPerMinute, const std::string &Prefix);
+	~OCMFlightRecorder();
+
+	// Record a transfer
+	void record(unsigned int tickMs, int spiResult, const char *pTx, const char *pRx, size_t length, const OCMFlightCounters_t &Counters);
+
+	// Count the errors of the last transfer (called when the driver is closed)
+	void updateCounters(unsigned int tickMs, const OCMFlightCounters_t &Counters);
+
+	// Write the ring from the background thread
+	void requestDump(const char *Reason);
+
+	// Write the ring now. Returns the name of the .bin file in Filename.
+	bool dump(const char *Reason, std::string &Filename);
+
+	OCMFlightStats_t getStats();
+
+	// Name of the last file written by the background thread (empty if none)
+	std::string getLastDump();
+
+	// Process-wide recorder used by FinisarHROCM_V3. find() takes no lock unless start() or stop() has been
+	// called since its last call on the same thread; the reference stays valid until its next call there.
+	static std::shared_ptr<OCMFlightRecorder> start(size_t capacity, unsigned int errorsPerMinute);
+	static void stop();
+	static const std::shared_ptr<OCMFlightRecorder> &find();
+
+private:
+	OCMFlightRecorder(const OCMFlightRecorder&);
+	OCMFlightRecorder &operator=(const OCMFlightRecorder&);
+
+	// Ring entry header; MOSI and MISO follow
+	typedef struct {
+		unsigned int		TickMs;
+		int					SpiResult;
+		unsigned int		Length;
+		OCMFlightCounters_t	Counters;
+	} Frame_t;
+
+	void countErrors(unsigned int tickMs, int spiResult, const OCMFlightCounters_t &Counters);
+	void copyIn(size_t pos, const void *pData, size_t length);
+	void copyOut(size_t pos, void *pData, size_t length) const;
+	void snapshot(std::vector<char> &Frames);
+	bool write(const std::vector<char> &Frames, const char *Reason, std::string &Filename);
+	void threadProc();
+
+	std::mutex					_mutex;
+	std::vector<char>			_ring;
+	size_t						_head;				// Offset of the oldest frame
+	size_t						_used;				// Bytes in use
+	size_t						_frames;
+	std::string					_prefix;
+	unsigned int				_threshold;
+	OCMFlightCounters_t			_lastCounters;
+	unsigned int				_windowStartMs;		// Start of the current minute of the error rate
+	unsigned int				_windowErrors;
+	bool						_dumped;			// A threshold dump has been made (_lastDumpMs is valid)
+	unsigned int				_lastDumpMs;
+	OCMFlightStats_t			_stats;
+
+	std::thread					_thread;
+	std::condition_variable		_wake;
+	bool						_stop;
+	std::string					_dumpReason;		// Pending request of a dump (empty: none)
+	std::string					_lastDump;
+};
@@ -0,0 +1,431 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "FinisarHROCM_V3.h"
+#include "CCRC32.h"
+#include "OCM3Opcodes.h"
+#include "OCMTransferTrace.h"
+#include "OCMLogAnalyzer.h"
+
+#define OCMLOG_MAGIC		0xBEEFBEEF		// Start of a record
+#define OCMLOG_SPIEMPTY		0xFFFFFFFF		// SPIMAGIC if the module did not answer
+
+OCMLogAnalyzer::OCMLogAnalyzer()
+{
+	_lengthSize = 4;
+	_fileSize = 0;
+	_skippedBytes = 0;
+	_nBursts = 0;
+	_errorTransfers = 0;
+	_loggedMs = 0;
+	_nTPC = 0;
+	memset(_errorCounts, 0, sizeof(_errorCounts));
+}
+
+bool OCMLogAnalyzer::analyze(const char *pData, size_t size, int nThreads)
+{
+	_records.clear();
+	_fileSize = size;
+	_skippedBytes = 0;
+	_lengthSize = detectLengthSize(pData, size);
+	if (nThreads < 1) {
+		nThreads = 1;
+	}
+	if ((size_t)nThreads > size / 65536 + 1) {
+		nThreads = (int)(size / 65536 + 1); // Not worth it for small files
+	}
+
+	// Decode the segments in parallel
+	std::vector<size_t> Bounds(nThreads + 1);
+	for (int i = 0; i < nThreads; ++i) {
+		Bounds[i] = size / nThreads * i;
+	}
+	Bounds[nThreads] = size;
+	std::vector<Segment_t> Segments(nThreads);
+	std::vector<std::thread> Threads;
+	for (int i = 0; i < nThreads; ++i) {
+		Threads.push_back(std::thread(&OCMLogAnalyzer::decodeSegment, this, pData, size, Bounds[i], Bounds[i + 1], std::ref(Segments[i])));
+	}
+	for (int i = 0; i < nThreads; ++i) {
+		Threads[i].join();
+	}
+
+	// Join the segments. A segment that does not start where the previous one ended has synchronized on data
+	// that only looked like a record (e.g. inside the last record of the previous segment), or on a record
+	// behind a corrupt one. Such a segment is decoded again, starting at the end of the previous one.
+	size_t end = 0;
+	for (int i = 0; i < nThreads; ++i) {
+		Segment_t &Segment = Segments[i];
+		if (end >= Bounds[i + 1]) {
+			continue; // The previous record extends over the whole segment
+		}
+		if (Segment.Begin != end) {
+			Segment.Records.clear();
+			decodeSegment(pData, size, end, Bounds[i + 1], Segment);
+		}
+		_skippedBytes += Segment.Begin - end + Segment.Skipped;
+		_records.insert(_records.end(), Segment.Records.begin(), Segment.Records.end());
+		end = Segment.End;
+	}
+	if (end < size) {
+		_skippedBytes += size - end;
+	}
+
+	follow();
+	return !_records.empty();
+}
+
+// The block size is a size_t of the logging program: 4 bytes in files of 32-bit builds, 8 bytes in files
+// of 64-bit builds. The first record tells which.
+size_t OCMLogAnalyzer::detectLengthSize(const char *pData, size_t size) const
+{
+	if (size < 24) {
+		return 4;
+	}
+	unsigned int length32;
+	unsigned int nextMagic = 0;
+	memcpy(&length32, pData + 12, sizeof(length32));
+	size_t next = 16 + 2 * (size_t)length32;
+	if (next + 4 <= size) {
+		memcpy(&nextMagic, pData + next, sizeof(nextMagic));
+	}
+	return next == size || nextMagic == OCMLOG_MAGIC ? 4 : 8;
+}
+
+// Offset of the first record at or after from: a record followed by another record or the end of the file
+size_t OCMLogAnalyzer::findRecord(const char *pData, size_t size, size_t from) const
+{
+	for (size_t pos = from; pos + 4 <= size; ++pos) {
+		unsigned int magic;
+		memcpy(&magic, pData + pos, sizeof(magic));
+		if (magic != OCMLOG_MAGIC) {
+			continue;
+		}
+		size_t length = parseRecord(pData, size, pos, NULL);
+		if (length == 0) {
+			continue;
+		}
+		if (pos + length == size) {
+			return pos;
+		}
+		if (pos + length + 4 <= size) {
+			memcpy(&magic, pData + pos + length, sizeof(magic));
+			if (magic == OCMLOG_MAGIC) {
+				return pos;
+			}
+		}
+	}
+	return size;
+}
+
+// Decode the record at offset into pRecord (if not NULL). Returns the size of the record, 0 if there is
+// no valid record at offset.
+size_t OCMLogAnalyzer::parseRecord(const char *pData, size_t size, size_t offset, OCMLogRecord_t *pRecord) const
+{
+	size_t headSize = 12 + _lengthSize;
+	if (offset + headSize > size) {
+		return 0;
+	}
+	const char *p = pData + offset;
+	unsigned int magic;
+	int result;
+	unsigned long long length = 0;
+	memcpy(&magic, p, 4);
+	memcpy(&result, p + 8, 4);
+	memcpy(&length, p + 12, _lengthSize);
+	if (magic != OCMLOG_MAGIC || length > (size - offset - headSize) / 2) {
+		return 0;
+	}
+	if (pRecord == NULL) {
+		return headSize + 2 * (size_t)length;
+	}
+
+	const char *pMosi = p + headSize;
+	const char *pMiso = pMosi + length;
+	OCMLogRecord_t &Record = *pRecord;
+	memset(&Record, 0, sizeof(Record));
+	memcpy(&Record.TickMs, p + 4, 4);
+	Record.Kind = OCMLOG_KIND_OTHER;
+	if (result != 0) {
+		Record.Errors |= OCMLOG_ERR_SPI;
+	}
+
+	// Command package
+	OCM3_cmd_t Cmd;
+	if (length >= sizeof(Cmd)) {
+		memcpy(&Cmd, pMosi, sizeof(Cmd));
+		if (Cmd.SPIMAGIC == OCM_SPIMAGIC_V3) {
+			Record.Kind = OCMLOG_KIND_COMMAND;
+			Record.Opcode = Cmd.OPCODE;
+			Record.SeqNo = Cmd.SEQNO;
+			if (Cmd.OPCODE == OPCODE_TPC && length >= sizeof(Cmd) + sizeof(Record.TaskVector)) {
+				memcpy(&Record.TaskVector, pMosi + sizeof(Cmd), sizeof(Record.TaskVector));
+			}
+			return headSize + 2 * (size_t)length;
+		}
+	}
+
+	// Poll package: check and decode the response header
+	OCM3_Response_t Head;
+	if (length < sizeof(Head) || Cmd.SPIMAGIC != 0) {
+		return headSize + 2 * (size_t)length;
+	}
+	Record.Kind = OCMLOG_KIND_POLL;
+	memcpy(&Head, pMiso, sizeof(Head));
+	CCRC32 crc;
+	if (Head.SPIMAGIC == OCMLOG_SPIEMPTY) {
+		Record.Errors |= OCMLOG_ERR_EMPTY;
+	}
+	else if (Head.SPIMAGIC != OCM_SPIMAGIC_V3) {
+		Record.Errors |= OCMLOG_ERR_MAGIC;
+	}
+	else if (crc.FullCRC((const unsigned char *)pMiso, 20) != Head.CRC1) {
+		Record.Errors |= OCMLOG_ERR_CRC1;
+	}
+	else {
+		Record.SeqNo = Head.SEQNO;
+		Record.ComRes = Head.COMRES;
+		Record.NSeqArr = Head.NSEQARR < OCMLOG_MAXSEQARR ? Head.NSEQARR : OCMLOG_MAXSEQARR;
+		size_t seqOffset = (const char*)&Head.SEQARR[0] - (const char*)&Head;
+		if (seqOffset + Record.NSeqArr * sizeof(unsigned int) > length) {
+			Record.NSeqArr = 0;
+		}
+		memcpy(Record.SeqArr, pMiso + seqOffset, Record.NSeqArr * sizeof(unsigned int));
+
+		if (Head.LENGTH > 20 + 4 && Head.LENGTH <= length) {
+			unsigned int CRC2;
+			memcpy(&CRC2, pMiso + Head.LENGTH - 4, sizeof(CRC2));
+			if (crc.FullCRC((const unsigned char *)pMiso, Head.LENGTH - 4) != CRC2) {
+				Record.Errors |= OCMLOG_ERR_CRC2;
+			}
+		}
+	}
+
+	return headSize + 2 * (size_t)length;
+}
+
+// Decode the records starting in [from, to)
+void OCMLogAnalyzer::decodeSegment(const char *pData, size_t size, size_t from, size_t to, Segment_t &Segment) const
+{
+	Segment.Begin = findRecord(pData, size, from);
+	if (Segment.Begin > to) {
+		Segment.Begin = to;
+	}
+	Segment.End = Segment.Begin;
+	Segment.Skipped = 0;
+	while (Segment.End < to) {
+		OCMLogRecord_t Record;
+		size_t length = parseRecord(pData, size, Segment.End, &Record);
+		if (length == 0) {
+			// Corrupt or truncated record: continue with the next record found
+			size_t next = findRecord(pData, size, Segment.End + 1);
+			if (next > to) {
+				next = to;
+			}
+			Segment.Skipped += next - Segment.End;
+			Segment.End = next;
+			continue;
+		}
+		Segment.Records.push_back(Record);
+		Segment.End += length;
+	}
+}
+
+// Follow the commands through the decoded transfers
+void OCMLogAnalyzer::follow()
+{
+	// Command waiting for acceptance
+	typedef struct {
+		unsigned int	SeqNo;
+		unsigned int	Opcode;
+		unsigned int	SentMs;
+	} Pending_t;
+
+	// TPC waiting for its processes
+	typedef struct {
+		unsigned int	SeqNo;
+		unsigned int	SentMs;
+		unsigned int	Tasks;		// Processes not yet completed
+	} Task_t;
+
+	_opcodes.assign(256, Opcode_t());
+	for (int i = 0; i < OCMLOG_MAXSEQARR; ++i) {
+		_taskMs[i].clear();
+	}
+	memset(_errorCounts, 0, sizeof(_errorCounts));
+	_errorTransfers = 0;
+	_bursts.clear();
+	_nBursts = 0;
+	_loggedMs = 0;
+	_nTPC = 0;
+
+	std::vector<Pending_t> Pending;
+	std::vector<Task_t> Tasks;
+	Burst_t Burst = { 0, 0 };
+	for (size_t i = 0; i < _records.size(); ++i) {
+		const OCMLogRecord_t &Record = _records[i];
+		if (i > 0) {
+			unsigned int gap = Record.TickMs - _records[i - 1].TickMs;
+			if (gap < OCMLOG_MAXGAPMS) {
+				_loggedMs += gap;
+			}
+		}
+
+		// Errors and bursts
+		if (Record.Errors != 0) {
+			_errorTransfers++;
+			for (int bit = 0; bit < 5; ++bit) {
+				if ((Record.Errors & (1 << bit)) != 0) {
+					_errorCounts[bit]++;
+				}
+			}
+			if (Burst.Length++ == 0) {
+				Burst.TickMs = Record.TickMs;
+			}
+		}
+		if ((Record.Errors == 0 || i + 1 == _records.size()) && Burst.Length > 0) {
+			_nBursts++;
+			_bursts.push_back(Burst);
+			std::sort(_bursts.begin(), _bursts.end(), [](const Burst_t &a, const Burst_t &b) { return a.Length > b.Length; });
+			if (_bursts.size() > OCMLOG_TOPBURSTS) {
+				_bursts.pop_back();
+			}
+			Burst.Length = 0;
+		}
+
+		if (Record.Kind == OCMLOG_KIND_COMMAND) {
+			Opcode_t &Op = _opcodes[Record.Opcode & 0xFF];
+			Op.Sent++;
+			bool resent = false;
+			for (size_t k = 0; k < Pending.size(); ++k) {
+				if (Pending[k].SeqNo == Record.SeqNo) {
+					resent = true;
+				}
+			}
+			if (resent) {
+				Op.Retransmits++;
+			}
+			else {
+				Pending_t Cmd = { Record.SeqNo, Record.Opcode & 0xFF, Record.TickMs };
+				Pending.push_back(Cmd);
+				if (Pending.size() > 16) {
+					Pending.erase(Pending.begin()); // Never accepted
+				}
+			}
+			if (Record.Opcode == OPCODE_TPC && !resent) {
+				_nTPC++;
+				Task_t Task = { Record.SeqNo, Record.TickMs, Record.TaskVector & ((1 << OCMLOG_MAXSEQARR) - 1) };
+				Tasks.push_back(Task);
+				if (Tasks.size() > 16) {
+					Tasks.erase(Tasks.begin()); // Never completed
+				}
+			}
+		}
+		else if (Record.Kind == OCMLOG_KIND_POLL && (Record.Errors & ~OCMLOG_ERR_CRC2) == 0) {
+			// Valid response header (the driver does not check CRC2 of polls either). Accepted commands:
+			if (Record.ComRes >= 0) {
+				for (size_t k = 0; k < Pending.size(); ++k) {
+					if (Pending[k].SeqNo == Record.SeqNo) {
+						Opcode_t &Op = _opcodes[Pending[k].Opcode];
+						Op.AcceptMs.push_back(Record.TickMs - Pending[k].SentMs);
+						if (Record.ComRes > 0) {
+							Op.ComResErrors++;
+						}
+						Pending.erase(Pending.begin() + k);
+						break;
+					}
+				}
+			}
+
+			// Completed processes
+			for (size_t k = 0; k < Tasks.size(); ) {
+				Task_t &Task = Tasks[k];
+				for (int p = 0; p < Record.NSeqArr; ++p) {
+					if ((Task.Tasks & (1 << p)) != 0 && Record.SeqArr[p] == Task.SeqNo) {
+						_taskMs[p].push_back(Record.TickMs - Task.SentMs);
+						Task.Tasks &= ~(1 << p);
+					}
+				}
+				if (Task.Tasks == 0) {
+					Tasks.erase(Tasks.begin() + k);
+				}
+				else {
+					++k;
+				}
+			}
+		}
+	}
+}
+
+OCMLogLatency_t OCMLogAnalyzer::latency(std::vector<unsigned int> &Values)
+{
+	OCMLogLatency_t Latency;
+	memset(&Latency, 0, sizeof(Latency));
+	Latency.Count = Values.size();
+	if (Values.empty()) {
+		return Latency;
+	}
+	std::sort(Values.begin(), Values.end());
+	double sum = 0;
+	for (size_t i = 0; i < Values.size(); ++i) {
+		sum += Values[i];
+	}
+	Latency.MeanMs = sum / Values.size();
+	Latency.P50Ms = Values[(Values.size() - 1) / 2];
+	Latency.P99Ms = Values[(Values.size() - 1) * 99 / 100];
+	Latency.MaxMs = Values.back();
+	return Latency;
+}
+
+std::string OCMLogAnalyzer::getReport() const
+{
+	std::string Report;
+	char line[256];
+
+	double seconds = _loggedMs / 1000.0;
+	snprintf(line, sizeof(line), "Transfers: %zu in %.1f s logged (%zu bytes, %zu bytes skipped)\n", _records.size(), seconds, _fileSize, _skippedBytes);
+	Report += line;
+	if (seconds > 0) {
+		snprintf(line, sizeof(line), "Throughput: %.1f transfers/s, %.3f MB/s, %.3f TPC/s\n",
+			_records.size() / seconds, (_fileSize - _skippedBytes) / seconds / 1e6, _nTPC / seconds);
+		Report += line;
+	}
+
+	snprintf(line, sizeof(line), "Errors: %zu transfers (SPI %zu, empty %zu, SPIMAGIC %zu, CRC1 %zu, CRC2 %zu) in %zu bursts\n",
+		_errorTransfers, _errorCounts[0], _errorCounts[1], _errorCounts[2], _errorCounts[3], _errorCounts[4], _nBursts);
+	Report += line;
+	for (size_t i = 0; i < _bursts.size(); ++i) {
+		snprintf(line, sizeof(line), "  Burst of %zu transfers at tick %u ms\n", _bursts[i].Length, _bursts[i].TickMs);
+		Report += line;
+	}
+
+	// Latencies are sorted by latency(), so work on copies
+	Report += "Opcode      Sent  Retransmit  COMRES>0  Accept mean/p50/p99/max [ms]\n";
+	for (size_t opcode = 0; opcode < _opcodes.size(); ++opcode) {
+		const Opcode_t &Op = _opcodes[opcode];
+		if (Op.Sent == 0) {
+			continue;
+		}
+		std::vector<unsigned int> Values = Op.AcceptMs;
+		OCMLogLatency_t Latency = latency(Values);
+		snprintf(line, sizeof(line), "%-10s %5zu  %10zu  %8zu  %.1f/%u/%u/%u (%zu accepted)\n", OCMTransferTrace::getOpcodeName((unsigned int)opcode),
+			Op.Sent, Op.Retransmits, Op.ComResErrors, Latency.MeanMs, Latency.P50Ms, Latency.P99Ms, Latency.MaxMs, Latency.Count);
+		Report += line;
+	}
+
+	static const char *Processes[OCMLOG_MAXSEQARR] = { "PW", "VC", "CS", "OSNR", "CP" };
+	Report += "Process     Done  TPC-to-SEQARR mean/p50/p99/max [ms]\n";
+	for (int p = 0; p < OCMLOG_MAXSEQARR; ++p) {
+		if (_taskMs[p].empty()) {
+			continue;
+		}
+		std::vector<unsigned int> Values = _taskMs[p];
+		OCMLogLatency_t Latency = latency(Values);
+		snprintf(line, sizeof(line), "%-10s %5zu  %.1f/%u/%u/%u\n", Processes[p], Latency.Count, Latency.MeanMs, Latency.P50Ms, Latency.P99Ms, Latency.MaxMs);
+		Report += line;
+	}
+
+	return Report;
+}
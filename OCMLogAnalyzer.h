@@ -0,0 +1,116 @@
+//
+// Analyzer for binary log files (-logbin, see HROCMQueryV3.cpp for the format)
+//
+// Works on the mapped file without copying the records. The file is split into one segment per thread;
+// each thread finds the first record in its segment, then decodes the command and response headers of its
+// records and checks their CRCs. The decoded headers are then walked in file order to follow the commands:
+//
+// - Command-to-accept latency per opcode: from the first transmission of a command to the first poll
+//   response with its SEQNO and COMRES not pending. Retransmissions and COMRES errors are counted.
+// - TPC-to-SEQARR latency per process: from the TPC command to the first poll response with its sequence
+//   number in SEQARR of the process (PW, VC, CS, OSNR, CP) started by the TPC.
+// - Error bursts: runs of consecutive transfers with SPI errors, empty packages (0xFFFFFFFF), a wrong
+//   SPIMAGIC or CRC errors.
+// - Throughput: transfers, bytes and TPC commands per second of logged time. Gaps of more than a minute
+//   (e.g. between sessions appended to the same file) are not counted as logged time.
+//
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define OCMLOG_MAXSEQARR		5		// Processes in SEQARR (PW, VC, CS, OSNR, CP)
+#define OCMLOG_MAXGAPMS			60000	// Longer gaps between transfers are not counted as logged time
+#define OCMLOG_TOPBURSTS		5		// Number of longest error bursts listed in the report
+
+// Kinds of transfers
+#define OCMLOG_KIND_POLL		0		// MOSI is a poll package (SPIMAGIC 0)
+#define OCMLOG_KIND_COMMAND		1		// MOSI is a command package
+#define OCMLOG_KIND_OTHER		2		// Anything else (e.g. too short)
+
+// Error flags of a transfer
+#define OCMLOG_ERR_SPI			0x01	// SPI transfer failed
+#define OCMLOG_ERR_EMPTY		0x02	// Response SPIMAGIC 0xFFFFFFFF
+#define OCMLOG_ERR_MAGIC		0x04	// Response SPIMAGIC wrong
+#define OCMLOG_ERR_CRC1			0x08	// Response CRC1 wrong
+#define OCMLOG_ERR_CRC2			0x10	// Response CRC2 wrong
+
+// Decoded headers of one transfer
+typedef struct {
+	unsigned int		TickMs;
+	unsigned char		Kind;			// OCMLOG_KIND_...
+	unsigned char		Errors;			// OCMLOG_ERR_...
+	unsigned short		NSeqArr;		// Response: number of valid SEQARR entries
+	unsigned int		Opcode;			// Command: OPCODE
+	unsigned int		SeqNo;			// Command: SEQNO sent; poll: SEQNO of the response
+	int					ComRes;			// Poll: COMRES of the response
+	unsigned int		TaskVector;		// TPC command: processes started
+	unsigned int		SeqArr[OCMLOG_MAXSEQARR];	// Poll: SEQARR of the response
+} OCMLogRecord_t;
+
+// Latency statistics in ms
+typedef struct {
+	size_t			Count;
+	double			MeanMs;
+	unsigned int	P50Ms;
+	unsigned int	P99Ms;
+	unsigned int	MaxMs;
+} OCMLogLatency_t;
+
+class OCMLogAnalyzer
+{
+public:
+	OCMLogAnalyzer();
+
+	// Analyze a complete log file in memory using nThreads threads. Returns false if no record was found.
+	bool analyze(const char *pData, size_t size, int nThreads);
+
+	// Text report of the last analysis
+	std::string getReport() const;
+
+	// Decoded transfers of the last analysis in file order
+	const std::vector<OCMLogRecord_t> &getRecords() const { return _records; }
+
+private:
+	// Statistics of an opcode
+	typedef struct {
+		size_t						Sent;			// Command transmissions
+		size_t						Retransmits;	// Transmissions with a SEQNO sent before
+		size_t						ComResErrors;	// Accepted with COMRES > 0
+		std::vector<unsigned int>	AcceptMs;		// Command-to-accept latencies
+	} Opcode_t;
+
+	// Error burst
+	typedef struct {
+		unsigned int	TickMs;			// Time of the first transfer of the burst
+		size_t			Length;			// Number of transfers
+	} Burst_t;
+
+	// Decoding of one segment
+	typedef struct {
+		size_t						Begin;		// Offset of the first record found
+		size_t						End;		// Offset after the last record decoded
+		size_t						Skipped;	// Bytes of corrupt records between Begin and End
+		std::vector<OCMLogRecord_t>	Records;
+	} Segment_t;
+
+	size_t detectLengthSize(const char *pData, size_t size) const;
+	size_t findRecord(const char *pData, size_t size, size_t from) const;
+	size_t parseRecord(const char *pData, size_t size, size_t offset, OCMLogRecord_t *pRecord) const;
+	void decodeSegment(const char *pData, size_t size, size_t from, size_t to, Segment_t &Segment) const;
+	void follow();
+	static OCMLogLatency_t latency(std::vector<unsigned int> &Values);
+
+	size_t						_lengthSize;	// Size of the block size field (4 or 8)
+	size_t						_fileSize;
+	size_t						_skippedBytes;	// Bytes not belonging to any record (corrupt or truncated)
+	std::vector<OCMLogRecord_t>	_records;
+	std::vector<Opcode_t>		_opcodes;		// By OPCODE (0..255)
+	std::vector<unsigned int>	_taskMs[OCMLOG_MAXSEQARR];
+	size_t						_errorCounts[5];	// Per OCMLOG_ERR_ bit
+	size_t						_errorTransfers;
+	std::vector<Burst_t>		_bursts;		// Longest bursts
+	size_t						_nBursts;
+	unsigned long long			_loggedMs;
+	size_t						_nTPC;
+};
@@ -0,0 +1,130 @@
+#include "stdafx.h"
+#include "OCMMappedFile.h"
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+OCMMappedFile::OCMMappedFile()
+{
+	_pData = NULL;
+	_size = 0;
+#ifdef _WIN32
+	_hFile = INVALID_HANDLE_VALUE;
+	_hMapping = NULL;
+#else
+	_fd = -1;
+#endif
+}
+
+OCMMappedFile::~OCMMappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+
+bool OCMMappedFile::open(const char *filename)
+{
+	close();
+
+	_hFile = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_hFile == INVALID_HANDLE_VALUE) {
+		_lastError = std::string("Could not open file: ") + filename;
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_hFile, &size)) {
+		_lastError = std::string("Could not get size of file: ") + filename;
+		close();
+		return false;
+	}
+	_size = (size_t)size.QuadPart;
+	if (_size == 0) {
+		return true; // Empty files cannot be mapped
+	}
+
+	_hMapping = CreateFileMappingA(_hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (_hMapping != NULL) {
+		_pData = (const char*)MapViewOfFile(_hMapping, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (_pData == NULL) {
+		_lastError = std::string("Could not map file: ") + filename;
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void OCMMappedFile::close()
+{
+	if (_pData != NULL) {
+		UnmapViewOfFile(_pData);
+		_pData = NULL;
+	}
+	if (_hMapping != NULL) {
+		CloseHandle(_hMapping);
+		_hMapping = NULL;
+	}
+	if (_hFile != INVALID_HANDLE_VALUE) {
+		CloseHandle(_hFile);
+		_hFile = INVALID_HANDLE_VALUE;
+	}
+	_size = 0;
+}
+
+#else
+
+bool OCMMappedFile::open(const char *filename)
+{
+	close();
+
+	_fd = ::open(filename, O_RDONLY);
+	if (_fd < 0) {
+		_lastError = std::string("Could not open file: ") + filename;
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(_fd, &st) != 0) {
+		_lastError = std::string("Could not get size of file: ") + filename;
+		close();
+		return false;
+	}
+	_size = (size_t)st.st_size;
+	if (_size == 0) {
+		return true; // Empty files cannot be mapped
+	}
+
+	void *p = mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+	if (p == MAP_FAILED) {
+		_lastError = std::string("Could not map file: ") + filename;
+		close();
+		return false;
+	}
+	madvise(p, _size, MADV_SEQUENTIAL);
+	_pData = (const char*)p;
+
+	return true;
+}
+
+void OCMMappedFile::close()
+{
+	if (_pData != NULL) {
+		munmap((void*)_pData, _size);
+		_pData = NULL;
+	}
+	if (_fd >= 0) {
+		::close(_fd);
+		_fd = -1;
+	}
+	_size = 0;
+}
+
+#endif
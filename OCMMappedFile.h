@@ -0,0 +1,40 @@
+//
+// Read-only memory mapping of a whole file
+//
+// Used to walk large log files without reading them into memory. The mapping stays valid until close()
+// is called or the object is destroyed.
+//
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+class OCMMappedFile
+{
+public:
+	OCMMappedFile();
+	~OCMMappedFile();
+
+	// Map filename. Returns false if the file cannot be opened or mapped (see getLastError()).
+	bool open(const char *filename);
+	void close();
+
+	const char *data() const { return _pData; }
+	size_t size() const { return _size; }
+
+	std::string getLastError() const { return _lastError; }
+
+private:
+	OCMMappedFile(const OCMMappedFile&);
+	OCMMappedFile &operator=(const OCMMappedFile&);
+
+	const char	*_pData;
+	size_t		_size;
+#ifdef _WIN32
+	void		*_hFile;
+	void		*_hMapping;
+#else
+	int			_fd;
+#endif
+	std::string	_lastError;
+};
@@ -0,0 +1,189 @@
+#include "stdafx.h"
+#include <string.h>
+#include <charconv>
+#include "OCMOutputWriter.h"
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#define OCM_OUTPUT_MAXNUMBER	64		// Longest formatted number
+
+// Format value with precision digits after the decimal point. Returns the end of the text.
+static char *outputFixed(char *pFirst, char *pLast, double value, int precision)
+{
+#if defined(__cpp_lib_to_chars)
+	std::to_chars_result Result = std::to_chars(pFirst, pLast, value, std::chars_format::fixed, precision);
+	if (Result.ec == std::errc()) {
+		return Result.ptr;
+	}
+#endif
+	int n = snprintf(pFirst, pLast - pFirst, "%.*f", precision, value);
+	return n < 0 ? pFirst : n < pLast - pFirst ? pFirst + n : pLast - 1;
+}
+
+OCMOutputWriter::OCMOutputWriter(FILE *f)
+{
+	_file = f;
+	_buffer.resize(OCM_OUTPUT_BUFFERSIZE);
+	_used = 0;
+	_format = OCM_OUTPUT_CSV;
+	_column = 0;
+}
+
+OCMOutputWriter::~OCMOutputWriter()
+{
+	flush();
+}
+
+void OCMOutputWriter::beginTable(int format, const OCMOutputColumn_t *pColumns, size_t nColumns, size_t nRows)
+{
+	_format = format;
+	_columns.assign(pColumns, pColumns + nColumns);
+	_column = 0;
+
+	if (format == OCM_OUTPUT_CSV) {
+		for (size_t k = 0; k < nColumns; ++k) {
+			if (k > 0) {
+				putChar(',');
+			}
+			putText(pColumns[k].Name, strlen(pColumns[k].Name));
+		}
+		putChar('\n');
+		return;
+	}
+
+	flush();
+	fflush(_file);
+#ifdef _WIN32
+	_setmode(_fileno(_file), _O_BINARY);
+#endif
+	if (format != OCM_OUTPUT_NPY) {
+		return;
+	}
+
+	// NumPy format 1.0: magic, version, header length, then the header dictionary padded to a multiple of 64 bytes
+	static const char *const Types[] = { "<u2", "<f4", "<f8" };
+	std::string Header = "{'descr': [";
+	for (size_t k = 0; k < nColumns; ++k) {
+		Header += std::string(k > 0 ? ", " : "") + "('" + pColumns[k].Name + "', '" + Types[pColumns[k].Type] + "')";
+	}
+	char shape[32];
+	snprintf(shape, sizeof(shape), "(%llu,)", (unsigned long long)nRows);
+	Header += std::string("], 'fortran_order': False, 'shape': ") + shape + ", }";
+	size_t total = 10 + Header.size() + 1;
+	Header.append((64 - total % 64) % 64, ' ');
+	Header += '\n';
+
+	unsigned short length = (unsigned short)Header.size();
+	putBinary("\x93NUMPY\x01\x00", 8);
+	putBinary(&length, sizeof(length));
+	putBinary(Header.data(), Header.size());
+}
+
+void OCMOutputWriter::putValue(double value)
+{
+	const OCMOutputColumn_t &Column = _columns[_column];
+	if (_format == OCM_OUTPUT_CSV) {
+		if (_column > 0) {
+			putChar(',');
+		}
+		if (Column.Precision == 0 && Column.Type == OCM_OUTPUT_U16) {
+			putInt((long long)value);
+		}
+		else {
+			putFixed(value, Column.Precision);
+		}
+	}
+	else if (Column.Type == OCM_OUTPUT_U16) {
+		unsigned short v = (unsigned short)value;
+		putBinary(&v, sizeof(v));
+	}
+	else if (Column.Type == OCM_OUTPUT_F32) {
+		float v = (float)value;
+		putBinary(&v, sizeof(v));
+	}
+	else {
+		putBinary(&value, sizeof(value));
+	}
+
+	if (++_column == _columns.size()) {
+		if (_format == OCM_OUTPUT_CSV) {
+			putChar('\n');
+		}
+		_column = 0;
+	}
+}
+
+void OCMOutputWriter::putValue(double value, const std::string &Text)
+{
+	if (_format != OCM_OUTPUT_CSV) {
+		putValue(value);
+		return;
+	}
+	if (_column > 0) {
+		putChar(',');
+	}
+	putText(Text);
+	if (++_column == _columns.size()) {
+		putChar('\n');
+		_column = 0;
+	}
+}
+
+void OCMOutputWriter::putText(const char *pText, size_t length)
+{
+	putBinary(pText, length);
+}
+
+void OCMOutputWriter::putChar(char c)
+{
+	*reserve(1) = c;
+	_used++;
+}
+
+void OCMOutputWriter::putInt(long long value)
+{
+	char *p = reserve(OCM_OUTPUT_MAXNUMBER);
+	_used += std::to_chars(p, p + OCM_OUTPUT_MAXNUMBER, value).ptr - p;
+}
+
+void OCMOutputWriter::putFixed(double value, int precision)
+{
+	char *p = reserve(OCM_OUTPUT_MAXNUMBER);
+	_used += outputFixed(p, p + OCM_OUTPUT_MAXNUMBER, value, precision) - p;
+}
+
+std::string OCMOutputWriter::formatFixed(double value, int precision)
+{
+	char text[OCM_OUTPUT_MAXNUMBER];
+	return std::string(text, outputFixed(text, text + sizeof(text), value, precision));
+}
+
+void OCMOutputWriter::flush()
+{
+	if (_used > 0) {
+		fwrite(&_buffer[0], 1, _used, _file);
+		_used = 0;
+	}
+}
+
+void OCMOutputWriter::putBinary(const void *pData, size_t length)
+{
+	if (length > _buffer.size()) {
+		flush();
+		fwrite(pData, 1, length, _file);
+		return;
+	}
+	memcpy(reserve(length), pData, length);
+	_used += length;
+}
+
+// Make room for length bytes and return where they go
+char *OCMOutputWriter::reserve(size_t length)
+{
+	if (_used + length > _buffer.size()) {
+		flush();
+	}
+	return &_buffer[_used];
+}
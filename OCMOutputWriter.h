@@ -0,0 +1,76 @@
+//
+// Buffered output of scan results (scan, scanraw, scanosnr, dump; see -format in HROCMQueryV3.cpp)
+//
+// Collects the output in a memory buffer and writes it with fwrite in large blocks. Numbers are formatted
+// with std::to_chars, which gives the same text as printf("%d") and printf("%.*f") without parsing a format
+// string and without locale lookups.
+//
+// A table is a header and rows of numeric columns. Depending on the format it is written as
+// - OCM_OUTPUT_CSV: text with a header line,
+// - OCM_OUTPUT_BIN: packed little-endian records (column types as declared), no header,
+// - OCM_OUTPUT_NPY: the same records preceded by a NumPy .npy header with a structured dtype, so that
+//   numpy.load() returns one named field per column.
+//
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// Output formats
+#define OCM_OUTPUT_CSV		0
+#define OCM_OUTPUT_BIN		1
+#define OCM_OUTPUT_NPY		2
+
+// Column types in binary formats
+#define OCM_OUTPUT_U16		0		// uint16
+#define OCM_OUTPUT_F32		1		// float32
+#define OCM_OUTPUT_F64		2		// float64
+
+#define OCM_OUTPUT_BUFFERSIZE	65536
+
+typedef struct {
+	const char	*Name;			// CSV header and NumPy field name
+	int			Type;			// OCM_OUTPUT_U16, _F32, _F64
+	int			Precision;		// Digits after the decimal point in CSV (0 for integers)
+} OCMOutputColumn_t;
+
+class OCMOutputWriter
+{
+public:
+	OCMOutputWriter(FILE *f);
+	~OCMOutputWriter();
+
+	// Start a table of nRows rows. Switches the file to binary mode for the binary formats.
+	void beginTable(int format, const OCMOutputColumn_t *pColumns, size_t nColumns, size_t nRows);
+
+	// Next value of the current row. Text is the CSV text of the value if it has been formatted before.
+	void putValue(double value);
+	void putValue(double value, const std::string &Text);
+
+	// Text output
+	void putText(const char *pText, size_t length);
+	void putText(const std::string &Text) { putText(Text.data(), Text.size()); }
+	void putChar(char c);
+	void putInt(long long value);
+	void putFixed(double value, int precision);
+
+	// Text of a number as written by putFixed
+	static std::string formatFixed(double value, int precision);
+
+	void flush();
+
+private:
+	OCMOutputWriter(const OCMOutputWriter&);
+	OCMOutputWriter &operator=(const OCMOutputWriter&);
+
+	void putBinary(const void *pData, size_t length);
+	char *reserve(size_t length);
+
+	FILE							*_file;
+	std::vector<char>				_buffer;
+	size_t							_used;
+	int								_format;
+	std::vector<OCMOutputColumn_t>	_columns;
+	size_t							_column;		// Index of the next column of the current row
+};
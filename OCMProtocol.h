@@ -0,0 +1,177 @@
+//
+// Binary protocol of the scan server (OCMP)
+//
+// Every message is a frame consisting of a fixed 16-byte header and a payload of LENGTH bytes. All values
+// are little endian (doubles in IEEE 754 format). Frequencies are given in units of 0.1 MHz like FSF of the
+// module (191.4 THz = 1914000000).
+//
+// The server and HROCMLoadGen copy the packed structs below to and from the frames as they are, i.e. in host
+// byte order, so they can only be built for little-endian hosts (checked below; all Windows targets are).
+// The compact encoding of OCMSpectrumCodec.h is a byte stream and does not depend on the byte order.
+//
+// A client can send any number of requests without waiting for the responses (pipelining). The responses are
+// sent in the order of the requests and carry the REQID of the request they belong to.
+//
+// Request OCMP_MSG_CHANNELS:
+//   uint32 NENTRIES
+//   NENTRIES * OCMP_ChannelQuery_t
+//
+// Response OCMP_MSG_CHANNELS:
+//   OCMP_ScanInfo_t
+//   uint32 NENTRIES
+//   NENTRIES * OCMP_ChannelResult_t
+//   for each entry: COUNT * OCMP_ChannelValue_t
+//
+// Request OCMP_MSG_WINDOW:
+//   uint32 NWINDOWS
+//   NWINDOWS * OCMP_SpectrumWindow_t
+//   uint32 BASESCAN (only if FLAGS has OCMP_FLAG_DELTASCAN)
+//
+// Response OCMP_MSG_WINDOW:
+//   OCMP_ScanInfo_t
+//   uint32 NWINDOWS
+//   NWINDOWS * OCMP_WindowResult_t
+//   for each window: COUNT * uint32 center frequency, then COUNT * double power in dBm
+//   or, if FLAGS has OCMP_FLAG_COMPACT: uint32 NBYTES, then NBYTES of encoded slices (see OCMSpectrumCodec.h)
+//
+// Returns the slices of the high-resolution scan within each window. STATUS is OCMP_STATUS_NOGRID if
+// the server does not run high-resolution scans.
+//
+// With OCMP_FLAG_COMPACT in the request the slices are sent in the compact encoding, about a tenth of the
+// plain size. A client that still has the response of scan BASESCAN can additionally set OCMP_FLAG_DELTASCAN
+// to receive the powers relative to that scan. The server only does so if it still has that scan and its
+// frequency axis is unchanged; the response then has OCMP_FLAG_DELTASCAN set and BASESCAN in its
+// OCMP_ScanInfo_t. Otherwise the powers are relative to the previous slice.
+//
+// Request OCMP_MSG_SUBSCRIBE:
+//   OCMP_Subscribe_t
+//   NCHANNELS * OCMP_ChannelQuery_t
+//   NWINDOWS * OCMP_FreqWindow_t
+//
+// Response OCMP_MSG_SUBSCRIBE: no payload. From then on the server pushes an OCMP_MSG_SCAN frame with the
+// REQID of the subscription for every new scan. The payload is the same as for OCMP_MSG_CHANNELS with one
+// entry per channel query followed by one entry per window. A connection has at most one subscription;
+// a new OCMP_MSG_SUBSCRIBE replaces the previous one.
+//
+// Pushes are rate limited to one per INTERVAL ms. As long as the previous push has not been sent completely
+// (the client reads slower than scans are published) no further push is queued; the client then receives
+// the latest scan once it has caught up, not the ones in between. Gaps show in the SCAN number.
+//
+// Request OCMP_MSG_UNSUBSCRIBE: no payload. Response: no payload.
+//
+// Request OCMP_MSG_TRIGGER: no payload. Response: no payload.
+// Makes the on-demand scans of the server due (see -scan50 ondemand in HROCMQueryV3.cpp). The response is
+// sent as soon as the scans are queued, not when they are complete; their results are published like those
+// of any other scan, so subscribers receive them as OCMP_MSG_SCAN. Triggers arriving while the scans are
+// still queued are merged. OCMP_ERR_NOTRIGGER if the server has no on-demand scans.
+//
+// Response OCMP_MSG_ERROR:
+//   uint32 CODE (OCMP_ERR_...)
+//   Error message (not zero-terminated)
+//
+#pragma once
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error OCMP frames are written in host byte order, which has to be little endian
+#endif
+
+#define OCMP_MAGIC				0x504D434F		// "OCMP"
+#define OCMP_VERSION			1				// Current protocol version
+#define OCMP_MAXPAYLOAD			(1024*1024)		// Maximum payload of a request
+
+// Message types. Responses use the type of the request.
+#define OCMP_MSG_CHANNELS		0x01			// Power and OSNR of channels on a fixed grid
+#define OCMP_MSG_SUBSCRIBE		0x02			// Push channels and windows of every new scan
+#define OCMP_MSG_UNSUBSCRIBE	0x03			// Stop pushing
+#define OCMP_MSG_SCAN			0x04			// Pushed by the server (subscription)
+#define OCMP_MSG_WINDOW			0x05			// Power of the high-resolution slices in frequency windows
+#define OCMP_MSG_TRIGGER		0x06			// Run the on-demand scans
+#define OCMP_MSG_ERROR			0xFF			// Request failed
+
+// Header flags
+#define OCMP_FLAG_COMPACT		0x0001			// OCMP_MSG_WINDOW: compact encoding of the slices
+#define OCMP_FLAG_DELTASCAN		0x0002			// OCMP_MSG_WINDOW: powers relative to BASESCAN
+
+// Error codes
+#define OCMP_ERR_VERSION		1				// Protocol version not supported
+#define OCMP_ERR_TYPE			2				// Unknown message type
+#define OCMP_ERR_FORMAT			3				// Payload malformed
+#define OCMP_ERR_NODATA			4				// No scan completed yet
+#define OCMP_ERR_NOTRIGGER		5				// No on-demand scans configured
+
+// Status of a single query entry
+#define OCMP_STATUS_OK			0				// All requested channels returned
+#define OCMP_STATUS_PARTIAL		1				// Range clipped to the channels available
+#define OCMP_STATUS_NOGRID		2				// No scan on the requested grid
+#define OCMP_STATUS_RANGE		3				// Requested channels outside of the scanned range
+
+#pragma pack(push,1)
+
+// Frame header
+typedef struct {
+	unsigned int	MAGIC;		// OCMP_MAGIC
+	unsigned char	VERSION;	// Protocol version of the sender
+	unsigned char	TYPE;		// OCMP_MSG_...
+	unsigned short	FLAGS;		// OCMP_FLAG_...
+	unsigned int	REQID;		// Request id chosen by the client, echoed in the response
+	unsigned int	LENGTH;		// Payload length in bytes
+} OCMP_Header_t;
+
+// COUNT consecutive channels on a grid starting at FREQ
+typedef struct {
+	unsigned int	FREQ;		// Center frequency of the first channel
+	unsigned short	GRID;		// Channel spacing in GHz (e.g. 50 or 100)
+	unsigned short	COUNT;		// Number of channels
+} OCMP_ChannelQuery_t;
+
+// Subscription parameters
+typedef struct {
+	unsigned int	INTERVAL;	// Minimum time between two pushes in ms (0: every scan)
+	unsigned short	NCHANNELS;	// Number of OCMP_ChannelQuery_t
+	unsigned short	NWINDOWS;	// Number of OCMP_FreqWindow_t
+} OCMP_Subscribe_t;
+
+// All channels on a grid with a center frequency between FSTART and FSTOP (inclusive)
+typedef struct {
+	unsigned int	FSTART;		// Lower edge of the window
+	unsigned int	FSTOP;		// Upper edge of the window
+	unsigned short	GRID;		// Channel spacing in GHz
+	unsigned short	RESERVED;
+} OCMP_FreqWindow_t;
+
+// Frequency window of the high-resolution spectrum
+typedef struct {
+	unsigned int	FSTART;		// Lower edge of the window
+	unsigned int	FSTOP;		// Upper edge of the window (inclusive)
+} OCMP_SpectrumWindow_t;
+
+// Result of one OCMP_SpectrumWindow_t
+typedef struct {
+	unsigned int	FSTART;		// Center frequency of the first returned slice
+	unsigned int	FSTOP;		// Center frequency of the last returned slice
+	unsigned short	STATUS;		// OCMP_STATUS_...
+	unsigned short	RESERVED;
+	unsigned int	COUNT;		// Number of slices returned for this window
+} OCMP_WindowResult_t;
+
+// Scan the response is based on
+typedef struct {
+	unsigned int	SCAN;		// Scan number (increases with every completed scan cycle)
+	unsigned int	BASESCAN;	// Scan the powers are relative to (OCMP_FLAG_DELTASCAN), otherwise 0
+	long long		TIMESTAMP;	// Time the scan was completed (ms since 1970-01-01 UTC)
+} OCMP_ScanInfo_t;
+
+// Result of one OCMP_ChannelQuery_t
+typedef struct {
+	unsigned int	FREQ;		// Center frequency of the first returned channel
+	unsigned short	STATUS;		// OCMP_STATUS_...
+	unsigned short	COUNT;		// Number of OCMP_ChannelValue_t returned for this entry
+} OCMP_ChannelResult_t;
+
+// Values of a channel
+typedef struct {
+	double			POWER;		// Channel power in dBm
+	double			OSNR;		// OSNR in dB
+} OCMP_ChannelValue_t;
+
+#pragma pack(pop)
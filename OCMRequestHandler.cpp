@@ -0,0 +1,627 @@
+#include "stdafx.h"
+#include <algorithm>
+#include "OCMRequestHandler.h"
+#include "OCMSpectrumCodec.h"
+
+#define OCM_CACHE_MAXENTRIES	4096				// Maximum number of cached responses per snapshot
+#define OCM_CACHE_MAXBYTES		(64 * 1024 * 1024)	// Maximum size of the cached keys and payloads per snapshot
+#define OCM_HISTORY_SIZE		8					// Number of snapshots kept as bases for OCMP_FLAG_DELTASCAN
+
+OCMRequestHandler::OCMRequestHandler(OCMSnapshotSource *pSource, OCMScanTrigger *pTrigger)
+{
+	_pSource = pSource;
+	_pTrigger = pTrigger;
+	_cacheBytes = 0;
+}
+
+int OCMRequestHandler::onReceive(OCMScanServer &Server, OCMConnection &Conn, const char *pData, size_t size)
+{
+	// Wait for the header
+	OCMP_Header_t Head;
+	if (size < sizeof(Head)) {
+		return 0;
+	}
+	memcpy(&Head, pData, sizeof(Head));
+
+	// We cannot resynchronize on a broken stream
+	if (Head.MAGIC != OCMP_MAGIC || Head.LENGTH > OCMP_MAXPAYLOAD) {
+		fprintf(stderr, "[WARNING] Connection %u (%s): invalid frame (MAGIC=%08X, LENGTH=%u)\n", Conn.Id, Conn.Peer.c_str(), Head.MAGIC, Head.LENGTH);
+		return -1;
+	}
+
+	// Wait for the payload
+	if (size < sizeof(Head) + Head.LENGTH) {
+		return 0;
+	}
+	const char *pPayload = pData + sizeof(Head);
+
+	if (Head.VERSION == 0 || Head.VERSION > OCMP_VERSION) {
+		sendError(Server, Conn, Head, OCMP_ERR_VERSION, "Protocol version not supported");
+	}
+	else {
+		switch (Head.TYPE) {
+		case OCMP_MSG_CHANNELS:
+			handleChannels(Server, Conn, Head, pPayload);
+			break;
+		case OCMP_MSG_WINDOW:
+			handleWindow(Server, Conn, Head, pPayload);
+			break;
+		case OCMP_MSG_SUBSCRIBE:
+			handleSubscribe(Server, Conn, Head, pPayload);
+			break;
+		case OCMP_MSG_UNSUBSCRIBE:
+			handleUnsubscribe(Server, Conn, Head);
+			break;
+		case OCMP_MSG_TRIGGER:
+			handleTrigger(Server, Conn, Head);
+			break;
+		default:
+			sendError(Server, Conn, Head, OCMP_ERR_TYPE, "Unknown message type");
+			break;
+		}
+	}
+
+	return (int)(sizeof(Head) + Head.LENGTH);
+}
+
+void OCMRequestHandler::onClose(OCMScanServer &Server, OCMConnection &Conn)
+{
+	_subscriptions.erase(Conn.Id);
+}
+
+void OCMRequestHandler::onTick(OCMScanServer &Server)
+{
+	std::string Error = Server.getLastError();
+	if (Error != "") {
+		fprintf(stderr, "%s", Error.c_str());
+	}
+
+	if (_subscriptions.empty()) {
+		return;
+	}
+
+	std::shared_ptr<const OCMScanSnapshot> Snapshot = _pSource->getSnapshot();
+	if (!Snapshot) {
+		return;
+	}
+
+	long long now = OCMScanServer::nowMs();
+	for (std::map<unsigned int, Subscription_t>::iterator it = _subscriptions.begin(); it != _subscriptions.end(); ++it) {
+		Subscription_t &Sub = it->second;
+		if (Sub.LastScan == Snapshot->Scan || now - Sub.LastPushMs < (long long)Sub.IntervalMs) {
+			continue;
+		}
+
+		// Coalesce: while the previous push is still queued, newer scans only replace each other here
+		OCMConnection *pConn = Server.getConnection(it->first);
+		if (pConn == NULL || pConn->TxQueued > 0) {
+			continue;
+		}
+
+		push(Server, *pConn, Sub, Snapshot);
+	}
+}
+
+void OCMRequestHandler::handleChannels(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, const char *pPayload)
+{
+	unsigned int nEntries = 0;
+	if (Head.LENGTH < sizeof(nEntries)) {
+		sendError(Server, Conn, Head, OCMP_ERR_FORMAT, "Payload too short");
+		return;
+	}
+	memcpy(&nEntries, pPayload, sizeof(nEntries));
+	if (Head.LENGTH != sizeof(nEntries) + (size_t)nEntries * sizeof(OCMP_ChannelQuery_t)) {
+		sendError(Server, Conn, Head, OCMP_ERR_FORMAT, "Payload length does not match NENTRIES");
+		return;
+	}
+
+	std::shared_ptr<const OCMScanSnapshot> Snapshot = _pSource->getSnapshot();
+	if (!Snapshot) {
+		sendError(Server, Conn, Head, OCMP_ERR_NODATA, "No scan completed yet");
+		return;
+	}
+
+	std::string Key = cacheKey(Head, pPayload);
+	std::shared_ptr<const Payload_t> Payload = findCached(Snapshot, Key);
+	if (!Payload) {
+		std::vector<Range_t> Ranges(nEntries);
+		for (unsigned int i = 0; i < nEntries; ++i) {
+			OCMP_ChannelQuery_t Query;
+			memcpy(&Query, pPayload + sizeof(nEntries) + i * sizeof(Query), sizeof(Query));
+			Ranges[i] = findChannels(*Snapshot, Query);
+		}
+		Payload = buildRanges(Snapshot, Ranges);
+		addCached(Key, Payload);
+	}
+
+	sendPayload(Server, Conn, OCMP_MSG_CHANNELS, Head.REQID, *Payload);
+}
+
+void OCMRequestHandler::handleWindow(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, const char *pPayload)
+{
+	unsigned int nWindows = 0;
+	if (Head.LENGTH < sizeof(nWindows)) {
+		sendError(Server, Conn, Head, OCMP_ERR_FORMAT, "Payload too short");
+		return;
+	}
+	memcpy(&nWindows, pPayload, sizeof(nWindows));
+	unsigned int BaseScan = 0;
+	size_t baseSize = (Head.FLAGS & OCMP_FLAG_DELTASCAN) != 0 ? sizeof(BaseScan) : 0;
+	if (Head.LENGTH != sizeof(nWindows) + (size_t)nWindows * sizeof(OCMP_SpectrumWindow_t) + baseSize) {
+		sendError(Server, Conn, Head, OCMP_ERR_FORMAT, "Payload length does not match NWINDOWS");
+		return;
+	}
+	if (baseSize > 0) {
+		memcpy(&BaseScan, pPayload + Head.LENGTH - baseSize, baseSize);
+	}
+
+	std::shared_ptr<const OCMScanSnapshot> Snapshot = _pSource->getSnapshot();
+	if (!Snapshot) {
+		sendError(Server, Conn, Head, OCMP_ERR_NODATA, "No scan completed yet");
+		return;
+	}
+
+	std::string Key = cacheKey(Head, pPayload);
+	std::shared_ptr<const Payload_t> Payload = findCached(Snapshot, Key);
+	if (!Payload) {
+		if ((Head.FLAGS & OCMP_FLAG_COMPACT) != 0) {
+			const OCMSpectrum_t *pBase = baseSize > 0 ? findBase(*Snapshot, BaseScan) : NULL;
+			Payload = buildWindowsCompact(Snapshot, pPayload + sizeof(nWindows), nWindows, pBase, BaseScan);
+		}
+		else {
+			Payload = buildWindows(Snapshot, pPayload + sizeof(nWindows), nWindows);
+		}
+		addCached(Key, Payload);
+	}
+
+	sendPayload(Server, Conn, OCMP_MSG_WINDOW, Head.REQID, *Payload);
+}
+
+void OCMRequestHandler::handleSubscribe(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, const char *pPayload)
+{
+	OCMP_Subscribe_t Params;
+	if (Head.LENGTH < sizeof(Params)) {
+		sendError(Server, Conn, Head, OCMP_ERR_FORMAT, "Payload too short");
+		return;
+	}
+	memcpy(&Params, pPayload, sizeof(Params));
+	if (Head.LENGTH != sizeof(Params) + Params.NCHANNELS * sizeof(OCMP_ChannelQuery_t) + Params.NWINDOWS * sizeof(OCMP_FreqWindow_t)) {
+		sendError(Server, Conn, Head, OCMP_ERR_FORMAT, "Payload length does not match NCHANNELS and NWINDOWS");
+		return;
+	}
+
+	// Subscribers with the same channels and windows share the pushed payload, whatever their interval
+	Subscription_t Sub;
+	Sub.ReqId		= Head.REQID;
+	Sub.Key			= std::string(1, (char)OCMP_MSG_SCAN) + std::string(pPayload + sizeof(Params.INTERVAL), Head.LENGTH - sizeof(Params.INTERVAL));
+	Sub.IntervalMs	= Params.INTERVAL;
+	Sub.Channels.resize(Params.NCHANNELS);
+	Sub.Windows.resize(Params.NWINDOWS);
+	Sub.LastScan	= 0;
+	Sub.LastPushMs	= 0;
+
+	const char *p = pPayload + sizeof(Params);
+	if (Params.NCHANNELS > 0) {
+		memcpy(&Sub.Channels[0], p, Params.NCHANNELS * sizeof(OCMP_ChannelQuery_t));
+		p += Params.NCHANNELS * sizeof(OCMP_ChannelQuery_t);
+	}
+	if (Params.NWINDOWS > 0) {
+		memcpy(&Sub.Windows[0], p, Params.NWINDOWS * sizeof(OCMP_FreqWindow_t));
+	}
+
+	_subscriptions[Conn.Id] = Sub;
+	sendEmpty(Server, Conn, OCMP_MSG_SUBSCRIBE, Head.REQID);
+
+	// Start with the current scan, if any
+	std::shared_ptr<const OCMScanSnapshot> Snapshot = _pSource->getSnapshot();
+	if (Snapshot) {
+		push(Server, Conn, _subscriptions[Conn.Id], Snapshot);
+	}
+}
+
+void OCMRequestHandler::handleUnsubscribe(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head)
+{
+	_subscriptions.erase(Conn.Id);
+	sendEmpty(Server, Conn, OCMP_MSG_UNSUBSCRIBE, Head.REQID);
+}
+
+void OCMRequestHandler::handleTrigger(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head)
+{
+	if (_pTrigger == NULL || !_pTrigger->triggerScans()) {
+		sendError(Server, Conn, Head, OCMP_ERR_NOTRIGGER, "No on-demand scans configured");
+		return;
+	}
+	sendEmpty(Server, Conn, OCMP_MSG_TRIGGER, Head.REQID);
+}
+
+void OCMRequestHandler::push(OCMScanServer &Server, OCMConnection &Conn, Subscription_t &Sub, const std::shared_ptr<const OCMScanSnapshot> &Snapshot)
+{
+	std::shared_ptr<const Payload_t> Payload = findCached(Snapshot, Sub.Key);
+	if (!Payload) {
+		std::vector<Range_t> Ranges;
+		Ranges.reserve(Sub.Channels.size() + Sub.Windows.size());
+		for (size_t i = 0; i < Sub.Channels.size(); ++i) {
+			Ranges.push_back(findChannels(*Snapshot, Sub.Channels[i]));
+		}
+		for (size_t i = 0; i < Sub.Windows.size(); ++i) {
+			Ranges.push_back(findWindow(*Snapshot, Sub.Windows[i]));
+		}
+		Payload = buildRanges(Snapshot, Ranges);
+		addCached(Sub.Key, Payload);
+	}
+
+	sendPayload(Server, Conn, OCMP_MSG_SCAN, Sub.ReqId, *Payload);
+	Sub.LastScan = Snapshot->Scan;
+	Sub.LastPushMs = OCMScanServer::nowMs();
+}
+
+const OCMGridResult_t *OCMRequestHandler::findGrid(const OCMScanSnapshot &Snapshot, unsigned short Grid)
+{
+	for (unsigned int g = 0; g < Snapshot.Grids.size(); ++g) {
+		if (Snapshot.Grids[g].Step != 0 && Snapshot.Grids[g].Step == Grid * 10000u) { // GHz -> 0.1 MHz
+			return &Snapshot.Grids[g];
+		}
+	}
+	return NULL;
+}
+
+void OCMRequestHandler::clip(Range_t &Range, long long first, long long last)
+{
+	const OCMGridResult_t *pGrid = Range.pGrid;
+	long long begin = first < 0 ? 0 : first;
+	long long end = last > (long long)pGrid->Values.size() ? (long long)pGrid->Values.size() : last;
+	if (begin >= end) {
+		Range.Result.STATUS = OCMP_STATUS_RANGE;
+		return;
+	}
+	if (end - begin > 0xFFFF) {
+		end = begin + 0xFFFF;
+	}
+
+	Range.Result.FREQ	= (unsigned int)(pGrid->FirstFreq + begin * pGrid->Step);
+	Range.Result.STATUS	= (begin == first && end == last) ? OCMP_STATUS_OK : OCMP_STATUS_PARTIAL;
+	Range.Result.COUNT	= (unsigned short)(end - begin);
+	Range.Begin			= (size_t)begin;
+}
+
+OCMRequestHandler::Range_t OCMRequestHandler::findChannels(const OCMScanSnapshot &Snapshot, const OCMP_ChannelQuery_t &Query)
+{
+	Range_t Range;
+	Range.Result.FREQ	= Query.FREQ;
+	Range.Result.STATUS	= OCMP_STATUS_NOGRID;
+	Range.Result.COUNT	= 0;
+	Range.pGrid			= findGrid(Snapshot, Query.GRID);
+	Range.Begin			= 0;
+	if (Range.pGrid == NULL) {
+		return Range;
+	}
+
+	// Round to the nearest channel
+	long long step = Range.pGrid->Step;
+	long long offset = (long long)Query.FREQ - Range.pGrid->FirstFreq + step / 2;
+	long long first = offset >= 0 ? offset / step : -((-offset + step - 1) / step);
+	clip(Range, first, first + Query.COUNT);
+	return Range;
+}
+
+OCMRequestHandler::Range_t OCMRequestHandler::findWindow(const OCMScanSnapshot &Snapshot, const OCMP_FreqWindow_t &Window)
+{
+	Range_t Range;
+	Range.Result.FREQ	= Window.FSTART;
+	Range.Result.STATUS	= OCMP_STATUS_NOGRID;
+	Range.Result.COUNT	= 0;
+	Range.pGrid			= findGrid(Snapshot, Window.GRID);
+	Range.Begin			= 0;
+	if (Range.pGrid == NULL) {
+		return Range;
+	}
+
+	// First channel at or above FSTART, last channel at or below FSTOP
+	long long step = Range.pGrid->Step;
+	long long start = (long long)Window.FSTART - Range.pGrid->FirstFreq;
+	long long stop = (long long)Window.FSTOP - Range.pGrid->FirstFreq;
+	long long first = start >= 0 ? (start + step - 1) / step : -(-start / step);
+	long long last = stop >= 0 ? stop / step : -((-stop + step - 1) / step);
+	clip(Range, first, last + 1);
+	return Range;
+}
+
+std::shared_ptr<const OCMRequestHandler::Payload_t> OCMRequestHandler::buildRanges(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const std::vector<Range_t> &Ranges)
+{
+	// Scan information and result table are built in a separate buffer. The channel values are sent
+	// straight from the snapshot.
+	unsigned int nEntries = (unsigned int)Ranges.size();
+	size_t metaSize = sizeof(OCMP_ScanInfo_t) + sizeof(nEntries) + nEntries * sizeof(OCMP_ChannelResult_t);
+	std::shared_ptr<std::vector<char> > Meta = std::make_shared<std::vector<char> >(metaSize);
+
+	std::shared_ptr<Payload_t> Payload = std::make_shared<Payload_t>();
+	std::vector<OCMTxSegment_t> &Segments = Payload->Segments;
+	Segments.resize(1);
+	Segments[0].Owner = Meta;
+	Segments[0].pData = &(*Meta)[0];
+	Segments[0].Length = metaSize;
+
+	OCMP_ChannelResult_t *pResult = (OCMP_ChannelResult_t*)(&(*Meta)[0] + metaSize - nEntries * sizeof(OCMP_ChannelResult_t));
+	size_t dataSize = 0;
+	for (unsigned int i = 0; i < nEntries; ++i) {
+		pResult[i] = Ranges[i].Result;
+		if (Ranges[i].Result.COUNT == 0) {
+			continue;
+		}
+
+		OCMTxSegment_t Segment;
+		Segment.Owner	= Snapshot;
+		Segment.pData	= (const char*)&Ranges[i].pGrid->Values[Ranges[i].Begin];
+		Segment.Length	= Ranges[i].Result.COUNT * sizeof(OCMP_ChannelValue_t);
+		Segments.push_back(Segment);
+		dataSize += Segment.Length;
+	}
+
+	OCMP_ScanInfo_t *pInfo = (OCMP_ScanInfo_t*)&(*Meta)[0];
+	pInfo->SCAN			= Snapshot->Scan;
+	pInfo->BASESCAN		= 0;
+	pInfo->TIMESTAMP	= Snapshot->TimestampMs;
+	memcpy(pInfo + 1, &nEntries, sizeof(nEntries));
+
+	Payload->Length = metaSize + dataSize;
+	Payload->Flags = 0;
+	return Payload;
+}
+
+std::shared_ptr<const OCMRequestHandler::Payload_t> OCMRequestHandler::buildWindows(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const char *pWindows, unsigned int nWindows)
+{
+	const OCMSpectrum_t &Spectrum = Snapshot->Spectrum;
+
+	size_t metaSize = sizeof(OCMP_ScanInfo_t) + sizeof(nWindows) + nWindows * sizeof(OCMP_WindowResult_t);
+	std::shared_ptr<std::vector<char> > Meta = std::make_shared<std::vector<char> >(metaSize);
+
+	std::shared_ptr<Payload_t> Payload = std::make_shared<Payload_t>();
+	std::vector<OCMTxSegment_t> &Segments = Payload->Segments;
+	Segments.resize(1);
+	Segments[0].Owner = Meta;
+	Segments[0].pData = &(*Meta)[0];
+	Segments[0].Length = metaSize;
+
+	OCMP_WindowResult_t *pResult = (OCMP_WindowResult_t*)(&(*Meta)[0] + metaSize - nWindows * sizeof(OCMP_WindowResult_t));
+	size_t dataSize = 0;
+	for (unsigned int i = 0; i < nWindows; ++i) {
+		OCMP_SpectrumWindow_t Window;
+		memcpy(&Window, pWindows + i * sizeof(Window), sizeof(Window));
+
+		pResult[i].FSTART	= Window.FSTART;
+		pResult[i].FSTOP	= Window.FSTOP;
+		pResult[i].STATUS	= OCMP_STATUS_NOGRID;
+		pResult[i].RESERVED	= 0;
+		pResult[i].COUNT	= 0;
+		if (Spectrum.Freq.empty()) {
+			continue;
+		}
+
+		// The axis is sorted, so the window is found with two binary searches
+		size_t begin = std::lower_bound(Spectrum.Freq.begin(), Spectrum.Freq.end(), Window.FSTART) - Spectrum.Freq.begin();
+		size_t end = std::upper_bound(Spectrum.Freq.begin(), Spectrum.Freq.end(), Window.FSTOP) - Spectrum.Freq.begin();
+		if (Window.FSTOP < Window.FSTART || begin >= end) {
+			pResult[i].STATUS = OCMP_STATUS_RANGE;
+			continue;
+		}
+
+		pResult[i].FSTART	= Spectrum.Freq[begin];
+		pResult[i].FSTOP	= Spectrum.Freq[end - 1];
+		pResult[i].STATUS	= (Window.FSTART >= Spectrum.Freq.front() && Window.FSTOP <= Spectrum.Freq.back()) ? OCMP_STATUS_OK : OCMP_STATUS_PARTIAL;
+		pResult[i].COUNT	= (unsigned int)(end - begin);
+
+		OCMTxSegment_t Segment;
+		Segment.Owner	= Snapshot;
+		Segment.pData	= (const char*)&Spectrum.Freq[begin];
+		Segment.Length	= (end - begin) * sizeof(unsigned int);
+		Segments.push_back(Segment);
+		Segment.pData	= (const char*)&Spectrum.Power[begin];
+		Segment.Length	= (end - begin) * sizeof(double);
+		Segments.push_back(Segment);
+		dataSize += (end - begin) * (sizeof(unsigned int) + sizeof(double));
+	}
+
+	OCMP_ScanInfo_t *pInfo = (OCMP_ScanInfo_t*)&(*Meta)[0];
+	pInfo->SCAN			= Snapshot->Scan;
+	pInfo->BASESCAN		= 0;
+	pInfo->TIMESTAMP	= Snapshot->TimestampMs;
+	memcpy(pInfo + 1, &nWindows, sizeof(nWindows));
+
+	Payload->Length = metaSize + dataSize;
+	Payload->Flags = 0;
+	return Payload;
+}
+
+std::shared_ptr<const OCMRequestHandler::Payload_t> OCMRequestHandler::buildWindowsCompact(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const char *pWindows, unsigned int nWindows, const OCMSpectrum_t *pBase, unsigned int BaseScan)
+{
+	// The encoded slices are much smaller than the plain ones, so everything goes into one buffer
+	const OCMSpectrum_t &Spectrum = Snapshot->Spectrum;
+	size_t tableOffset = sizeof(OCMP_ScanInfo_t) + sizeof(nWindows);
+	std::vector<unsigned char> Data(tableOffset + nWindows * sizeof(OCMP_WindowResult_t));
+
+	for (unsigned int i = 0; i < nWindows; ++i) {
+		OCMP_SpectrumWindow_t Window;
+		memcpy(&Window, pWindows + i * sizeof(Window), sizeof(Window));
+
+		OCMP_WindowResult_t Result;
+		Result.FSTART	= Window.FSTART;
+		Result.FSTOP	= Window.FSTOP;
+		Result.STATUS	= OCMP_STATUS_NOGRID;
+		Result.RESERVED	= 0;
+		Result.COUNT	= 0;
+
+		size_t begin = 0, end = 0;
+		if (!Spectrum.Freq.empty()) {
+			begin = std::lower_bound(Spectrum.Freq.begin(), Spectrum.Freq.end(), Window.FSTART) - Spectrum.Freq.begin();
+			end = std::upper_bound(Spectrum.Freq.begin(), Spectrum.Freq.end(), Window.FSTOP) - Spectrum.Freq.begin();
+			if (Window.FSTOP < Window.FSTART || begin >= end) {
+				Result.STATUS = OCMP_STATUS_RANGE;
+				begin = end = 0;
+			}
+			else {
+				Result.FSTART	= Spectrum.Freq[begin];
+				Result.FSTOP	= Spectrum.Freq[end - 1];
+				Result.STATUS	= (Window.FSTART >= Spectrum.Freq.front() && Window.FSTOP <= Spectrum.Freq.back()) ? OCMP_STATUS_OK : OCMP_STATUS_PARTIAL;
+				Result.COUNT	= (unsigned int)(end - begin);
+			}
+		}
+		memcpy(&Data[tableOffset + i * sizeof(Result)], &Result, sizeof(Result));
+
+		// NBYTES, then the encoded slices
+		size_t sizeOffset = Data.size();
+		Data.resize(sizeOffset + sizeof(unsigned int));
+		OCMSpectrumCodec::encode(Spectrum, begin, end, pBase, Data);
+		unsigned int nBytes = (unsigned int)(Data.size() - sizeOffset - sizeof(unsigned int));
+		memcpy(&Data[sizeOffset], &nBytes, sizeof(nBytes));
+	}
+
+	OCMP_ScanInfo_t Info;
+	Info.SCAN		= Snapshot->Scan;
+	Info.BASESCAN	= pBase ? BaseScan : 0;
+	Info.TIMESTAMP	= Snapshot->TimestampMs;
+	memcpy(&Data[0], &Info, sizeof(Info));
+	memcpy(&Data[sizeof(Info)], &nWindows, sizeof(nWindows));
+
+	std::shared_ptr<std::vector<unsigned char> > Buffer = std::make_shared<std::vector<unsigned char> >();
+	Buffer->swap(Data);
+
+	std::shared_ptr<Payload_t> Payload = std::make_shared<Payload_t>();
+	OCMTxSegment_t Segment;
+	Segment.Owner	= Buffer;
+	Segment.pData	= (const char*)&(*Buffer)[0];
+	Segment.Length	= Buffer->size();
+	Payload->Segments.push_back(Segment);
+	Payload->Length	= Buffer->size();
+	Payload->Flags	= OCMP_FLAG_COMPACT | (pBase ? OCMP_FLAG_DELTASCAN : 0);
+	return Payload;
+}
+
+const OCMSpectrum_t *OCMRequestHandler::findBase(const OCMScanSnapshot &Snapshot, unsigned int BaseScan) const
+{
+	for (size_t i = 0; i < _history.size(); ++i) {
+		const History_t &Entry = _history[i];
+		if (BaseScan >= Entry.FirstScan && BaseScan <= Entry.LastScan) {
+			const OCMSpectrum_t &Base = Entry.Snapshot->Spectrum;
+			return Base.Freq == Snapshot.Spectrum.Freq ? &Base : NULL;
+		}
+	}
+	return NULL;
+}
+
+void OCMRequestHandler::addHistory(const std::shared_ptr<const OCMScanSnapshot> &Snapshot)
+{
+	// Snapshots of grid scans carry the spectrum of the last high-resolution scan unchanged. They extend
+	// the scan range of the last entry, so a client can use any of their scan numbers as base.
+	if (Snapshot->Spectrum.Freq.empty()) {
+		return;
+	}
+	if (!_history.empty()) {
+		History_t &Last = _history.back();
+		if (Last.Snapshot->Spectrum.Freq == Snapshot->Spectrum.Freq && Last.Snapshot->Spectrum.Power == Snapshot->Spectrum.Power) {
+			Last.LastScan = Snapshot->Scan;
+			return;
+		}
+	}
+
+	History_t Entry;
+	Entry.Snapshot	= Snapshot;
+	Entry.FirstScan	= Snapshot->Scan;
+	Entry.LastScan	= Snapshot->Scan;
+	_history.push_back(Entry);
+	if (_history.size() > OCM_HISTORY_SIZE) {
+		_history.pop_front();
+	}
+}
+
+std::string OCMRequestHandler::cacheKey(const OCMP_Header_t &Head, const char *pPayload)
+{
+	std::string Key;
+	Key.reserve(sizeof(Head.TYPE) + sizeof(Head.FLAGS) + Head.LENGTH);
+	Key.append((const char*)&Head.TYPE, sizeof(Head.TYPE));
+	Key.append((const char*)&Head.FLAGS, sizeof(Head.FLAGS));
+	Key.append(pPayload, Head.LENGTH);
+	return Key;
+}
+
+std::shared_ptr<const OCMRequestHandler::Payload_t> OCMRequestHandler::findCached(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const std::string &Key)
+{
+	// A new snapshot invalidates all entries
+	if (Snapshot != _cacheSnapshot) {
+		_cache.clear();
+		_cacheBytes = 0;
+		_cacheSnapshot = Snapshot;
+		addHistory(Snapshot);
+		return std::shared_ptr<const Payload_t>();
+	}
+
+	std::unordered_map<std::string, std::shared_ptr<const Payload_t> >::iterator it = _cache.find(Key);
+	if (it == _cache.end()) {
+		return std::shared_ptr<const Payload_t>();
+	}
+	return it->second;
+}
+
+void OCMRequestHandler::addCached(const std::string &Key, const std::shared_ptr<const Payload_t> &Payload)
+{
+	// Requests that are all different do not pile up. The keys hold the whole request payload,
+	// so they count against the byte budget as well as the response payloads.
+	size_t size = Key.size() + Payload->Length;
+	if (_cache.size() < OCM_CACHE_MAXENTRIES && _cacheBytes + size <= OCM_CACHE_MAXBYTES) {
+		if (_cache.insert(std::make_pair(Key, Payload)).second) {
+			_cacheBytes += size;
+		}
+	}
+}
+
+void OCMRequestHandler::sendPayload(OCMScanServer &Server, OCMConnection &Conn, unsigned char Type, unsigned int ReqId, const Payload_t &Payload)
+{
+	std::shared_ptr<OCMP_Header_t> Head = std::make_shared<OCMP_Header_t>();
+	Head->MAGIC		= OCMP_MAGIC;
+	Head->VERSION	= OCMP_VERSION;
+	Head->TYPE		= Type;
+	Head->FLAGS		= Payload.Flags;
+	Head->REQID		= ReqId;
+	Head->LENGTH	= (unsigned int)Payload.Length;
+
+	std::vector<OCMTxSegment_t> Segments;
+	Segments.reserve(Payload.Segments.size() + 1);
+	OCMTxSegment_t Segment;
+	Segment.Owner	= Head;
+	Segment.pData	= (const char*)Head.get();
+	Segment.Length	= sizeof(OCMP_Header_t);
+	Segments.push_back(Segment);
+	Segments.insert(Segments.end(), Payload.Segments.begin(), Payload.Segments.end());
+
+	Server.send(Conn, Segments);
+}
+
+void OCMRequestHandler::sendEmpty(OCMScanServer &Server, OCMConnection &Conn, unsigned char Type, unsigned int ReqId)
+{
+	OCMP_Header_t Head;
+	Head.MAGIC		= OCMP_MAGIC;
+	Head.VERSION	= OCMP_VERSION;
+	Head.TYPE		= Type;
+	Head.FLAGS		= 0;
+	Head.REQID		= ReqId;
+	Head.LENGTH		= 0;
+
+	Server.send(Conn, &Head, sizeof(Head));
+}
+
+void OCMRequestHandler::sendError(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, unsigned int Code, const char *Message)
+{
+	size_t length = strlen(Message);
+	std::vector<char> Frame(sizeof(OCMP_Header_t) + sizeof(Code) + length);
+
+	OCMP_Header_t *pHead = (OCMP_Header_t*)&Frame[0];
+	pHead->MAGIC	= OCMP_MAGIC;
+	pHead->VERSION	= OCMP_VERSION;
+	pHead->TYPE		= OCMP_MSG_ERROR;
+	pHead->FLAGS	= 0;
+	pHead->REQID	= Head.REQID;
+	pHead->LENGTH	= (unsigned int)(sizeof(Code) + length);
+	memcpy(&Frame[sizeof(OCMP_Header_t)], &Code, sizeof(Code));
+	memcpy(&Frame[sizeof(OCMP_Header_t) + sizeof(Code)], Message, length);
+
+	Server.send(Conn, &Frame[0], Frame.size());
+}
@@ -0,0 +1,101 @@
+//
+// OCMP request handler of the scan server (see OCMProtocol.h)
+//
+// Parses all complete frames in the receive buffer of a connection and queues the responses. The
+// response data is not copied: the payload segments point straight into the buffers of the snapshot
+// and keep it alive until they have been sent. Compactly encoded windows (OCMP_FLAG_COMPACT) are the
+// exception: they are encoded into a buffer owned by the payload.
+//
+// Responses are cached per snapshot: the serialized payload of a request is kept, keyed by message type,
+// flags and request payload, until a new snapshot is published. Identical requests of any number of clients
+// against the same scan then only cost a lookup and a 16-byte header. The cached payload segments are
+// reference counted, so a response still queued on a slow connection keeps its payload alive after the
+// cache has been cleared. The cache is bounded both in entries and in bytes; the keys, which include the
+// request payload, count against the byte budget.
+//
+// Subscriptions are served from onTick(): whenever the snapshot source has a newer scan than the one
+// last pushed to a subscriber, and its rate limit and send queue allow it, the scan is pushed. Call
+// OCMScanServer::wakeup() after publishing a scan to push it without waiting for the next tick.
+//
+#pragma once
+
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include "OCMScanServer.h"
+#include "OCMScanSnapshot.h"
+
+class OCMRequestHandler : public OCMServerHandler
+{
+public:
+	// pTrigger may be NULL if the server has no on-demand scans
+	OCMRequestHandler(OCMSnapshotSource *pSource, OCMScanTrigger *pTrigger = NULL);
+
+	virtual int onReceive(OCMScanServer &Server, OCMConnection &Conn, const char *pData, size_t size);
+	virtual void onClose(OCMScanServer &Server, OCMConnection &Conn);
+	virtual void onTick(OCMScanServer &Server);
+
+private:
+	// Subscription of a connection
+	typedef struct {
+		unsigned int						ReqId;		// REQID of the OCMP_MSG_SUBSCRIBE request
+		std::string							Key;		// Cache key of the pushed payload
+		unsigned int						IntervalMs;	// Minimum time between two pushes
+		std::vector<OCMP_ChannelQuery_t>	Channels;
+		std::vector<OCMP_FreqWindow_t>		Windows;
+		unsigned int						LastScan;	// Scan number of the last push (0: none yet)
+		long long							LastPushMs;	// Time of the last push
+	} Subscription_t;
+
+	// Channels of a query entry found in a snapshot
+	typedef struct {
+		OCMP_ChannelResult_t	Result;
+		const OCMGridResult_t	*pGrid;
+		size_t					Begin;		// Index of the first channel in pGrid->Values
+	} Range_t;
+
+	// Serialized response payload (everything after the header)
+	typedef struct {
+		std::vector<OCMTxSegment_t>	Segments;
+		size_t						Length;
+		unsigned short				Flags;		// OCMP_FLAG_... of the response header
+	} Payload_t;
+
+	// Spectrum of one or more consecutive scans (grid scans publish snapshots with an unchanged spectrum)
+	typedef struct {
+		std::shared_ptr<const OCMScanSnapshot>	Snapshot;	// First snapshot with this spectrum
+		unsigned int							FirstScan;
+		unsigned int							LastScan;
+	} History_t;
+
+	void handleChannels(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, const char *pPayload);
+	void handleWindow(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, const char *pPayload);
+	void handleSubscribe(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, const char *pPayload);
+	void handleUnsubscribe(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head);
+	void handleTrigger(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head);
+	void push(OCMScanServer &Server, OCMConnection &Conn, Subscription_t &Sub, const std::shared_ptr<const OCMScanSnapshot> &Snapshot);
+	std::shared_ptr<const Payload_t> buildRanges(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const std::vector<Range_t> &Ranges);
+	std::shared_ptr<const Payload_t> buildWindows(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const char *pWindows, unsigned int nWindows);
+	std::shared_ptr<const Payload_t> buildWindowsCompact(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const char *pWindows, unsigned int nWindows, const OCMSpectrum_t *pBase, unsigned int BaseScan);
+	const OCMSpectrum_t *findBase(const OCMScanSnapshot &Snapshot, unsigned int BaseScan) const;
+	void addHistory(const std::shared_ptr<const OCMScanSnapshot> &Snapshot);
+	static std::string cacheKey(const OCMP_Header_t &Head, const char *pPayload);
+	std::shared_ptr<const Payload_t> findCached(const std::shared_ptr<const OCMScanSnapshot> &Snapshot, const std::string &Key);
+	void addCached(const std::string &Key, const std::shared_ptr<const Payload_t> &Payload);
+	void sendPayload(OCMScanServer &Server, OCMConnection &Conn, unsigned char Type, unsigned int ReqId, const Payload_t &Payload);
+	void sendEmpty(OCMScanServer &Server, OCMConnection &Conn, unsigned char Type, unsigned int ReqId);
+	void sendError(OCMScanServer &Server, OCMConnection &Conn, const OCMP_Header_t &Head, unsigned int Code, const char *Message);
+
+	static Range_t findChannels(const OCMScanSnapshot &Snapshot, const OCMP_ChannelQuery_t &Query);
+	static Range_t findWindow(const OCMScanSnapshot &Snapshot, const OCMP_FreqWindow_t &Window);
+	static const OCMGridResult_t *findGrid(const OCMScanSnapshot &Snapshot, unsigned short Grid);
+	static void clip(Range_t &Range, long long first, long long last);
+
+	OCMSnapshotSource						*_pSource;
+	OCMScanTrigger							*_pTrigger;		// NULL: no on-demand scans
+	std::map<unsigned int, Subscription_t>	_subscriptions;	// By connection Id
+	std::shared_ptr<const OCMScanSnapshot>	_cacheSnapshot;	// Snapshot the cached payloads belong to
+	std::unordered_map<std::string, std::shared_ptr<const Payload_t> >	_cache;
+	size_t									_cacheBytes;	// Size of the cached keys and payloads
+	std::deque<History_t>					_history;		// Recent spectra (bases for OCMP_FLAG_DELTASCAN)
+};
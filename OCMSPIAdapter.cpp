@@ -0,0 +1,121 @@
+#include "stdafx.h"
+#include <stdlib.h>
+#include <string.h>
+#include "OCMSPIAdapter.h"
+#include "SPIAdapterEmulator.h"
+#include "SPIAdapterFaultInjector.h"
+#include "SPIAdapterReplay.h"
+
+// Numeric setting of the emulator, unchanged if the key is not present
+static void getSPIConfigNumber(const char *createString, const char *key, unsigned int &value)
+{
+	std::string Value;
+	if (getSPIConfigValue(createString, key, Value)) {
+		value = (unsigned int)strtoul(Value.c_str(), NULL, 10);
+	}
+}
+
+// Numeric setting of the fault injector, unchanged if the key is not present. Returns true if it is present.
+static bool getSPIConfigDouble(const char *createString, const char *key, double &value)
+{
+	std::string Value;
+	if (!getSPIConfigValue(createString, key, Value)) {
+		return false;
+	}
+	value = atof(Value.c_str());
+	return true;
+}
+
+// Settings of the fault injector. Returns false if no fault key is present.
+static bool getSPIFaultSettings(const char *createString, SPIFaultSettings_t &Settings)
+{
+	Settings = SPIAdapterFaultInjector::defaultSettings();
+	bool present = false;
+	present = getSPIConfigDouble(createString, "faultber", Settings.Ber) || present;
+	present = getSPIConfigDouble(createString, "faultallones", Settings.AllOnes) || present;
+	present = getSPIConfigDouble(createString, "faultdrop", Settings.Drop) || present;
+	present = getSPIConfigDouble(createString, "faultcomres", Settings.Comres) || present;
+	present = getSPIConfigDouble(createString, "faultcomresms", Settings.ComresMs) || present;
+
+	std::string Value;
+	if (getSPIConfigValue(createString, "faultburst", Value)) {
+		Settings.Burst = (unsigned int)strtoul(Value.c_str(), NULL, 10);
+		present = true;
+	}
+	if (getSPIConfigValue(createString, "faultperiodic", Value)) {
+		Settings.Periodic = atoi(Value.c_str()) != 0;
+		present = true;
+	}
+	if (getSPIConfigValue(createString, "faultseed", Value)) {
+		Settings.Seed = (unsigned int)strtoul(Value.c_str(), NULL, 10);
+		present = true;
+	}
+	return present;
+}
+
+bool isOCMSimulatedAdapter(const char *createString)
+{
+	std::string Value;
+	if (getSPIConfigValue(createString, "replay", Value)) {
+		return true;
+	}
+	return getSPIConfigValue(createString, "emulator", Value) && atoi(Value.c_str()) != 0;
+}
+
+// Adapter without the fault injector
+static SPIAdapter *createOCMBaseSPIAdapter(const char *createString)
+{
+	std::string Filename;
+	if (getSPIConfigValue(createString, "replay", Filename)) {
+		std::string Speed;
+		double speed = getSPIConfigValue(createString, "speed", Speed) ? atof(Speed.c_str()) : 0;
+		return new SPIAdapterReplay(Filename, speed);
+	}
+
+	std::string Emulator;
+	if (getSPIConfigValue(createString, "emulator", Emulator) && atoi(Emulator.c_str()) != 0) {
+		SPIEmulatorSettings_t Settings = SPIAdapterEmulator::defaultSettings();
+		std::string Value;
+		if (getSPIConfigValue(createString, "scanms", Value)) {
+			Settings.ScanMs = atof(Value.c_str());
+		}
+		if (getSPIConfigValue(createString, "osnrms", Value)) {
+			Settings.OsnrMs = atof(Value.c_str());
+		}
+		getSPIConfigNumber(createString, "commandus", Settings.CommandUs);
+		getSPIConfigNumber(createString, "latencyus", Settings.LatencyUs);
+		getSPIConfigNumber(createString, "spiclk", Settings.SpiClock);
+		getSPIConfigNumber(createString, "ports", Settings.Ports);
+		getSPIConfigNumber(createString, "channels", Settings.Channels);
+		getSPIConfigNumber(createString, "seed", Settings.Seed);
+		return new SPIAdapterEmulator(Settings);
+	}
+
+	return createSPIAdapter(createString);
+}
+
+SPIAdapter *createOCMSPIAdapter(const char *createString)
+{
+	SPIAdapter *pAdapter = createOCMBaseSPIAdapter(createString);
+	SPIFaultSettings_t Faults;
+	if (pAdapter != NULL && getSPIFaultSettings(createString, Faults)) {
+		pAdapter = new SPIAdapterFaultInjector(pAdapter, Faults);
+	}
+	return pAdapter;
+}
+
+bool getSPIConfigValue(const char *createString, const char *key, std::string &value)
+{
+	size_t keyLength = strlen(key);
+	const char *p = createString;
+	while (p != NULL && *p != 0) {
+		const char *end = strchr(p, ';');
+		size_t length = end != NULL ? (size_t)(end - p) : strlen(p);
+		if (length > keyLength && strncmp(p, key, keyLength) == 0 && p[keyLength] == '=') {
+			value.assign(p + keyLength + 1, length - keyLength - 1);
+			return true;
+		}
+		p = end != NULL ? end + 1 : NULL;
+	}
+	return false;
+}
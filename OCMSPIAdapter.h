@@ -0,0 +1,24 @@
+//
+// Factory of the SPI adapters used by FinisarHROCM_V3
+//
+// The configuration string is a list of key=value pairs separated by semicolons. Keys handled here:
+//
+//   replay=file.bin;speed=1	Replay a binary log file instead of talking to hardware (see SPIAdapterReplay.h)
+//   emulator=1;scanms=200		Emulate the module in the process (see SPIAdapterEmulator.h for the keys)
+//   faultber=1e-5;faultdrop=0	Inject link faults into the transfers of the adapter (see SPIAdapterFaultInjector.h)
+//
+// Any other string is passed on to createSPIAdapter() (e.g. "id=dln00001234;spiclk=12000000").
+//
+#pragma once
+
+#include <string>
+#include "SPIAdapter.h"
+
+// Create the adapter described by createString (NULL if it cannot be created)
+SPIAdapter *createOCMSPIAdapter(const char *createString);
+
+// Value of key in a configuration string. Returns false if the key is not present.
+bool getSPIConfigValue(const char *createString, const char *key, std::string &value);
+
+// true if createString selects the replay or the emulator adapter, i.e. there is no module on the bus
+bool isOCMSimulatedAdapter(const char *createString);
@@ -0,0 +1,477 @@
+#include "stdafx.h"
+#include <stddef.h>
+#include <string.h>
+#include "CCRC32.h"
+#include "OCMScanArchive.h"
+
+#ifdef _WIN32
+#define archiveSeek(f, offset) _fseeki64(f, (__int64)(offset), SEEK_SET)
+#else
+#define archiveSeek(f, offset) fseeko(f, (off_t)(offset), SEEK_SET)
+#endif
+
+// Size of a block in the file including header and padding
+static unsigned long long archiveBlockSize(const OCMArchiveBlock_t &Block)
+{
+	return (sizeof(Block) + (unsigned long long)Block.SIZE + 7) & ~7ULL;
+}
+
+static unsigned int archiveCrc(const void *pData, size_t size)
+{
+	CCRC32 crc;
+	return crc.FullCRC((const unsigned char*)pData, size);
+}
+
+// Column as zigzag varints of the differences between neighbouring channels
+static void archiveEncodeColumn(const short *pValues, size_t n, std::vector<unsigned char> &Out)
+{
+	short previous = 0;
+	for (size_t k = 0; k < n; ++k) {
+		unsigned short delta = (unsigned short)(pValues[k] - previous);
+		unsigned int value = (unsigned short)((delta << 1) ^ ((delta & 0x8000) != 0 ? 0xFFFF : 0));
+		while (value >= 0x80) {
+			Out.push_back((unsigned char)(value | 0x80));
+			value >>= 7;
+		}
+		Out.push_back((unsigned char)value);
+		previous = pValues[k];
+	}
+}
+
+static bool archiveDecodeColumn(const unsigned char *&p, const unsigned char *pEnd, size_t n, short *pValues)
+{
+	unsigned short previous = 0;
+	for (size_t k = 0; k < n; ++k) {
+		unsigned int value = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (p >= pEnd || shift > 14) {
+				return false;
+			}
+			unsigned char b = *p++;
+			value |= (unsigned int)(b & 0x7F) << shift;
+			if ((b & 0x80) == 0) {
+				break;
+			}
+		}
+		unsigned short delta = (unsigned short)((value >> 1) ^ ((value & 1) != 0 ? 0xFFFF : 0));
+		previous = (unsigned short)(previous + delta);
+		pValues[k] = (short)previous;
+	}
+	return true;
+}
+
+// Read and check the block at offset
+static bool archiveReadBlock(FILE *f, unsigned long long offset, OCMArchiveBlock_t &Block, std::vector<unsigned char> &Payload)
+{
+	if (archiveSeek(f, offset) != 0 || fread(&Block, sizeof(Block), 1, f) != 1 || Block.MAGIC != OCM_ARCHIVE_BLOCKMAGIC) {
+		return false;
+	}
+	Payload.resize(Block.SIZE);
+	if (Block.SIZE > 0 && fread(&Payload[0], 1, Block.SIZE, f) != Block.SIZE) {
+		return false;
+	}
+	return archiveCrc(Payload.empty() ? NULL : &Payload[0], Payload.size()) == Block.CRC;
+}
+
+OCMScanArchiveWriter::OCMScanArchiveWriter()
+{
+	_file = NULL;
+	_compress = false;
+	_end = 0;
+	_lastIndex = 0;
+}
+
+OCMScanArchiveWriter::~OCMScanArchiveWriter()
+{
+	close();
+}
+
+bool OCMScanArchiveWriter::open(const char *filename, bool compress)
+{
+	close();
+	_compress = compress;
+	_pending.clear();
+	_plans.clear();
+
+	_file = fopen(filename, "r+b");
+	if (_file == NULL) {
+		_file = fopen(filename, "w+b");
+		if (_file == NULL) {
+			_lastError = std::string("Could not create archive: ") + filename;
+			return false;
+		}
+		OCMArchiveHeader_t Header;
+		memset(&Header, 0, sizeof(Header));
+		Header.MAGIC		= OCM_ARCHIVE_MAGIC;
+		Header.VERSION		= OCM_ARCHIVE_VERSION;
+		Header.HEADERSIZE	= sizeof(Header);
+		if (fwrite(&Header, sizeof(Header), 1, _file) != 1 || fflush(_file) != 0) {
+			_lastError = std::string("Could not write archive: ") + filename;
+			close();
+			return false;
+		}
+		_end = sizeof(Header);
+		_lastIndex = 0;
+		return true;
+	}
+
+	if (!recover()) {
+		_lastError = std::string("Not a scan archive: ") + filename;
+		fclose(_file);
+		_file = NULL;
+		return false;
+	}
+	return true;
+}
+
+// Find the end of the valid blocks and the scans not yet indexed
+bool OCMScanArchiveWriter::recover()
+{
+	OCMArchiveHeader_t Header;
+	if (archiveSeek(_file, 0) != 0 || fread(&Header, sizeof(Header), 1, _file) != 1 ||
+		Header.MAGIC != OCM_ARCHIVE_MAGIC || Header.VERSION != OCM_ARCHIVE_VERSION || Header.HEADERSIZE < sizeof(Header)) {
+		return false;
+	}
+
+	OCMArchiveBlock_t Block;
+	std::vector<unsigned char> Payload;
+	_lastIndex = Header.LASTINDEX;
+	_end = Header.HEADERSIZE;
+	if (_lastIndex != 0) {
+		if (!archiveReadBlock(_file, _lastIndex, Block, Payload) || Block.TYPE != OCM_ARCHIVE_INDEX) {
+			return false;
+		}
+		_end = _lastIndex + archiveBlockSize(Block);
+	}
+
+	while (archiveReadBlock(_file, _end, Block, Payload)) {
+		if (Block.TYPE == OCM_ARCHIVE_SCAN && Payload.size() >= sizeof(OCMArchiveScan_t)) {
+			OCMArchiveScan_t Head;
+			memcpy(&Head, &Payload[0], sizeof(Head));
+			OCMArchiveIndexEntry_t Entry = { Head.TIMESTAMPMS, _end, Head.SCAN, 0 };
+			_pending.push_back(Entry);
+		}
+		_end += archiveBlockSize(Block);
+	}
+	return true;
+}
+
+void OCMScanArchiveWriter::close()
+{
+	if (_file == NULL) {
+		return;
+	}
+	if (!_pending.empty()) {
+		writeIndex();
+	}
+	fclose(_file);
+	_file = NULL;
+}
+
+bool OCMScanArchiveWriter::append(const OCMArchiveScan_t &Head, const std::vector<OCM3_MPPWRecord_t> &Plan, const short *pPower, const short *pOSNR)
+{
+	if (_file == NULL || Plan.empty() || Plan.size() > 0xFFFF) {
+		return false;
+	}
+
+	// Write the channel plan once per session
+	unsigned int planHash = archiveCrc(&Plan[0], Plan.size() * sizeof(Plan[0]));
+	std::map<unsigned int, unsigned long long>::iterator it = _plans.find(planHash);
+	if (it == _plans.end()) {
+		std::vector<unsigned char> Payload((const unsigned char*)&Plan[0], (const unsigned char*)&Plan[0] + Plan.size() * sizeof(Plan[0]));
+		unsigned long long offset;
+		if (!writeBlock(OCM_ARCHIVE_PLAN, 0, Payload, offset)) {
+			return false;
+		}
+		it = _plans.insert(std::make_pair(planHash, offset)).first;
+	}
+
+	OCMArchiveScan_t Scan = Head;
+	Scan.PLANOFFSET	= it->second;
+	Scan.PLANHASH	= planHash;
+	Scan.NCHANNELS	= (unsigned short)Plan.size();
+	Scan.COLUMNS	= OCM_ARCHIVE_COL_POWER | (pOSNR != NULL ? OCM_ARCHIVE_COL_OSNR : 0);
+
+	std::vector<unsigned char> Payload((const unsigned char*)&Scan, (const unsigned char*)&Scan + sizeof(Scan));
+	const short *pColumns[] = { pPower, pOSNR };
+	for (int c = 0; c < 2 && pColumns[c] != NULL; ++c) {
+		if (_compress) {
+			archiveEncodeColumn(pColumns[c], Plan.size(), Payload);
+		}
+		else {
+			Payload.insert(Payload.end(), (const unsigned char*)pColumns[c], (const unsigned char*)(pColumns[c] + Plan.size()));
+		}
+	}
+
+	unsigned long long offset;
+	if (!writeBlock(OCM_ARCHIVE_SCAN, _compress ? OCM_ARCHIVE_COMPRESSED : 0, Payload, offset)) {
+		return false;
+	}
+	OCMArchiveIndexEntry_t Entry = { Scan.TIMESTAMPMS, offset, Scan.SCAN, 0 };
+	_pending.push_back(Entry);
+
+	if (_pending.size() >= OCM_ARCHIVE_INDEXINTERVAL) {
+		return writeIndex();
+	}
+	return true;
+}
+
+bool OCMScanArchiveWriter::writeBlock(unsigned short type, unsigned short flags, const std::vector<unsigned char> &Payload, unsigned long long &offset)
+{
+	OCMArchiveBlock_t Block;
+	Block.MAGIC	= OCM_ARCHIVE_BLOCKMAGIC;
+	Block.TYPE	= type;
+	Block.FLAGS	= flags;
+	Block.SIZE	= (unsigned int)Payload.size();
+	Block.CRC	= archiveCrc(Payload.empty() ? NULL : &Payload[0], Payload.size());
+
+	static const unsigned char Padding[8] = { 0 };
+	size_t padding = (size_t)(archiveBlockSize(Block) - sizeof(Block) - Payload.size());
+	if (archiveSeek(_file, _end) != 0 ||
+		fwrite(&Block, sizeof(Block), 1, _file) != 1 ||
+		(!Payload.empty() && fwrite(&Payload[0], 1, Payload.size(), _file) != Payload.size()) ||
+		fwrite(Padding, 1, padding, _file) != padding ||
+		fflush(_file) != 0) {
+		_lastError = "Could not write archive";
+		return false;
+	}
+
+	offset = _end;
+	_end += archiveBlockSize(Block);
+	return true;
+}
+
+// Write the pending entries as index block, then make it the last index in the file header
+bool OCMScanArchiveWriter::writeIndex()
+{
+	OCMArchiveIndex_t Index;
+	Index.PREVINDEX	= _lastIndex;
+	Index.NENTRIES	= (unsigned int)_pending.size();
+	Index.RESERVED	= 0;
+
+	std::vector<unsigned char> Payload((const unsigned char*)&Index, (const unsigned char*)&Index + sizeof(Index));
+	Payload.insert(Payload.end(), (const unsigned char*)&_pending[0], (const unsigned char*)(&_pending[0] + _pending.size()));
+	unsigned long long offset;
+	if (!writeBlock(OCM_ARCHIVE_INDEX, 0, Payload, offset)) {
+		return false;
+	}
+
+	if (archiveSeek(_file, offsetof(OCMArchiveHeader_t, LASTINDEX)) != 0 || fwrite(&offset, sizeof(offset), 1, _file) != 1 || fflush(_file) != 0) {
+		_lastError = "Could not write archive";
+		return false;
+	}
+	_lastIndex = offset;
+	_pending.clear();
+	return true;
+}
+
+OCMScanArchiveReader::OCMScanArchiveReader()
+{
+}
+
+bool OCMScanArchiveReader::open(const char *filename)
+{
+	_entries.clear();
+	if (!_file.open(filename)) {
+		_lastError = _file.getLastError();
+		return false;
+	}
+
+	OCMArchiveHeader_t Header;
+	if (_file.size() < sizeof(Header)) {
+		_lastError = std::string("Not a scan archive: ") + filename;
+		return false;
+	}
+	memcpy(&Header, _file.data(), sizeof(Header));
+	if (Header.MAGIC != OCM_ARCHIVE_MAGIC || Header.VERSION != OCM_ARCHIVE_VERSION || Header.HEADERSIZE < sizeof(Header)) {
+		_lastError = std::string("Not a scan archive: ") + filename;
+		return false;
+	}
+
+	// Follow the chain of index blocks from the last one
+	std::vector<const char*> Indexes;
+	OCMArchiveBlock_t Block;
+	for (unsigned long long offset = Header.LASTINDEX; offset != 0; ) {
+		const char *pPayload = getBlock(offset, OCM_ARCHIVE_INDEX, Block);
+		OCMArchiveIndex_t Index;
+		if (pPayload == NULL || Block.SIZE < sizeof(Index)) {
+			_lastError = std::string("Corrupt index in archive: ") + filename;
+			return false;
+		}
+		memcpy(&Index, pPayload, sizeof(Index));
+		if (Index.PREVINDEX >= offset || Block.SIZE < sizeof(Index) + (unsigned long long)Index.NENTRIES * sizeof(OCMArchiveIndexEntry_t)) {
+			_lastError = std::string("Corrupt index in archive: ") + filename;
+			return false;
+		}
+		Indexes.push_back(pPayload);
+		offset = Index.PREVINDEX;
+	}
+	for (size_t k = Indexes.size(); k-- > 0; ) {
+		OCMArchiveIndex_t Index;
+		memcpy(&Index, Indexes[k], sizeof(Index));
+		size_t first = _entries.size();
+		_entries.resize(first + Index.NENTRIES);
+		if (Index.NENTRIES > 0) {
+			memcpy(&_entries[first], Indexes[k] + sizeof(Index), Index.NENTRIES * sizeof(OCMArchiveIndexEntry_t));
+		}
+	}
+
+	// Scans after the last index block
+	unsigned long long offset = Header.HEADERSIZE;
+	if (Header.LASTINDEX != 0) {
+		getBlock(Header.LASTINDEX, OCM_ARCHIVE_INDEX, Block);
+		offset = Header.LASTINDEX + archiveBlockSize(Block);
+	}
+	for (const char *pPayload; (pPayload = getBlock(offset, 0, Block)) != NULL; offset += archiveBlockSize(Block)) {
+		if (Block.TYPE == OCM_ARCHIVE_SCAN && Block.SIZE >= sizeof(OCMArchiveScan_t)) {
+			OCMArchiveScan_t Head;
+			memcpy(&Head, pPayload, sizeof(Head));
+			OCMArchiveIndexEntry_t Entry = { Head.TIMESTAMPMS, offset, Head.SCAN, 0 };
+			_entries.push_back(Entry);
+		}
+	}
+
+	return true;
+}
+
+size_t OCMScanArchiveReader::findTime(long long TimestampMs) const
+{
+	size_t first = 0, last = _entries.size();
+	while (first < last) {
+		size_t middle = first + (last - first) / 2;
+		if (_entries[middle].TIMESTAMPMS < TimestampMs) {
+			first = middle + 1;
+		}
+		else {
+			last = middle;
+		}
+	}
+	return first;
+}
+
+// Payload of the block at offset if it is complete, of the given type (0: any) and its CRC is correct
+const char *OCMScanArchiveReader::getBlock(unsigned long long offset, unsigned short type, OCMArchiveBlock_t &Block) const
+{
+	if (offset + sizeof(Block) > _file.size()) {
+		return NULL;
+	}
+	memcpy(&Block, _file.data() + offset, sizeof(Block));
+	if (Block.MAGIC != OCM_ARCHIVE_BLOCKMAGIC || (type != 0 && Block.TYPE != type) || offset + sizeof(Block) + Block.SIZE > _file.size()) {
+		return NULL;
+	}
+	const char *pPayload = _file.data() + offset + sizeof(Block);
+	return archiveCrc(pPayload, Block.SIZE) == Block.CRC ? pPayload : NULL;
+}
+
+const char *OCMScanArchiveReader::getScan(size_t i, OCMArchiveBlock_t &Block, OCMArchiveScan_t &Head) const
+{
+	if (i >= _entries.size()) {
+		return NULL;
+	}
+	const char *pPayload = getBlock(_entries[i].OFFSET, OCM_ARCHIVE_SCAN, Block);
+	if (pPayload == NULL || Block.SIZE < sizeof(Head)) {
+		return NULL;
+	}
+	memcpy(&Head, pPayload, sizeof(Head));
+	if (Head.NCHANNELS == 0) {
+		return NULL;
+	}
+	size_t nColumns = (Head.COLUMNS & OCM_ARCHIVE_COL_OSNR) != 0 ? 2 : 1;
+	if ((Block.FLAGS & OCM_ARCHIVE_COMPRESSED) == 0 && Block.SIZE < sizeof(Head) + nColumns * Head.NCHANNELS * sizeof(short)) {
+		return NULL;
+	}
+	return pPayload;
+}
+
+bool OCMScanArchiveReader::readScan(size_t i, OCMArchiveScan_t &Head, std::vector<OCM3_MPPWRecord_t> &Plan, std::vector<short> &Power, std::vector<short> &OSNR) const
+{
+	OCMArchiveBlock_t Block;
+	const char *pPayload = getScan(i, Block, Head);
+	if (pPayload == NULL) {
+		return false;
+	}
+
+	OCMArchiveBlock_t PlanBlock;
+	const char *pPlan = getBlock(Head.PLANOFFSET, OCM_ARCHIVE_PLAN, PlanBlock);
+	if (pPlan == NULL || PlanBlock.SIZE != Head.NCHANNELS * sizeof(OCM3_MPPWRecord_t)) {
+		return false;
+	}
+	Plan.resize(Head.NCHANNELS);
+	memcpy(&Plan[0], pPlan, PlanBlock.SIZE);
+
+	Power.resize(Head.NCHANNELS);
+	OSNR.resize((Head.COLUMNS & OCM_ARCHIVE_COL_OSNR) != 0 ? Head.NCHANNELS : 0);
+	const unsigned char *p = (const unsigned char*)pPayload + sizeof(Head);
+	const unsigned char *pEnd = (const unsigned char*)pPayload + Block.SIZE;
+	std::vector<short> *pColumns[] = { &Power, &OSNR };
+	for (int c = 0; c < 2 && !pColumns[c]->empty(); ++c) {
+		if ((Block.FLAGS & OCM_ARCHIVE_COMPRESSED) != 0) {
+			if (!archiveDecodeColumn(p, pEnd, Head.NCHANNELS, &(*pColumns[c])[0])) {
+				return false;
+			}
+		}
+		else {
+			memcpy(&(*pColumns[c])[0], p, Head.NCHANNELS * sizeof(short));
+			p += Head.NCHANNELS * sizeof(short);
+		}
+	}
+	return true;
+}
+
+int OCMScanArchiveReader::findChannel(size_t i, unsigned short PORTNO, unsigned short slice) const
+{
+	OCMArchiveBlock_t Block;
+	OCMArchiveScan_t Head;
+	if (getScan(i, Block, Head) == NULL) {
+		return -1;
+	}
+	const char *pPlan = getBlock(Head.PLANOFFSET, OCM_ARCHIVE_PLAN, Block);
+	if (pPlan == NULL || Block.SIZE != Head.NCHANNELS * sizeof(OCM3_MPPWRecord_t)) {
+		return -1;
+	}
+	for (int k = 0; k < Head.NCHANNELS; ++k) {
+		OCM3_MPPWRecord_t Channel;
+		memcpy(&Channel, pPlan + k * sizeof(Channel), sizeof(Channel));
+		if (Channel.PORTNO == PORTNO && Channel.SLICESTART <= slice && slice <= Channel.SLICEEND) {
+			return k;
+		}
+	}
+	return -1;
+}
+
+bool OCMScanArchiveReader::getValue(size_t i, size_t iChannel, short &Power, short &OSNR) const
+{
+	OCMArchiveBlock_t Block;
+	OCMArchiveScan_t Head;
+	const char *pPayload = getScan(i, Block, Head);
+	if (pPayload == NULL || iChannel >= Head.NCHANNELS) {
+		return false;
+	}
+	bool hasOSNR = (Head.COLUMNS & OCM_ARCHIVE_COL_OSNR) != 0;
+	OSNR = 0;
+
+	// Uncompressed columns are read in place
+	const char *pColumns = pPayload + sizeof(Head);
+	if ((Block.FLAGS & OCM_ARCHIVE_COMPRESSED) == 0) {
+		memcpy(&Power, pColumns + iChannel * sizeof(short), sizeof(short));
+		if (hasOSNR) {
+			memcpy(&OSNR, pColumns + (Head.NCHANNELS + iChannel) * sizeof(short), sizeof(short));
+		}
+		return true;
+	}
+
+	std::vector<short> Values(Head.NCHANNELS);
+	const unsigned char *p = (const unsigned char*)pColumns;
+	const unsigned char *pEnd = (const unsigned char*)pPayload + Block.SIZE;
+	if (!archiveDecodeColumn(p, pEnd, Values.size(), &Values[0])) {
+		return false;
+	}
+	Power = Values[iChannel];
+	if (hasOSNR) {
+		if (!archiveDecodeColumn(p, pEnd, Values.size(), &Values[0])) {
+			return false;
+		}
+		OSNR = Values[iChannel];
+	}
+	return true;
+}
@@ -0,0 +1,163 @@
+//
+// Append-only archive of scan results (-archive, see HROCMQueryV3.cpp)
+//
+// Keeps months of scans in a compact file that can be searched by time without reading it. The file starts
+// with OCMArchiveHeader_t, followed by blocks. Each block has an OCMArchiveBlock_t header with the CRC of its
+// payload and is padded to 8 bytes:
+//
+// - PLAN: the channel plan of the following scans (OCM3_MPPWRecord_t per channel). A plan is written once
+//   per session and referenced by the scans by offset; its CRC32 is the plan hash.
+// - SCAN: OCMArchiveScan_t followed by the columns: POWER and, for OSNR scans, OSNR (int16 per channel in
+//   the units of the module, 0.1 dB). Compressed blocks hold the differences between neighbouring channels
+//   as zigzag varints instead.
+// - INDEX: OCMArchiveIndex_t followed by OCMArchiveIndexEntry_t per scan written since the previous index
+//   block. Written every OCM_ARCHIVE_INDEXINTERVAL scans and on close.
+//
+// The data is only ever appended. The one exception is LASTINDEX in the file header, which is updated after
+// an index block has been written; the index blocks are chained by PREVINDEX. Scans written after the last
+// index block (e.g. before a crash) are found by walking the blocks; the writer adds them to the next index.
+// A torn block at the end of the file fails its CRC check and is overwritten by the next session.
+//
+#pragma once
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "FinisarHROCM_V3.h"
+#include "OCMMappedFile.h"
+
+#define OCM_ARCHIVE_MAGIC			0x414D434F		// "OCMA"
+#define OCM_ARCHIVE_BLOCKMAGIC		0x424D434F		// "OCMB"
+#define OCM_ARCHIVE_VERSION			1
+#define OCM_ARCHIVE_INDEXINTERVAL	256				// Scans per index block
+
+// Block types
+#define OCM_ARCHIVE_PLAN			1
+#define OCM_ARCHIVE_SCAN			2
+#define OCM_ARCHIVE_INDEX			3
+
+// Block flags
+#define OCM_ARCHIVE_COMPRESSED		0x0001			// Columns as zigzag varints of the differences
+
+// Columns of a scan
+#define OCM_ARCHIVE_COL_POWER		0x0001
+#define OCM_ARCHIVE_COL_OSNR		0x0002
+
+#pragma pack(push,1)
+typedef struct {
+	unsigned int		MAGIC;			// OCM_ARCHIVE_MAGIC
+	unsigned short		VERSION;		// OCM_ARCHIVE_VERSION
+	unsigned short		HEADERSIZE;		// sizeof(OCMArchiveHeader_t)
+	unsigned long long	LASTINDEX;		// Offset of the last index block (0: none)
+	unsigned long long	RESERVED[2];
+} OCMArchiveHeader_t;
+
+typedef struct {
+	unsigned int		MAGIC;			// OCM_ARCHIVE_BLOCKMAGIC
+	unsigned short		TYPE;			// OCM_ARCHIVE_PLAN, _SCAN, _INDEX
+	unsigned short		FLAGS;			// OCM_ARCHIVE_COMPRESSED
+	unsigned int		SIZE;			// Payload size without padding
+	unsigned int		CRC;			// CRC32 of the payload
+} OCMArchiveBlock_t;
+
+typedef struct {
+	long long			TIMESTAMPMS;	// Host time of the scan (ms since 1970-01-01 UTC)
+	unsigned long long	PLANOFFSET;		// Offset of the PLAN block
+	unsigned int		SCAN;			// Scan number of the module
+	unsigned int		MPSEQNO;		// Sequence number of the channel plan in the module
+	unsigned int		PLANHASH;		// CRC32 of the channel plan
+	unsigned short		NCHANNELS;
+	unsigned short		COLUMNS;		// OCM_ARCHIVE_COL_...
+	short				CSS;			// Module temperature (0.1 degC)
+	short				ISS;			// Optics temperature (0.1 degC)
+	unsigned int		RESERVED;
+	char				SNO[16];		// Serial number of the module
+} OCMArchiveScan_t;
+
+typedef struct {
+	unsigned long long	PREVINDEX;		// Offset of the previous index block (0: none)
+	unsigned int		NENTRIES;
+	unsigned int		RESERVED;
+} OCMArchiveIndex_t;
+
+typedef struct {
+	long long			TIMESTAMPMS;
+	unsigned long long	OFFSET;			// Offset of the SCAN block
+	unsigned int		SCAN;
+	unsigned int		RESERVED;
+} OCMArchiveIndexEntry_t;
+#pragma pack(pop)
+
+// Appends scans to an archive file. Not thread-safe.
+class OCMScanArchiveWriter
+{
+public:
+	OCMScanArchiveWriter();
+	~OCMScanArchiveWriter();
+
+	// Create filename or continue an existing archive. compress selects the encoding of the new scans.
+	bool open(const char *filename, bool compress);
+
+	// Write the pending index entries and close the file
+	void close();
+
+	bool isOpen() const { return _file != NULL; }
+
+	// Append a scan. Head.PLANOFFSET, PLANHASH, NCHANNELS and COLUMNS are filled in. pOSNR may be NULL.
+	bool append(const OCMArchiveScan_t &Head, const std::vector<OCM3_MPPWRecord_t> &Plan, const short *pPower, const short *pOSNR);
+
+	std::string getLastError() const { return _lastError; }
+
+private:
+	OCMScanArchiveWriter(const OCMScanArchiveWriter&);
+	OCMScanArchiveWriter &operator=(const OCMScanArchiveWriter&);
+
+	bool recover();
+	bool writeBlock(unsigned short type, unsigned short flags, const std::vector<unsigned char> &Payload, unsigned long long &offset);
+	bool writeIndex();
+
+	FILE										*_file;
+	bool										_compress;
+	unsigned long long							_end;			// Offset of the next block
+	unsigned long long							_lastIndex;		// Offset of the last index block
+	std::vector<OCMArchiveIndexEntry_t>			_pending;		// Scans not yet in an index block
+	std::map<unsigned int, unsigned long long>	_plans;			// Plan hash -> offset of the PLAN block of this session
+	std::string									_lastError;
+};
+
+// Random access to the scans of an archive file. The file is mapped; the index blocks are read on open.
+class OCMScanArchiveReader
+{
+public:
+	OCMScanArchiveReader();
+
+	bool open(const char *filename);
+
+	// Scans in file order
+	size_t size() const { return _entries.size(); }
+	const OCMArchiveIndexEntry_t &getEntry(size_t i) const { return _entries[i]; }
+
+	// Index of the first scan at or after TimestampMs (size() if none). Assumes the host clock did not
+	// go backwards between the scans.
+	size_t findTime(long long TimestampMs) const;
+
+	// Read a complete scan. OSNR is empty if the scan has no OSNR column.
+	bool readScan(size_t i, OCMArchiveScan_t &Head, std::vector<OCM3_MPPWRecord_t> &Plan, std::vector<short> &Power, std::vector<short> &OSNR) const;
+
+	// Index of the channel of scan i on PORTNO that contains slice (-1 if none)
+	int findChannel(size_t i, unsigned short PORTNO, unsigned short slice) const;
+
+	// Values of one channel of scan i (OSNR is 0 if the scan has no OSNR column)
+	bool getValue(size_t i, size_t iChannel, short &Power, short &OSNR) const;
+
+	std::string getLastError() const { return _lastError; }
+
+private:
+	const char *getBlock(unsigned long long offset, unsigned short type, OCMArchiveBlock_t &Block) const;
+	const char *getScan(size_t i, OCMArchiveBlock_t &Block, OCMArchiveScan_t &Head) const;
+
+	OCMMappedFile							_file;
+	std::vector<OCMArchiveIndexEntry_t>		_entries;
+	std::string								_lastError;
+};
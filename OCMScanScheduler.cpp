@@ -0,0 +1,232 @@
+#include "stdafx.h"
+#include <math.h>
+#include <chrono>
+#include "OCMScanScheduler.h"
+#include "OCMDriverStats.h"
+
+#define LOGERROR(msg) {_lastError << "[ERROR] " << msg << std::endl;}
+
+// Milliseconds of the monotonic clock of the driver statistics
+static long long schedNowMs()
+{
+	return (long long)(OCMDriverStats::nowUs() / 1000);
+}
+
+OCMScanScheduler::OCMScanScheduler()
+{
+	_stop = false;
+	_startMs = 0;
+}
+
+int OCMScanScheduler::addPlan(const OCMSchedPlan_t &Plan, OCMScanJob *pJob)
+{
+	Entry_t Entry;
+	Entry.Plan			= Plan;
+	Entry.pJob			= pJob;
+	Entry.DueMs			= 0;
+	Entry.Triggered		= false;
+	Entry.Runs			= 0;
+	Entry.Errors		= 0;
+	Entry.Overruns		= 0;
+	Entry.SumDurationMs	= 0;
+	Entry.MaxDurationMs	= 0;
+	Entry.JitterCount	= 0;
+	Entry.SumJitterMs	= 0;
+	Entry.SumJitterSqMs	= 0;
+	Entry.MaxJitterMs	= 0;
+
+	std::lock_guard<std::mutex> Lock(_mutex);
+	_plans.push_back(Entry);
+	return (int)_plans.size() - 1;
+}
+
+void OCMScanScheduler::trigger(int Id)
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	if (Id >= 0 && Id < (int)_plans.size()) {
+		if (!_plans[Id].Triggered) {
+			_plans[Id].Triggered = true;
+			_plans[Id].DueMs = schedNowMs();
+		}
+		_wake.notify_all();
+	}
+}
+
+void OCMScanScheduler::stop()
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	_stop = true;
+	_wake.notify_all();
+}
+
+int OCMScanScheduler::selectNext(long long now, long long &waitUntil)
+{
+	int best = -1;
+	waitUntil = -1;
+	for (int i = 0; i < (int)_plans.size(); ++i) {
+		Entry_t &Entry = _plans[i];
+		if (Entry.Plan.Mode == OCM_SCHED_ONDEMAND && !Entry.Triggered) {
+			continue;
+		}
+		if (Entry.DueMs > now) {
+			if (waitUntil < 0 || Entry.DueMs < waitUntil) {
+				waitUntil = Entry.DueMs;
+			}
+			continue;
+		}
+		if (best < 0
+			|| Entry.Plan.Priority > _plans[best].Plan.Priority
+			|| (Entry.Plan.Priority == _plans[best].Plan.Priority && Entry.DueMs < _plans[best].DueMs)) {
+			best = i;
+		}
+	}
+	return best;
+}
+
+OCM_Error_t OCMScanScheduler::run()
+{
+	std::unique_lock<std::mutex> Lock(_mutex);
+	if (_plans.empty()) {
+		LOGERROR("No plans to schedule");
+		return OCM_FAILED;
+	}
+
+	_startMs = schedNowMs();
+	for (unsigned int i = 0; i < _plans.size(); ++i) {
+		_plans[i].DueMs = _startMs;
+	}
+
+	while (!_stop) {
+		long long now = schedNowMs();
+		long long waitUntil;
+		int next = selectNext(now, waitUntil);
+		if (next < 0) {
+			if (waitUntil < 0) {
+				_wake.wait(Lock);
+			}
+			else {
+				_wake.wait_for(Lock, std::chrono::milliseconds(waitUntil - now));
+			}
+			continue;
+		}
+
+		Entry_t &Entry = _plans[next];
+		long long scheduled = Entry.DueMs;
+		OCMScanJob *pJob = Entry.pJob;
+		Entry.Triggered = false;
+
+		// Run the scan without holding the lock so that trigger() and the statistics do not have to wait
+		Lock.unlock();
+		long long start = schedNowMs();
+		OCM_Error_t Result = pJob->run();
+		long long end = schedNowMs();
+		Lock.lock();
+
+		Entry_t &Done = _plans[next];
+		Done.Runs++;
+		if (Result != OCM_OK) {
+			Done.Errors++;
+		}
+		double duration = (double)(end - start);
+		Done.SumDurationMs += duration;
+		if (duration > Done.MaxDurationMs) {
+			Done.MaxDurationMs = duration;
+		}
+
+		switch (Done.Plan.Mode) {
+		case OCM_SCHED_FIXEDRATE:
+		{
+			double jitter = (double)(start - scheduled);
+			Done.JitterCount++;
+			Done.SumJitterMs += jitter;
+			Done.SumJitterSqMs += jitter * jitter;
+			if (jitter > Done.MaxJitterMs) {
+				Done.MaxJitterMs = jitter;
+			}
+
+			// Keep the phase; skip the starts that are already missed
+			long long period = Done.Plan.PeriodMs > 0 ? Done.Plan.PeriodMs : 1;
+			Done.DueMs = scheduled + period;
+			if (Done.DueMs <= end - period) {
+				long long missed = (end - Done.DueMs) / period;
+				Done.Overruns += (unsigned int)missed;
+				Done.DueMs += missed * period;
+			}
+			break;
+		}
+		case OCM_SCHED_BACKTOBACK:
+			Done.DueMs = end;
+			break;
+		case OCM_SCHED_ONDEMAND:
+			if (Done.Triggered) {
+				Done.DueMs = end; // Triggered again while running
+			}
+			break;
+		}
+	}
+
+	return OCM_OK;
+}
+
+OCMSchedStats_t OCMScanScheduler::statsOf(const Entry_t &Entry, long long now)
+{
+	OCMSchedStats_t Stats;
+	Stats.Runs				= Entry.Runs;
+	Stats.Errors			= Entry.Errors;
+	Stats.Overruns			= Entry.Overruns;
+	Stats.MeanDurationMs	= Entry.Runs > 0 ? Entry.SumDurationMs / Entry.Runs : 0;
+	Stats.MaxDurationMs		= Entry.MaxDurationMs;
+	Stats.MeanJitterMs		= Entry.JitterCount > 0 ? Entry.SumJitterMs / Entry.JitterCount : 0;
+	Stats.StdJitterMs		= 0;
+	if (Entry.JitterCount > 1) {
+		double variance = (Entry.SumJitterSqMs - Entry.SumJitterMs * Stats.MeanJitterMs) / (Entry.JitterCount - 1);
+		Stats.StdJitterMs = variance > 0 ? sqrt(variance) : 0;
+	}
+	Stats.MaxJitterMs		= Entry.MaxJitterMs;
+	Stats.TargetHz			= Entry.Plan.Mode == OCM_SCHED_FIXEDRATE && Entry.Plan.PeriodMs > 0 ? 1000.0 / Entry.Plan.PeriodMs : 0;
+	Stats.MeasuredHz		= _startMs > 0 && now > _startMs ? Entry.Runs * 1000.0 / (now - _startMs) : 0;
+	return Stats;
+}
+
+OCMSchedStats_t OCMScanScheduler::getStats(int Id)
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	OCMSchedStats_t Stats;
+	memset(&Stats, 0, sizeof(Stats));
+	if (Id >= 0 && Id < (int)_plans.size()) {
+		Stats = statsOf(_plans[Id], schedNowMs());
+	}
+	return Stats;
+}
+
+std::string OCMScanScheduler::getReport()
+{
+	std::lock_guard<std::mutex> Lock(_mutex);
+	long long now = schedNowMs();
+
+	std::ostringstream Report;
+	for (unsigned int i = 0; i < _plans.size(); ++i) {
+		OCMSchedStats_t Stats = statsOf(_plans[i], now);
+		char line[256];
+		if (_plans[i].Plan.Mode == OCM_SCHED_FIXEDRATE) {
+			snprintf(line, sizeof(line), "%s: %.3f Hz (target %.3f Hz), %u runs, %u errors, %u overruns, duration %.0f/%.0f ms, jitter %.1f+-%.1f/%.0f ms",
+				_plans[i].Plan.Name.c_str(), Stats.MeasuredHz, Stats.TargetHz, Stats.Runs, Stats.Errors, Stats.Overruns,
+				Stats.MeanDurationMs, Stats.MaxDurationMs, Stats.MeanJitterMs, Stats.StdJitterMs, Stats.MaxJitterMs);
+		}
+		else {
+			snprintf(line, sizeof(line), "%s: %.3f Hz (%s), %u runs, %u errors, duration %.0f/%.0f ms",
+				_plans[i].Plan.Name.c_str(), Stats.MeasuredHz, _plans[i].Plan.Mode == OCM_SCHED_BACKTOBACK ? "back-to-back" : "on demand",
+				Stats.Runs, Stats.Errors, Stats.MeanDurationMs, Stats.MaxDurationMs);
+		}
+		Report << line << std::endl;
+	}
+	return Report.str();
+}
+
+std::string OCMScanScheduler::getLastError()
+{
+	std::string Error = _lastError.str();
+	_lastError.str("");
+	_lastError.clear();
+	return Error;
+}
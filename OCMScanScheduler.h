@@ -0,0 +1,117 @@
+//
+// Scheduler for the scans of the server's acquisition thread
+//
+// The module can only run one scan at a time, so all plans are executed one after another on the thread
+// calling run(). Whenever the module is free, the scheduler picks the plan with the highest priority among
+// the plans that are due; plans with equal priority are taken in the order they became due.
+//
+// - OCM_SCHED_BACKTOBACK plans are always due. They run as fast as the module allows, using the time
+//   left by the other plans.
+// - OCM_SCHED_FIXEDRATE plans are due every PeriodMs, measured from start to start. If a start is missed by
+//   more than a whole period (e.g. because a scan took longer), the missed starts are counted as overruns
+//   and skipped rather than run back to back.
+// - OCM_SCHED_ONDEMAND plans are due after trigger() has been called.
+//
+// For every plan the scheduler measures the scan duration, the start jitter (delay of the actual start
+// versus the scheduled start, fixed-rate plans only) and the achieved rate versus the target rate.
+//
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "FinisarHROCM.h"
+
+// Scheduling modes
+typedef enum {
+	OCM_SCHED_BACKTOBACK,	// Run continuously
+	OCM_SCHED_FIXEDRATE,	// Run every PeriodMs
+	OCM_SCHED_ONDEMAND		// Run once per trigger()
+} OCMSchedMode_t;
+
+// Work done by a plan
+class OCMScanJob
+{
+public:
+	virtual ~OCMScanJob() {}
+
+	virtual OCM_Error_t run() = 0;
+};
+
+// Scheduling parameters of a plan
+typedef struct {
+	std::string		Name;		// Used in the report
+	OCMSchedMode_t	Mode;
+	int				PeriodMs;	// OCM_SCHED_FIXEDRATE only
+	int				Priority;	// Higher values first
+} OCMSchedPlan_t;
+
+// Statistics of a plan
+typedef struct {
+	unsigned int	Runs;			// Number of completed runs
+	unsigned int	Errors;			// Runs that returned an error
+	unsigned int	Overruns;		// Starts skipped because the plan was more than a period late
+	double			MeanDurationMs;	// Scan duration
+	double			MaxDurationMs;
+	double			MeanJitterMs;	// Delay of the start versus the scheduled start
+	double			StdJitterMs;
+	double			MaxJitterMs;
+	double			TargetHz;		// 1000/PeriodMs for fixed-rate plans, otherwise 0
+	double			MeasuredHz;		// Runs per second since the scheduler was started
+} OCMSchedStats_t;
+
+class OCMScanScheduler
+{
+public:
+	OCMScanScheduler();
+
+	// Add a plan and return its Id. pJob must stay valid until run() returns. Call before run().
+	int addPlan(const OCMSchedPlan_t &Plan, OCMScanJob *pJob);
+
+	// Make an on-demand plan due (can be called from any thread)
+	void trigger(int Id);
+
+	// Execute the plans until stop() is called
+	OCM_Error_t run();
+
+	// Ask run() to return after the current scan (can be called from any thread)
+	void stop();
+
+	// Statistics of a plan (can be called from any thread)
+	OCMSchedStats_t getStats(int Id);
+
+	// One line per plan with the statistics (can be called from any thread)
+	std::string getReport();
+
+	// Accumulated error messages (clears the error buffer)
+	std::string getLastError();
+
+private:
+	typedef struct {
+		OCMSchedPlan_t	Plan;
+		OCMScanJob		*pJob;
+		long long		DueMs;			// Next scheduled start
+		bool			Triggered;		// OCM_SCHED_ONDEMAND only
+		unsigned int	Runs;
+		unsigned int	Errors;
+		unsigned int	Overruns;
+		double			SumDurationMs;
+		double			MaxDurationMs;
+		unsigned int	JitterCount;
+		double			SumJitterMs;
+		double			SumJitterSqMs;
+		double			MaxJitterMs;
+	} Entry_t;
+
+	int selectNext(long long now, long long &waitUntil);
+	OCMSchedStats_t statsOf(const Entry_t &Entry, long long now);
+
+	std::vector<Entry_t>		_plans;
+	std::mutex					_mutex;			// Protects _plans (state and statistics) and _stop
+	std::condition_variable		_wake;
+	bool						_stop;
+	long long					_startMs;		// Time run() was called
+	std::ostringstream			_lastError;
+};
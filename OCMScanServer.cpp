@@ -0,0 +1,651 @@
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#endif
+#include "stdafx.h"
+#include "OCMScanServer.h"
+#include "OCMDriverStats.h"
+
+#ifdef _WIN32
+#pragma comment(lib,"ws2_32.lib")
+typedef int socklen_t;
+#define OCM_INVALID_SOCKET		((intptr_t)INVALID_SOCKET)
+#define OCM_CLOSESOCKET(s)		closesocket((SOCKET)(s))
+#define OCM_WOULDBLOCK()		(WSAGetLastError() == WSAEWOULDBLOCK)
+#define OCM_NODESCRIPTORS()		(WSAGetLastError() == WSAEMFILE || WSAGetLastError() == WSAENOBUFS)
+#else
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#define OCM_INVALID_SOCKET		((intptr_t)-1)
+#define OCM_CLOSESOCKET(s)		::close((int)(s))
+#define OCM_WOULDBLOCK()		(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+#define OCM_NODESCRIPTORS()		(errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM)
+#endif
+
+#define OCM_LISTEN_ID			0		// Connection Id used for the listening socket
+#define OCM_WAKEUP_ID			0xFFFFFFFF	// Connection Id used for the wakeup socket
+#define OCM_RECV_CHUNK			65536	// Bytes read per recv call
+#define OCM_MAX_SEGMENTS		64		// Segments gathered per send call
+#define OCM_ACCEPT_RETRY_MS		1000	// Accepting is resumed after this time even if no connection has been closed
+
+#define LOGERROR(msg) {_lastError << "[ERROR] " << msg << std::endl;}
+#define LOGWARNING(msg) {_lastError << "[WARNING] " << msg << std::endl;}
+
+// Make a socket non-blocking
+static bool setNonBlocking(intptr_t s)
+{
+#ifdef _WIN32
+	u_long mode = 1;
+	return ioctlsocket((SOCKET)s, FIONBIO, &mode) == 0;
+#else
+	int flags = fcntl((int)s, F_GETFL, 0);
+	return flags >= 0 && fcntl((int)s, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+OCMScanServer::OCMScanServer(OCMServerHandler *pHandler, const OCMServerSettings_t &Settings)
+{
+	_pHandler	= pHandler;
+	_settings	= Settings;
+	_listen		= OCM_INVALID_SOCKET;
+	_poll		= OCM_INVALID_SOCKET;
+	_wakeup		= OCM_INVALID_SOCKET;
+	_nextId		= OCM_LISTEN_ID + 1;
+	_stop		= false;
+	_acceptPaused	= false;
+	_acceptPausedMs	= 0;
+}
+
+OCMScanServer::~OCMScanServer()
+{
+	close();
+}
+
+OCMServerSettings_t OCMScanServer::defaultSettings()
+{
+	OCMServerSettings_t Settings;
+
+	Settings.Port			= 8888;
+	Settings.BindAddress	= "";
+	Settings.MaxConnections	= 1024;
+	Settings.MaxTxQueued	= 16 * 1024 * 1024;
+	Settings.MaxRxBuffered	= 1024 * 1024;
+	Settings.IdleTimeoutMs	= 5 * 60 * 1000;
+	Settings.TickMs			= 50;
+
+	return Settings;
+}
+
+long long OCMScanServer::nowMs()
+{
+	return (long long)(OCMDriverStats::nowUs() / 1000);
+}
+
+OCM_Error_t OCMScanServer::open()
+{
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+		LOGERROR("WSAStartup failed");
+		return OCM_FAILED;
+	}
+#endif
+
+	_listen = (intptr_t)socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (_listen == OCM_INVALID_SOCKET) {
+		LOGERROR("Could not create socket");
+		return OCM_FAILED;
+	}
+
+	int reuse = 1;
+	setsockopt(_listen, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+
+	sockaddr_in sin;
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_port = htons(_settings.Port);
+	sin.sin_addr.s_addr = _settings.BindAddress.empty() ? htonl(INADDR_ANY) : inet_addr(_settings.BindAddress.c_str());
+
+	if (bind(_listen, (sockaddr*)&sin, sizeof(sin)) != 0) {
+		LOGERROR("Could not bind to " << (_settings.BindAddress.empty() ? "*" : _settings.BindAddress) << ":" << _settings.Port);
+		return OCM_FAILED;
+	}
+
+	if (listen(_listen, SOMAXCONN) != 0 || !setNonBlocking(_listen)) {
+		LOGERROR("Could not listen on port " << _settings.Port);
+		return OCM_FAILED;
+	}
+
+	// A datagram sent to this socket wakes up the event loop. Unlike an eventfd or a pipe this works with
+	// WSAPoll as well.
+	_wakeup = (intptr_t)socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	sockaddr_in loopback;
+	memset(&loopback, 0, sizeof(loopback));
+	loopback.sin_family = AF_INET;
+	loopback.sin_port = 0;
+	loopback.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	socklen_t loopbackLen = sizeof(loopback);
+	if (_wakeup == OCM_INVALID_SOCKET
+		|| bind(_wakeup, (sockaddr*)&loopback, sizeof(loopback)) != 0
+		|| getsockname(_wakeup, (sockaddr*)&loopback, &loopbackLen) != 0
+		|| connect(_wakeup, (sockaddr*)&loopback, sizeof(loopback)) != 0
+		|| !setNonBlocking(_wakeup)) {
+		LOGERROR("Could not create wakeup socket");
+		return OCM_FAILED;
+	}
+
+#ifndef _WIN32
+	_poll = epoll_create1(0);
+	if (_poll < 0) {
+		LOGERROR("epoll_create1 failed");
+		return OCM_FAILED;
+	}
+
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.u64 = OCM_LISTEN_ID;
+	if (epoll_ctl((int)_poll, EPOLL_CTL_ADD, (int)_listen, &ev) != 0) {
+		LOGERROR("epoll_ctl failed");
+		return OCM_FAILED;
+	}
+	ev.data.u64 = OCM_WAKEUP_ID;
+	if (epoll_ctl((int)_poll, EPOLL_CTL_ADD, (int)_wakeup, &ev) != 0) {
+		LOGERROR("epoll_ctl failed");
+		return OCM_FAILED;
+	}
+#endif
+
+	return OCM_OK;
+}
+
+void OCMScanServer::close()
+{
+	for (std::map<unsigned int, OCMConnection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+		closeConnection(*it->second);
+	}
+	releaseClosed();
+
+	if (_wakeup != OCM_INVALID_SOCKET) {
+		OCM_CLOSESOCKET(_wakeup);
+		_wakeup = OCM_INVALID_SOCKET;
+	}
+
+	if (_listen != OCM_INVALID_SOCKET) {
+		OCM_CLOSESOCKET(_listen);
+		_listen = OCM_INVALID_SOCKET;
+#ifdef _WIN32
+		WSACleanup();
+#endif
+	}
+
+#ifndef _WIN32
+	if (_poll != OCM_INVALID_SOCKET) {
+		::close((int)_poll);
+		_poll = OCM_INVALID_SOCKET;
+	}
+#endif
+}
+
+OCM_Error_t OCMScanServer::run()
+{
+	if (_listen == OCM_INVALID_SOCKET) {
+		LOGERROR("Server not open");
+		return OCM_FAILED;
+	}
+
+	while (!_stop) {
+#ifdef _WIN32
+		// WSAPoll needs the full descriptor set on every call
+		std::vector<WSAPOLLFD> fds;
+		std::vector<unsigned int> ids;
+		WSAPOLLFD pfd;
+		pfd.events = POLLRDNORM;
+		pfd.revents = 0;
+		if (!_acceptPaused) {
+			pfd.fd = (SOCKET)_listen;
+			fds.push_back(pfd);
+			ids.push_back(OCM_LISTEN_ID);
+		}
+		pfd.fd = (SOCKET)_wakeup;
+		fds.push_back(pfd);
+		ids.push_back(OCM_WAKEUP_ID);
+		for (std::map<unsigned int, OCMConnection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+			pfd.fd = (SOCKET)it->second->Socket;
+			pfd.events = POLLRDNORM | (it->second->WantWrite ? POLLWRNORM : 0);
+			fds.push_back(pfd);
+			ids.push_back(it->first);
+		}
+
+		int n = WSAPoll(&fds[0], (ULONG)fds.size(), _settings.TickMs);
+		for (int i = 0; i < (int)fds.size() && n > 0; ++i) {
+			short revents = fds[i].revents;
+			if (revents == 0) {
+				continue;
+			}
+			if (ids[i] == OCM_LISTEN_ID) {
+				acceptConnections();
+				continue;
+			}
+			if (ids[i] == OCM_WAKEUP_ID) {
+				drainWakeup();
+				continue;
+			}
+			OCMConnection *pConn = getConnection(ids[i]);
+			if (pConn == NULL) {
+				continue;
+			}
+			if ((revents & (POLLERR | POLLNVAL)) != 0) {
+				closeConnection(*pConn);
+				continue;
+			}
+			if ((revents & (POLLRDNORM | POLLHUP)) != 0) {
+				readConnection(*pConn);
+			}
+			if ((revents & POLLWRNORM) != 0 && pConn->State != OCM_CONN_CLOSED) {
+				flushConnection(*pConn);
+			}
+		}
+#else
+		epoll_event events[256];
+		int n = epoll_wait((int)_poll, events, 256, _settings.TickMs);
+		for (int i = 0; i < n; ++i) {
+			unsigned int id = (unsigned int)events[i].data.u64;
+			if (id == OCM_LISTEN_ID) {
+				acceptConnections();
+				continue;
+			}
+			if (id == OCM_WAKEUP_ID) {
+				drainWakeup();
+				continue;
+			}
+			OCMConnection *pConn = getConnection(id);
+			if (pConn == NULL) {
+				continue;
+			}
+			if ((events[i].events & EPOLLERR) != 0) {
+				closeConnection(*pConn);
+				continue;
+			}
+			if ((events[i].events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) != 0) {
+				readConnection(*pConn);
+			}
+			if ((events[i].events & EPOLLOUT) != 0 && pConn->State != OCM_CONN_CLOSED) {
+				flushConnection(*pConn);
+			}
+		}
+#endif
+
+		sweepIdle();
+
+		if (_pHandler != NULL) {
+			_pHandler->onTick(*this);
+		}
+
+		flushPending();
+		releaseClosed();
+	}
+
+	return OCM_OK;
+}
+
+void OCMScanServer::wakeup()
+{
+	if (_wakeup != OCM_INVALID_SOCKET) {
+		char c = 0;
+		::send(_wakeup, &c, 1, 0);
+	}
+}
+
+void OCMScanServer::drainWakeup()
+{
+	char buffer[64];
+	while (recv(_wakeup, buffer, sizeof(buffer), 0) > 0) {
+	}
+}
+
+void OCMScanServer::acceptConnections()
+{
+	for (;;) {
+		sockaddr_in remoteAddr;
+		socklen_t nAddrlen = sizeof(remoteAddr);
+		intptr_t s = (intptr_t)accept(_listen, (sockaddr*)&remoteAddr, &nAddrlen);
+		if (s == OCM_INVALID_SOCKET) {
+			if (OCM_NODESCRIPTORS()) {
+				// The connection stays in the backlog and the listening socket would be reported as readable
+				// again right away: stop polling it until a descriptor has been freed
+				LOGWARNING("Could not accept connections: out of socket descriptors");
+				pauseAccept(true);
+			}
+			break; // No more pending connections
+		}
+
+		if (_connections.size() >= _settings.MaxConnections || !setNonBlocking(s)) {
+			LOGWARNING("Connection from " << inet_ntoa(remoteAddr.sin_addr) << " refused");
+			OCM_CLOSESOCKET(s);
+			continue;
+		}
+
+		int noDelay = 1;
+		setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&noDelay, sizeof(noDelay));
+
+		OCMConnection *pConn	= new OCMConnection();
+		pConn->Id				= _nextId++;
+		pConn->Socket			= s;
+		pConn->Peer				= inet_ntoa(remoteAddr.sin_addr);
+		pConn->State			= OCM_CONN_OPEN;
+		pConn->TxOffset			= 0;
+		pConn->TxQueued			= 0;
+		pConn->LastActiveMs		= nowMs();
+		pConn->WantWrite		= false;
+		while (_nextId == OCM_LISTEN_ID || _nextId == OCM_WAKEUP_ID) {
+			_nextId++;
+		}
+
+#ifndef _WIN32
+		epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.u64 = pConn->Id;
+		if (epoll_ctl((int)_poll, EPOLL_CTL_ADD, (int)s, &ev) != 0) {
+			OCM_CLOSESOCKET(s);
+			delete pConn;
+			continue;
+		}
+#endif
+
+		_connections[pConn->Id] = pConn;
+	}
+}
+
+void OCMScanServer::readConnection(OCMConnection &Conn)
+{
+	char buffer[OCM_RECV_CHUNK];
+
+	for (;;) {
+		int ret = (int)recv(Conn.Socket, buffer, sizeof(buffer), 0);
+		if (ret > 0) {
+			Conn.Rx.insert(Conn.Rx.end(), buffer, buffer + ret);
+			Conn.LastActiveMs = nowMs();
+			// Stop at the limit; the rest stays in the socket until the requests received so far have been handled
+			if (ret < (int)sizeof(buffer) || Conn.Rx.size() > _settings.MaxRxBuffered) {
+				break;
+			}
+			continue;
+		}
+		if (ret < 0 && OCM_WOULDBLOCK()) {
+			break;
+		}
+		// Connection closed by the peer or failed
+		closeConnection(Conn);
+		return;
+	}
+
+	// Hand all complete requests to the protocol handler
+	size_t consumed = 0;
+	while (Conn.State == OCM_CONN_OPEN && consumed < Conn.Rx.size() && _pHandler != NULL) {
+		int n = _pHandler->onReceive(*this, Conn, &Conn.Rx[consumed], Conn.Rx.size() - consumed);
+		if (n < 0) {
+			closeConnection(Conn);
+			return;
+		}
+		if (n == 0) {
+			break; // Request incomplete
+		}
+		consumed += n;
+	}
+	Conn.Rx.erase(Conn.Rx.begin(), Conn.Rx.begin() + consumed);
+
+	// Send the responses to all requests of this read at once
+	flushPending();
+
+	if (Conn.Rx.size() > _settings.MaxRxBuffered) {
+		LOGWARNING("Connection " << Conn.Id << " (" << Conn.Peer << ") closed: receive buffer limit exceeded");
+		closeConnection(Conn);
+	}
+}
+
+OCM_Error_t OCMScanServer::send(OCMConnection &Conn, const void *pData, size_t size)
+{
+	std::shared_ptr<std::vector<char> > Copy = std::make_shared<std::vector<char> >((const char*)pData, (const char*)pData + size);
+
+	OCMTxSegment_t Segment;
+	Segment.Owner	= Copy;
+	Segment.pData	= Copy->empty() ? NULL : &(*Copy)[0];
+	Segment.Length	= size;
+
+	return send(Conn, Segment);
+}
+
+OCM_Error_t OCMScanServer::send(OCMConnection &Conn, const OCMTxSegment_t &Segment)
+{
+	return send(Conn, std::vector<OCMTxSegment_t>(1, Segment));
+}
+
+OCM_Error_t OCMScanServer::send(OCMConnection &Conn, const std::vector<OCMTxSegment_t> &Segments)
+{
+	if (Conn.State == OCM_CONN_CLOSED) {
+		return OCM_FAILED;
+	}
+
+	size_t size = 0;
+	for (size_t k = 0; k < Segments.size(); ++k) {
+		size += Segments[k].Length;
+	}
+
+	if (Conn.TxQueued + size > _settings.MaxTxQueued) {
+		LOGWARNING("Connection " << Conn.Id << " (" << Conn.Peer << ") closed: send queue limit exceeded");
+		closeConnection(Conn);
+		return OCM_FAILED;
+	}
+
+	if (Conn.Tx.empty()) {
+		_pending.push_back(Conn.Id);
+	}
+	for (size_t k = 0; k < Segments.size(); ++k) {
+		if (Segments[k].Length > 0) {
+			Conn.Tx.push_back(Segments[k]);
+		}
+	}
+	Conn.TxQueued += size;
+
+	return OCM_OK;
+}
+
+void OCMScanServer::flushPending()
+{
+	// Try to send right away, only wait for writability if the socket buffer is full
+	for (size_t i = 0; i < _pending.size(); ++i) {
+		OCMConnection *pConn = getConnection(_pending[i]);
+		if (pConn != NULL && !pConn->WantWrite) {
+			flushConnection(*pConn);
+		}
+	}
+	_pending.clear();
+}
+
+void OCMScanServer::flushConnection(OCMConnection &Conn)
+{
+	while (!Conn.Tx.empty() && Conn.State != OCM_CONN_CLOSED) {
+		// Gather as many segments as possible into one call
+		size_t nSegments = Conn.Tx.size() < OCM_MAX_SEGMENTS ? Conn.Tx.size() : OCM_MAX_SEGMENTS;
+		long long sent = 0;
+#ifdef _WIN32
+		WSABUF bufs[OCM_MAX_SEGMENTS];
+		for (size_t k = 0; k < nSegments; ++k) {
+			size_t offset = k == 0 ? Conn.TxOffset : 0;
+			bufs[k].buf = (CHAR*)Conn.Tx[k].pData + offset;
+			bufs[k].len = (ULONG)(Conn.Tx[k].Length - offset);
+		}
+		DWORD nSent = 0;
+		if (WSASend((SOCKET)Conn.Socket, bufs, (DWORD)nSegments, &nSent, 0, NULL, NULL) != 0) {
+			sent = -1;
+		}
+		else {
+			sent = nSent;
+		}
+#else
+		iovec iov[OCM_MAX_SEGMENTS];
+		for (size_t k = 0; k < nSegments; ++k) {
+			size_t offset = k == 0 ? Conn.TxOffset : 0;
+			iov[k].iov_base = (void*)(Conn.Tx[k].pData + offset);
+			iov[k].iov_len = Conn.Tx[k].Length - offset;
+		}
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = nSegments;
+		sent = sendmsg((int)Conn.Socket, &msg, MSG_NOSIGNAL);
+#endif
+		if (sent < 0) {
+			if (OCM_WOULDBLOCK()) {
+				break;
+			}
+			closeConnection(Conn);
+			return;
+		}
+
+		Conn.LastActiveMs = nowMs();
+		Conn.TxQueued -= (size_t)sent;
+
+		// Drop the segments that are completely sent
+		while (sent > 0) {
+			size_t remaining = Conn.Tx.front().Length - Conn.TxOffset;
+			if ((size_t)sent < remaining) {
+				Conn.TxOffset += (size_t)sent;
+				sent = 0;
+			}
+			else {
+				sent -= remaining;
+				Conn.Tx.pop_front();
+				Conn.TxOffset = 0;
+			}
+		}
+	}
+
+	if (Conn.Tx.empty() && Conn.State == OCM_CONN_CLOSING) {
+		closeConnection(Conn);
+		return;
+	}
+
+	updateInterest(Conn);
+}
+
+void OCMScanServer::updateInterest(OCMConnection &Conn)
+{
+	bool wantWrite = !Conn.Tx.empty();
+	if (wantWrite == Conn.WantWrite || Conn.State == OCM_CONN_CLOSED) {
+		return;
+	}
+	Conn.WantWrite = wantWrite;
+
+#ifndef _WIN32
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | (wantWrite ? EPOLLOUT : 0);
+	ev.data.u64 = Conn.Id;
+	epoll_ctl((int)_poll, EPOLL_CTL_MOD, (int)Conn.Socket, &ev);
+#endif
+}
+
+void OCMScanServer::closeAfterFlush(OCMConnection &Conn)
+{
+	if (Conn.State == OCM_CONN_OPEN) {
+		Conn.State = OCM_CONN_CLOSING;
+	}
+	if (Conn.Tx.empty()) {
+		closeConnection(Conn);
+	}
+}
+
+void OCMScanServer::closeConnection(OCMConnection &Conn)
+{
+	if (Conn.State == OCM_CONN_CLOSED) {
+		return;
+	}
+
+	if (_pHandler != NULL) {
+		_pHandler->onClose(*this, Conn);
+	}
+
+	Conn.State = OCM_CONN_CLOSED;
+	_closing.push_back(Conn.Id);
+}
+
+void OCMScanServer::releaseClosed()
+{
+	for (unsigned int i = 0; i < _closing.size(); ++i) {
+		std::map<unsigned int, OCMConnection*>::iterator it = _connections.find(_closing[i]);
+		if (it == _connections.end()) {
+			continue;
+		}
+		OCMConnection *pConn = it->second;
+#ifndef _WIN32
+		epoll_ctl((int)_poll, EPOLL_CTL_DEL, (int)pConn->Socket, NULL);
+#endif
+		OCM_CLOSESOCKET(pConn->Socket);
+		delete pConn;
+		_connections.erase(it);
+	}
+
+	// Descriptors of other parts of the process can be freed as well, so retry after a while in any case
+	if (_acceptPaused && (!_closing.empty() || nowMs() - _acceptPausedMs >= OCM_ACCEPT_RETRY_MS)) {
+		pauseAccept(false);
+	}
+	_closing.clear();
+}
+
+void OCMScanServer::pauseAccept(bool pause)
+{
+	if (pause == _acceptPaused) {
+		return;
+	}
+	_acceptPaused	= pause;
+	_acceptPausedMs	= nowMs();
+
+#ifndef _WIN32
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = pause ? 0 : EPOLLIN;
+	ev.data.u64 = OCM_LISTEN_ID;
+	epoll_ctl((int)_poll, EPOLL_CTL_MOD, (int)_listen, &ev);
+#endif
+}
+
+void OCMScanServer::sweepIdle()
+{
+	if (_settings.IdleTimeoutMs <= 0) {
+		return;
+	}
+
+	long long now = nowMs();
+	for (std::map<unsigned int, OCMConnection*>::iterator it = _connections.begin(); it != _connections.end(); ++it) {
+		if (it->second->State != OCM_CONN_CLOSED && now - it->second->LastActiveMs > _settings.IdleTimeoutMs) {
+			closeConnection(*it->second);
+		}
+	}
+}
+
+OCMConnection *OCMScanServer::getConnection(unsigned int Id)
+{
+	std::map<unsigned int, OCMConnection*>::iterator it = _connections.find(Id);
+	if (it == _connections.end() || it->second->State == OCM_CONN_CLOSED) {
+		return NULL;
+	}
+	return it->second;
+}
+
+std::string OCMScanServer::getLastError()
+{
+	std::string Error = _lastError.str();
+	_lastError.str("");
+	_lastError.clear();
+	return Error;
+}
@@ -0,0 +1,157 @@
+//
+// Event-driven TCP server for scan results
+//
+// A single thread serves all clients using non-blocking sockets (epoll on Linux, WSAPoll on Windows).
+// Each connection has its own receive buffer, a bounded send queue and an idle timer. The application
+// protocol is implemented by an OCMServerHandler, which consumes complete requests from the receive
+// buffer and queues the responses. A slow client only fills up its own send queue and is disconnected
+// when the queue limit is exceeded; it never blocks the other connections.
+//
+#pragma once
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <atomic>
+#include "FinisarHROCM.h"
+
+class OCMScanServer;
+
+// Part of a response. Owner keeps the memory pData is pointing to alive until it has been sent.
+typedef struct {
+	std::shared_ptr<const void>	Owner;
+	const char					*pData;
+	size_t						Length;
+} OCMTxSegment_t;
+
+// Connection states
+typedef enum {
+	OCM_CONN_OPEN,		// Reading requests and writing responses
+	OCM_CONN_CLOSING,	// Close as soon as the send queue is empty
+	OCM_CONN_CLOSED		// Closed, released at the end of the event loop iteration
+} OCMConnState_t;
+
+// State of a client connection
+class OCMConnection
+{
+public:
+	unsigned int				Id;				// Unique connection number (never reused)
+	intptr_t					Socket;			// Socket handle
+	std::string					Peer;			// Remote address
+	OCMConnState_t				State;			// Connection state
+	std::vector<char>			Rx;				// Received bytes not yet consumed by the handler
+	std::deque<OCMTxSegment_t>	Tx;				// Send queue
+	size_t						TxOffset;		// Bytes of Tx.front() already sent
+	size_t						TxQueued;		// Total bytes in the send queue
+	long long					LastActiveMs;	// Time of the last successful receive or send
+	bool						WantWrite;		// Registered for writability
+};
+
+// Application protocol
+class OCMServerHandler
+{
+public:
+	virtual ~OCMServerHandler() {}
+
+	// Called when new bytes arrived. Consume complete requests from pData and queue the responses using
+	// OCMScanServer::send(). Return the number of bytes consumed or -1 to close the connection.
+	virtual int onReceive(OCMScanServer &Server, OCMConnection &Conn, const char *pData, size_t size) = 0;
+
+	// Called before a connection is closed
+	virtual void onClose(OCMScanServer &Server, OCMConnection &Conn) {}
+
+	// Called once per event loop iteration
+	virtual void onTick(OCMScanServer &Server) {}
+};
+
+// Server settings
+typedef struct {
+	unsigned short	Port;			// TCP port
+	std::string		BindAddress;	// IP address to bind to. Empty: all interfaces
+	unsigned int	MaxConnections;	// Further connections are refused
+	size_t			MaxTxQueued;	// Send queue limit per connection in bytes. The connection is closed if exceeded.
+	size_t			MaxRxBuffered;	// Receive buffer limit per connection in bytes. The connection is closed if exceeded.
+	int				IdleTimeoutMs;	// Connections without any traffic are closed after this time (0: never)
+	int				TickMs;			// Maximum time between two calls of OCMServerHandler::onTick
+} OCMServerSettings_t;
+
+class OCMScanServer
+{
+public:
+	OCMScanServer(OCMServerHandler *pHandler, const OCMServerSettings_t &Settings);
+	~OCMScanServer();
+
+	static OCMServerSettings_t defaultSettings();
+
+	// Create the listening socket
+	OCM_Error_t open();
+
+	// Run the event loop until stop() is called
+	OCM_Error_t run();
+
+	// Ask the event loop to return (can be called from any thread)
+	void stop() { _stop = true; wakeup(); }
+
+	// Interrupt the wait of the event loop so that OCMServerHandler::onTick is called right away, e.g. when
+	// new data for the clients is available (can be called from any thread)
+	void wakeup();
+
+	// Close all connections and the listening socket
+	void close();
+
+	// Queue a response. The data is copied. Only call from the event loop thread (i.e. from the handler).
+	// The send queues are flushed after the handler returns.
+	OCM_Error_t send(OCMConnection &Conn, const void *pData, size_t size);
+
+	// Queue a response without copying. Owner has to keep pData alive.
+	OCM_Error_t send(OCMConnection &Conn, const OCMTxSegment_t &Segment);
+
+	// Queue a response consisting of several segments without copying
+	OCM_Error_t send(OCMConnection &Conn, const std::vector<OCMTxSegment_t> &Segments);
+
+	// Close the connection after the send queue has been flushed
+	void closeAfterFlush(OCMConnection &Conn);
+
+	// Close the connection immediately. The queued responses are dropped.
+	void closeConnection(OCMConnection &Conn);
+
+	// Look up a connection by its Id (NULL if it has been closed)
+	OCMConnection *getConnection(unsigned int Id);
+
+	// Number of open connections
+	size_t getConnectionCount() const { return _connections.size(); }
+
+	// Milliseconds of a monotonic clock
+	static long long nowMs();
+
+	// Accumulated error messages (clears the error buffer)
+	std::string getLastError();
+
+private:
+	void acceptConnections();
+	void readConnection(OCMConnection &Conn);
+	void flushConnection(OCMConnection &Conn);
+	void updateInterest(OCMConnection &Conn);
+	void sweepIdle();
+	void releaseClosed();
+	void flushPending();
+	void drainWakeup();
+	void pauseAccept(bool pause);
+
+	OCMServerHandler							*_pHandler;
+	OCMServerSettings_t							_settings;
+	intptr_t									_listen;		// Listening socket
+	intptr_t									_poll;			// epoll descriptor (Linux only)
+	intptr_t									_wakeup;		// UDP socket connected to itself, see wakeup()
+	unsigned int								_nextId;		// Id of the next connection
+	std::map<unsigned int, OCMConnection*>		_connections;
+	std::vector<unsigned int>					_closing;		// Connections to close at the end of the iteration
+	std::vector<unsigned int>					_pending;		// Connections with new data in the send queue
+	std::atomic<bool>							_stop;
+	bool										_acceptPaused;	// Listening socket not polled (out of descriptors)
+	long long									_acceptPausedMs;	// Time accepting was paused or resumed
+	std::ostringstream							_lastError;
+};
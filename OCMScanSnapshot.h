@@ -0,0 +1,56 @@
+//
+// Scan results as served to the clients
+//
+// A snapshot holds the results of one complete scan cycle. Once handed out by an OCMSnapshotSource it
+// is never modified, so the request handlers can reference its buffers until the responses are sent.
+//
+#pragma once
+
+#include <memory>
+#include <vector>
+#include "OCMProtocol.h"
+
+// Results of a scan on an equidistant channel grid
+typedef struct {
+	unsigned int						FirstFreq;	// Center frequency of the first channel (0.1 MHz units)
+	unsigned int						Step;		// Channel spacing (0.1 MHz units)
+	std::vector<OCMP_ChannelValue_t>	Values;		// Power and OSNR per channel
+} OCMGridResult_t;
+
+// Results of a high-resolution scan. Freq is sorted in ascending order, so the slices of a frequency
+// window are a contiguous range of both vectors.
+typedef struct {
+	std::vector<unsigned int>			Freq;		// Center frequency of each slice (0.1 MHz units)
+	std::vector<double>					Power;		// Power of each slice in dBm
+} OCMSpectrum_t;
+
+class OCMScanSnapshot
+{
+public:
+	OCMScanSnapshot() : Scan(0), TimestampMs(0) {}
+
+	unsigned int					Scan;			// Scan cycle number
+	long long						TimestampMs;	// Completion time (ms since 1970-01-01 UTC)
+	std::vector<OCMGridResult_t>	Grids;			// One entry per channel grid scanned
+	OCMSpectrum_t					Spectrum;		// High-resolution scan (empty if not scanned)
+};
+
+// Provides the latest complete snapshot to the request handlers
+class OCMSnapshotSource
+{
+public:
+	virtual ~OCMSnapshotSource() {}
+
+	// Latest complete snapshot (empty before the first scan cycle completed)
+	virtual std::shared_ptr<const OCMScanSnapshot> getSnapshot() = 0;
+};
+
+// Starts the on-demand scans on request of a client (OCMP_MSG_TRIGGER)
+class OCMScanTrigger
+{
+public:
+	virtual ~OCMScanTrigger() {}
+
+	// Make the on-demand scans due. Returns false if there are none.
+	virtual bool triggerScans() = 0;
+};
@@ -0,0 +1,61 @@
+#include "stdafx.h"
+#include "OCMSnapshotPublisher.h"
+#include <thread>
+
+OCMSnapshotPublisher::OCMSnapshotPublisher()
+{
+	for (unsigned int i = 0; i < OCM_PUBLISHER_SLOTS; ++i) {
+		_slots[i].Readers = 0;
+	}
+	_current = 0;
+	_generation = 0;
+	_pListener = NULL;
+}
+
+void OCMSnapshotPublisher::publish(std::shared_ptr<const OCMScanSnapshot> Snapshot)
+{
+	unsigned int current = _current.load();
+
+	// Find a slot that is neither current nor being read. Readers only hold a slot for the time it takes
+	// to copy a shared_ptr, so this hardly ever has to wait.
+	unsigned int next = (current + 1) % OCM_PUBLISHER_SLOTS;
+	while (_slots[next].Readers.load() != 0) {
+		next = (next + 1) % OCM_PUBLISHER_SLOTS;
+		if (next == current) {
+			next = (next + 1) % OCM_PUBLISHER_SLOTS;
+			std::this_thread::yield();
+		}
+	}
+
+	// Releases the snapshot published OCM_PUBLISHER_SLOTS-1 generations ago, unless still referenced
+	_slots[next].Snapshot = Snapshot;
+	_current.store(next);
+	unsigned int generation = ++_generation;
+
+	if (_pListener != NULL) {
+		_pListener->onPublish(generation);
+	}
+}
+
+std::shared_ptr<const OCMScanSnapshot> OCMSnapshotPublisher::getSnapshot()
+{
+	while (1) {
+		unsigned int current = _current.load();
+		_slots[current].Readers++;
+
+		// The writer does not touch the slot while it is current or has readers. If the slot is still
+		// current after announcing ourselves, the writer either saw the reader count or has not picked
+		// this slot since it was made current.
+		if (_current.load() == current) {
+			std::shared_ptr<const OCMScanSnapshot> Snapshot = _slots[current].Snapshot;
+			_slots[current].Readers--;
+			return Snapshot;
+		}
+		_slots[current].Readers--;
+	}
+}
+
+unsigned int OCMSnapshotPublisher::getGeneration() const
+{
+	return _generation.load();
+}
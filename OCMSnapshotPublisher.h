@@ -0,0 +1,59 @@
+//
+// Publication of scan snapshots from the scan thread to the request handlers
+//
+// The scan thread builds every snapshot privately and hands it over with publish() once it is complete.
+// Readers never wait for the scan thread: getSnapshot() only touches a few atomics and copies a
+// shared_ptr, so it takes the same time whether or not a scan is running.
+//
+// The publisher keeps the snapshot pointers in a small array of slots, one of which is current. A reader
+// announces itself on the current slot with a reader count and then copies the pointer. The writer only
+// refills slots that are neither current nor in use by a reader, so a reader never sees a half written
+// pointer. A snapshot that is replaced stays alive for as long as any reader or queued response holds a
+// reference to it and is freed with the last one.
+//
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include "OCMScanSnapshot.h"
+
+#define OCM_PUBLISHER_SLOTS		4
+
+// Notified on the publishing thread after a new snapshot became current
+class OCMPublishListener
+{
+public:
+	virtual ~OCMPublishListener() {}
+
+	virtual void onPublish(unsigned int Generation) = 0;
+};
+
+class OCMSnapshotPublisher : public OCMSnapshotSource
+{
+public:
+	OCMSnapshotPublisher();
+
+	// Makes Snapshot the current one. Only one thread may publish.
+	void publish(std::shared_ptr<const OCMScanSnapshot> Snapshot);
+
+	// Latest published snapshot (empty before the first publish). Lock-free; a reader only retries if a
+	// publish completes between its two loads of the current slot.
+	virtual std::shared_ptr<const OCMScanSnapshot> getSnapshot();
+
+	// Number of snapshots published so far
+	unsigned int getGeneration() const;
+
+	// Set the listener called by publish() (NULL: none). Must not be changed while publishing.
+	void setListener(OCMPublishListener *pListener) { _pListener = pListener; }
+
+private:
+	typedef struct {
+		std::atomic<unsigned int>				Readers;	// Readers currently copying Snapshot
+		std::shared_ptr<const OCMScanSnapshot>	Snapshot;
+	} Slot_t;
+
+	Slot_t						_slots[OCM_PUBLISHER_SLOTS];
+	std::atomic<unsigned int>	_current;		// Index of the current slot
+	std::atomic<unsigned int>	_generation;	// Number of publishes
+	OCMPublishListener			*_pListener;
+};
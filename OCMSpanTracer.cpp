@@ -0,0 +1,177 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "OCMSpanTracer.h"
+
+typedef struct {
+	const char			*Name;
+	const char			*Category;
+	const char			*ArgName;		// NULL: no argument
+	long long			ArgValue;
+	unsigned long long	StartUs;
+	unsigned long long	DurationUs;
+	bool				Instant;
+} SpanEvent_t;
+
+// Events of one thread. The mutex is only contended while the session is written.
+typedef struct {
+	std::mutex					Mutex;
+	std::vector<SpanEvent_t>	Events;
+	unsigned int				Tid;
+	std::string					Name;
+} SpanThread_t;
+
+std::atomic<bool> OCMSpanTracer::_enabled(false);
+
+static std::mutex &spanMutex()
+{
+	static std::mutex Mutex;
+	return Mutex;
+}
+
+static std::vector<std::shared_ptr<SpanThread_t> > &spanThreads()
+{
+	static std::vector<std::shared_ptr<SpanThread_t> > Threads;
+	return Threads;
+}
+
+static std::atomic<unsigned long long> spanEvents(0);			// Events in the session
+static std::atomic<unsigned long long> spanDropped(0);
+static std::atomic<unsigned long long> spanMaxEvents(0);
+static std::atomic<unsigned long long> spanStartUs(0);
+
+// Buffer of the calling thread, created on first use
+static SpanThread_t &spanThread()
+{
+	static thread_local std::shared_ptr<SpanThread_t> pThread;
+	if (!pThread) {
+		pThread = std::make_shared<SpanThread_t>();
+		std::lock_guard<std::mutex> Lock(spanMutex());
+		pThread->Tid = (unsigned int)spanThreads().size() + 1;
+		spanThreads().push_back(pThread);
+	}
+	return *pThread;
+}
+
+static void spanAppend(const SpanEvent_t &Event)
+{
+	if (spanEvents.fetch_add(1, std::memory_order_relaxed) >= spanMaxEvents.load(std::memory_order_relaxed)) {
+		spanDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	SpanThread_t &Thread = spanThread();
+	std::lock_guard<std::mutex> Lock(Thread.Mutex);
+	Thread.Events.push_back(Event);
+}
+
+// Text of a JSON string without the quotes
+static std::string spanEscape(const char *pText)
+{
+	std::string Text;
+	for (; *pText != 0; ++pText) {
+		if (*pText == '"' || *pText == '\\') {
+			Text += '\\';
+		}
+		Text += (unsigned char)*pText < 0x20 ? ' ' : *pText;
+	}
+	return Text;
+}
+
+void OCMSpanTracer::start(size_t maxEvents)
+{
+	std::lock_guard<std::mutex> Lock(spanMutex());
+	for (size_t i = 0; i < spanThreads().size(); ++i) {
+		std::lock_guard<std::mutex> ThreadLock(spanThreads()[i]->Mutex);
+		spanThreads()[i]->Events.clear();
+	}
+	spanEvents.store(0, std::memory_order_relaxed);
+	spanDropped.store(0, std::memory_order_relaxed);
+	spanMaxEvents.store(maxEvents, std::memory_order_relaxed);
+	spanStartUs.store(OCMDriverStats::nowUs(), std::memory_order_relaxed);
+	_enabled.store(true, std::memory_order_release);
+}
+
+void OCMSpanTracer::stop()
+{
+	_enabled.store(false, std::memory_order_release);
+}
+
+void OCMSpanTracer::record(const char *Name, const char *Category, unsigned long long startUs, unsigned long long endUs, const char *ArgName, long long ArgValue)
+{
+	SpanEvent_t Event = { Name, Category, ArgName, ArgValue, startUs, endUs - startUs, false };
+	spanAppend(Event);
+}
+
+void OCMSpanTracer::instant(const char *Name, const char *Category, const char *ArgName, long long ArgValue)
+{
+	if (!isEnabled()) {
+		return;
+	}
+	SpanEvent_t Event = { Name, Category, ArgName, ArgValue, OCMDriverStats::nowUs(), 0, true };
+	spanAppend(Event);
+}
+
+void OCMSpanTracer::setThreadName(const char *Name)
+{
+	SpanThread_t &Thread = spanThread();
+	std::lock_guard<std::mutex> Lock(Thread.Mutex);
+	Thread.Name = Name;
+}
+
+unsigned long long OCMSpanTracer::getDropped()
+{
+	return spanDropped.load(std::memory_order_relaxed);
+}
+
+bool OCMSpanTracer::writeChromeJson(const char *filename, std::string &Error)
+{
+	FILE *f = fopen(filename, "wt");
+	if (f == NULL) {
+		Error = std::string("Could not write file ") + filename;
+		return false;
+	}
+
+	unsigned long long baseUs = spanStartUs.load(std::memory_order_relaxed);
+	fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"HROCMQueryV3\"}}");
+
+	std::vector<std::shared_ptr<SpanThread_t> > Threads;
+	{
+		std::lock_guard<std::mutex> Lock(spanMutex());
+		Threads = spanThreads();
+	}
+	for (size_t i = 0; i < Threads.size(); ++i) {
+		std::lock_guard<std::mutex> Lock(Threads[i]->Mutex);
+		if (!Threads[i]->Name.empty()) {
+			fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", Threads[i]->Tid,
+				spanEscape(Threads[i]->Name.c_str()).c_str());
+		}
+
+		for (size_t k = 0; k < Threads[i]->Events.size(); ++k) {
+			const SpanEvent_t &Event = Threads[i]->Events[k];
+			unsigned long long ts = Event.StartUs > baseUs ? Event.StartUs - baseUs : 0;
+			if (Event.Instant) {
+				fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%llu,\"pid\":1,\"tid\":%u", Event.Name, Event.Category,
+					ts, Threads[i]->Tid);
+			}
+			else {
+				fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu,\"dur\":%llu,\"pid\":1,\"tid\":%u", Event.Name, Event.Category,
+					ts, Event.DurationUs, Threads[i]->Tid);
+			}
+			if (Event.ArgName != NULL) {
+				fprintf(f, ",\"args\":{\"%s\":%lld}", Event.ArgName, Event.ArgValue);
+			}
+			fprintf(f, "}");
+		}
+	}
+	fprintf(f, "\n]}\n");
+
+	bool Result = ferror(f) == 0;
+	fclose(f);
+	if (!Result) {
+		Error = std::string("Could not write file ") + filename;
+	}
+	return Result;
+}
@@ -0,0 +1,72 @@
+//
+// Timeline of the driver calls (-timeline, see HROCMQueryV3.cpp)
+//
+// FinisarHROCM_V3 marks the phases of a scan with OCMSpan objects (runFullScan, cmdTPC, waitTaskComplete,
+// cmdPollLong, spiTransfer, runPostProcessing, ...); retransmits and CRC retries are marked as instant
+// events. While the tracer is stopped a span costs one relaxed atomic load. While it runs, each thread
+// appends to its own buffer; the events of all threads are written as Chrome trace JSON by writeChromeJson(),
+// which chrome://tracing and the Perfetto UI (ui.perfetto.dev) open directly.
+//
+// Names, categories and argument names must be string literals (only the pointers are kept).
+//
+#pragma once
+
+#include <atomic>
+#include <string>
+#include "OCMDriverStats.h"
+
+#define OCM_SPAN_DEFAULT_MAXEVENTS	1000000		// Events kept per session (about 56 MB)
+
+class OCMSpanTracer
+{
+public:
+	// Start a session; events of a previous session are discarded
+	static void start(size_t maxEvents);
+	static void stop();
+	static bool isEnabled() { return _enabled.load(std::memory_order_relaxed); }
+
+	// Add a complete span / an instant event of the calling thread
+	static void record(const char *Name, const char *Category, unsigned long long startUs, unsigned long long endUs, const char *ArgName, long long ArgValue);
+	static void instant(const char *Name, const char *Category, const char *ArgName, long long ArgValue);
+
+	// Name of the calling thread in the timeline
+	static void setThreadName(const char *Name);
+
+	// Events not kept because the session was full
+	static unsigned long long getDropped();
+
+	static bool writeChromeJson(const char *filename, std::string &Error);
+
+private:
+	static std::atomic<bool>	_enabled;
+};
+
+// Span from construction to destruction
+class OCMSpan
+{
+public:
+	OCMSpan(const char *Name, const char *Category = "ocm") : _name(Name), _category(Category), _argName(NULL), _argValue(0)
+	{
+		_startUs = OCMSpanTracer::isEnabled() ? OCMDriverStats::nowUs() : 0;
+	}
+
+	~OCMSpan()
+	{
+		if (_startUs != 0 && OCMSpanTracer::isEnabled()) {
+			OCMSpanTracer::record(_name, _category, _startUs, OCMDriverStats::nowUs(), _argName, _argValue);
+		}
+	}
+
+	// Argument shown with the span (e.g. the opcode of a transfer)
+	void setArg(const char *Name, long long Value) { _argName = Name; _argValue = Value; }
+
+private:
+	OCMSpan(const OCMSpan&);
+	OCMSpan &operator=(const OCMSpan&);
+
+	const char			*_name;
+	const char			*_category;
+	const char			*_argName;
+	long long			_argValue;
+	unsigned long long	_startUs;
+};
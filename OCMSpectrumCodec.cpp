@@ -0,0 +1,154 @@
+#include "stdafx.h"
+#include <math.h>
+#include "OCMSpectrumCodec.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define OCM_CODEC_SSE2
+#endif
+
+short OCMSpectrumCodec::quantize(double powerDbm)
+{
+	double q = floor(powerDbm * 100 + 0.5);
+	if (q > 32767) {
+		return 32767;
+	}
+	if (q < -32768) {
+		return -32768;
+	}
+	return (short)q;
+}
+
+void OCMSpectrumCodec::putVarint(unsigned int value, std::vector<unsigned char> &Out)
+{
+	while (value >= 0x80) {
+		Out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	Out.push_back((unsigned char)value);
+}
+
+bool OCMSpectrumCodec::getVarint(const unsigned char *&p, const unsigned char *pEnd, unsigned int &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 35 && p < pEnd; shift += 7) {
+		unsigned char b = *p++;
+		value |= (unsigned int)(b & 0x7F) << shift;
+		if ((b & 0x80) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void OCMSpectrumCodec::encode(const OCMSpectrum_t &Spectrum, size_t begin, size_t end, const OCMSpectrum_t *pBase, std::vector<unsigned char> &Out)
+{
+	if (begin >= end) {
+		putVarint(0, Out);
+		return;
+	}
+
+	// Frequency axis as runs of equal steps
+	std::vector<unsigned int> Runs;
+	for (size_t k = begin + 1; k < end; ++k) {
+		unsigned int step = Spectrum.Freq[k] - Spectrum.Freq[k - 1];
+		if (!Runs.empty() && Runs[Runs.size() - 2] == step) {
+			Runs.back()++;
+		}
+		else {
+			Runs.push_back(step);
+			Runs.push_back(1);
+		}
+	}
+	putVarint((unsigned int)Runs.size() / 2, Out);
+	for (size_t k = 0; k < Runs.size(); ++k) {
+		putVarint(Runs[k], Out);
+	}
+
+	// Powers as zigzag varints of the 16-bit differences
+	short previous = 0;
+	for (size_t k = begin; k < end; ++k) {
+		short power = quantize(Spectrum.Power[k]);
+		short reference = pBase != NULL ? quantize(pBase->Power[k]) : previous;
+		unsigned short delta = (unsigned short)(power - reference);
+		putVarint((unsigned short)((delta << 1) ^ ((delta & 0x8000) != 0 ? 0xFFFF : 0)), Out);
+		previous = power;
+	}
+}
+
+size_t OCMSpectrumCodec::decode(const unsigned char *pData, size_t size, unsigned int fStart, unsigned int count, const short *pBasePower, unsigned int *pFreq, short *pPower)
+{
+	const unsigned char *p = pData;
+	const unsigned char *pEnd = pData + size;
+
+	// Frequency axis
+	unsigned int nRuns = 0;
+	if (!getVarint(p, pEnd, nRuns)) {
+		return 0;
+	}
+	if (count == 0) {
+		return nRuns == 0 ? (size_t)(p - pData) : 0;
+	}
+	unsigned int k = 0;
+	pFreq[k++] = fStart;
+	for (unsigned int r = 0; r < nRuns; ++r) {
+		unsigned int step = 0, length = 0;
+		if (!getVarint(p, pEnd, step) || !getVarint(p, pEnd, length) || length > count - k) {
+			return 0;
+		}
+		for (unsigned int i = 0; i < length; ++i, ++k) {
+			pFreq[k] = pFreq[k - 1] + step;
+		}
+	}
+	if (k != count) {
+		return 0;
+	}
+
+	// Varints to 16-bit zigzag values. Almost all values fit into one byte, so that case is checked first.
+	unsigned short *pZigzag = (unsigned short*)pPower;
+	for (k = 0; k < count; ++k) {
+		if (p < pEnd && *p < 0x80) {
+			pZigzag[k] = *p++;
+		}
+		else {
+			unsigned int value = 0;
+			if (!getVarint(p, pEnd, value) || value > 0xFFFF) {
+				return 0;
+			}
+			pZigzag[k] = (unsigned short)value;
+		}
+	}
+
+	// Undo the zigzag mapping, then add the base scan or take the prefix sum
+	k = 0;
+#ifdef OCM_CODEC_SSE2
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i carry = zero;	// Last decoded value in all lanes
+	for (; k + 8 <= count; k += 8) {
+		__m128i z = _mm_loadu_si128((const __m128i*)(pZigzag + k));
+		__m128i d = _mm_xor_si128(_mm_srli_epi16(z, 1), _mm_sub_epi16(zero, _mm_and_si128(z, one)));
+		if (pBasePower != NULL) {
+			d = _mm_add_epi16(d, _mm_loadu_si128((const __m128i*)(pBasePower + k)));
+		}
+		else {
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 2));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 4));
+			d = _mm_add_epi16(d, _mm_slli_si128(d, 8));
+			d = _mm_add_epi16(d, carry);
+			carry = _mm_shufflehi_epi16(d, _MM_SHUFFLE(3, 3, 3, 3));
+			carry = _mm_unpackhi_epi64(carry, carry);
+		}
+		_mm_storeu_si128((__m128i*)(pPower + k), d);
+	}
+#endif
+	short previous = k > 0 ? pPower[k - 1] : 0;
+	for (; k < count; ++k) {
+		unsigned short z = pZigzag[k];
+		short delta = (short)((z >> 1) ^ (unsigned short)-(short)(z & 1));
+		pPower[k] = (short)(delta + (pBasePower != NULL ? pBasePower[k] : previous));
+		previous = pPower[k];
+	}
+
+	return (size_t)(p - pData);
+}
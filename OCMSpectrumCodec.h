@@ -0,0 +1,42 @@
+//
+// Compact encoding of high-resolution spectra (OCMP_FLAG_COMPACT)
+//
+// Powers are quantized to int16 in units of 0.01 dB. Each value is sent as the difference to the previous
+// slice or, with delta-from-previous-scan, to the same slice of an earlier scan the client already has.
+// The differences are taken modulo 2^16, zigzag mapped and written as varints, so a spectrum with small
+// slice-to-slice changes needs little more than one byte per slice.
+//
+// The frequency axis is sent as runs of equal steps: varint NRUNS, then NRUNS pairs of varints {STEP, LENGTH},
+// starting at the FSTART of the window result. An equidistant axis thus takes a few bytes regardless of
+// the number of slices.
+//
+// The encoder is used by the server, the decoder by clients. The decoder undoes the zigzag mapping and
+// the prefix sum with SSE2 when available.
+//
+#pragma once
+
+#include <vector>
+#include "OCMScanSnapshot.h"
+
+class OCMSpectrumCodec
+{
+public:
+	// Power in 0.01 dB, saturated to the int16 range
+	static short quantize(double powerDbm);
+
+	// Power in dBm
+	static double dequantize(short power) { return power / 100.0; }
+
+	// Append the encoding of slices [begin, end) of Spectrum to Out. pBase is the spectrum of an earlier scan
+	// with the same frequency axis for delta-from-previous-scan, or NULL for delta-from-previous-slice.
+	static void encode(const OCMSpectrum_t &Spectrum, size_t begin, size_t end, const OCMSpectrum_t *pBase, std::vector<unsigned char> &Out);
+
+	// Decode count slices starting at frequency fStart. pBasePower holds the quantized powers of the same
+	// slices of the base scan for delta-from-previous-scan, otherwise NULL. Returns the number of bytes
+	// consumed, 0 if the data is malformed.
+	static size_t decode(const unsigned char *pData, size_t size, unsigned int fStart, unsigned int count, const short *pBasePower, unsigned int *pFreq, short *pPower);
+
+private:
+	static void putVarint(unsigned int value, std::vector<unsigned char> &Out);
+	static bool getVarint(const unsigned char *&p, const unsigned char *pEnd, unsigned int &value);
+};
@@ -0,0 +1,247 @@
+#include "stdafx.h"
+#include <string.h>
+#include <chrono>
+#include <map>
+#include "OCMTraceWriter.h"
+
+#define OCM_TRACE_MAXLINE	1024	// Longest text record of appendv()
+
+// Registry of the writers by file handle
+static std::mutex &traceRegistryMutex()
+{
+	static std::mutex Mutex;
+	return Mutex;
+}
+
+static std::map<FILE*, OCMTraceWriter*> &traceRegistry()
+{
+	static std::map<FILE*, OCMTraceWriter*> Registry;
+	return Registry;
+}
+
+// Incremented by every change of the registry; invalidates the lookups cached by find()
+static std::atomic<unsigned int> &traceRegistryGeneration()
+{
+	static std::atomic<unsigned int> Generation(1);
+	return Generation;
+}
+
+#define OCM_TRACE_FINDCACHE	4		// Lookups cached per thread (-log and -logbin of a driver)
+
+typedef struct {
+	FILE			*File;
+	OCMTraceWriter	*pWriter;
+	unsigned int	Generation;		// 0: empty
+} OCMTraceLookup_t;
+
+OCMTraceWriter::OCMTraceWriter(FILE *f, size_t capacity, int format)
+{
+	size_t size = 4096;
+	while (size < capacity) {
+		size <<= 1;
+	}
+
+	_file = f;
+	_format = format;
+	_ring.resize(size);
+	_mask = size - 1;
+	_reserved = 0;
+	_committed = 0;
+	_written = 0;
+	_records = 0;
+	_droppedRecords = 0;
+	_droppedBytes = 0;
+	_maxFill = 0;
+	_blocks = 0;
+	_stop = false;
+	_flushWaiters = 0;
+	_thread = std::thread(&OCMTraceWriter::threadProc, this);
+}
+
+OCMTraceWriter::~OCMTraceWriter()
+{
+	{
+		std::lock_guard<std::mutex> Lock(_mutex);
+		_stop = true;
+		_wake.notify_all();
+	}
+	_thread.join();
+}
+
+bool OCMTraceWriter::append(const OCMTraceChunk_t *pChunks, size_t nChunks)
+{
+	size_t length = 0;
+	for (size_t i = 0; i < nChunks; ++i) {
+		length += pChunks[i].Length;
+	}
+
+	// Reserve space behind the records of other threads
+	unsigned long long start = _reserved.load(std::memory_order_relaxed);
+	do {
+		if (start + length - _written.load(std::memory_order_acquire) > _ring.size()) {
+			_droppedRecords++;
+			_droppedBytes += length;
+			return false;
+		}
+	} while (!_reserved.compare_exchange_weak(start, start + length, std::memory_order_relaxed));
+
+	unsigned long long pos = start;
+	for (size_t i = 0; i < nChunks; ++i) {
+		const char *p = (const char*)pChunks[i].pData;
+		size_t left = pChunks[i].Length;
+		while (left > 0) {
+			size_t offset = (size_t)(pos & _mask);
+			size_t n = _ring.size() - offset < left ? _ring.size() - offset : left;
+			memcpy(&_ring[offset], p, n);
+			p += n;
+			pos += n;
+			left -= n;
+		}
+	}
+
+	// Commit in reservation order so that the writer thread never sees a gap
+	while (_committed.load(std::memory_order_acquire) != start) {
+		std::this_thread::yield();
+	}
+	_committed.store(start + length, std::memory_order_release);
+	_records++;
+
+	size_t fill = (size_t)(start + length - _written.load(std::memory_order_relaxed));
+	size_t maxFill = _maxFill.load(std::memory_order_relaxed);
+	while (fill > maxFill && !_maxFill.compare_exchange_weak(maxFill, fill, std::memory_order_relaxed)) {
+	}
+
+	// Do not wait for the timeout if the ring is getting full
+	if (fill > _ring.size() / 2) {
+		_wake.notify_one();
+	}
+	return true;
+}
+
+bool OCMTraceWriter::append(const void *pData, size_t length)
+{
+	OCMTraceChunk_t Chunk;
+	Chunk.pData = pData;
+	Chunk.Length = length;
+	return append(&Chunk, 1);
+}
+
+bool OCMTraceWriter::appendv(const char *format, va_list args)
+{
+	char line[OCM_TRACE_MAXLINE];
+	int n = vsnprintf(line, sizeof(line), format, args);
+	if (n < 0) {
+		return false;
+	}
+	return append(line, (size_t)n < sizeof(line) ? (size_t)n : sizeof(line) - 1);
+}
+
+void OCMTraceWriter::flush()
+{
+	unsigned long long target = _committed.load(std::memory_order_acquire);
+
+	std::unique_lock<std::mutex> Lock(_mutex);
+	_flushWaiters++;
+	_wake.notify_all();
+	while (_written.load(std::memory_order_acquire) < target) {
+		_done.wait(Lock);
+	}
+	_flushWaiters--;
+}
+
+OCMTraceStats_t OCMTraceWriter::getStats()
+{
+	OCMTraceStats_t Stats;
+	Stats.Records			= _records;
+	Stats.Bytes				= _committed;
+	Stats.DroppedRecords	= _droppedRecords;
+	Stats.DroppedBytes		= _droppedBytes;
+	Stats.Blocks			= _blocks;
+	Stats.MaxFill			= _maxFill;
+	Stats.Capacity			= _ring.size();
+	return Stats;
+}
+
+void OCMTraceWriter::threadProc()
+{
+	std::unique_lock<std::mutex> Lock(_mutex);
+	for (;;) {
+		bool stop = _stop;
+		Lock.unlock();
+
+		// Write everything committed so far in at most two blocks (the ring may wrap)
+		unsigned long long committed = _committed.load(std::memory_order_acquire);
+		unsigned long long written = _written.load(std::memory_order_relaxed);
+		if (committed != written) {
+			size_t offset = (size_t)(written & _mask);
+			size_t length = (size_t)(committed - written);
+			size_t first = _ring.size() - offset < length ? _ring.size() - offset : length;
+			fwrite(&_ring[offset], 1, first, _file);
+			if (first < length) {
+				fwrite(&_ring[0], 1, length - first, _file);
+			}
+			fflush(_file);
+			_blocks++;
+			_written.store(committed, std::memory_order_release);
+		}
+
+		Lock.lock();
+		_done.notify_all();
+		if (stop) {
+			break;
+		}
+		if (!_stop && (_flushWaiters == 0 || _committed.load(std::memory_order_acquire) == _written.load(std::memory_order_relaxed))) {
+			_wake.wait_for(Lock, std::chrono::milliseconds(OCM_TRACE_FLUSH_MS));
+		}
+	}
+}
+
+OCMTraceWriter *OCMTraceWriter::attach(FILE *f, size_t capacity, int format)
+{
+	std::lock_guard<std::mutex> Lock(traceRegistryMutex());
+	OCMTraceWriter *&pWriter = traceRegistry()[f];
+	if (pWriter == NULL) {
+		pWriter = new OCMTraceWriter(f, capacity, format);
+		traceRegistryGeneration().fetch_add(1, std::memory_order_release);
+	}
+	return pWriter;
+}
+
+void OCMTraceWriter::detach(FILE *f)
+{
+	OCMTraceWriter *pWriter = NULL;
+	{
+		std::lock_guard<std::mutex> Lock(traceRegistryMutex());
+		std::map<FILE*, OCMTraceWriter*>::iterator it = traceRegistry().find(f);
+		if (it != traceRegistry().end()) {
+			pWriter = it->second;
+			traceRegistry().erase(it);
+			traceRegistryGeneration().fetch_add(1, std::memory_order_release);
+		}
+	}
+	delete pWriter;
+}
+
+// The transfer path looks up the same few files for every record, so each thread keeps its last lookups and
+// only takes the registry lock after a writer was attached or detached
+OCMTraceWriter *OCMTraceWriter::find(FILE *f)
+{
+	static thread_local OCMTraceLookup_t Cache[OCM_TRACE_FINDCACHE];
+	static thread_local unsigned int next = 0;
+
+	unsigned int generation = traceRegistryGeneration().load(std::memory_order_acquire);
+	for (int i = 0; i < OCM_TRACE_FINDCACHE; ++i) {
+		if (Cache[i].Generation == generation && Cache[i].File == f) {
+			return Cache[i].pWriter;
+		}
+	}
+
+	std::lock_guard<std::mutex> Lock(traceRegistryMutex());
+	std::map<FILE*, OCMTraceWriter*>::const_iterator it = traceRegistry().find(f);
+	OCMTraceWriter *pWriter = it != traceRegistry().end() ? it->second : NULL;
+	OCMTraceLookup_t &Entry = Cache[next++ % OCM_TRACE_FINDCACHE];
+	Entry.File			= f;
+	Entry.pWriter		= pWriter;
+	Entry.Generation	= traceRegistryGeneration().load(std::memory_order_relaxed);
+	return pWriter;
+}
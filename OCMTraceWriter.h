@@ -0,0 +1,109 @@
+//
+// Asynchronous writer for the SPI trace files (-log, -logbin)
+//
+// The transfer path only copies its records into a ring buffer in memory; a background thread writes the
+// buffer to the file in large blocks. Appending does not take a lock and never waits for the disk. The
+// ring has a fixed capacity: if the writer thread falls behind and a record does not fit, the record is
+// dropped and counted instead of blocking the scan. The byte stream of the file is unchanged, so existing
+// tools can read it as before.
+//
+// Records appended from several threads are committed in the order they were reserved. A record is never
+// split: either all of it is written or none of it.
+//
+// The writers are registered per FILE handle, so the code writing a trace only needs the handle:
+//
+//   OCMTraceWriter::attach(f, 4*1024*1024);		// Start the writer thread
+//   OCMTraceWriter::find(f)->append(...);			// On the transfer path
+//   OCMTraceWriter::detach(f);						// Flush and stop before closing f
+//
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define OCM_TRACE_DEFAULT_CAPACITY	(4*1024*1024)	// Default ring buffer size in bytes
+#define OCM_TRACE_FLUSH_MS			200				// Maximum time a record stays in memory
+
+// Content of a trace file (tells the code writing to a FILE handle what to write)
+#define OCM_TRACE_RAW				0				// Text or bytes as appended (-log, -logbin)
+#define OCM_TRACE_EVENTS			1				// OCMTransferEvent_t records (-logtrace, see OCMTransferTrace.h)
+
+// Part of a record (records are gathered from several buffers without copying them first)
+typedef struct {
+	const void		*pData;
+	size_t			Length;
+} OCMTraceChunk_t;
+
+// Counters of a writer
+typedef struct {
+	unsigned long long	Records;		// Records appended
+	unsigned long long	Bytes;			// Bytes appended
+	unsigned long long	DroppedRecords;	// Records dropped because the ring was full
+	unsigned long long	DroppedBytes;
+	unsigned long long	Blocks;			// Block writes to the file
+	size_t				MaxFill;		// Highest fill level of the ring in bytes
+	size_t				Capacity;		// Size of the ring in bytes
+} OCMTraceStats_t;
+
+class OCMTraceWriter
+{
+public:
+	// capacity is rounded up to a power of two. format is one of OCM_TRACE_...
+	OCMTraceWriter(FILE *f, size_t capacity, int format);
+
+	// Writes what is left in the ring and stops the writer thread. Does not close the file.
+	~OCMTraceWriter();
+
+	// Append a record consisting of nChunks parts. Returns false if the record was dropped.
+	bool append(const OCMTraceChunk_t *pChunks, size_t nChunks);
+
+	// Append a single buffer
+	bool append(const void *pData, size_t length);
+
+	// Append formatted text (like vfprintf)
+	bool appendv(const char *format, va_list args);
+
+	// Wait until all records appended so far are written to the file
+	void flush();
+
+	OCMTraceStats_t getStats();
+
+	int getFormat() const { return _format; }
+
+	// Start a writer for f. Returns the existing writer if f already has one.
+	static OCMTraceWriter *attach(FILE *f, size_t capacity = OCM_TRACE_DEFAULT_CAPACITY, int format = OCM_TRACE_RAW);
+
+	// Stop the writer of f (if any) after writing all its records. Call before closing f.
+	static void detach(FILE *f);
+
+	// Writer of f, NULL if f has none. Lock-free unless a writer was attached or detached since the calling
+	// thread last looked up f.
+	static OCMTraceWriter *find(FILE *f);
+
+private:
+	void threadProc();
+
+	FILE							*_file;
+	int								_format;
+	std::vector<char>				_ring;
+	size_t							_mask;			// _ring.size() - 1
+	std::atomic<unsigned long long>	_reserved;		// End of the space reserved by appending threads
+	std::atomic<unsigned long long>	_committed;		// End of the records completely copied into the ring
+	std::atomic<unsigned long long>	_written;		// End of the data written to the file
+	std::atomic<unsigned long long>	_records;
+	std::atomic<unsigned long long>	_droppedRecords;
+	std::atomic<unsigned long long>	_droppedBytes;
+	std::atomic<size_t>				_maxFill;
+	std::atomic<unsigned long long>	_blocks;
+	bool							_stop;
+	int								_flushWaiters;	// Threads waiting in flush()
+	std::mutex						_mutex;			// Protects _stop and _flushWaiters
+	std::condition_variable			_wake;			// Writer thread: data to write or stop
+	std::condition_variable			_done;			// flush(): data written
+	std::thread						_thread;
+};
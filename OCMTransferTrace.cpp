@@ -0,0 +1,133 @@
+#include "stdafx.h"
+#include <string.h>
+#include "CCRC32.h"
+#include "OCM3Opcodes.h"
+#include "OCMTraceWriter.h"
+#include "OCMTransferTrace.h"
+
+bool OCMTransferTrace::open(FILE *f, size_t capacity)
+{
+	OCMTransferTraceHeader_t Header;
+	Header.MAGIC		= OCM_TRANSFERTRACE_MAGIC;
+	Header.VERSION		= OCM_TRANSFERTRACE_VERSION;
+	Header.EVENTSIZE	= sizeof(OCMTransferEvent_t);
+	if (f == NULL || fwrite(&Header, sizeof(Header), 1, f) != 1) {
+		return false;
+	}
+	fflush(f);
+	return OCMTraceWriter::attach(f, capacity, OCM_TRACE_EVENTS) != NULL;
+}
+
+bool OCMTransferTrace::isTrace(FILE *f)
+{
+	OCMTraceWriter *pWriter = OCMTraceWriter::find(f);
+	return pWriter != NULL && pWriter->getFormat() == OCM_TRACE_EVENTS;
+}
+
+bool OCMTransferTrace::record(FILE *f, unsigned int tickMs, int spiResult, const char *pTx, const char *pRx, size_t length, int nCRC1Error, int nCRC2Error, int nRetransmit)
+{
+	OCMTraceWriter *pWriter = OCMTraceWriter::find(f);
+	if (pWriter == NULL || pWriter->getFormat() != OCM_TRACE_EVENTS) {
+		return false;
+	}
+
+	OCMTransferEvent_t Event;
+	memset(&Event, 0, sizeof(Event));
+	Event.TickMs		= tickMs;
+	Event.Length		= (unsigned int)length;
+	Event.SpiResult		= spiResult;
+	Event.nCRC1Error	= nCRC1Error;
+	Event.nCRC2Error	= nCRC2Error;
+	Event.nRetransmit	= nRetransmit;
+	if (length >= sizeof(Event.Tx)) {
+		memcpy(&Event.Tx, pTx, sizeof(Event.Tx));
+		Event.Flags |= OCM_TRANSFERTRACE_TX;
+	}
+	if (length >= sizeof(Event.Rx)) {
+		memcpy(&Event.Rx, pRx, sizeof(Event.Rx));
+		Event.Flags |= OCM_TRANSFERTRACE_RX;
+		if (Event.Rx.LENGTH >= 4 && Event.Rx.LENGTH <= length) {
+			memcpy(&Event.RxCRC2, pRx + Event.Rx.LENGTH - 4, sizeof(Event.RxCRC2));
+			Event.Flags |= OCM_TRANSFERTRACE_CRC2;
+		}
+	}
+
+	return pWriter->append(&Event, sizeof(Event));
+}
+
+const char *OCMTransferTrace::getCsvHeader()
+{
+	return "TickCount,Length,nCRC1Error,nCRC2Error,nRetransmit,TxOPCODE,TxSEQNO,TxCRC1,LENGTH,OPCODE1,SEQNO1,COMRES,PPEND,SEQARR_PW,SEQARR_VC,SEQARR_CS,SEQARR_OSNR,SEQARR_CP,HSS,OSS,CRC1,CRC2Value,CRC2,Diolan";
+}
+
+// Same columns as FinisarHROCM_V3::logTx, logRx and LOGRESULT
+int OCMTransferTrace::formatCsv(const OCMTransferEvent_t &Event, const OCMTransferEvent_t *pNext, char *line, size_t size)
+{
+	CCRC32 crc;
+	int n = snprintf(line, size, "%u,%d,%d,%d,%d,", Event.TickMs, (int)Event.Length, Event.nCRC1Error, Event.nCRC2Error, Event.nRetransmit);
+
+	if ((Event.Flags & OCM_TRANSFERTRACE_TX) != 0) {
+		const OCM3_cmd_t *p = &Event.Tx;
+		bool CRC1OK = p->CRC1 == crc.FullCRC((const unsigned char*)p, 16) || p->OPCODE == 0;
+		n += snprintf(line + n, size - n, "%s,%u,CRC1=%s,", getOpcodeName(p->OPCODE), p->SEQNO, CRC1OK ? "OK" : "FAIL");
+	}
+	else {
+		n += snprintf(line + n, size - n, "???,???,???,");
+	}
+
+	if ((Event.Flags & OCM_TRANSFERTRACE_RX) != 0) {
+		const OCM3_Response_t *p = &Event.Rx;
+		n += snprintf(line + n, size - n, "%u,%s,%u,%d,%u,%u,%u,%u,%u,%u,%X,%X,", p->LENGTH, getOpcodeName(p->OPCODE), p->SEQNO, p->COMRES, p->PPEND, p->SEQARR[0], p->SEQARR[1], p->SEQARR[2], p->SEQARR[3], p->SEQARR[4], p->HSS, p->OSS);
+
+		bool CRC1OK = p->CRC1 == crc.FullCRC((const unsigned char*)p, 20);
+		n += snprintf(line + n, size - n, "CRC1=%s,", CRC1OK ? "OK" : "FAIL");
+
+		if (CRC1OK && (Event.Flags & OCM_TRANSFERTRACE_CRC2) != 0) {
+			const char *pCRC2 = pNext == NULL ? "???" : pNext->nCRC2Error > Event.nCRC2Error ? "FAIL" : "OK";
+			n += snprintf(line + n, size - n, "%08X,CRC2=%s,", Event.RxCRC2, pCRC2);
+		}
+		else {
+			n += snprintf(line + n, size - n, "???,???,");
+		}
+	}
+	else {
+		n += snprintf(line + n, size - n, "???,???,???,???,???,???,???,???,???,???,???,???,???,???,???,");
+	}
+
+	n += snprintf(line + n, size - n, "%s\n", Event.SpiResult == 0 ? "SPI=OK" : "SPI=ERROR");
+	return n;
+}
+
+const char *OCMTransferTrace::getOpcodeName(unsigned int OPCODE)
+{
+	switch (OPCODE) {
+	case OPCODE_NOP:		return "NOP";
+	case OPCODE_RES:		return "RES";
+	case OPCODE_MID:		return "MID";
+	case OPCODE_CLE:		return "CLE";
+	case OPCODE_TPC:		return "TPC";
+	case OPCODE_FWT:		return "FWT";
+	case OPCODE_FWS:		return "FWS";
+	case OPCODE_FWE:		return "FWE";
+	case OPCODE_GETDEV:		return "GETDEV";
+	case OPCODE_SETMPPW:	return "SETMPPW";
+	case OPCODE_GETMPPW:	return "GETMPPW";
+	case OPCODE_GETMPW:		return "GETMPW";
+	case OPCODE_SETMPVC:	return "SETMPVC";
+	case OPCODE_GETMPVC:	return "GETMPVC";
+	case OPCODE_GETMVC:		return "GETMVC";
+	case OPCODE_SETMPCS:	return "SETMPCS";
+	case OPCODE_GETMPCS:	return "GETMPCS";
+	case OPCODE_GETMCS:		return "GETMCS";
+	case OPCODE_SETMPOSNR:	return "SETMPOSNR";
+	case OPCODE_GETMPOSNR:	return "GETMPOSNR";
+	case OPCODE_GETMOSNR:	return "GETMOSNR";
+	case OPCODE_SETMPCP:	return "SETMPCP";
+	case OPCODE_GETMPCP:	return "GETMPCP";
+	case OPCODE_GETMCP:		return "GETMCP";
+	case OPCODE_ATG:		return "ATG";
+	case OPCODE_ATS:		return "ATS";
+	case OPCODE_ATC:		return "ATC";
+	default:				return "???";
+	}
+}
@@ -0,0 +1,74 @@
+//
+// Structured trace of the SPI transfers (-logtrace, see HROCMQueryV3.cpp)
+//
+// Replaces the CSV log of FinisarHROCM_V3 (logTx/logRx) by fixed-size binary events. An event holds the raw
+// command and response headers and the counters of the driver; nothing is formatted, looked up or checked
+// while the transfer is logged, and the event is queued to the OCMTraceWriter of the file. Formatting,
+// opcode names and the CRC checks are deferred to formatCsv(), which writes the columns of the CSV log
+// (used by HROCMTrace2Csv).
+//
+// CRC2 covers the whole package and is not recalculated for the trace. The CRC2 column is taken from the
+// check of the driver instead (its CRC2 error counter in the following event), which is done for every
+// response read completely. The data of failed transfers is kept by OCMFlightRecorder.
+//
+// File format: OCMTransferTraceHeader_t followed by OCMTransferEvent_t records.
+//
+#pragma once
+
+#include <stdio.h>
+#include "FinisarHROCM_V3.h"
+
+#define OCM_TRANSFERTRACE_MAGIC		0x544D434F		// "OCMT"
+#define OCM_TRANSFERTRACE_VERSION	1
+#define OCM_TRANSFERTRACE_MAXLINE	512				// Buffer size for formatCsv()
+
+// Flags of an event
+#define OCM_TRANSFERTRACE_TX		0x01			// Tx holds a complete command header
+#define OCM_TRANSFERTRACE_RX		0x02			// Rx holds a complete response header
+#define OCM_TRANSFERTRACE_CRC2		0x04			// The transfer contains CRC2 of the response (RxCRC2 is valid)
+
+#pragma pack(push,1)
+typedef struct {
+	unsigned int		MAGIC;						// OCM_TRANSFERTRACE_MAGIC
+	unsigned short		VERSION;					// OCM_TRANSFERTRACE_VERSION
+	unsigned short		EVENTSIZE;					// sizeof(OCMTransferEvent_t)
+} OCMTransferTraceHeader_t;
+
+typedef struct {
+	unsigned int		TickMs;						// System tick count in ms before the transfer
+	unsigned int		Length;						// Transfer size
+	int					SpiResult;					// SPID_Error_t of the transfer
+	int					nCRC1Error;					// Counters of the driver before the transfer
+	int					nCRC2Error;
+	int					nRetransmit;
+	unsigned int		Flags;						// OCM_TRANSFERTRACE_...
+	unsigned int		RxCRC2;						// CRC2 field of the response
+	OCM3_cmd_t			Tx;							// Command header as sent
+	OCM3_Response_t		Rx;							// Response header as received
+} OCMTransferEvent_t;
+#pragma pack(pop)
+
+class OCMTransferTrace
+{
+public:
+	// Write the file header and attach a trace writer (OCM_TRACE_EVENTS) to a file opened with "wb"
+	static bool open(FILE *f, size_t capacity);
+
+	// true if f has been opened with open()
+	static bool isTrace(FILE *f);
+
+	// Queue the event of a transfer. Returns false if f is not a transfer trace or the event was dropped.
+	static bool record(FILE *f, unsigned int tickMs, int spiResult, const char *pTx, const char *pRx, size_t length, int nCRC1Error, int nCRC2Error, int nRetransmit);
+
+	// CSV columns (same as the log of FinisarHROCM_V3), without line end
+	static const char *getCsvHeader();
+
+	// Format an event as CSV line including the line end. pNext is the following event of the trace (NULL
+	// for the last one) and gives the CRC2 check of the driver. line must hold OCM_TRANSFERTRACE_MAXLINE
+	// characters. Returns the length of the line.
+	static int formatCsv(const OCMTransferEvent_t &Event, const OCMTransferEvent_t *pNext, char *line, size_t size);
+
+	// Name of an opcode ("???" if unknown). The only opcode name table, also used by FinisarHROCM_V3 and
+	// OCMLogAnalyzer.
+	static const char *getOpcodeName(unsigned int OPCODE);
+};
@@ -0,0 +1,602 @@
+#include "stdafx.h"
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include "CCRC32.h"
+#include "OCM3Opcodes.h"
+#include "SPIAdapterEmulator.h"
+#include "OCMDriverStats.h"
+
+#define SPIEMULATOR_FSF			1913125000		// First slice frequency (FSCALE units: 191.3125 THz)
+#define SPIEMULATOR_SLW			3125			// Slice width (FSCALE units: 312.5 MHz)
+#define SPIEMULATOR_SMAX		15440
+#define SPIEMULATOR_GRID_GHZ	191350.0		// First carrier of the synthetic spectrum
+#define SPIEMULATOR_SPACING_GHZ	50.0
+#define SPIEMULATOR_FWHM_GHZ	32.0
+#define SPIEMULATOR_CARRIER_DBM	-5.0
+#define SPIEMULATOR_ASE_DBM		-62.0			// Per slice
+#define SPIEMULATOR_NOISE_DB	0.05			// Standard deviation of the scan noise
+#define SPIEMULATOR_OSNR_GHZ	12.5			// Noise reference bandwidth of the OSNR (0.1 nm)
+
+// Microseconds of the monotonic clock of the driver statistics
+static long long emulatorNowUs()
+{
+	return (long long)OCMDriverStats::nowUs();
+}
+
+// Settings the module keeps over a reset: the measurement plans and the attributes. They are shared by all
+// emulators of the process, so that a plan set by one command (e.g. itu) is scanned by the next, as on the module.
+typedef struct {
+	bool								Valid;
+	std::vector<OCM3_MPPWRecord_t>		MPPW;
+	std::vector<OCM3_MPOSNRRecord_t>	MPOSNR;
+	unsigned int						MPSEQNO;
+	unsigned short						Average;
+	unsigned short						BWXB;
+} SPIEmulatorMemory_t;
+
+static std::mutex emulatorMutex;
+static SPIEmulatorMemory_t emulatorMemory = { false };
+
+// Copy a string into a fixed size, zero padded field of RDATA
+static void emulatorSetText(char *pField, size_t size, const char *Text)
+{
+	memset(pField, 0, size);
+	strncpy(pField, Text, size - 1);
+}
+
+SPIEmulatorSettings_t SPIAdapterEmulator::defaultSettings()
+{
+	SPIEmulatorSettings_t Settings;
+	Settings.ScanMs		= 200;
+	Settings.OsnrMs		= 300;
+	Settings.CommandUs	= 500;
+	Settings.LatencyUs	= 100;
+	Settings.SpiClock	= SPID_DEFAULT_CLOCKRATE;
+	Settings.Ports		= 1;
+	Settings.Channels	= 96;
+	Settings.Seed		= 1;
+	return Settings;
+}
+
+SPIAdapterEmulator::SPIAdapterEmulator(const SPIEmulatorSettings_t &Settings)
+{
+	_settings = Settings;
+	if (_settings.Ports == 0) {
+		_settings.Ports = 1;
+	}
+	_random.seed(_settings.Seed);
+
+	memset(&_dev, 0, sizeof(_dev));
+	_dev.HWR	= 0x1040000;
+	_dev.FWR	= 0x1040100;
+	emulatorSetText(_dev.SNO, sizeof(_dev.SNO), "EM000001");
+	emulatorSetText(_dev.MFD, sizeof(_dev.MFD), "2020-01-01");
+	emulatorSetText(_dev.LBL, sizeof(_dev.LBL), "FOCM01FXC1AN-CN");
+	emulatorSetText(_dev.MID, sizeof(_dev.MID), "OCM Emulator");
+	_dev.Pmax	= (unsigned short)_settings.Ports;
+	_dev.Smax	= SPIEMULATOR_SMAX;
+	_dev.SLW	= SPIEMULATOR_SLW;
+	_dev.Nmax	= 17000;
+	_dev.FSF	= SPIEMULATOR_FSF;
+	_dev.BWXB	= 'T';
+	_dev.CAP	= 31;
+
+	_seqno		= 0;
+	_opcode		= 0;
+	_comres		= 0;
+	memset(_seqarr, 0, sizeof(_seqarr));
+	_pending	= false;
+	_pendingUs	= 0;
+	_scanning	= false;
+	_powerUs	= 0;
+	_osnrUs		= 0;
+	_scanSeqNum	= 0;
+	_scanNumber	= 0;
+	_scanMPSEQNO = 0;
+	_mpseqno	= 0;
+	_average	= 1;
+	_bwxb		= (unsigned short)_dev.BWXB;
+	_firmwareBytes = 0;
+	_transfers	= 0;
+	_commands	= 0;
+	_scans		= 0;
+	loadMemory();
+
+	makeSpectrum();
+	buildResponse();
+}
+
+SPID_Error_t SPIAdapterEmulator::Open()
+{
+	return SPID_OK;
+}
+
+void SPIAdapterEmulator::Close()
+{
+}
+
+SPID_Error_t SPIAdapterEmulator::GetID(std::string &ID)
+{
+	ID = "emulator";
+	return SPID_OK;
+}
+
+SPID_Error_t SPIAdapterEmulator::SetID(std::string ID)
+{
+	return SPID_FAILED;
+}
+
+SPID_Error_t SPIAdapterEmulator::GetFW(std::string &rev)
+{
+	rev = "emulator";
+	return SPID_OK;
+}
+
+// MISO is the response register before the transfer; the command on MOSI takes effect afterwards
+SPID_Error_t SPIAdapterEmulator::Transfer(char *writeBuffer, char *readBuffer, size_t length)
+{
+	long long startUs = emulatorNowUs();
+	_transfers++;
+	update(startUs);
+
+	size_t n = length < _response.size() ? length : _response.size();
+	memcpy(readBuffer, &_response[0], n);
+	memset(readBuffer + n, 0, length - n);
+
+	accept(writeBuffer, length, startUs);
+
+	long long bitsUs = _settings.SpiClock > 0 ? (long long)(length * 8 * 1e6 / _settings.SpiClock) : 0;
+	wait(startUs + _settings.LatencyUs + bitsUs);
+	return SPID_OK;
+}
+
+SPID_Error_t SPIAdapterEmulator::Transfer(std::vector<char> &Tx, std::vector<char> &Rx)
+{
+	Rx.resize(Tx.size());
+	if (Tx.empty()) {
+		return SPID_OK;
+	}
+	return Transfer(&Tx[0], &Rx[0], Tx.size());
+}
+
+// Complete the tasks and the command that are due, in the order of their completion times
+void SPIAdapterEmulator::update(long long nowUs)
+{
+	for (;;) {
+		long long nextUs = nowUs + 1;
+		int next = -1;
+		if (_powerUs != 0 && _powerUs < nextUs) {
+			nextUs = _powerUs;
+			next = 0;
+		}
+		if (_osnrUs != 0 && _osnrUs < nextUs) {
+			nextUs = _osnrUs;
+			next = 1;
+		}
+		if (_pending && _pendingUs < nextUs) {
+			nextUs = _pendingUs;
+			next = 2;
+		}
+
+		if (next == 0) {
+			_powerUs = 0;
+			completePower();
+		}
+		else if (next == 1) {
+			_osnrUs = 0;
+			completeOSNR();
+		}
+		else if (next == 2) {
+			_pending = false;
+			execute(_opcode, _command.empty() ? NULL : &_command[0], _command.size(), _pendingUs);
+		}
+		else {
+			break;
+		}
+
+		if (_scanning && _powerUs == 0 && _osnrUs == 0) {
+			_scanning = false;
+			_scans++;
+		}
+	}
+}
+
+// Take a command from MOSI. Polls and packages with a wrong SPIMAGIC or CRC are ignored.
+void SPIAdapterEmulator::accept(const char *pMosi, size_t length, long long nowUs)
+{
+	OCM3_cmd_t Cmd;
+	if (length < sizeof(Cmd)) {
+		return;
+	}
+	memcpy(&Cmd, pMosi, sizeof(Cmd));
+	if (Cmd.SPIMAGIC != OCM_SPIMAGIC_V3 || Cmd.LENGTH > length) {
+		return;
+	}
+
+	CCRC32 crc;
+	if (crc.FullCRC((const unsigned char *)pMosi, 16) != Cmd.CRC1) {
+		return;
+	}
+	size_t size = 0;
+	if (Cmd.LENGTH > sizeof(Cmd)) {
+		unsigned int CRC2;
+		if (Cmd.LENGTH < sizeof(Cmd) + sizeof(CRC2)) {
+			return;
+		}
+		memcpy(&CRC2, pMosi + Cmd.LENGTH - sizeof(CRC2), sizeof(CRC2));
+		if (crc.FullCRC((const unsigned char *)pMosi, Cmd.LENGTH - sizeof(CRC2)) != CRC2) {
+			return;
+		}
+		size = Cmd.LENGTH - sizeof(Cmd) - sizeof(CRC2);
+	}
+
+	_command.assign(pMosi + sizeof(Cmd), pMosi + sizeof(Cmd) + size);
+	_pending	= true;
+	_pendingUs	= nowUs + _settings.CommandUs;
+	_commands++;
+
+	_seqno		= Cmd.SEQNO;
+	_opcode		= Cmd.OPCODE;
+	setResponse(-1, NULL, 0);
+}
+
+void SPIAdapterEmulator::execute(unsigned int OPCODE, const char *pData, size_t size, long long nowUs)
+{
+	unsigned short ATTR = 0;
+	unsigned short VAL = 0;
+	if (size >= sizeof(ATTR)) {
+		memcpy(&ATTR, pData, sizeof(ATTR));
+	}
+	if (size >= sizeof(ATTR) + sizeof(VAL)) {
+		memcpy(&VAL, pData + sizeof(ATTR), sizeof(VAL));
+	}
+
+	switch (OPCODE) {
+	case OPCODE_NOP:
+	case OPCODE_CLE:
+	case OPCODE_MID:
+	case OPCODE_FWS:
+	case OPCODE_FWE:
+		setResponse(0, NULL, 0);
+		break;
+
+	case OPCODE_FWT:
+		if (size < sizeof(unsigned int)) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		_firmwareBytes += size - sizeof(unsigned int); // Offset + data
+		setResponse(0, NULL, 0);
+		break;
+
+	case OPCODE_RES:
+		_scanning	= false;
+		_powerUs	= 0;
+		_osnrUs		= 0;
+		memset(_seqarr, 0, sizeof(_seqarr));
+		_powerResult.clear();
+		_osnrResult.clear();
+		setResponse(0, NULL, 0);
+		break;
+
+	case OPCODE_TPC: {
+		OCM3_TPCProcessMask_t TaskVector = 0;
+		if (size < sizeof(TaskVector)) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		memcpy(&TaskVector, pData, sizeof(TaskVector));
+		if (_scanning) {
+			setResponse(2, NULL, 0);
+			break;
+		}
+		bool power = (TaskVector & OCM3_TASK_PW_MASK) != 0;
+		bool osnr = (TaskVector & OCM3_TASK_OSNR_MASK) != 0;
+		if ((!power && !osnr) || (power && _mppw.empty()) || (osnr && _mposnr.empty())) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		_scanning		= true;
+		_scanSeqNum		= _seqno;
+		_scanNumber++;
+		_scanMPSEQNO	= _mpseqno;
+		_scanMppw		= _mppw;
+		_scanMposnr		= _mposnr;
+		_powerUs		= power ? nowUs + (long long)(_settings.ScanMs * 1000) : 0;
+		_osnrUs			= osnr ? nowUs + (long long)((_settings.ScanMs + _settings.OsnrMs) * 1000) : 0;
+		setResponse(0, NULL, 0);
+		break;
+	}
+
+	case OPCODE_GETDEV:
+		setResponse(0, &_dev, sizeof(_dev));
+		break;
+
+	case OPCODE_SETMPPW: {
+		size_t n = size / sizeof(OCM3_MPPWRecord_t);
+		bool valid = n > 0 && n * sizeof(OCM3_MPPWRecord_t) == size;
+		std::vector<OCM3_MPPWRecord_t> Plan(n);
+		if (valid) {
+			memcpy(&Plan[0], pData, size);
+		}
+		for (size_t i = 0; i < n && valid; ++i) {
+			valid = Plan[i].PORTNO >= 1 && Plan[i].PORTNO <= _dev.Pmax && Plan[i].SLICESTART >= 1 &&
+				Plan[i].SLICESTART <= Plan[i].SLICEEND && Plan[i].SLICEEND <= _dev.Smax;
+		}
+		if (valid) {
+			_mppw.swap(Plan);
+			_mpseqno++;
+			storeMemory();
+		}
+		setResponse(valid ? 0 : 1, NULL, 0);
+		break;
+	}
+
+	case OPCODE_SETMPOSNR: {
+		size_t n = size / sizeof(OCM3_MPOSNRRecord_t);
+		bool valid = n > 0 && n * sizeof(OCM3_MPOSNRRecord_t) == size;
+		std::vector<OCM3_MPOSNRRecord_t> Plan(n);
+		if (valid) {
+			memcpy(&Plan[0], pData, size);
+		}
+		for (size_t i = 0; i < n && valid; ++i) {
+			valid = Plan[i].PORTNO >= 1 && Plan[i].PORTNO <= _dev.Pmax && Plan[i].CENTERSTART >= 1 &&
+				Plan[i].CENTERSTART <= Plan[i].CENTERSTOP && Plan[i].CENTERSTOP <= _dev.Smax;
+		}
+		if (valid) {
+			_mposnr.swap(Plan);
+			_mpseqno++;
+			storeMemory();
+		}
+		setResponse(valid ? 0 : 1, NULL, 0);
+		break;
+	}
+
+	case OPCODE_GETMPPW:
+		setResponse(0, _mppw.empty() ? NULL : &_mppw[0], _mppw.size() * sizeof(OCM3_MPPWRecord_t));
+		break;
+
+	case OPCODE_GETMPW:
+		if (_powerResult.empty()) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		setResponse(0, &_powerResult[0], _powerResult.size());
+		break;
+
+	case OPCODE_GETMOSNR:
+		if (_osnrResult.empty()) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		setResponse(0, &_osnrResult[0], _osnrResult.size());
+		break;
+
+	case OPCODE_ATS:
+		if (size < sizeof(ATTR) + sizeof(VAL) || (ATTR != 0 && ATTR != 2) || (ATTR == 0 && VAL == 0)) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		if (ATTR == 0) {
+			_average = VAL;
+		}
+		else {
+			_bwxb = VAL;
+		}
+		storeMemory();
+		setResponse(0, NULL, 0);
+		break;
+
+	case OPCODE_ATG:
+		if (size < sizeof(ATTR) || (ATTR != 1 && ATTR != 3)) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		VAL = ATTR == 1 ? _average : _bwxb;
+		setResponse(0, &VAL, sizeof(VAL));
+		break;
+
+	case OPCODE_ATC:
+		if (size < sizeof(ATTR) || (ATTR != 0 && ATTR != 2)) {
+			setResponse(1, NULL, 0);
+			break;
+		}
+		if (ATTR == 0) {
+			_average = 1;
+		}
+		else {
+			_bwxb = (unsigned short)_dev.BWXB;
+		}
+		storeMemory();
+		setResponse(0, NULL, 0);
+		break;
+
+	default:
+		setResponse(1, NULL, 0); // Not supported by the emulator
+		break;
+	}
+}
+
+void SPIAdapterEmulator::setResponse(int COMRES, const void *pRData, size_t size)
+{
+	_comres = COMRES;
+	_rdata.assign((const char*)pRData, (const char*)pRData + (pRData != NULL ? size : 0));
+	buildResponse();
+}
+
+// Header with CRC1, RDATA and CRC2 of the response register
+void SPIAdapterEmulator::buildResponse()
+{
+	OCM3_Response_t Head;
+	memset(&Head, 0, sizeof(Head));
+	Head.SPIMAGIC	= OCM_SPIMAGIC_V3;
+	Head.LENGTH		= (unsigned int)(sizeof(Head) + _rdata.size() + 4);
+	Head.SEQNO		= _seqno;
+	Head.OPCODE		= _opcode;
+	Head.COMRES		= _comres;
+
+	CCRC32 crc;
+	Head.CRC1		= crc.FullCRC((const unsigned char *)&Head, 20);
+	Head.OSS		= 1;
+	Head.HSS		= 0;
+	Head.LSS		= 0;
+	Head.CSS		= 454;		// Module temperature 45.4 C
+	Head.ISS		= 468;		// Optics temperature 46.8 C
+	Head.PPEND		= 0;
+	Head.NSEQARR	= SPIEMULATOR_NSEQARR;
+	memcpy(Head.SEQARR, _seqarr, sizeof(_seqarr));
+
+	_response.resize(Head.LENGTH);
+	memcpy(&_response[0], &Head, sizeof(Head));
+	if (!_rdata.empty()) {
+		memcpy(&_response[sizeof(Head)], &_rdata[0], _rdata.size());
+	}
+	unsigned int CRC2 = crc.FullCRC((const unsigned char *)&_response[0], Head.LENGTH - 4);
+	memcpy(&_response[Head.LENGTH - 4], &CRC2, sizeof(CRC2));
+}
+
+// Power task: one GETMPW record per record of the plan
+void SPIAdapterEmulator::completePower()
+{
+	std::normal_distribution<double> Noise(0, SPIEMULATOR_NOISE_DB);
+
+	OCM3_GMPWHead_t Head;
+	Head.MPSEQNO	= _scanMPSEQNO;
+	Head.SCAN		= _scanNumber;
+	std::vector<OCM3_GMPWRecord_t> Records(_scanMppw.size());
+	for (size_t i = 0; i < _scanMppw.size(); ++i) {
+		double dBm = 10 * log10(getPower(_scanMppw[i].PORTNO, _scanMppw[i].SLICESTART, _scanMppw[i].SLICEEND)) + Noise(_random);
+		Records[i].PORTNO		= _scanMppw[i].PORTNO;
+		Records[i].SLICESTART	= _scanMppw[i].SLICESTART;
+		Records[i].SLICEEND		= _scanMppw[i].SLICEEND;
+		Records[i].POWER		= (short)round((dBm < OCM3_PMIN_CLIP ? OCM3_PMIN_CLIP : dBm) * OCM3_PSCALE);
+	}
+
+	_powerResult.resize(sizeof(Head) + Records.size() * sizeof(OCM3_GMPWRecord_t));
+	memcpy(&_powerResult[0], &Head, sizeof(Head));
+	if (!Records.empty()) {
+		memcpy(&_powerResult[sizeof(Head)], &Records[0], Records.size() * sizeof(OCM3_GMPWRecord_t));
+	}
+
+	_seqarr[OCM3_PROCESS_PW] = _scanSeqNum;
+	buildResponse();
+}
+
+// OSNR task: signal power over the ASE in 0.1 nm for each record of the plan
+void SPIAdapterEmulator::completeOSNR()
+{
+	std::normal_distribution<double> Noise(0, SPIEMULATOR_NOISE_DB);
+	double referenceSlices = SPIEMULATOR_OSNR_GHZ / 1000 * OCM3_FSCALE / _dev.SLW;
+
+	OCM3_GMOSNRHead_t Head;
+	Head.MPSEQNO	= _scanMPSEQNO;
+	Head.SCAN		= _scanNumber;
+	std::vector<OCM3_GMOSNRRecord_t> Records(_scanMposnr.size());
+	for (size_t i = 0; i < _scanMposnr.size(); ++i) {
+		const OCM3_MPOSNRRecord_t &Plan = _scanMposnr[i];
+		double total = getPower(Plan.PORTNO, Plan.CENTERSTART, Plan.CENTERSTOP);
+		double noise = _noiseMw * (Plan.CENTERSTOP - Plan.CENTERSTART + 1);
+		double signal = total - noise > _noiseMw * 1e-3 ? total - noise : _noiseMw * 1e-3;
+		double osnr = 10 * log10(signal / (_noiseMw * referenceSlices)) + Noise(_random);
+		double dBm = 10 * log10(total) + Noise(_random);
+		int lower = (int)Plan.CENTERSTART - Plan.KEEPOUTLOWER;
+		int upper = (int)Plan.CENTERSTOP + Plan.KEEPOUTUPPER;
+
+		OCM3_GMOSNRRecord_t &Record = Records[i];
+		Record.PORTNO			= Plan.PORTNO;
+		Record.SLICESTART		= Plan.CENTERSTART;
+		Record.SLICEEND			= Plan.CENTERSTOP;
+		Record.OSNR				= (short)round(osnr * OCM3_PSCALE);
+		Record.POWER			= (short)round((dBm < OCM3_PMIN_CLIP ? OCM3_PMIN_CLIP : dBm) * OCM3_PSCALE);
+		Record.NOISETAGLOWER	= (unsigned short)(lower < 1 ? 1 : lower);
+		Record.NOISETAGUPPER	= (unsigned short)(upper > _dev.Smax ? _dev.Smax : upper);
+		Record.BANDWIDTHLOWER	= Plan.CENTERSTART;
+		Record.BANDWIDTHUPPER	= Plan.CENTERSTOP;
+		Record.CENTERFREQUENCY	= (unsigned short)((Plan.CENTERSTART + Plan.CENTERSTOP) / 2);
+	}
+
+	_osnrResult.resize(sizeof(Head) + Records.size() * sizeof(OCM3_GMOSNRRecord_t));
+	memcpy(&_osnrResult[0], &Head, sizeof(Head));
+	if (!Records.empty()) {
+		memcpy(&_osnrResult[sizeof(Head)], &Records[0], Records.size() * sizeof(OCM3_GMOSNRRecord_t));
+	}
+
+	_seqarr[OCM3_PROCESS_OSNR] = _scanSeqNum;
+	buildResponse();
+}
+
+// Gaussian carriers on the ASE floor; each port 3 dB below the previous one
+void SPIAdapterEmulator::makeSpectrum()
+{
+	const double sliceGHz = _dev.SLW / OCM3_FSCALE * 1000;
+	const double firstGHz = _dev.FSF / OCM3_FSCALE * 1000;
+	const double sigmaGHz = SPIEMULATOR_FWHM_GHZ / (2 * sqrt(2 * log(2.0)));
+	const double pi = 3.14159265358979323846;
+
+	_noiseMw = pow(10, SPIEMULATOR_ASE_DBM / 10);
+	_spectrum.assign(_settings.Ports, std::vector<double>(_dev.Smax + 1, 0));
+
+	std::vector<double> Slices(_dev.Smax + 1);
+	for (unsigned int p = 0; p < _settings.Ports; ++p) {
+		Slices.assign(_dev.Smax + 1, _noiseMw);
+		Slices[0] = 0;
+		double carrierMw = pow(10, (SPIEMULATOR_CARRIER_DBM - 3.0 * p) / 10);
+		for (unsigned int c = 0; c < _settings.Channels; ++c) {
+			double centerGHz = SPIEMULATOR_GRID_GHZ + c * SPIEMULATOR_SPACING_GHZ;
+			int first = (int)floor((centerGHz - 4 * sigmaGHz - firstGHz) / sliceGHz) + 1;
+			int last = (int)ceil((centerGHz + 4 * sigmaGHz - firstGHz) / sliceGHz) + 1;
+			for (int s = first < 1 ? 1 : first; s <= last && s <= (int)_dev.Smax; ++s) {
+				double x = (firstGHz + (s - 1) * sliceGHz - centerGHz) / sigmaGHz;
+				Slices[s] += carrierMw * sliceGHz / (sigmaGHz * sqrt(2 * pi)) * exp(-0.5 * x * x);
+			}
+		}
+		for (size_t s = 1; s < Slices.size(); ++s) {
+			_spectrum[p][s] = _spectrum[p][s - 1] + Slices[s];
+		}
+	}
+}
+
+// Power in mW of the slices SLICESTART..SLICEEND (checked when the plan was set)
+double SPIAdapterEmulator::getPower(unsigned short PORTNO, unsigned short SLICESTART, unsigned short SLICEEND) const
+{
+	const std::vector<double> &Sums = _spectrum[PORTNO - 1];
+	return Sums[SLICEEND] - Sums[SLICESTART - 1];
+}
+
+// Sleeps are coarse (1 ms and more on Windows), so the last millisecond is spent yielding
+void SPIAdapterEmulator::wait(long long untilUs) const
+{
+	long long remainingUs = untilUs - emulatorNowUs();
+	if (remainingUs > 2000) {
+		std::this_thread::sleep_for(std::chrono::microseconds(remainingUs - 1000));
+	}
+	while (emulatorNowUs() < untilUs) {
+		std::this_thread::yield();
+	}
+}
+
+void SPIAdapterEmulator::loadMemory()
+{
+	std::lock_guard<std::mutex> Lock(emulatorMutex);
+	if (emulatorMemory.Valid) {
+		_mppw		= emulatorMemory.MPPW;
+		_mposnr		= emulatorMemory.MPOSNR;
+		_mpseqno	= emulatorMemory.MPSEQNO;
+		_average	= emulatorMemory.Average;
+		_bwxb		= emulatorMemory.BWXB;
+	}
+}
+
+void SPIAdapterEmulator::storeMemory()
+{
+	std::lock_guard<std::mutex> Lock(emulatorMutex);
+	emulatorMemory.Valid	= true;
+	emulatorMemory.MPPW		= _mppw;
+	emulatorMemory.MPOSNR	= _mposnr;
+	emulatorMemory.MPSEQNO	= _mpseqno;
+	emulatorMemory.Average	= _average;
+	emulatorMemory.BWXB		= _bwxb;
+}
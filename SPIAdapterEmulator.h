@@ -0,0 +1,124 @@
+//
+// SPI adapter emulating an HR-OCM module (V3 SPI protocol) in the process
+//
+// Lets FinisarHROCM_V3 and the tools built on it run without an SPI adapter and a module, e.g. to benchmark
+// the host software. The emulator implements the protocol as the driver sees it:
+//
+// - Every transfer is full duplex: MISO is the response register as it was before the transfer, MOSI is
+//   either a command (SPIMAGIC V3, valid CRC1 and, if it has data, CRC2) or a poll (all zero). Invalid
+//   commands are ignored, so the driver retransmits them.
+// - A command sets SEQNO and OPCODE of the response register with COMRES -1 (pending). After CommandUs the
+//   command is executed and COMRES is 0 (OK), 1 (rejected) or 2 (busy: TPC while a scan is running).
+// - TPC starts a scan of the tasks in its task vector with the measurement plans set by SETMPPW and
+//   SETMPOSNR. The power task completes after ScanMs, the OSNR task OsnrMs later; on completion the
+//   sequence number of the TPC is written to the task slot in SEQARR and the result replaces the previous
+//   one of GETMPW / GETMOSNR.
+// - GETDEV returns the parameters of a FOCM01 module (15440 slices of 312.5 MHz from 191.3125 THz).
+// - ATS/ATG/ATC keep the averaging and bandwidth mode; MID, CLE, NOP, FWT, FWS and FWE are accepted.
+// - The measurement plans and the attributes are kept like the non-volatile memory of the module: all
+//   emulators of the process share them, so a plan set through one driver instance is used by the next.
+//
+// The spectrum is synthetic: Channels carriers on the 50 GHz grid from 191.35 THz (32 GBd, -5 dBm, 3 dB
+// lower per port) on an ASE floor of -62 dBm per slice, with 0.05 dB of noise per scan and channel.
+//
+// A transfer takes LatencyUs plus the time of the bits at the SPI clock (none with SpiClock 0).
+//
+// Created by createOCMSPIAdapter() with "emulator=1" and optionally scanms, osnrms, commandus, latencyus,
+// spiclk, ports, channels and seed (e.g. "emulator=1;scanms=100;latencyus=300").
+//
+#pragma once
+
+#include <random>
+#include <string>
+#include <vector>
+#include "SPIAdapter.h"
+#include "FinisarHROCM_V3.h"
+
+#define SPIEMULATOR_NSEQARR		5			// Task slots in SEQARR
+
+typedef struct {
+	double			ScanMs;			// Duration of the power task of a scan
+	double			OsnrMs;			// Additional duration of the OSNR task
+	unsigned int	CommandUs;		// Execution time of a command
+	unsigned int	LatencyUs;		// Bus latency per transfer
+	unsigned int	SpiClock;		// Hz (0: transfers take no time)
+	unsigned int	Ports;
+	unsigned int	Channels;		// Carriers in the synthetic spectrum
+	unsigned int	Seed;			// Seed of the scan noise
+} SPIEmulatorSettings_t;
+
+class SPIAdapterEmulator : public SPIAdapter
+{
+public:
+	SPIAdapterEmulator(const SPIEmulatorSettings_t &Settings);
+
+	static SPIEmulatorSettings_t defaultSettings();
+
+	virtual SPID_Error_t Open();
+	virtual void Close();
+	virtual SPID_Error_t GetID(std::string &ID);
+	virtual SPID_Error_t SetID(std::string ID);
+	virtual SPID_Error_t GetFW(std::string &rev);
+	virtual SPID_Error_t Transfer(char *writeBuffer, char *readBuffer, size_t length);
+	virtual SPID_Error_t Transfer(std::vector<char> &Tx, std::vector<char> &Rx);
+
+	// Number of transfers, commands accepted and scans completed
+	size_t getTransfers() const { return _transfers; }
+	size_t getCommands() const { return _commands; }
+	size_t getScans() const { return _scans; }
+
+private:
+	void update(long long nowUs);
+	void accept(const char *pMosi, size_t length, long long nowUs);
+	void execute(unsigned int OPCODE, const char *pData, size_t size, long long nowUs);
+	void setResponse(int COMRES, const void *pRData, size_t size);
+	void buildResponse();
+	void completePower();
+	void completeOSNR();
+	void makeSpectrum();
+	double getPower(unsigned short PORTNO, unsigned short SLICESTART, unsigned short SLICEEND) const;
+	void wait(long long untilUs) const;
+	void loadMemory();
+	void storeMemory();
+
+	SPIEmulatorSettings_t				_settings;
+	OCM3_RDataDEV_t						_dev;
+	std::mt19937						_random;
+	std::vector<std::vector<double> >	_spectrum;		// Per port: power in mW summed over the slices 1..s (index s)
+	double								_noiseMw;		// ASE per slice
+
+	// Response register
+	unsigned int						_seqno;
+	unsigned int						_opcode;
+	int									_comres;
+	std::vector<char>					_rdata;
+	unsigned int						_seqarr[SPIEMULATOR_NSEQARR];
+	std::vector<char>					_response;		// Package sent on MISO (header, RDATA, CRC2)
+
+	// Command being executed
+	bool								_pending;
+	long long							_pendingUs;		// Time the command completes
+	std::vector<char>					_command;		// Data of the command
+
+	// Scan
+	bool								_scanning;
+	long long							_powerUs;		// Time the power / OSNR task completes (0: not part of the scan)
+	long long							_osnrUs;
+	unsigned int						_scanSeqNum;
+	unsigned int						_scanNumber;
+	unsigned int						_scanMPSEQNO;
+	unsigned int						_mpseqno;		// Incremented by each new measurement plan
+	std::vector<OCM3_MPPWRecord_t>		_mppw;
+	std::vector<OCM3_MPOSNRRecord_t>	_mposnr;
+	std::vector<OCM3_MPPWRecord_t>		_scanMppw;		// Plans of the running scan
+	std::vector<OCM3_MPOSNRRecord_t>	_scanMposnr;
+	std::vector<char>					_powerResult;	// RDATA of GETMPW / GETMOSNR
+	std::vector<char>					_osnrResult;
+
+	unsigned short						_average;
+	unsigned short						_bwxb;
+	size_t								_firmwareBytes;
+	size_t								_transfers;
+	size_t								_commands;
+	size_t								_scans;
+};
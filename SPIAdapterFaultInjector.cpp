@@ -0,0 +1,198 @@
+#include "stdafx.h"
+#include <math.h>
+#include <string.h>
+#include "FinisarHROCM_V3.h"
+#include "CCRC32.h"
+#include "OCM3Opcodes.h"
+#include "SPIAdapterFaultInjector.h"
+#include "OCMDriverStats.h"
+
+// Microseconds of the monotonic clock of the driver statistics
+static long long faultNowUs()
+{
+	return (long long)OCMDriverStats::nowUs();
+}
+
+SPIFaultSettings_t SPIAdapterFaultInjector::defaultSettings()
+{
+	SPIFaultSettings_t Settings;
+	Settings.Ber		= 0;
+	Settings.Burst		= 1;
+	Settings.Periodic	= false;
+	Settings.AllOnes	= 0;
+	Settings.Drop		= 0;
+	Settings.Comres		= 0;
+	Settings.ComresMs	= 100;
+	Settings.Seed		= 1;
+	return Settings;
+}
+
+SPIAdapterFaultInjector::SPIAdapterFaultInjector(SPIAdapter *pAdapter, const SPIFaultSettings_t &Settings) : _adapter(pAdapter)
+{
+	_settings = Settings;
+	if (_settings.Burst == 0) {
+		_settings.Burst = 1;
+	}
+	memset(&_stats, 0, sizeof(_stats));
+	_random.seed(_settings.Seed);
+	_bitsToError	= nextErrorDistance();
+	_burstLeft		= 0;
+	_lastSeqNo		= 0;
+	_lastSeqNoValid	= false;
+	_holdComres		= false;
+	_holdUntilUs	= 0;
+}
+
+SPID_Error_t SPIAdapterFaultInjector::Open()
+{
+	return _adapter->Open();
+}
+
+void SPIAdapterFaultInjector::Close()
+{
+	_adapter->Close();
+}
+
+SPID_Error_t SPIAdapterFaultInjector::GetID(std::string &ID)
+{
+	return _adapter->GetID(ID);
+}
+
+SPID_Error_t SPIAdapterFaultInjector::SetID(std::string ID)
+{
+	return _adapter->SetID(ID);
+}
+
+SPID_Error_t SPIAdapterFaultInjector::GetFW(std::string &rev)
+{
+	return _adapter->GetFW(rev);
+}
+
+// Faults of the module (dropped command, delayed COMRES) are injected before the bit errors of the link
+SPID_Error_t SPIAdapterFaultInjector::Transfer(char *writeBuffer, char *readBuffer, size_t length)
+{
+	_stats.Transfers++;
+	if (length == 0) {
+		return _adapter->Transfer(writeBuffer, readBuffer, length);
+	}
+
+	// The driver retransmits from writeBuffer, so the faults go into a copy
+	_mosi.assign(writeBuffer, writeBuffer + length);
+	unsigned int SPIMAGIC = 0;
+	if (length >= sizeof(SPIMAGIC)) {
+		memcpy(&SPIMAGIC, &_mosi[0], sizeof(SPIMAGIC));
+	}
+	if (SPIMAGIC == OCM_SPIMAGIC_V3 && chance(_settings.Drop)) {
+		memset(&_mosi[0], 0, length);
+		_stats.Dropped++;
+	}
+	flipBits(&_mosi[0], length);
+
+	SPID_Error_t Result = _adapter->Transfer(&_mosi[0], readBuffer, length);
+
+	delayComres(readBuffer, length);
+	flipBits(readBuffer, length);
+	if (chance(_settings.AllOnes)) {
+		memset(readBuffer, 0xFF, length);
+		_stats.AllOnes++;
+	}
+	return Result;
+}
+
+SPID_Error_t SPIAdapterFaultInjector::Transfer(std::vector<char> &Tx, std::vector<char> &Rx)
+{
+	Rx.resize(Tx.size());
+	if (Tx.empty()) {
+		return _adapter->Transfer(Tx, Rx);
+	}
+	return Transfer(&Tx[0], &Rx[0], Tx.size());
+}
+
+bool SPIAdapterFaultInjector::chance(double probability)
+{
+	return probability > 0 && std::uniform_real_distribution<double>(0, 1)(_random) < probability;
+}
+
+// Error free bits before the next error
+unsigned long long SPIAdapterFaultInjector::nextErrorDistance()
+{
+	if (_settings.Ber <= 0) {
+		return ~0ULL;
+	}
+	if (_settings.Ber >= 1) {
+		return 0;
+	}
+	if (_settings.Periodic) {
+		return (unsigned long long)floor(1 / _settings.Ber + 0.5) - 1;
+	}
+	return std::geometric_distribution<unsigned long long>(_settings.Ber)(_random);
+}
+
+// Flip the bits of the buffer that fall on an error of the bit stream
+void SPIAdapterFaultInjector::flipBits(char *pBuffer, size_t length)
+{
+	if (_settings.Ber <= 0) {
+		return;
+	}
+	unsigned long long bits = (unsigned long long)length * 8;
+	unsigned long long bit = 0;
+	while (bit < bits) {
+		if (_burstLeft > 0) {
+			pBuffer[bit / 8] ^= (char)(1 << (bit % 8));
+			--_burstLeft;
+			++bit;
+			continue;
+		}
+		if (_bitsToError >= bits - bit) {
+			_bitsToError -= bits - bit;
+			break;
+		}
+		bit += _bitsToError;
+		_bitsToError = nextErrorDistance();
+		_burstLeft = _settings.Burst;
+		_stats.BitErrors++;
+	}
+}
+
+// Keep COMRES pending for ComresMs after the command completed. Decided once per command (new SEQNO).
+void SPIAdapterFaultInjector::delayComres(char *pMiso, size_t length)
+{
+	if (_settings.Comres <= 0 || length < sizeof(OCM3_Response_t)) {
+		return;
+	}
+	OCM3_Response_t Head;
+	memcpy(&Head, pMiso, sizeof(Head));
+	CCRC32 crc;
+	if (Head.SPIMAGIC != OCM_SPIMAGIC_V3 || crc.FullCRC((const unsigned char *)pMiso, 20) != Head.CRC1) {
+		return;
+	}
+
+	if (!_lastSeqNoValid || Head.SEQNO != _lastSeqNo) {
+		_lastSeqNo		= Head.SEQNO;
+		_lastSeqNoValid	= true;
+		_holdComres		= chance(_settings.Comres);
+		_holdUntilUs	= 0;
+	}
+	if (!_holdComres || Head.COMRES < 0) {
+		return;
+	}
+
+	long long nowUs = faultNowUs();
+	if (_holdUntilUs == 0) {
+		_holdUntilUs = nowUs + (long long)(_settings.ComresMs * 1000);
+		_stats.Delayed++;
+	}
+	if (nowUs >= _holdUntilUs) {
+		_holdComres = false;
+		return;
+	}
+
+	Head.COMRES	= -1;
+	memcpy(pMiso, &Head, sizeof(Head));
+	Head.CRC1	= crc.FullCRC((const unsigned char *)pMiso, 20);
+	memcpy(pMiso, &Head, sizeof(Head));
+	if (Head.LENGTH >= sizeof(Head) + 4 && Head.LENGTH <= length) {
+		unsigned int CRC2 = crc.FullCRC((const unsigned char *)pMiso, Head.LENGTH - 4);
+		memcpy(pMiso + Head.LENGTH - 4, &CRC2, sizeof(CRC2));
+	}
+}
@@ -0,0 +1,86 @@
+//
+// SPI adapter injecting link faults into the transfers of another adapter
+//
+// Exercises the retry paths of FinisarHROCM_V3 (SPIMAGIC 0xFFFFFFFF, CRC1, CRC2, pending COMRES, SEQNO
+// mismatch and retransmit) on purpose, so that the throughput under a bad link can be measured and the retry
+// policy tuned, e.g. with the bench command of HROCMQueryV3 against the emulator or the module. Faults:
+//
+// - Bit errors: bits of MOSI and MISO are flipped with the bit error rate Ber. The bits of all transfers form
+//   one stream; the distance between two errors is random (geometric) or, with Periodic, exactly 1/Ber bits.
+//   Each error flips Burst consecutive bits.
+// - All ones: with probability AllOnes per transfer MISO reads 0xFF only (the module does not answer).
+// - Dropped commands: with probability Drop per command the module does not see it (a poll is sent instead).
+// - Delayed COMRES: with probability Comres per command the response keeps COMRES -1 (pending) for ComresMs
+//   after the module completed it. CRC1 and CRC2 are recalculated.
+//
+// Created by createOCMSPIAdapter() when one of faultber, faultburst, faultperiodic, faultallones, faultdrop,
+// faultcomres, faultcomresms or faultseed is given; it wraps the adapter the rest of the string describes
+// (e.g. "emulator=1;faultber=1e-5;faultdrop=0.001").
+//
+#pragma once
+
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+#include "SPIAdapter.h"
+
+typedef struct {
+	double			Ber;			// Bit error rate (0: off)
+	unsigned int	Burst;			// Bits flipped per error
+	bool			Periodic;		// Errors every 1/Ber bits instead of random distances
+	double			AllOnes;		// Probability per transfer
+	double			Drop;			// Probability per command
+	double			Comres;			// Probability per command
+	double			ComresMs;		// Time COMRES is held pending
+	unsigned int	Seed;
+} SPIFaultSettings_t;
+
+// Number of transfers and of the faults injected
+typedef struct {
+	unsigned long long	Transfers;
+	unsigned long long	BitErrors;		// Error events (of Burst bits each)
+	unsigned long long	AllOnes;
+	unsigned long long	Dropped;
+	unsigned long long	Delayed;
+} SPIFaultStats_t;
+
+class SPIAdapterFaultInjector : public SPIAdapter
+{
+public:
+	// Takes ownership of pAdapter
+	SPIAdapterFaultInjector(SPIAdapter *pAdapter, const SPIFaultSettings_t &Settings);
+
+	static SPIFaultSettings_t defaultSettings();
+
+	virtual SPID_Error_t Open();
+	virtual void Close();
+	virtual SPID_Error_t GetID(std::string &ID);
+	virtual SPID_Error_t SetID(std::string ID);
+	virtual SPID_Error_t GetFW(std::string &rev);
+	virtual SPID_Error_t Transfer(char *writeBuffer, char *readBuffer, size_t length);
+	virtual SPID_Error_t Transfer(std::vector<char> &Tx, std::vector<char> &Rx);
+
+	SPIFaultStats_t getStats() const { return _stats; }
+
+private:
+	SPIAdapterFaultInjector(const SPIAdapterFaultInjector&);
+	SPIAdapterFaultInjector &operator=(const SPIAdapterFaultInjector&);
+
+	bool chance(double probability);
+	void flipBits(char *pBuffer, size_t length);
+	unsigned long long nextErrorDistance();
+	void delayComres(char *pMiso, size_t length);
+
+	std::unique_ptr<SPIAdapter>	_adapter;
+	SPIFaultSettings_t			_settings;
+	SPIFaultStats_t				_stats;
+	std::mt19937_64				_random;
+	std::vector<char>			_mosi;				// Copy of MOSI with the injected faults
+	unsigned long long			_bitsToError;		// Bits of the stream until the next error
+	unsigned int				_burstLeft;			// Bits of the current burst still to flip
+	unsigned int				_lastSeqNo;			// Last command seen in a response
+	bool						_lastSeqNoValid;
+	bool						_holdComres;		// COMRES of the last command is held pending
+	long long					_holdUntilUs;		// End of the hold, 0 until the command is complete
+};
@@ -0,0 +1,240 @@
+#include "stdafx.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "FinisarHROCM_V3.h"
+#include "CCRC32.h"
+#include "SPIAdapterReplay.h"
+#include "OCMDriverStats.h"
+
+#define SPIREPLAY_MAGIC		0xBEEFBEEF		// Start of a record in the log file
+
+// Milliseconds of the monotonic clock of the driver statistics
+static long long replayNowMs()
+{
+	return (long long)(OCMDriverStats::nowUs() / 1000);
+}
+
+SPIAdapterReplay::SPIAdapterReplay(const std::string &Filename, double speed)
+{
+	_filename	= Filename;
+	_speed		= speed;
+	_next		= 0;
+	_seqDelta	= 0;
+	_startMs	= 0;
+	_startTickMs = 0;
+	_replayed	= 0;
+	_skipped	= 0;
+	_mismatches	= 0;
+}
+
+SPID_Error_t SPIAdapterReplay::Open()
+{
+	if (_records.empty() && !load()) {
+		return SPID_FAILED;
+	}
+	_next = 0;
+	_startMs = 0;
+	return SPID_OK;
+}
+
+void SPIAdapterReplay::Close()
+{
+}
+
+SPID_Error_t SPIAdapterReplay::GetID(std::string &ID)
+{
+	ID = "replay";
+	return SPID_OK;
+}
+
+SPID_Error_t SPIAdapterReplay::SetID(std::string ID)
+{
+	return SPID_FAILED;
+}
+
+SPID_Error_t SPIAdapterReplay::GetFW(std::string &rev)
+{
+	rev = "replay";
+	return SPID_OK;
+}
+
+SPID_Error_t SPIAdapterReplay::Transfer(char *writeBuffer, char *readBuffer, size_t length)
+{
+	size_t last = _next + SPIREPLAY_SEARCHWINDOW < _records.size() ? _next + SPIREPLAY_SEARCHWINDOW : _records.size();
+	for (size_t i = _next; i < last; ++i) {
+		if (matches(_records[i], writeBuffer, length)) {
+			_skipped += i - _next;
+			_next = i + 1;
+			wait(_records[i]);
+			replay(_records[i], writeBuffer, readBuffer, length);
+			_replayed++;
+			return _records[i].Result;
+		}
+	}
+
+	_mismatches++;
+	memset(readBuffer, 0xFF, length);
+	return SPID_FAILED;
+}
+
+SPID_Error_t SPIAdapterReplay::Transfer(std::vector<char> &Tx, std::vector<char> &Rx)
+{
+	Rx.resize(Tx.size());
+	if (Tx.empty()) {
+		return SPID_OK;
+	}
+	return Transfer(&Tx[0], &Rx[0], Tx.size());
+}
+
+// Read all records of the log file. The block size is a size_t of the logging program, so it takes 4 bytes
+// in files of 32-bit builds and 8 bytes in files of 64-bit builds; the first record tells which.
+bool SPIAdapterReplay::load()
+{
+	FILE *f = fopen(_filename.c_str(), "rb");
+	if (f == NULL) {
+		return false;
+	}
+	std::vector<char> Data;
+	char buffer[65536];
+	size_t n;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) {
+		Data.insert(Data.end(), buffer, buffer + n);
+	}
+	fclose(f);
+
+	size_t lengthSize = 4;
+	if (Data.size() >= 24) {
+		unsigned int length32;
+		unsigned int nextMagic = 0;
+		memcpy(&length32, &Data[12], sizeof(length32));
+		size_t next = 16 + 2 * (size_t)length32;
+		if (next + 4 <= Data.size()) {
+			memcpy(&nextMagic, &Data[next], sizeof(nextMagic));
+		}
+		if (next != Data.size() && nextMagic != SPIREPLAY_MAGIC) {
+			lengthSize = 8;
+		}
+	}
+
+	size_t pos = 0;
+	while (pos + 12 + lengthSize <= Data.size()) {
+		unsigned int magic;
+		int result;
+		unsigned long long length = 0;
+		Record_t Record;
+		memcpy(&magic, &Data[pos], 4);
+		memcpy(&Record.TickMs, &Data[pos + 4], 4);
+		memcpy(&result, &Data[pos + 8], 4);
+		memcpy(&length, &Data[pos + 12], lengthSize);
+		pos += 12 + lengthSize;
+		if (magic != SPIREPLAY_MAGIC || length > (Data.size() - pos) / 2) {
+			break; // Truncated or corrupt: keep what was read so far
+		}
+		Record.Result = (SPID_Error_t)result;
+		Record.Mosi.assign(Data.begin() + pos, Data.begin() + pos + (size_t)length);
+		Record.Miso.assign(Data.begin() + pos + (size_t)length, Data.begin() + pos + 2 * (size_t)length);
+		pos += 2 * (size_t)length;
+		_records.push_back(Record);
+	}
+
+	return !_records.empty();
+}
+
+// Compare the MOSI data, ignoring the fields that depend on the sequence number
+bool SPIAdapterReplay::matches(const Record_t &Record, const char *pMosi, size_t length) const
+{
+	if (Record.Mosi.size() != length) {
+		return false;
+	}
+	const char *pRecorded = &Record.Mosi[0];
+
+	OCM3_cmd_t Cmd, RecordedCmd;
+	if (length < sizeof(Cmd)) {
+		return memcmp(pRecorded, pMosi, length) == 0;
+	}
+	memcpy(&Cmd, pMosi, sizeof(Cmd));
+	memcpy(&RecordedCmd, pRecorded, sizeof(Cmd));
+	if (Cmd.SPIMAGIC != RecordedCmd.SPIMAGIC || Cmd.LENGTH != RecordedCmd.LENGTH || Cmd.OPCODE != RecordedCmd.OPCODE) {
+		return false;
+	}
+	if (Cmd.SEQNO == RecordedCmd.SEQNO) {
+		return memcmp(pRecorded, pMosi, length) == 0; // Poll packages (all zero) and unchanged commands
+	}
+
+	// SEQNO and CRC1 are part of the header (compared above), CRC2 follows the data
+	size_t crc2 = Cmd.LENGTH > sizeof(Cmd) && Cmd.LENGTH <= length ? Cmd.LENGTH - 4 : length;
+	if (memcmp(pRecorded + sizeof(Cmd), pMosi + sizeof(Cmd), crc2 - sizeof(Cmd)) != 0) {
+		return false;
+	}
+	return crc2 == length || memcmp(pRecorded + crc2 + 4, pMosi + crc2 + 4, length - crc2 - 4) == 0;
+}
+
+// Copy the recorded MISO data with the sequence numbers of this run
+void SPIAdapterReplay::replay(const Record_t &Record, const char *pMosi, char *pMiso, size_t length)
+{
+	memcpy(pMiso, &Record.Miso[0], length);
+
+	OCM3_cmd_t Cmd, RecordedCmd;
+	if (length >= sizeof(Cmd)) {
+		memcpy(&Cmd, pMosi, sizeof(Cmd));
+		memcpy(&RecordedCmd, &Record.Mosi[0], sizeof(Cmd));
+		if (Cmd.SPIMAGIC != 0) {
+			_seqDelta = Cmd.SEQNO - RecordedCmd.SEQNO;
+		}
+	}
+	if (_seqDelta == 0 || length < sizeof(OCM3_Response_t)) {
+		return;
+	}
+
+	// Leave packages alone that were already broken in the recording (empty, CRC errors)
+	OCM3_Response_t *pResponse = (OCM3_Response_t*)pMiso;
+	CCRC32 crc;
+	if (crc.FullCRC((const unsigned char *)pResponse, 20) != pResponse->CRC1) {
+		return;
+	}
+	unsigned int CRC2;
+	bool CRC2OK = pResponse->LENGTH >= sizeof(OCM3_Response_t) && pResponse->LENGTH <= length;
+	if (CRC2OK) {
+		memcpy(&CRC2, pMiso + pResponse->LENGTH - 4, sizeof(CRC2));
+		CRC2OK = crc.FullCRC((const unsigned char *)pResponse, pResponse->LENGTH - 4) == CRC2;
+	}
+
+	if (pResponse->SEQNO != 0) {
+		pResponse->SEQNO += _seqDelta;
+	}
+	unsigned int *pSeq = pResponse->SEQARR;
+	for (int k = 0; k < pResponse->NSEQARR && (char*)(pSeq + k + 1) <= pMiso + length; ++k) {
+		unsigned int seq;
+		memcpy(&seq, pSeq + k, sizeof(seq));
+		if (seq != 0) {
+			seq += _seqDelta;
+			memcpy(pSeq + k, &seq, sizeof(seq));
+		}
+	}
+
+	pResponse->CRC1 = crc.FullCRC((const unsigned char *)pResponse, 20);
+	if (CRC2OK) {
+		CRC2 = crc.FullCRC((const unsigned char *)pResponse, pResponse->LENGTH - 4);
+		memcpy(pMiso + pResponse->LENGTH - 4, &CRC2, sizeof(CRC2));
+	}
+}
+
+// Reproduce the recorded time of a transfer relative to the first one
+void SPIAdapterReplay::wait(const Record_t &Record)
+{
+	if (_speed <= 0) {
+		return;
+	}
+	long long now = replayNowMs();
+	if (_startMs == 0) {
+		_startMs = now;
+		_startTickMs = Record.TickMs;
+		return;
+	}
+	long long due = _startMs + (long long)((unsigned int)(Record.TickMs - _startTickMs) / _speed);
+	if (due > now) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(due - now));
+	}
+}
@@ -0,0 +1,69 @@
+//
+// SPI adapter replaying a binary log file (-logbin, see HROCMQueryV3.cpp for the format)
+//
+// Serves the recorded MISO data of a real session to FinisarHROCM_V3 without hardware. Each transfer is
+// matched against the next recorded transfer with the same MOSI data. Sequence numbers differ from run to
+// run (the driver starts at a random number), so SEQNO and the CRCs of command packages are ignored when
+// matching, and the sequence numbers in the recorded responses (SEQNO, SEQARR) are shifted to the ones of
+// the current run. The CRCs of the responses are recalculated unless they were already wrong in the
+// recording, so recorded CRC errors are replayed as well.
+//
+// Transfers without a matching record (e.g. because the driver changed) skip ahead to the next match
+// within a small window; if there is none the transfer fails. By default the records are served as fast as
+// the driver asks for them; with a speed factor the recorded timing is reproduced (1: real time, 10: ten
+// times faster).
+//
+// Created by createOCMSPIAdapter() with "replay=HROCMQuery.bin;speed=1".
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include "SPIAdapter.h"
+
+#define SPIREPLAY_SEARCHWINDOW	64		// Number of records searched ahead for a matching MOSI
+
+class SPIAdapterReplay : public SPIAdapter
+{
+public:
+	// speed: 0 = as fast as possible, otherwise factor relative to the recorded timing
+	SPIAdapterReplay(const std::string &Filename, double speed);
+
+	virtual SPID_Error_t Open();
+	virtual void Close();
+	virtual SPID_Error_t GetID(std::string &ID);
+	virtual SPID_Error_t SetID(std::string ID);
+	virtual SPID_Error_t GetFW(std::string &rev);
+	virtual SPID_Error_t Transfer(char *writeBuffer, char *readBuffer, size_t length);
+	virtual SPID_Error_t Transfer(std::vector<char> &Tx, std::vector<char> &Rx);
+
+	// Number of transfers served, records skipped and transfers without a match
+	size_t getReplayed() const { return _replayed; }
+	size_t getSkipped() const { return _skipped; }
+	size_t getMismatches() const { return _mismatches; }
+
+private:
+	// One SPI transfer of the log file
+	typedef struct {
+		unsigned int		TickMs;
+		SPID_Error_t		Result;
+		std::vector<char>	Mosi;
+		std::vector<char>	Miso;
+	} Record_t;
+
+	bool load();
+	bool matches(const Record_t &Record, const char *pMosi, size_t length) const;
+	void replay(const Record_t &Record, const char *pMosi, char *pMiso, size_t length);
+	void wait(const Record_t &Record);
+
+	std::string				_filename;
+	double					_speed;
+	std::vector<Record_t>	_records;
+	size_t					_next;			// Index of the next record to serve
+	unsigned int			_seqDelta;		// Current SEQNO minus recorded SEQNO
+	long long				_startMs;		// Time the first record was served
+	unsigned int			_startTickMs;	// Recorded time of that record
+	size_t					_replayed;
+	size_t					_skipped;
+	size_t					_mismatches;
+};